@@ -31,7 +31,8 @@ void rlDrawCube(UmkaStackSlot *params, UmkaStackSlot *result)
 int main(void)
 {
     // Umka initialization
-    int umkaInitBodies = 0, umkaDrawBodies = 0;
+    int umkaInitBodies = 0;
+    UmkaPreparedCall umkaDrawBodies;
     void *umka = umkaAlloc();
     bool umkaOk = umkaInit(umka, "3dcam.um", 1024 * 1024, 1024 * 1024, 0, NULL);
     
@@ -46,9 +47,10 @@ int main(void)
     {
         printf("Umka initialized\n");
         umkaInitBodies = umkaGetFunc(umka, NULL, "initBodies"); 
-        umkaDrawBodies = umkaGetFunc(umka, NULL, "drawBodies");
+        umkaOk = umkaPrepareCall(umka, NULL, "drawBodies", 0, &umkaDrawBodies);
     }
-    else
+
+    if (!umkaOk)
     {
         UmkaError error;
         umkaGetError(umka, &error);
@@ -93,7 +95,7 @@ int main(void)
 
                 BeginMode3D(camera);
 
-                bool umkaOk = umkaCall(umka, umkaDrawBodies, 0, NULL, NULL);
+                bool umkaOk = umkaCallPrepared(umka, &umkaDrawBodies, NULL, NULL);
                 if (!umkaOk)
                 {
                     UmkaError error;
@@ -23,14 +23,16 @@ int main(int argc, char **argv)
         printf("    -storage <storage-size>\n");
         printf("    -stack   <stack-size>\n");
         printf("    -asm     <output.asm>\n");
+        printf("    -cache   <cache-dir>\n");
         return 1;
     }
 
     int storageSize     = 1024 * 1024;  // Bytes
     int stackSize       = 1024 * 1024;  // Slots
     char *asmFileName   = NULL;
+    char *cacheDir      = NULL;
 
-    for (int i = 0; i < 4; i += 2)
+    for (int i = 0; i < 6; i += 2)
     {
         if (argc > 2 + i)
         {
@@ -74,13 +76,26 @@ int main(int argc, char **argv)
 
                 asmFileName = argv[2 + i + 1];
             }
+            else if (strcmp(argv[2 + i], "-cache") == 0)
+            {
+                if (argc == 2 + i + 1)
+                {
+                    printf("Illegal command line parameter\n");
+                    return 1;
+                }
+
+                cacheDir = argv[2 + i + 1];
+            }
         }
     }
 
     void *umka = umkaAlloc();
     bool ok = umkaInit(umka, argv[1], storageSize, stackSize, argc, argv);
     if (ok)
+    {
+        umkaSetCacheDir(umka, cacheDir);
         ok = umkaCompile(umka);
+    }
 
     if (ok)
     {
@@ -111,6 +126,9 @@ int main(int argc, char **argv)
             UmkaError error;
             umkaGetError(umka, &error);
             printf("\nRuntime error %s (%d): %s\n", error.fileName, error.line, error.msg);
+
+            for (int i = 0; i < error.traceLen; i++)
+                printf("    %s() at %s (%d)\n", error.trace[i].fnName, error.trace[i].fileName, error.trace[i].line);
         }
     }
     else
@@ -17,34 +17,153 @@ static void compileError(void *context, const char *format, ...)
 
     Compiler *comp = context;
 
-    strcpy(comp->error.fileName, comp->lex.fileName);
+    snprintf(comp->error.fileName, sizeof(comp->error.fileName), "%s", comp->lex.fileName);
     comp->error.line = comp->lex.line;
     comp->error.pos = comp->lex.pos;
-    vsprintf(comp->error.msg, format, args);
+    vsnprintf(comp->error.msg, sizeof(comp->error.msg), format, args);
+    comp->error.traceLen = 0;
 
     va_end(args);
     longjmp(comp->error.jumper, 1);
 }
 
 
+static void runtimeErrorReport(Error *error, VM *vm, const char *format, va_list args)
+{
+    Instruction *instr = &vm->fiber->code[vm->fiber->ip];
+
+    snprintf(error->fileName, sizeof(error->fileName), "%s", instr->debug.fileName);
+    error->line = instr->debug.line;
+    error->pos = 1;
+    vsnprintf(error->msg, sizeof(error->msg), format, args);
+    error->traceLen = vmGetStackTrace(vm, error->trace, MAX_STACK_TRACE);
+}
+
+
 static void runtimeError(void *context, const char *format, ...)
 {
     va_list args;
     va_start(args, format);
 
     Compiler *comp = context;
-    Instruction *instr = &comp->vm.fiber->code[comp->vm.fiber->ip];
-
-    strcpy(comp->error.fileName, instr->debug.fileName);
-    comp->error.line = instr->debug.line;
-    comp->error.pos = 1;
-    vsprintf(comp->error.msg, format, args);
+    runtimeErrorReport(&comp->error, &comp->vm, format, args);
 
     va_end(args);
     longjmp(comp->error.jumper, 1);
 }
 
 
+static void contextRuntimeError(void *context, const char *format, ...)
+{
+    va_list args;
+    va_start(args, format);
+
+    Context *ctx = context;
+    runtimeErrorReport(&ctx->error, &ctx->vm, format, args);
+
+    va_end(args);
+    longjmp(ctx->error.jumper, 1);
+}
+
+
+static bool getVar(Ident *ident, void *globals, UmkaVar *var)
+{
+    if (!ident || !globals)
+        return false;
+
+    var->ptr = (char *)globals + ident->globalOffset;
+    var->size = typeSizeNoCheck(ident->type);
+    var->numItems = 0;
+    var->itemSize = 0;
+
+    if (ident->type->kind == TYPE_ARRAY)
+    {
+        var->numItems = ident->type->numItems;
+        var->itemSize = typeSizeNoCheck(ident->type->base);
+    }
+
+    Type *structType = ident->type;
+    if (structType->kind == TYPE_ARRAY || structType->kind == TYPE_DYNARRAY)
+        structType = structType->base;
+
+    var->numFields = 0;
+    if (structType->kind == TYPE_STRUCT)
+    {
+        var->numFields = structType->numItems;
+        for (int i = 0; i < structType->numItems; i++)
+        {
+            var->field[i].name = structType->field[i]->name;
+            var->field[i].offset = structType->field[i]->offset;
+            var->field[i].size = typeSizeNoCheck(structType->field[i]->type);
+        }
+    }
+
+    typeSpelling(ident->type, var->type);
+    return true;
+}
+
+
+static void getError(Error *error, UmkaError *err)
+{
+    snprintf(err->fileName, sizeof(err->fileName), "%s", error->fileName);
+    err->line = error->line;
+    err->pos = error->pos;
+    snprintf(err->msg, sizeof(err->msg), "%s", error->msg);
+
+    err->traceLen = error->traceLen;
+    for (int i = 0; i < error->traceLen; i++)
+    {
+        err->trace[i].fileName = error->trace[i].fileName;
+        err->trace[i].fnName = error->trace[i].fnName ? error->trace[i].fnName : "";
+        err->trace[i].line = error->trace[i].line;
+    }
+}
+
+
+typedef struct
+{
+    jmp_buf jumper;
+    CallState state;
+} NestedCall;
+
+
+static bool enterNested(Error *error, VM *vm, NestedCall *call)
+{
+    // A script function called by an external function must not overwrite the error handler of the script that called
+    // the external function, so that the handler is restored when the call returns
+    if (vm->externDepth == 0)
+        return false;
+
+    memcpy(call->jumper, error->jumper, sizeof(jmp_buf));
+    vmSaveCallState(vm, &call->state);
+    return true;
+}
+
+
+static void leaveNested(Error *error, VM *vm, NestedCall *call, bool ok)
+{
+    // A failed call leaves the interrupted script as it was, so that the external function can return to it
+    if (!ok)
+        vmRestoreCallState(vm, &call->state);
+
+    memcpy(error->jumper, call->jumper, sizeof(jmp_buf));
+}
+
+
+static bool rejectNested(Error *error, VM *vm, const char *funcName)
+{
+    // Only the function calls can be nested, as anything else would reset or replace the running script
+    if (vm->externDepth == 0)
+        return false;
+
+    snprintf(error->msg, sizeof(error->msg), "%s() cannot be called from an external function", funcName);
+    error->fileName[0] = 0;
+    error->line = error->pos = 0;
+    error->traceLen = 0;
+    return true;
+}
+
+
 // API functions
 
 void *umkaAlloc(void)
@@ -54,6 +173,12 @@ void *umkaAlloc(void)
 
 
 bool umkaInit(void *umka, char *fileName, int storageSize, int stackSize, int argc, char **argv)
+{
+    return umkaInitSource(umka, fileName, NULL, 0, storageSize, stackSize, argc, argv);
+}
+
+
+bool umkaInitSource(void *umka, char *fileName, const char *source, int sourceLen, int storageSize, int stackSize, int argc, char **argv)
 {
     Compiler *comp = umka;
     memset(comp, 0, sizeof(Compiler));
@@ -65,17 +190,35 @@ bool umkaInit(void *umka, char *fileName, int storageSize, int stackSize, int ar
 
     if (setjmp(comp->error.jumper) == 0)
     {
-        compilerInit(comp, fileName, storageSize, stackSize, argc, argv);
+        compilerInit(comp, fileName, source, sourceLen, storageSize, stackSize, argc, argv);
         return true;
     }
     return false;
 }
 
 
+void umkaSetLoader(void *umka, UmkaModuleLoader loader, void *context)
+{
+    Compiler *comp = umka;
+    comp->modules.loader = loader;
+    comp->modules.loaderContext = context;
+}
+
+
+void umkaSetCacheDir(void *umka, char *dir)
+{
+    Compiler *comp = umka;
+    snprintf(comp->cacheDir, sizeof(comp->cacheDir), "%s", dir ? dir : "");
+}
+
+
 bool umkaCompile(void *umka)
 {
     Compiler *comp = umka;
 
+    if (rejectNested(&comp->error, &comp->vm, "umkaCompile"))
+        return false;
+
     if (setjmp(comp->error.jumper) == 0)
     {
         compilerCompile(comp);
@@ -85,10 +228,61 @@ bool umkaCompile(void *umka)
 }
 
 
+bool umkaSave(void *umka, char *fileName)
+{
+    Compiler *comp = umka;
+
+    if (rejectNested(&comp->error, &comp->vm, "umkaSave"))
+        return false;
+
+    if (setjmp(comp->error.jumper) == 0)
+    {
+        compilerSave(comp, fileName);
+        return true;
+    }
+    return false;
+}
+
+
+bool umkaLoad(void *umka, const void *image, int imageLen)
+{
+    Compiler *comp = umka;
+
+    if (rejectNested(&comp->error, &comp->vm, "umkaLoad"))
+        return false;
+
+    if (setjmp(comp->error.jumper) == 0)
+    {
+        compilerLoad(comp, image, imageLen);
+        return true;
+    }
+    return false;
+}
+
+
+bool umkaReload(void *umka, char *moduleName, const char *source, int sourceLen)
+{
+    Compiler *comp = umka;
+
+    if (rejectNested(&comp->error, &comp->vm, "umkaReload"))
+        return false;
+
+    if (setjmp(comp->error.jumper) == 0)
+    {
+        compilerReload(comp, moduleName, source, sourceLen);
+        return true;
+    }
+    return false;
+}
+
+
 bool umkaRun(void *umka)
 {
     Compiler *comp = umka;
 
+    if (rejectNested(&comp->error, &comp->vm, "umkaRun"))
+        return false;
+
     if (setjmp(comp->error.jumper) == 0)
     {
         compilerRun(comp);
@@ -102,9 +296,62 @@ bool umkaCall(void *umka, int entryOffset, int numParamSlots, UmkaStackSlot *par
 {
     Compiler *comp = umka;
 
+    NestedCall nestedCall;
+    bool nested = enterNested(&comp->error, &comp->vm, &nestedCall);
+
+    bool ok = false;
     if (setjmp(comp->error.jumper) == 0)
     {
         compilerCall(comp, entryOffset, numParamSlots, (Slot *)params, (Slot *)result);
+        ok = true;
+    }
+
+    if (nested)
+        leaveNested(&comp->error, &comp->vm, &nestedCall, ok);
+    return ok;
+}
+
+
+void umkaSetBudget(void *umka, int budget)
+{
+    Compiler *comp = umka;
+    comp->vm.budget = budget;
+}
+
+
+bool umkaInterrupted(void *umka)
+{
+    Compiler *comp = umka;
+    return comp->vm.interrupted;
+}
+
+
+bool umkaContinue(void *umka)
+{
+    Compiler *comp = umka;
+
+    if (rejectNested(&comp->error, &comp->vm, "umkaContinue"))
+        return false;
+
+    if (setjmp(comp->error.jumper) == 0)
+    {
+        compilerContinue(comp);
+        return true;
+    }
+    return false;
+}
+
+
+bool umkaResetState(void *umka)
+{
+    Compiler *comp = umka;
+
+    if (rejectNested(&comp->error, &comp->vm, "umkaResetState"))
+        return false;
+
+    if (setjmp(comp->error.jumper) == 0)
+    {
+        compilerResetState(comp);
         return true;
     }
     return false;
@@ -122,10 +369,7 @@ void umkaFree(void *umka)
 void umkaGetError(void *umka, UmkaError *err)
 {
     Compiler *comp = umka;
-    strcpy(err->fileName, comp->error.fileName);
-    err->line = comp->error.line;
-    err->pos = comp->error.pos;
-    strcpy(err->msg, comp->error.msg);
+    getError(&comp->error, err);
 }
 
 
@@ -143,9 +387,292 @@ void umkaAddFunc(void *umka, char *name, UmkaExternFunc entry)
 }
 
 
+void umkaAddTypedFunc(void *umka, char *name, char *signature, UmkaExternFunc entry)
+{
+    Compiler *comp = umka;
+    externalAddTyped(&comp->externals, name, signature, entry);
+}
+
+
 int umkaGetFunc(void *umka, char *moduleName, char *funcName)
 {
     Compiler *comp = umka;
     return compilerGetFunc(comp, moduleName, funcName);
 }
 
+
+bool umkaGetVar(void *umka, char *moduleName, char *varName, UmkaVar *var)
+{
+    Compiler *comp = umka;
+    return getVar(compilerGetVar(comp, moduleName, varName), comp->vm.globals, var);
+}
+
+
+bool umkaShareArray(void *umka, char *moduleName, char *varName, void *data, int len)
+{
+    Compiler *comp = umka;
+
+    if (rejectNested(&comp->error, &comp->vm, "umkaShareArray"))
+        return false;
+
+    if (setjmp(comp->error.jumper) == 0)
+    {
+        compilerShareArray(comp, moduleName, varName, data, len);
+        return true;
+    }
+    return false;
+}
+
+
+bool umkaPrepareCall(void *umka, char *moduleName, char *funcName, int numParamSlots, UmkaPreparedCall *call)
+{
+    Compiler *comp = umka;
+
+    if (rejectNested(&comp->error, &comp->vm, "umkaPrepareCall"))
+        return false;
+
+    if (setjmp(comp->error.jumper) == 0)
+    {
+        call->entryOffset = compilerPrepareCall(comp, moduleName, funcName, numParamSlots);
+        call->numParamSlots = numParamSlots;
+        return true;
+    }
+    return false;
+}
+
+
+bool umkaCallPrepared(void *umka, UmkaPreparedCall *call, UmkaStackSlot *params, UmkaStackSlot *result)
+{
+    Compiler *comp = umka;
+
+    NestedCall nestedCall;
+    bool nested = enterNested(&comp->error, &comp->vm, &nestedCall);
+
+    bool ok = false;
+    if (setjmp(comp->error.jumper) == 0)
+    {
+        compilerCallPrepared(comp, call->entryOffset, call->numParamSlots, (Slot *)params, (Slot *)result);
+        ok = true;
+    }
+
+    if (nested)
+        leaveNested(&comp->error, &comp->vm, &nestedCall, ok);
+    return ok;
+}
+
+
+bool umkaCallBatch(void *umka, UmkaPreparedCall *call, int numCalls, UmkaStackSlot *params, UmkaStackSlot *results)
+{
+    Compiler *comp = umka;
+
+    NestedCall nestedCall;
+    bool nested = enterNested(&comp->error, &comp->vm, &nestedCall);
+
+    bool ok = false;
+    if (setjmp(comp->error.jumper) == 0)
+    {
+        compilerCallBatch(comp, call->entryOffset, numCalls, call->numParamSlots, (Slot *)params, (Slot *)results);
+        ok = true;
+    }
+
+    if (nested)
+        leaveNested(&comp->error, &comp->vm, &nestedCall, ok);
+    return ok;
+}
+
+
+void *umkaSuspend(UmkaStackSlot *result)
+{
+    return vmSuspendExtern((Slot *)result);
+}
+
+
+void umkaResume(void *handle, UmkaStackSlot *result)
+{
+    vmResumeExtern(handle, (Slot *)result);
+}
+
+
+void *umkaAllocContext(void)
+{
+    return malloc(sizeof(Context));
+}
+
+
+bool umkaInitContext(void *context, void *umka, int stackSize)
+{
+    Context *ctx = context;
+    memset(ctx, 0, sizeof(Context));
+
+    // First set error handlers
+    ctx->error.handler = contextRuntimeError;
+    ctx->error.handlerRuntime = contextRuntimeError;
+    ctx->error.context = ctx;
+
+    if (setjmp(ctx->error.jumper) == 0)
+    {
+        contextInit(ctx, umka, stackSize);
+        return true;
+    }
+    return false;
+}
+
+
+bool umkaRunContext(void *context)
+{
+    Context *ctx = context;
+
+    if (rejectNested(&ctx->error, &ctx->vm, "umkaRunContext"))
+        return false;
+
+    if (setjmp(ctx->error.jumper) == 0)
+    {
+        contextRun(ctx);
+        return true;
+    }
+    return false;
+}
+
+
+bool umkaCallContext(void *context, int entryOffset, int numParamSlots, UmkaStackSlot *params, UmkaStackSlot *result)
+{
+    Context *ctx = context;
+
+    NestedCall nestedCall;
+    bool nested = enterNested(&ctx->error, &ctx->vm, &nestedCall);
+
+    bool ok = false;
+    if (setjmp(ctx->error.jumper) == 0)
+    {
+        contextCall(ctx, entryOffset, numParamSlots, (Slot *)params, (Slot *)result);
+        ok = true;
+    }
+
+    if (nested)
+        leaveNested(&ctx->error, &ctx->vm, &nestedCall, ok);
+    return ok;
+}
+
+
+void umkaSetContextBudget(void *context, int budget)
+{
+    Context *ctx = context;
+    ctx->vm.budget = budget;
+}
+
+
+bool umkaContextInterrupted(void *context)
+{
+    Context *ctx = context;
+    return ctx->vm.interrupted;
+}
+
+
+bool umkaContinueContext(void *context)
+{
+    Context *ctx = context;
+
+    if (rejectNested(&ctx->error, &ctx->vm, "umkaContinueContext"))
+        return false;
+
+    if (setjmp(ctx->error.jumper) == 0)
+    {
+        contextContinue(ctx);
+        return true;
+    }
+    return false;
+}
+
+
+bool umkaResetStateContext(void *context)
+{
+    Context *ctx = context;
+
+    if (rejectNested(&ctx->error, &ctx->vm, "umkaResetStateContext"))
+        return false;
+
+    if (setjmp(ctx->error.jumper) == 0)
+    {
+        contextResetState(ctx);
+        return true;
+    }
+    return false;
+}
+
+
+bool umkaGetVarContext(void *context, char *moduleName, char *varName, UmkaVar *var)
+{
+    Context *ctx = context;
+    return getVar(contextGetVar(ctx, moduleName, varName), ctx->vm.globals, var);
+}
+
+
+bool umkaShareArrayContext(void *context, char *moduleName, char *varName, void *data, int len)
+{
+    Context *ctx = context;
+
+    if (rejectNested(&ctx->error, &ctx->vm, "umkaShareArrayContext"))
+        return false;
+
+    if (setjmp(ctx->error.jumper) == 0)
+    {
+        contextShareArray(ctx, moduleName, varName, data, len);
+        return true;
+    }
+    return false;
+}
+
+
+bool umkaCallPreparedContext(void *context, UmkaPreparedCall *call, UmkaStackSlot *params, UmkaStackSlot *result)
+{
+    Context *ctx = context;
+
+    NestedCall nestedCall;
+    bool nested = enterNested(&ctx->error, &ctx->vm, &nestedCall);
+
+    bool ok = false;
+    if (setjmp(ctx->error.jumper) == 0)
+    {
+        contextCallPrepared(ctx, call->entryOffset, call->numParamSlots, (Slot *)params, (Slot *)result);
+        ok = true;
+    }
+
+    if (nested)
+        leaveNested(&ctx->error, &ctx->vm, &nestedCall, ok);
+    return ok;
+}
+
+
+bool umkaCallBatchContext(void *context, UmkaPreparedCall *call, int numCalls, UmkaStackSlot *params, UmkaStackSlot *results)
+{
+    Context *ctx = context;
+
+    NestedCall nestedCall;
+    bool nested = enterNested(&ctx->error, &ctx->vm, &nestedCall);
+
+    bool ok = false;
+    if (setjmp(ctx->error.jumper) == 0)
+    {
+        contextCallBatch(ctx, call->entryOffset, numCalls, call->numParamSlots, (Slot *)params, (Slot *)results);
+        ok = true;
+    }
+
+    if (nested)
+        leaveNested(&ctx->error, &ctx->vm, &nestedCall, ok);
+    return ok;
+}
+
+
+void umkaFreeContext(void *context)
+{
+    Context *ctx = context;
+    contextFree(ctx);
+    free(ctx);
+}
+
+
+void umkaGetContextError(void *context, UmkaError *err)
+{
+    Context *ctx = context;
+    getError(&ctx->error, err);
+}
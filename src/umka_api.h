@@ -20,33 +20,202 @@ typedef union
 
 
 typedef void (*UmkaExternFunc)(UmkaStackSlot *params, UmkaStackSlot *result);
+typedef bool (*UmkaModuleLoader)(const char *path, const char **source, int *sourceLen, void *context);
 
 
 enum
 {
-    UMKA_MSG_LEN = 512
+    UMKA_MSG_LEN = 512,
+    UMKA_MAX_STACK_FRAMES = 16,
+    UMKA_MAX_MODULES = 256,
+    UMKA_MAX_FIELDS = 100
 };
 
 
+typedef struct
+{
+    const char *fileName;
+    const char *fnName;
+    int line;
+} UmkaStackFrame;
+
+
 typedef struct
 {
     char fileName[UMKA_MSG_LEN];
     int line, pos;
     char msg[UMKA_MSG_LEN];
+    UmkaStackFrame trace[UMKA_MAX_STACK_FRAMES];    // Function calls that led to a runtime error, innermost first
+    int traceLen;
 } UmkaError;
 
 
+typedef struct
+{
+    int entryOffset;
+    int numParamSlots;
+} UmkaPreparedCall;
+
+
+typedef struct
+{
+    int64_t len;
+    int64_t itemSize;
+    void *data;
+} UmkaDynArray;
+
+
+typedef struct
+{
+    const char *name;
+    int offset, size;
+} UmkaVarField;
+
+
+typedef struct
+{
+    void *ptr;
+    int size;
+    int numItems, itemSize;         // For static arrays
+    int numFields;                  // For structures, or arrays of structures, whose items have these fields
+    UmkaVarField field[UMKA_MAX_FIELDS];
+    char type[UMKA_MSG_LEN];
+} UmkaVar;
+
+
+// Interpreter instances allocated by umkaAlloc() share no mutable state, so separate instances can compile and run scripts
+// concurrently on different threads. A single instance must not be used by several threads at a time.
+// A compiled program can also be run by several lightweight execution contexts allocated by umkaAllocContext(). Each context
+// has its own stack, heap and global variables and shares the code with the interpreter instance, which must outlive the context.
+// Contexts of the same instance can run concurrently on different threads, provided that the instance itself is not running
+// Scripts that call fiberstart() also run fibers on the worker threads owned by the instance or context, so the external
+// functions called from such fibers must be thread-safe
+// A budget set by umkaSetBudget() limits the loop iterations and function calls that umkaRun() or umkaCall() execute before
+// returning to the host. If the budget is exhausted, umkaInterrupted() returns true and umkaContinue() resumes the script
+// with a new budget. The host must continue, reset or free an interrupted instance before running it again
+// umkaInitSource() compiles the main module from a source buffer rather than from a file. The file name is only used for error
+// messages and for resolving relative import paths. Imported modules are requested from the loader set by umkaSetLoader(), if any,
+// and read from the files if the loader returns false. The source buffers are not copied and must remain valid until umkaCompile() returns
+// umkaResetState() prepares a compiled program to be run again as if it were freshly compiled: the global variables get back
+// their initial values, and the heap left by the previous runs is discarded at once, including the data of an interrupted or failed
+// run. This costs a copy of the global variables rather than a compilation. umkaResetStateContext() resets an execution context
+// umkaSetCacheDir() makes umkaCompile() keep the compiled program as an image in the given existing directory. The next compilation
+// of the same main module loads the image instead, unless the source of the main module or of any imported module, or an external
+// function signature, has changed. Failures to write the cache are ignored. umkaSetCacheDir(umka, NULL) disables the cache
+// The error reported by umkaGetError() after a runtime error includes a stack trace of up to UMKA_MAX_STACK_FRAMES function calls,
+// starting from the function that failed. The file and function names in the trace remain valid until the instance is freed
+// An external function may call script functions of the instance or context that called it through umkaCall(), umkaCallPrepared()
+// and umkaCallBatch() or their context counterparts. The nested call runs on top of the stack of the calling script, and its error
+// is returned to the external function rather than propagated to the calling script. Any other API function that runs or replaces
+// the program fails if called from an external function
+// Errors are still reported by longjmp() to a setjmp() made by each API function, so every umkaCall() or umkaCallPrepared() pays
+// for one setjmp(), while umkaCallBatch() pays for it once per batch. The jump never leaves the API function that made the call
+
 void *umkaAlloc     (void);
 bool umkaInit       (void *umka, char *fileName, int storageSize, int stackSize, int argc, char **argv);
+bool umkaInitSource (void *umka, char *fileName, const char *source, int sourceLen, int storageSize, int stackSize, int argc, char **argv);
+void umkaSetLoader  (void *umka, UmkaModuleLoader loader, void *context);
+void umkaSetCacheDir(void *umka, char *dir);
 bool umkaCompile    (void *umka);
 bool umkaRun        (void *umka);
 bool umkaCall       (void *umka, int entryOffset, int numParamSlots, UmkaStackSlot *params, UmkaStackSlot *result);
+void umkaSetBudget  (void *umka, int budget);
+bool umkaInterrupted(void *umka);
+bool umkaContinue   (void *umka);
+bool umkaResetState (void *umka);
 void umkaFree       (void *umka);
 void umkaGetError   (void *umka, UmkaError *err);
 void umkaAsm        (void *umka, char *buf);
 void umkaAddFunc    (void *umka, char *name, UmkaExternFunc entry);
 int  umkaGetFunc    (void *umka, char *moduleName, char *funcName);
 
+// An external function added by umkaAddTypedFunc() declares its signature in Umka syntax, e.g., "fn (v: Vec, k: real): Vec",
+// which is checked against the prototype and may refer to the types of the module that declares the prototype. The function
+// receives its parameters in declaration order, with structured ones (arrays, dynamic arrays, structures) passed by pointer
+// rather than copied. A structured result is written to the memory pointed to by result->ptrVal. The function is called without
+// a stack frame if its parameters need no garbage collection
+
+void umkaAddTypedFunc(void *umka, char *name, char *signature, UmkaExternFunc entry);
+
+// umkaGetVar() locates a global variable of the compiled program and returns false if there is none. The variable can be
+// read and written in place through var->ptr without running the script, as long as the script is not running. The type
+// is spelled as in Umka, and a dynamic array is stored as UmkaDynArray. The fields of a structure, or of the items of an array
+// of structures, are listed with their offsets and sizes, and the field names remain valid until the instance is freed.
+// Strings, pointers and other garbage-collected data should not be written by the host, since their reference counts would
+// not be updated. The global variables keep their values after main() returns and are only released when the instance
+// is freed or reset, so var->ptr remains valid until then, or until a reload adds new global variables.
+// umkaGetVarContext() locates the variable among the global variables of an execution context
+
+bool umkaGetVar(void *umka, char *moduleName, char *varName, UmkaVar *var);
+
+// umkaSave() writes the compiled program to an image file. umkaLoad() then takes the place of umkaCompile() in another instance:
+// it reads the program from an image in memory, e.g., a memory-mapped file, without parsing any source. The instance should be
+// initialized by umkaInitSource() with an empty source, and the external functions should be added before the image is loaded.
+// The image is not copied and can be released after umkaLoad() returns. An instance that failed to load an image should be
+// freed. An image is only valid for the Umka build that saved it
+
+bool umkaSave(void *umka, char *fileName);
+bool umkaLoad(void *umka, const void *image, int imageLen);
+
+// umkaReload() compiles a new version of a module of the compiled program, from the source buffer or, if source is NULL, from
+// the loader or the file, and patches the program in place rather than recompiling it. The old functions jump to the new ones
+// that have the same name and signature, so the code compiled before the reload calls the new functions. The old functions
+// whose signature has changed are still called by the old code until the modules that call them are reloaded as well.
+// The global variables of the new version that have the same name and type as the old ones keep their values, the others
+// get their initial values. Execution contexts get the new global variables when they next run. The reload must not happen
+// while the program or any of its contexts is running, or while any fibers started by the program are alive. A failed reload
+// leaves the program as it was. The new version takes the module slot of the old one, so reloads do not count against the limit
+// of UMKA_MAX_MODULES modules per program, except for the modules they import for the first time and a single slot that holds
+// the identifiers of all the old versions. The code, constants and global variables of the old versions are kept, so each reload
+// still takes as much memory as the new version needs
+
+bool umkaReload(void *umka, char *moduleName, const char *source, int sourceLen);
+
+// umkaShareArray() makes a global dynamic array variable refer to len items of host memory rather than to the VM heap. The old
+// items of the variable are released, and the new ones are not copied. Scripts can read and write the items in place, while
+// the operations that need more room, such as append(), insert() or reserve(), copy the items to the heap and leave the host
+// memory intact. The VM never frees the host memory, and the host must keep it valid as long as the variable or any of
+// its slices or copies may refer to it, i.e., until the variable is shared again and the script has dropped all slices,
+// or until the instance is freed. Only dynamic arrays of items that are not garbage collected can be shared
+
+bool umkaShareArray(void *umka, char *moduleName, char *varName, void *data, int len);
+
+// A function called many times can be looked up and checked once by umkaPrepareCall(), which fails unless the function
+// takes exactly numParamSlots parameter slots, including the pointer to the structured result, if any. umkaCallPrepared()
+// then calls it with the parameters laid out as for umkaCall(), skipping the checks and reusing the stack left by the previous
+// call, unless that call has failed or has been interrupted. umkaCallBatch() calls it numCalls times in a single run, taking
+// numParamSlots slots of params for each call and storing each result into results, if not NULL, so that the setup of the run
+// is paid once per batch rather than once per call. Batch calls are not interrupted by the budget
+
+bool umkaPrepareCall  (void *umka, char *moduleName, char *funcName, int numParamSlots, UmkaPreparedCall *call);
+bool umkaCallPrepared (void *umka, UmkaPreparedCall *call, UmkaStackSlot *params, UmkaStackSlot *result);
+bool umkaCallBatch    (void *umka, UmkaPreparedCall *call, int numCalls, UmkaStackSlot *params, UmkaStackSlot *results);
+
+// An external function that cannot complete immediately, e.g., waiting for I/O, can call umkaSuspend() instead of setting
+// the result. The returned handle is later passed by the host from any thread to umkaResume() that sets the result and resumes
+// the calling fiber. A fiber started by fiberstart() yields its worker thread to other fibers while suspended. Any other fiber
+// returns to the host as if interrupted by the budget: umkaInterrupted() returns true, and umkaContinue() returns at once until
+// the fiber is resumed, then runs it further. A fiber that cannot return to the host, i.e., a script function called back by
+// an external or built-in function, or a fiber called by a started one, blocks its thread until resumed from another thread
+
+void *umkaSuspend   (UmkaStackSlot *result);
+void umkaResume     (void *handle, UmkaStackSlot *result);
+
+void *umkaAllocContext   (void);
+bool umkaInitContext     (void *context, void *umka, int stackSize);
+bool umkaRunContext      (void *context);
+bool umkaCallContext     (void *context, int entryOffset, int numParamSlots, UmkaStackSlot *params, UmkaStackSlot *result);
+void umkaSetContextBudget   (void *context, int budget);
+bool umkaContextInterrupted (void *context);
+bool umkaContinueContext    (void *context);
+bool umkaResetStateContext  (void *context);
+bool umkaGetVarContext      (void *context, char *moduleName, char *varName, UmkaVar *var);
+bool umkaShareArrayContext  (void *context, char *moduleName, char *varName, void *data, int len);
+bool umkaCallPreparedContext(void *context, UmkaPreparedCall *call, UmkaStackSlot *params, UmkaStackSlot *result);
+bool umkaCallBatchContext   (void *context, UmkaPreparedCall *call, int numCalls, UmkaStackSlot *params, UmkaStackSlot *results);
+void umkaFreeContext     (void *context);
+void umkaGetContextError (void *context, UmkaError *err);
+
 
 #if defined(__cplusplus)
 }
@@ -20,6 +20,19 @@ void storageFree(Storage *storage)
 }
 
 
+char *storageAddStr(Storage *storage, const char *str, Error *error)
+{
+    int len = strlen(str);
+    if (storage->len + len + 1 > storage->capacity)
+        error->handler(error->context, "Storage overflow");
+
+    char *res = &storage->data[storage->len];
+    strcpy(res, str);
+    storage->len += len + 1;
+    return res;
+}
+
+
 // Modules
 
 void moduleInit(Modules *modules, Error *error)
@@ -27,6 +40,8 @@ void moduleInit(Modules *modules, Error *error)
     for (int i = 0; i < MAX_MODULES; i++)
         modules->module[i] = NULL;
     modules->numModules = 0;
+    modules->loader = NULL;
+    modules->loaderContext = NULL;
     modules->error = error;
 }
 
@@ -95,6 +110,9 @@ int moduleAdd(Modules *modules, char *path)
     if (res >= 0)
         modules->error->handler(modules->error->context, "Duplicate module %s", name);
 
+    if (modules->numModules >= MAX_MODULES)
+        modules->error->handler(modules->error->context, "Too many modules");
+
     Module *module = malloc(sizeof(Module));
 
     strcpy(module->path, path);
@@ -103,6 +121,7 @@ int moduleAdd(Modules *modules, char *path)
 
     module->hash = hash(name);
     module->pathHash = hash(path);
+    module->sourceHash = 0;
 
     for (int i = 0; i < MAX_MODULES; i++)
         module->imports[i] = false;
@@ -171,6 +190,7 @@ void externalFree(Externals *externals)
     while (external)
     {
         External *next = external->next;
+        free(external->signature);
         free(external);
         external = next;
     }
@@ -198,6 +218,11 @@ External *externalAdd(Externals *externals, char *name, void *entry)
     strcpy(external->name, name);
     external->hash = hash(name);
 
+    external->signature = NULL;
+    external->numParams = 0;
+    external->resultOffset = -1;
+    external->frame = true;
+
     external->next = NULL;
 
     // Add to list
@@ -211,3 +236,14 @@ External *externalAdd(Externals *externals, char *name, void *entry)
     return externals->last;
 }
 
+
+External *externalAddTyped(Externals *externals, char *name, char *signature, void *entry)
+{
+    External *external = externalAdd(externals, name, entry);
+
+    external->signature = malloc(strlen(signature) + 1);
+    strcpy(external->signature, signature);
+
+    return external;
+}
+
@@ -15,7 +15,9 @@ enum
     MAX_PARAMS          = 16,
     MAX_RESULTS         = 16,
     MAX_BLOCK_NESTING   = 100,
-    MAX_GOTOS           = 100
+    MAX_GOTOS           = 100,
+    MAX_ERROR_LEN       = 512,
+    MAX_STACK_TRACE     = 16
 };
 
 
@@ -27,6 +29,14 @@ typedef struct
 } DynArray;
 
 
+typedef struct
+{
+    char *fileName;
+    char *fnName;
+    int line;
+} DebugInfo;
+
+
 typedef struct
 {
     void (*handler)(void *context, const char *format, ...);
@@ -35,9 +45,11 @@ typedef struct
     jmp_buf jumper;
 
     // Error report
-    char fileName[DEFAULT_STR_LEN];
+    char fileName[DEFAULT_STR_LEN + 1];
     int line, pos;
-    char msg[DEFAULT_STR_LEN];
+    char msg[MAX_ERROR_LEN];
+    DebugInfo trace[MAX_STACK_TRACE];   // Function calls that led to a runtime error, innermost first
+    int traceLen;
 } Error;
 
 
@@ -52,14 +64,20 @@ typedef struct
 {
     char path[DEFAULT_STR_LEN + 1], folder[DEFAULT_STR_LEN + 1], name[DEFAULT_STR_LEN + 1];
     unsigned int hash, pathHash;
+    uint64_t sourceHash;        // For checking the compile cache
     bool imports[MAX_MODULES];
 } Module;
 
 
+typedef bool (*ModuleLoader)(const char *path, const char **source, int *sourceLen, void *context);
+
+
 typedef struct
 {
     Module *module[MAX_MODULES];
     int numModules;
+    ModuleLoader loader;        // Supplies the source of imported modules instead of the files, if set by the host
+    void *loaderContext;
     Error *error;
 } Modules;
 
@@ -87,6 +105,15 @@ typedef struct tagExternal
     char name[DEFAULT_STR_LEN + 1];
     unsigned int hash;
     void *entry;
+
+    // For typed external functions: the signature declared by the host and the parameter layout resolved by the compiler
+    char *signature;
+    int numParams;
+    int paramOffset[MAX_PARAMS];
+    bool paramStructured[MAX_PARAMS];
+    int resultOffset;
+    bool frame;
+
     struct tagExternal *next;
 } External;
 
@@ -97,15 +124,9 @@ typedef struct
 } Externals;
 
 
-typedef struct
-{
-    char *fileName;
-    int line;
-} DebugInfo;
-
-
 void storageInit(Storage *storage, int capacity);
 void storageFree(Storage *storage);
+char *storageAddStr(Storage *storage, const char *str, Error *error);
 
 void moduleInit         (Modules *modules, Error *error);
 void moduleFree         (Modules *modules);
@@ -124,6 +145,7 @@ void externalInit       (Externals *externals);
 void externalFree       (Externals *externals);
 External *externalFind  (Externals *externals, char *name);
 External *externalAdd   (Externals *externals, char *name, void *entry);
+External *externalAddTyped(Externals *externals, char *name, char *signature, void *entry);
 
 static inline unsigned int hash(const char *str)
 {
@@ -138,6 +160,18 @@ static inline unsigned int hash(const char *str)
 }
 
 
+static inline uint64_t hashSource(const char *buf, int len)
+{
+    // FNV-1a hash
+    uint64_t hash = 14695981039346656037ULL;
+
+    for (int i = 0; i < len; i++)
+        hash = (hash ^ (unsigned char)buf[i]) * 1099511628211ULL;
+
+    return hash;
+}
+
+
 static inline int align(int size, int alignment)
 {
     return ((size + (alignment - 1)) / alignment) * alignment;
@@ -1,4 +1,5 @@
 #include <stddef.h>
+#include <stdlib.h>
 #include <string.h>
 #include <stdio.h>
 
@@ -86,6 +87,14 @@ static void compilerDeclareBuiltinIdents(Compiler *comp)
     identAddBuiltinFunc(&comp->idents, &comp->modules, &comp->blocks, "make",       comp->ptrVoidType, BUILTIN_MAKE);
     identAddBuiltinFunc(&comp->idents, &comp->modules, &comp->blocks, "append",     comp->ptrVoidType, BUILTIN_APPEND);
     identAddBuiltinFunc(&comp->idents, &comp->modules, &comp->blocks, "delete",     comp->ptrVoidType, BUILTIN_DELETE);
+    identAddBuiltinFunc(&comp->idents, &comp->modules, &comp->blocks, "insert",     comp->ptrVoidType, BUILTIN_INSERT);
+    identAddBuiltinFunc(&comp->idents, &comp->modules, &comp->blocks, "appendall",  comp->ptrVoidType, BUILTIN_APPENDALL);
+    identAddBuiltinFunc(&comp->idents, &comp->modules, &comp->blocks, "copy",       comp->intType,     BUILTIN_COPY);
+    identAddBuiltinFunc(&comp->idents, &comp->modules, &comp->blocks, "fill",       comp->voidType,    BUILTIN_FILL);
+    identAddBuiltinFunc(&comp->idents, &comp->modules, &comp->blocks, "resize",     comp->ptrVoidType, BUILTIN_RESIZE);
+    identAddBuiltinFunc(&comp->idents, &comp->modules, &comp->blocks, "reserve",    comp->ptrVoidType, BUILTIN_RESERVE);
+    identAddBuiltinFunc(&comp->idents, &comp->modules, &comp->blocks, "sort",       comp->voidType,    BUILTIN_SORT);
+    identAddBuiltinFunc(&comp->idents, &comp->modules, &comp->blocks, "bsearch",    comp->intType,     BUILTIN_BSEARCH);
     identAddBuiltinFunc(&comp->idents, &comp->modules, &comp->blocks, "len",        comp->intType,     BUILTIN_LEN);
     identAddBuiltinFunc(&comp->idents, &comp->modules, &comp->blocks, "sizeof",     comp->intType,     BUILTIN_SIZEOF);
     identAddBuiltinFunc(&comp->idents, &comp->modules, &comp->blocks, "sizeofself", comp->intType,     BUILTIN_SIZEOFSELF);
@@ -94,6 +103,15 @@ static void compilerDeclareBuiltinIdents(Compiler *comp)
     identAddBuiltinFunc(&comp->idents, &comp->modules, &comp->blocks, "fiberspawn", comp->ptrVoidType, BUILTIN_FIBERSPAWN);
     identAddBuiltinFunc(&comp->idents, &comp->modules, &comp->blocks, "fibercall",  comp->voidType,    BUILTIN_FIBERCALL);
     identAddBuiltinFunc(&comp->idents, &comp->modules, &comp->blocks, "fiberalive", comp->boolType,    BUILTIN_FIBERALIVE);
+    identAddBuiltinFunc(&comp->idents, &comp->modules, &comp->blocks, "fiberstart", comp->voidType,    BUILTIN_FIBERSTART);
+    identAddBuiltinFunc(&comp->idents, &comp->modules, &comp->blocks, "fiberwait",  comp->voidType,    BUILTIN_FIBERWAIT);
+    identAddBuiltinFunc(&comp->idents, &comp->modules, &comp->blocks, "parfor",     comp->voidType,    BUILTIN_PARFOR);
+
+    // Channels
+    identAddBuiltinFunc(&comp->idents, &comp->modules, &comp->blocks, "send",       comp->voidType,    BUILTIN_SEND);
+    identAddBuiltinFunc(&comp->idents, &comp->modules, &comp->blocks, "recv",       comp->ptrVoidType, BUILTIN_RECV);
+    identAddBuiltinFunc(&comp->idents, &comp->modules, &comp->blocks, "select",     comp->intType,     BUILTIN_SELECT);
+    identAddBuiltinFunc(&comp->idents, &comp->modules, &comp->blocks, "close",      comp->voidType,    BUILTIN_CLOSE);
 
     // Misc
     identAddBuiltinFunc(&comp->idents, &comp->modules, &comp->blocks, "repr",       comp->strType,     BUILTIN_REPR);
@@ -107,13 +125,16 @@ static void compilerDeclareExternalFuncs(Compiler *comp)
     externalAdd(&comp->externals, "rtlfclose",  &rtlfclose);
     externalAdd(&comp->externals, "rtlfread",   &rtlfread);
     externalAdd(&comp->externals, "rtlfwrite",  &rtlfwrite);
+    externalAdd(&comp->externals, "rtlfgetline", &rtlfgetline);
+    externalAdd(&comp->externals, "rtlsetvbuf", &rtlsetvbuf);
+    externalAdd(&comp->externals, "rtlftell",   &rtlftell);
     externalAdd(&comp->externals, "rtlfseek",   &rtlfseek);
     externalAdd(&comp->externals, "rtlremove",  &rtlremove);
     externalAdd(&comp->externals, "rtltime",    &rtltime);
 }
 
 
-void compilerInit(Compiler *comp, char *fileName, int storageSize, int stackSize, int argc, char **argv)
+void compilerInit(Compiler *comp, char *fileName, const char *source, int sourceLen, int storageSize, int stackSize, int argc, char **argv)
 {
     storageInit  (&comp->storage, storageSize);
     moduleInit   (&comp->modules, &comp->error);
@@ -124,7 +145,7 @@ void compilerInit(Compiler *comp, char *fileName, int storageSize, int stackSize
     constInit    (&comp->consts, &comp->error);
     genInit      (&comp->gen, &comp->debug, &comp->error);
     vmInit       (&comp->vm, stackSize, &comp->error);
-    lexInit      (&comp->lex, &comp->storage, &comp->debug, fileName, &comp->error);
+    lexInit      (&comp->lex, &comp->storage, &comp->debug, fileName, source, sourceLen, &comp->error);
 
     comp->argc  = argc;
     comp->argv  = argv;
@@ -144,8 +165,23 @@ void compilerInit(Compiler *comp, char *fileName, int storageSize, int stackSize
 }
 
 
+static void compilerReleaseGlobals(Compiler *comp, VM *vm)
+{
+    // The global variables live as long as the VM, so that the host can access them after main() returns
+    if (!vm->globals)
+        return;
+
+    for (Ident *ident = comp->idents.first; ident; ident = ident->next)
+        if (ident->kind == IDENT_VAR && ident->block == 0 && ident->globalOffset >= 0 && typeGarbageCollected(ident->type) &&
+            ident->globalOffset + typeSizeNoCheck(ident->type) <= vm->globalsSize)
+            vmReleaseGlobal(vm, ident->globalOffset, ident->type);
+}
+
+
 void compilerFree(Compiler *comp)
 {
+    compilerReleaseGlobals(comp, &comp->vm);
+
     lexFree      (&comp->lex);
     vmFree       (&comp->vm);
     genFree      (&comp->gen);
@@ -156,12 +192,28 @@ void compilerFree(Compiler *comp)
     blocksFree   (&comp->blocks);
     moduleFree   (&comp->modules);
     storageFree  (&comp->storage);
+
+    free(comp->globals);
+    free(comp->keptGlobals);
+    free(comp->storageConsts);
 }
 
 
 void compilerCompile(Compiler *comp)
 {
+    // An up-to-date program image in the compile cache replaces the compilation
+    if (comp->cacheDir[0] && compilerLoadCache(comp))
+        return;
+
     parseProgram(comp);
+
+    // The compiled program keeps the initial values of global variables, each VM gets a copy
+    comp->globals = malloc(comp->idents.globalsSize);
+    identCopyGlobals(&comp->idents, comp->globals);
+    vmSetGlobals(&comp->vm, comp->globals, comp->idents.globalsSize);
+
+    if (comp->cacheDir[0])
+        compilerSaveCache(comp);
 }
 
 
@@ -172,22 +224,154 @@ void compilerRun(Compiler *comp)
 }
 
 
+static void compilerCallNested(VM *vm, int entryOffset, int numCalls, int numParamSlots, Slot *params, Slot *results)
+{
+    // A call from an external function continues the script that called the external function rather than resetting the VM
+    for (int i = 0; i < numCalls; i++)
+        vmRunNested(vm, entryOffset, numParamSlots, params + i * numParamSlots, results ? &results[i] : NULL);
+}
+
+
 void compilerCall(Compiler *comp, int entryOffset, int numParamSlots, Slot *params, Slot *result)
 {
+    if (comp->vm.externDepth > 0)
+    {
+        compilerCallNested(&comp->vm, entryOffset, 1, numParamSlots, params, result);
+        return;
+    }
+
     vmReset(&comp->vm, comp->gen.code);
     vmRun(&comp->vm, entryOffset, numParamSlots, params, result);
 }
 
 
+void compilerResetState(Compiler *comp)
+{
+    if (!comp->globals)
+        comp->error.handler(comp->error.context, "Program is not compiled");
+
+    vmResetState(&comp->vm, comp->globals, comp->idents.globalsSize);
+}
+
+
+void compilerContinue(Compiler *comp)
+{
+    vmContinue(&comp->vm);
+}
+
+
+void compilerCallPrepared(Compiler *comp, int entryOffset, int numParamSlots, Slot *params, Slot *result)
+{
+    if (comp->vm.externDepth > 0)
+    {
+        compilerCallNested(&comp->vm, entryOffset, 1, numParamSlots, params, result);
+        return;
+    }
+
+    vmRunPrepared(&comp->vm, comp->gen.code, entryOffset, numParamSlots, params, result);
+}
+
+
+void compilerCallBatch(Compiler *comp, int entryOffset, int numCalls, int numParamSlots, Slot *params, Slot *results)
+{
+    if (comp->vm.externDepth > 0)
+    {
+        compilerCallNested(&comp->vm, entryOffset, numCalls, numParamSlots, params, results);
+        return;
+    }
+
+    vmReset(&comp->vm, comp->gen.code);
+    vmRunBatch(&comp->vm, entryOffset, numCalls, numParamSlots, params, results);
+}
+
+
 void compilerAsm(Compiler *comp, char *buf)
 {
     genAsm(&comp->gen, buf);
 }
 
 
+void contextInit(Context *ctx, Compiler *comp, int stackSize)
+{
+    // Execution context: an independent VM with its own stack, heap and global variables that runs the code of a compiled program
+    ctx->comp = comp;
+    vmInit(&ctx->vm, stackSize, &ctx->error);
+    vmSetGlobals(&ctx->vm, comp->globals, comp->idents.globalsSize);
+}
+
+
+void contextFree(Context *ctx)
+{
+    compilerReleaseGlobals(ctx->comp, &ctx->vm);
+    vmFree(&ctx->vm);
+}
+
+
+void contextRun(Context *ctx)
+{
+    compilerUpdateGlobals(ctx->comp, &ctx->vm);
+    vmReset(&ctx->vm, ctx->comp->gen.code);
+    vmRun(&ctx->vm, 0, 0, NULL, NULL);
+}
+
+
+void contextCall(Context *ctx, int entryOffset, int numParamSlots, Slot *params, Slot *result)
+{
+    if (ctx->vm.externDepth > 0)
+    {
+        compilerCallNested(&ctx->vm, entryOffset, 1, numParamSlots, params, result);
+        return;
+    }
+
+    compilerUpdateGlobals(ctx->comp, &ctx->vm);
+    vmReset(&ctx->vm, ctx->comp->gen.code);
+    vmRun(&ctx->vm, entryOffset, numParamSlots, params, result);
+}
+
+
+void contextResetState(Context *ctx)
+{
+    compilerUpdateGlobals(ctx->comp, &ctx->vm);
+    vmResetState(&ctx->vm, ctx->comp->globals, ctx->comp->idents.globalsSize);
+}
+
+
+void contextContinue(Context *ctx)
+{
+    vmContinue(&ctx->vm);
+}
+
+
+void contextCallPrepared(Context *ctx, int entryOffset, int numParamSlots, Slot *params, Slot *result)
+{
+    if (ctx->vm.externDepth > 0)
+    {
+        compilerCallNested(&ctx->vm, entryOffset, 1, numParamSlots, params, result);
+        return;
+    }
+
+    compilerUpdateGlobals(ctx->comp, &ctx->vm);
+    vmRunPrepared(&ctx->vm, ctx->comp->gen.code, entryOffset, numParamSlots, params, result);
+}
+
+
+void contextCallBatch(Context *ctx, int entryOffset, int numCalls, int numParamSlots, Slot *params, Slot *results)
+{
+    if (ctx->vm.externDepth > 0)
+    {
+        compilerCallNested(&ctx->vm, entryOffset, numCalls, numParamSlots, params, results);
+        return;
+    }
+
+    compilerUpdateGlobals(ctx->comp, &ctx->vm);
+    vmReset(&ctx->vm, ctx->comp->gen.code);
+    vmRunBatch(&ctx->vm, entryOffset, numCalls, numParamSlots, params, results);
+}
+
+
 int compilerGetFunc(Compiler *comp, char *moduleName, char *funcName)
 {
-    int module = 1;
+    int module = comp->blocks.module;      // Main module
     if (moduleName)
         module = moduleFindByPath(&comp->modules, moduleName);
 
@@ -198,4 +382,76 @@ int compilerGetFunc(Compiler *comp, char *moduleName, char *funcName)
 }
 
 
+Ident *compilerGetVar(Compiler *comp, char *moduleName, char *varName)
+{
+    int module = comp->blocks.module;      // Main module
+    if (moduleName)
+        module = moduleFindByPath(&comp->modules, moduleName);
+
+    Ident *var = identFind(&comp->idents, &comp->modules, &comp->blocks, module, varName, NULL);
+    if (var && var->kind == IDENT_VAR && var->globalOffset >= 0)
+        return var;
+    return NULL;
+}
+
+
+Ident *contextGetVar(Context *ctx, char *moduleName, char *varName)
+{
+    compilerUpdateGlobals(ctx->comp, &ctx->vm);
+    return compilerGetVar(ctx->comp, moduleName, varName);
+}
+
+
+static void compilerShareArrayInVM(Compiler *comp, VM *vm, Error *error, char *moduleName, char *varName, void *data, int len)
+{
+    Ident *var = compilerGetVar(comp, moduleName, varName);
+    if (!var || !vm->globals)
+        error->handler(error->context, "Variable %s is not defined", varName);
+
+    if (var->type->kind != TYPE_DYNARRAY)
+        error->handler(error->context, "Variable %s is not a dynamic array", varName);
+
+    // The items in the host memory are never released, so they cannot hold references to the heap
+    if (typeGarbageCollected(var->type->base))
+        error->handler(error->context, "Dynamic array %s cannot share host memory, since its items are garbage collected", varName);
+
+    if (len < 0 || (len > 0 && !data))
+        error->handler(error->context, "Illegal host memory for dynamic array %s", varName);
+
+    vmShareDynArray(vm, (DynArray *)(vm->globals + var->globalOffset), var->type, data, len);
+}
+
+
+void compilerShareArray(Compiler *comp, char *moduleName, char *varName, void *data, int len)
+{
+    compilerShareArrayInVM(comp, &comp->vm, &comp->error, moduleName, varName, data, len);
+}
+
+
+void contextShareArray(Context *ctx, char *moduleName, char *varName, void *data, int len)
+{
+    compilerUpdateGlobals(ctx->comp, &ctx->vm);
+    compilerShareArrayInVM(ctx->comp, &ctx->vm, &ctx->error, moduleName, varName, data, len);
+}
+
+
+int compilerPrepareCall(Compiler *comp, char *moduleName, char *funcName, int numParamSlots)
+{
+    int module = comp->blocks.module;      // Main module
+    if (moduleName)
+        module = moduleFindByPath(&comp->modules, moduleName);
+
+    Ident *fn = identFind(&comp->idents, &comp->modules, &comp->blocks, module, funcName, NULL);
+    if (!fn || fn->kind != IDENT_CONST || fn->type->kind != TYPE_FN)
+        comp->error.handler(comp->error.context, "Function %s is not defined", funcName);
+
+    // Parameters occupy whole slots. A structured result is returned through the __result pointer, which is the last parameter
+    int paramSlots = typeParamSizeTotal(&comp->types, &fn->type->sig) / sizeof(Slot);
+    if (paramSlots != numParamSlots)
+        comp->error.handler(comp->error.context, "Function %s has %d parameter slots rather than %d", funcName, paramSlots, numParamSlots);
+
+    return fn->offset;
+}
+
+
 
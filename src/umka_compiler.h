@@ -11,6 +11,20 @@
 #include "umka_runtime.h"
 
 
+typedef struct
+{
+    int offset, oldOffset;      // A global variable kept by a hot reload starts as a copy of the old one
+    Type *type;
+} KeptGlobal;
+
+
+typedef struct
+{
+    int offset;                 // A composite constant in the storage may hold pointers to strings in the storage
+    Type *type;
+} StorageConst;
+
+
 typedef struct
 {
     Storage     storage;
@@ -23,6 +37,12 @@ typedef struct
     Consts      consts;
     CodeGen     gen;
     VM          vm;
+    void        *globals;       // Initial values of global variables
+    char        cacheDir[DEFAULT_STR_LEN + 1];      // Compile cache, if set by the host
+    KeptGlobal  *keptGlobals;   // Global variables kept by hot reloads
+    int         numKeptGlobals;
+    StorageConst *storageConsts;    // Composite constants that hold pointers, for saving images
+    int         numStorageConsts;
     DebugInfo   debug;
     Error       error;
 
@@ -45,12 +65,44 @@ typedef struct
 } Compiler;
 
 
-void compilerInit   (Compiler *comp, char *fileName, int storageSize, int stackSize, int argc, char **argv);
+typedef struct
+{
+    Compiler    *comp;          // Compiled program, shared by all contexts and not modified by them
+    VM          vm;
+    Error       error;
+} Context;
+
+
+void compilerInit   (Compiler *comp, char *fileName, const char *source, int sourceLen, int storageSize, int stackSize, int argc, char **argv);
 void compilerFree   (Compiler *comp);
 void compilerCompile(Compiler *comp);
 void compilerRun    (Compiler *comp);
 void compilerCall   (Compiler *comp, int entryOffset, int numParamSlots, Slot *params, Slot *result);
+void compilerContinue(Compiler *comp);
+void compilerResetState(Compiler *comp);
+void compilerCallPrepared(Compiler *comp, int entryOffset, int numParamSlots, Slot *params, Slot *result);
+void compilerCallBatch(Compiler *comp, int entryOffset, int numCalls, int numParamSlots, Slot *params, Slot *results);
 void compilerAsm    (Compiler *comp, char *buf);
 int compilerGetFunc (Compiler *comp, char *moduleName, char *funcName);
+int compilerPrepareCall(Compiler *comp, char *moduleName, char *funcName, int numParamSlots);
+Ident *compilerGetVar(Compiler *comp, char *moduleName, char *varName);
+void compilerShareArray(Compiler *comp, char *moduleName, char *varName, void *data, int len);
+void compilerSave   (Compiler *comp, char *fileName);
+void compilerLoad   (Compiler *comp, const char *image, int imageLen);
+bool compilerLoadCache(Compiler *comp);
+void compilerSaveCache(Compiler *comp);
+void compilerReload (Compiler *comp, char *path, const char *source, int sourceLen);
+void compilerUpdateGlobals(Compiler *comp, VM *vm);
+
+void contextInit    (Context *ctx, Compiler *comp, int stackSize);
+void contextFree    (Context *ctx);
+void contextRun     (Context *ctx);
+void contextCall    (Context *ctx, int entryOffset, int numParamSlots, Slot *params, Slot *result);
+void contextContinue(Context *ctx);
+void contextResetState(Context *ctx);
+void contextCallPrepared(Context *ctx, int entryOffset, int numParamSlots, Slot *params, Slot *result);
+void contextCallBatch(Context *ctx, int entryOffset, int numCalls, int numParamSlots, Slot *params, Slot *results);
+void contextShareArray(Context *ctx, char *moduleName, char *varName, void *data, int len);
+Ident *contextGetVar(Context *ctx, char *moduleName, char *varName);
 
 #endif // UMKA_COMPILER_H_INCLUDED
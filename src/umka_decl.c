@@ -151,6 +151,14 @@ static void parseSignature(Compiler *comp, Signature *sig)
 }
 
 
+static bool chanTypeAhead(Compiler *comp)
+{
+    // "chan" is not a keyword, so that it starts a channel type only if no identifier or module of this name is visible
+    return comp->lex.tok.kind == TOK_IDENT && strcmp(comp->lex.tok.name, "chan") == 0 && moduleFind(&comp->modules, comp->lex.tok.name) < 0 &&
+           !identFind(&comp->idents, &comp->modules, &comp->blocks, comp->blocks.module, comp->lex.tok.name, NULL);
+}
+
+
 // ptrType = ["weak"] "^" type.
 static Type *parsePtrType(Compiler *comp)
 {
@@ -166,7 +174,7 @@ static Type *parsePtrType(Compiler *comp)
 
     // Forward declaration
     bool forward = false;
-    if (comp->lex.tok.kind == TOK_IDENT)
+    if (comp->lex.tok.kind == TOK_IDENT && !chanTypeAhead(comp))
     {
         int module = moduleFind(&comp->modules, comp->lex.tok.name);
         if (module < 0)
@@ -310,6 +318,18 @@ static Type *parseInterfaceType(Compiler *comp)
 }
 
 
+// chanType = "chan" type.
+static Type *parseChanType(Compiler *comp)
+{
+    lexEat(&comp->lex, TOK_IDENT);
+
+    // Channels are always accessed by pointers
+    Type *type = typeAdd(&comp->types, &comp->blocks, TYPE_CHAN);
+    type->base = parseType(comp, NULL);
+    return typeAddPtrTo(&comp->types, &comp->blocks, type);
+}
+
+
 // fnType = "fn" signature.
 static Type *parseFnType(Compiler *comp)
 {
@@ -320,7 +340,7 @@ static Type *parseFnType(Compiler *comp)
 }
 
 
-// type = qualIdent | ptrType | arrayType | dynArrayType | strType | structType | fnType.
+// type = qualIdent | ptrType | arrayType | dynArrayType | strType | structType | chanType | fnType.
 Type *parseType(Compiler *comp, Ident *ident)
 {
     if (ident)
@@ -331,6 +351,9 @@ Type *parseType(Compiler *comp, Ident *ident)
         return ident->type;
     }
 
+    if (chanTypeAhead(comp))
+        return parseChanType(comp);
+
     switch (comp->lex.tok.kind)
     {
         case TOK_IDENT:     return parseType(comp, parseQualIdent(comp));
@@ -586,7 +609,14 @@ static void parseImportItem(Compiler *comp)
         int currentModule       = comp->blocks.module;
         DebugInfo currentDebug  = comp->debug;
         Lexer currentLex        = comp->lex;
-        lexInit(&comp->lex, &comp->storage, &comp->debug, path, &comp->error);
+
+        // The host loader may supply the module source, otherwise the module is read from the file
+        const char *source = NULL;
+        int sourceLen = 0;
+        if (comp->modules.loader && !comp->modules.loader(path, &source, &sourceLen, comp->modules.loaderContext))
+            source = NULL;
+
+        lexInit(&comp->lex, &comp->storage, &comp->debug, path, source, sourceLen, &comp->error);
 
         lexNext(&comp->lex);
         importedModule = parseModule(comp);
@@ -624,9 +654,10 @@ static void parseImport(Compiler *comp)
 
 
 // module = [import ";"] decls.
-static int parseModule(Compiler *comp)
+static void parseModuleInSlot(Compiler *comp, int module)
 {
-    comp->blocks.module = moduleAdd(&comp->modules, comp->lex.fileName);
+    comp->blocks.module = module;
+    comp->modules.module[comp->blocks.module]->sourceHash = hashSource(comp->lex.buf, comp->lex.bufLen);
 
     if (comp->lex.tok.kind == TOK_IMPORT)
     {
@@ -634,7 +665,14 @@ static int parseModule(Compiler *comp)
         lexEat(&comp->lex, TOK_SEMICOLON);
     }
     parseDecls(comp);
-    return comp->blocks.module;
+}
+
+
+static int parseModule(Compiler *comp)
+{
+    int module = moduleAdd(&comp->modules, comp->lex.fileName);
+    parseModuleInSlot(comp, module);
+    return module;
 }
 
 
@@ -646,8 +684,19 @@ void parseProgram(Compiler *comp)
 
     lexNext(&comp->lex);
     parseModule(comp);
-    doResolveExtern(comp);
+    doResolveExtern(comp, comp->idents.first);
 
     if (!comp->gen.mainDefined)
         comp->error.handler(comp->error.context, "main() is not defined");
 }
+
+
+// Hot reload: the new version of a module is compiled after the whole program, into the module slot of the old version
+void parseReloadedModule(Compiler *comp, int module)
+{
+    Ident *lastIdent = comp->idents.last;
+
+    lexNext(&comp->lex);
+    parseModuleInSlot(comp, module);
+    doResolveExtern(comp, lastIdent->next);
+}
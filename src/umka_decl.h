@@ -8,6 +8,7 @@ Type *parseType(Compiler *comp, Ident *ident);
 void parseShortVarDecl(Compiler *comp);
 void parseDecl(Compiler *comp);
 void parseProgram(Compiler *comp);
+void parseReloadedModule(Compiler *comp, int module);
 
 
 #endif // UMKA_DECL_H_INCLUDED
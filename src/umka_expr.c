@@ -1,3 +1,4 @@
+#include <stdlib.h>
 #include <string.h>
 #include <limits.h>
 #include <stddef.h>
@@ -12,6 +13,8 @@ void doPushConst(Compiler *comp, Type *type, Const *constant)
 {
     if (typeReal(type))
         genPushRealConst(&comp->gen, constant->realVal);
+    else if (type->kind == TYPE_STR || typeStructured(type))
+        genPushGlobalPtr(&comp->gen, (void *)constant->ptrVal);
     else
         genPushIntConst(&comp->gen, constant->intVal);
 }
@@ -20,7 +23,7 @@ void doPushConst(Compiler *comp, Type *type, Const *constant)
 void doPushVarPtr(Compiler *comp, Ident *ident)
 {
     if (ident->block == 0)
-        genPushGlobalPtr(&comp->gen, ident->ptr);
+        genPushGlobalVarPtr(&comp->gen, ident->globalOffset);
     else
         genPushLocalPtr(&comp->gen, ident->offset);
 }
@@ -121,6 +124,38 @@ static void doArrayToDynArrayConv(Compiler *comp, Type *dest, Type **src, Const
 }
 
 
+// fn slice(array: [] type | [...] type | str, startIndex, endIndex: int [, len, itemSize: int, type]): [] type | str
+static void doGetSlice(Compiler *comp, Type **type)
+{
+    TypeKind typeKind = (*type)->kind;
+
+    if (typeKind == TYPE_ARRAY)
+    {
+        // Slicing a static array gives a dynamic array
+        Type *sliceType = typeAdd(&comp->types, &comp->blocks, TYPE_DYNARRAY);
+        sliceType->base = (*type)->base;
+
+        genPushIntConst(&comp->gen, (*type)->numItems);                         // Nominal length for range checking
+        genPushIntConst(&comp->gen, typeSize(&comp->types, (*type)->base));     // Item size
+        genPushGlobalPtr(&comp->gen, sliceType);                                // Slice type for copying the items
+
+        *type = sliceType;
+    }
+
+    if ((*type)->kind == TYPE_DYNARRAY)
+    {
+        // Pointer to result (hidden parameter)
+        int resultOffset = identAllocStack(&comp->idents, &comp->blocks, typeSize(&comp->types, *type));
+        genPushLocalPtr(&comp->gen, resultOffset);
+    }
+
+    genCallBuiltin(&comp->gen, typeKind, BUILTIN_SLICE);
+
+    // Copy result to a temporary local variable to collect it as garbage when leaving the block
+    doCopyResultToTempVar(comp, *type);
+}
+
+
 static void doPtrToInterfaceConv(Compiler *comp, Type *dest, Type **src, Const *constant)
 {
     if (constant)
@@ -361,6 +396,53 @@ Ident *parseQualIdent(Compiler *comp)
 }
 
 
+static void doCallIOBuiltin(Compiler *comp, char **format, TypeKind typeKind, BuiltinFunc builtin)
+{
+    // Format string literals are split at compile time into null-terminated segments, each with one conversion specifier at most,
+    // so that the VM does not need to check them again
+    if (!*format)
+    {
+        genCallBuiltin(&comp->gen, typeKind, builtin);
+        return;
+    }
+
+    int len;
+    TypeKind expectedTypeKind;
+    if (!vmCheckFormatString(*format, &len, &expectedTypeKind))
+        comp->error.handler(comp->error.context, "Illegal type character %c in format string", (*format)[len]);
+
+    if (builtin == BUILTIN_PRINTF || builtin == BUILTIN_FPRINTF || builtin == BUILTIN_SPRINTF)
+    {
+        if (typeKind != expectedTypeKind && !(typeKindInteger(typeKind) && typeKindInteger(expectedTypeKind)) &&
+                                            !(typeKindReal(typeKind)    && typeKindReal(expectedTypeKind)))
+            comp->error.handler(comp->error.context, "Incompatible types %s and %s in printf()", typeKindSpelling(expectedTypeKind), typeKindSpelling(typeKind));
+    }
+    else
+    {
+        if (typeKind != expectedTypeKind)
+            comp->error.handler(comp->error.context, "Incompatible types %s and %s in scanf()", typeKindSpelling(expectedTypeKind), typeKindSpelling(typeKind));
+    }
+
+    char *segment = *format;
+    if ((*format)[len])
+    {
+        if (comp->storage.len + len + 1 > comp->storage.capacity)
+            comp->error.handler(comp->error.context, "Storage overflow");
+
+        segment = &comp->storage.data[comp->storage.len];
+        strncpy(segment, *format, len);
+        segment[len] = 0;
+        comp->storage.len += len + 1;
+    }
+
+    genPushGlobalPtr(&comp->gen, segment);
+    genPopReg(&comp->gen, VM_REG_IO_FORMAT);
+    genCallBuiltinChecked(&comp->gen, typeKind, builtin);
+
+    *format += len;
+}
+
+
 static void parseBuiltinIOCall(Compiler *comp, Type **type, Const *constant, BuiltinFunc builtin)
 {
     if (constant)
@@ -386,7 +468,17 @@ static void parseBuiltinIOCall(Compiler *comp, Type **type, Const *constant, Bui
         lexEat(&comp->lex, TOK_COMMA);
     }
 
-    // Format string
+    // Format string, split into segments at compile time if it is a string literal
+    char *format = NULL;
+    if (comp->lex.tok.kind == TOK_STRLITERAL)
+    {
+        Lexer lookaheadLex = comp->lex;
+        lexNext(&lookaheadLex);
+
+        if (lookaheadLex.tok.kind == TOK_COMMA || lookaheadLex.tok.kind == TOK_RPAR)
+            format = comp->lex.tok.strVal;
+    }
+
     parseExpr(comp, type, constant);
     typeAssertCompatible(&comp->types, comp->strType, *type, false);
     genPopReg(&comp->gen, VM_REG_IO_FORMAT);
@@ -399,10 +491,10 @@ static void parseBuiltinIOCall(Compiler *comp, Type **type, Const *constant, Bui
 
         if (builtin == BUILTIN_PRINTF || builtin == BUILTIN_FPRINTF || builtin == BUILTIN_SPRINTF)
         {
-            if (typeOrdinal(*type) || typeReal(*type) || (*type)->kind == TYPE_STR)
-                genCallBuiltin(&comp->gen, (*type)->kind, builtin);
-            else
+            if (!typeOrdinal(*type) && !typeReal(*type) && (*type)->kind != TYPE_STR)
                 comp->error.handler(comp->error.context, "Incompatible type in printf()");
+
+            doCallIOBuiltin(comp, &format, (*type)->kind, builtin);
         }
         else  // BUILTIN_SCANF, BUILTIN_FSCANF, BUILTIN_SSCANF
         {
@@ -411,7 +503,7 @@ static void parseBuiltinIOCall(Compiler *comp, Type **type, Const *constant, Bui
                 if ((*type)->base->kind == TYPE_STR)
                     genDeref(&comp->gen, TYPE_STR);
 
-                genCallBuiltin(&comp->gen, (*type)->base->kind, builtin);
+                doCallIOBuiltin(comp, &format, (*type)->base->kind, builtin);
             }
             else
                 comp->error.handler(comp->error.context, "Incompatible type in scanf()");
@@ -422,7 +514,7 @@ static void parseBuiltinIOCall(Compiler *comp, Type **type, Const *constant, Bui
 
     // The rest of format string
     genPushIntConst(&comp->gen, 0);
-    genCallBuiltin(&comp->gen, TYPE_VOID, builtin);
+    doCallIOBuiltin(comp, &format, TYPE_VOID, builtin);
     genPop(&comp->gen);  // Manually remove parameter
 
     // Result
@@ -484,13 +576,36 @@ static void parseBuiltinNewCall(Compiler *comp, Type **type, Const *constant)
 
 
 // fn make([...] type (actually itemSize: int), len: int): [] type
+// fn make(chan type (actually ^chan type), capacity: int = 0): chan type
 static void parseBuiltinMakeCall(Compiler *comp, Type **type, Const *constant)
 {
     if (constant)
         comp->error.handler(comp->error.context, "Function is not allowed in constant expressions");
 
-    // Dynamic array type and item size
     *type = parseType(comp, NULL);
+
+    // Channel type and capacity
+    if (typeChannel(*type))
+    {
+        genPushGlobalPtr(&comp->gen, (*type)->base);
+
+        if (comp->lex.tok.kind == TOK_COMMA)
+        {
+            lexNext(&comp->lex);
+
+            Type *capacityType;
+            parseExpr(comp, &capacityType, NULL);
+            doImplicitTypeConv(comp, comp->intType, &capacityType, NULL, false);
+            typeAssertCompatible(&comp->types, comp->intType, capacityType, false);
+        }
+        else
+            genPushIntConst(&comp->gen, 0);
+
+        genCallBuiltin(&comp->gen, TYPE_PTR, BUILTIN_MAKECHAN);
+        return;
+    }
+
+    // Dynamic array type and item size
     if ((*type)->kind != TYPE_DYNARRAY)
         comp->error.handler(comp->error.context, "Incompatible type in make()");
 
@@ -541,6 +656,8 @@ static void parseBuiltinAppendCall(Compiler *comp, Type **type, Const *constant)
         genPushLocalPtr(&comp->gen, itemOffset);
     }
 
+    genPushGlobalPtr(&comp->gen, *type);
+
     // Pointer to result (hidden parameter)
     int resultOffset = identAllocStack(&comp->idents, &comp->blocks, typeSize(&comp->types, *type));
     genPushLocalPtr(&comp->gen, resultOffset);
@@ -568,6 +685,8 @@ static void parseBuiltinDeleteCall(Compiler *comp, Type **type, Const *constant)
     doImplicitTypeConv(comp, comp->intType, &indexType, NULL, false);
     typeAssertCompatible(&comp->types, comp->intType, indexType, false);
 
+    genPushGlobalPtr(&comp->gen, *type);
+
     // Pointer to result (hidden parameter)
     int resultOffset = identAllocStack(&comp->idents, &comp->blocks, typeSize(&comp->types, *type));
     genPushLocalPtr(&comp->gen, resultOffset);
@@ -576,6 +695,216 @@ static void parseBuiltinDeleteCall(Compiler *comp, Type **type, Const *constant)
 }
 
 
+// fn insert(array: [] type, index: int, items: [] type): [] type
+// fn appendall(array: [] type, items: [] type): [] type
+static void parseBuiltinInsertCall(Compiler *comp, Type **type, Const *constant, BuiltinFunc builtin)
+{
+    if (constant)
+        comp->error.handler(comp->error.context, "Function is not allowed in constant expressions");
+
+    // Dynamic array
+    parseExpr(comp, type, NULL);
+    if ((*type)->kind != TYPE_DYNARRAY)
+        comp->error.handler(comp->error.context, "Incompatible type in %s()", vmBuiltinSpelling(builtin));
+
+    lexEat(&comp->lex, TOK_COMMA);
+
+    // Index
+    if (builtin == BUILTIN_INSERT)
+    {
+        Type *indexType;
+        parseExpr(comp, &indexType, NULL);
+        doImplicitTypeConv(comp, comp->intType, &indexType, NULL, false);
+        typeAssertCompatible(&comp->types, comp->intType, indexType, false);
+
+        lexEat(&comp->lex, TOK_COMMA);
+    }
+
+    // New items
+    Type *itemsType;
+    parseExpr(comp, &itemsType, NULL);
+    doImplicitTypeConv(comp, *type, &itemsType, NULL, false);
+    typeAssertCompatible(&comp->types, *type, itemsType, false);
+
+    genPushGlobalPtr(&comp->gen, *type);
+
+    // Pointer to result (hidden parameter)
+    int resultOffset = identAllocStack(&comp->idents, &comp->blocks, typeSize(&comp->types, *type));
+    genPushLocalPtr(&comp->gen, resultOffset);
+
+    genCallBuiltin(&comp->gen, TYPE_DYNARRAY, builtin);
+}
+
+
+// fn copy(dest, src: [] type): int
+static void parseBuiltinCopyCall(Compiler *comp, Type **type, Const *constant)
+{
+    if (constant)
+        comp->error.handler(comp->error.context, "Function is not allowed in constant expressions");
+
+    // Destination dynamic array
+    parseExpr(comp, type, NULL);
+    if ((*type)->kind != TYPE_DYNARRAY)
+        comp->error.handler(comp->error.context, "Incompatible type in copy()");
+
+    lexEat(&comp->lex, TOK_COMMA);
+
+    // Source dynamic array
+    Type *srcType;
+    parseExpr(comp, &srcType, NULL);
+    doImplicitTypeConv(comp, *type, &srcType, NULL, false);
+    typeAssertCompatible(&comp->types, *type, srcType, false);
+
+    genPushGlobalPtr(&comp->gen, *type);
+    genCallBuiltin(&comp->gen, TYPE_DYNARRAY, BUILTIN_COPY);
+
+    *type = comp->intType;
+}
+
+
+// fn fill(array: [] type, item: ^type)
+static void parseBuiltinFillCall(Compiler *comp, Type **type, Const *constant)
+{
+    if (constant)
+        comp->error.handler(comp->error.context, "Function is not allowed in constant expressions");
+
+    // Dynamic array
+    parseExpr(comp, type, NULL);
+    if ((*type)->kind != TYPE_DYNARRAY)
+        comp->error.handler(comp->error.context, "Incompatible type in fill()");
+
+    lexEat(&comp->lex, TOK_COMMA);
+
+    // Item (must always be a pointer, even for value types)
+    Type *itemType;
+    parseExpr(comp, &itemType, NULL);
+    doImplicitTypeConv(comp, (*type)->base, &itemType, NULL, false);
+    typeAssertCompatible(&comp->types, (*type)->base, itemType, false);
+
+    if (!typeStructured(itemType))
+    {
+        // Assignment to an anonymous stack area does not require updating reference counts
+        int itemOffset = identAllocStack(&comp->idents, &comp->blocks, typeSize(&comp->types, itemType));
+        genPushLocalPtr(&comp->gen, itemOffset);
+        genSwapAssign(&comp->gen, itemType->kind, 0);
+
+        genPushLocalPtr(&comp->gen, itemOffset);
+    }
+
+    genPushGlobalPtr(&comp->gen, *type);
+    genCallBuiltin(&comp->gen, TYPE_DYNARRAY, BUILTIN_FILL);
+
+    *type = comp->voidType;
+}
+
+
+// fn resize(array: [] type, len: int): [] type
+// fn reserve(array: [] type, capacity: int): [] type
+static void parseBuiltinResizeCall(Compiler *comp, Type **type, Const *constant, BuiltinFunc builtin)
+{
+    if (constant)
+        comp->error.handler(comp->error.context, "Function is not allowed in constant expressions");
+
+    // Dynamic array
+    parseExpr(comp, type, NULL);
+    if ((*type)->kind != TYPE_DYNARRAY)
+        comp->error.handler(comp->error.context, "Incompatible type in %s()", vmBuiltinSpelling(builtin));
+
+    lexEat(&comp->lex, TOK_COMMA);
+
+    // New length or capacity
+    Type *lenType;
+    parseExpr(comp, &lenType, NULL);
+    doImplicitTypeConv(comp, comp->intType, &lenType, NULL, false);
+    typeAssertCompatible(&comp->types, comp->intType, lenType, false);
+
+    genPushGlobalPtr(&comp->gen, *type);
+
+    // Pointer to result (hidden parameter)
+    int resultOffset = identAllocStack(&comp->idents, &comp->blocks, typeSize(&comp->types, *type));
+    genPushLocalPtr(&comp->gen, resultOffset);
+
+    genCallBuiltin(&comp->gen, TYPE_DYNARRAY, builtin);
+}
+
+
+// fn sort(array: [] type | [...] type [, less: fn (a, b: ^type): bool])
+// fn bsearch(array: [] type | [...] type, item: type [, less: fn (a, b: ^type): bool]): int
+static void parseBuiltinSortCall(Compiler *comp, Type **type, Const *constant, BuiltinFunc builtin)
+{
+    if (constant)
+        comp->error.handler(comp->error.context, "Function is not allowed in constant expressions");
+
+    // Dynamic array or static array (sorted in place, given its length and item size)
+    parseExpr(comp, type, NULL);
+    if ((*type)->kind == TYPE_ARRAY)
+    {
+        genPushIntConst(&comp->gen, (*type)->numItems);
+        genPushIntConst(&comp->gen, typeSize(&comp->types, (*type)->base));
+    }
+    else if ((*type)->kind != TYPE_DYNARRAY)
+        comp->error.handler(comp->error.context, "Incompatible type in %s()", vmBuiltinSpelling(builtin));
+
+    TypeKind arrayTypeKind = (*type)->kind;
+
+    Type *itemPtrType = typeAddPtrTo(&comp->types, &comp->blocks, (*type)->base);
+
+    // Item to search for (must always be a pointer, even for value types)
+    if (builtin == BUILTIN_BSEARCH)
+    {
+        lexEat(&comp->lex, TOK_COMMA);
+
+        Type *itemType;
+        parseExpr(comp, &itemType, NULL);
+        doImplicitTypeConv(comp, (*type)->base, &itemType, NULL, false);
+        typeAssertCompatible(&comp->types, (*type)->base, itemType, false);
+
+        if (!typeStructured(itemType))
+        {
+            // Assignment to an anonymous stack area does not require updating reference counts
+            int itemOffset = identAllocStack(&comp->idents, &comp->blocks, typeSize(&comp->types, itemType));
+            genPushLocalPtr(&comp->gen, itemOffset);
+            genSwapAssign(&comp->gen, itemType->kind, 0);
+
+            genPushLocalPtr(&comp->gen, itemOffset);
+        }
+    }
+
+    // Comparison function, if any
+    if (comp->lex.tok.kind == TOK_COMMA)
+    {
+        lexNext(&comp->lex);
+
+        Type *lessType;
+        parseExpr(comp, &lessType, NULL);
+
+        if (lessType->kind != TYPE_FN                                             ||
+            lessType->sig.method                                                  ||
+            lessType->sig.numParams != 2                                          ||
+            !typeEquivalent(lessType->sig.param[0]->type, itemPtrType)            ||
+            !typeEquivalent(lessType->sig.param[1]->type, itemPtrType)            ||
+            lessType->sig.numResults != 1                                         ||
+            lessType->sig.resultType[0]->kind != TYPE_BOOL)
+            comp->error.handler(comp->error.context, "Incompatible function type in %s()", vmBuiltinSpelling(builtin));
+    }
+    else
+    {
+        if (!typeOrdinal((*type)->base) && !typeReal((*type)->base) && (*type)->base->kind != TYPE_STR)
+            comp->error.handler(comp->error.context, "Incompatible type in %s()", vmBuiltinSpelling(builtin));
+
+        genPushIntConst(&comp->gen, 0);
+    }
+
+    genPushGlobalPtr(&comp->gen, itemPtrType);
+    genCallBuiltin(&comp->gen, arrayTypeKind, builtin);
+
+    if (builtin == BUILTIN_BSEARCH)
+        *type = comp->intType;
+    else
+        *type = comp->voidType;
+}
+
+
 static void parseBuiltinLenCall(Compiler *comp, Type **type, Const *constant)
 {
     parseExpr(comp, type, constant);
@@ -673,7 +1002,7 @@ static void parseBuiltinFiberCall(Compiler *comp, Type **type, Const *constant,
 
         *type = comp->ptrFiberType;
     }
-    else    // BUILTIN_FIBERCALL, BUILTIN_FIBERALIVE
+    else    // BUILTIN_FIBERCALL, BUILTIN_FIBERALIVE, BUILTIN_FIBERSTART, BUILTIN_FIBERWAIT
     {
         parseExpr(comp, type, constant);
         doImplicitTypeConv(comp, comp->ptrFiberType, type, constant, false);
@@ -689,6 +1018,137 @@ static void parseBuiltinFiberCall(Compiler *comp, Type **type, Const *constant,
 }
 
 
+// fn parfor(count: int, body: fn (index: int [, data: ^type]) [, data: ^type])
+static void parseBuiltinParforCall(Compiler *comp, Type **type, Const *constant)
+{
+    if (constant)
+        comp->error.handler(comp->error.context, "Function is not allowed in constant expressions");
+
+    // Number of iterations
+    Type *countType;
+    parseExpr(comp, &countType, NULL);
+    doImplicitTypeConv(comp, comp->intType, &countType, NULL, false);
+    typeAssertCompatible(&comp->types, comp->intType, countType, false);
+
+    lexEat(&comp->lex, TOK_COMMA);
+
+    // Loop body
+    Type *bodyType;
+    parseExpr(comp, &bodyType, NULL);
+
+    if (bodyType->kind != TYPE_FN                                                     ||
+        bodyType->sig.method                                                          ||
+        bodyType->sig.numParams < 1 || bodyType->sig.numParams > 2                    ||
+        bodyType->sig.numDefaultParams != 0                                           ||
+        bodyType->sig.param[0]->type->kind != TYPE_INT                                ||
+        (bodyType->sig.numParams == 2 && bodyType->sig.param[1]->type->kind != TYPE_PTR) ||
+        bodyType->sig.numResults != 1                                                 ||
+        bodyType->sig.resultType[0]->kind != TYPE_VOID)
+        comp->error.handler(comp->error.context, "Incompatible function type in parfor()");
+
+    // Data shared by all iterations, if any
+    if (bodyType->sig.numParams == 2)
+    {
+        Type *dataType = bodyType->sig.param[1]->type;
+
+        lexEat(&comp->lex, TOK_COMMA);
+
+        Type *srcType;
+        parseExpr(comp, &srcType, NULL);
+        doImplicitTypeConv(comp, dataType, &srcType, NULL, false);
+        typeAssertCompatible(&comp->types, dataType, srcType, false);
+
+        genPushGlobalPtr(&comp->gen, dataType);
+    }
+    else
+    {
+        genPushIntConst(&comp->gen, 0);
+        genPushIntConst(&comp->gen, 0);
+    }
+
+    genCallBuiltin(&comp->gen, TYPE_VOID, BUILTIN_PARFOR);
+    *type = comp->voidType;
+}
+
+
+// fn send(c: chan type, item: type)
+// fn recv(c: chan type): type
+// fn select(c1, c2, ...: chan type): int
+// fn close(c: chan type)
+static void parseBuiltinChanCall(Compiler *comp, Type **type, Const *constant, BuiltinFunc builtin)
+{
+    if (constant)
+        comp->error.handler(comp->error.context, "Function is not allowed in constant expressions");
+
+    if (builtin == BUILTIN_SELECT)
+    {
+        // Any number of channels of any item types
+        int numChans = 0;
+        while (1)
+        {
+            parseExpr(comp, type, NULL);
+            if (!typeChannel(*type))
+                comp->error.handler(comp->error.context, "Incompatible type in select()");
+
+            if (++numChans > VM_MAX_SELECT_CHANS)
+                comp->error.handler(comp->error.context, "Too many channels in select()");
+
+            if (comp->lex.tok.kind != TOK_COMMA)
+                break;
+            lexNext(&comp->lex);
+        }
+
+        genPushIntConst(&comp->gen, numChans);
+        genCallBuiltin(&comp->gen, TYPE_INT, BUILTIN_SELECT);
+
+        *type = comp->intType;
+        return;
+    }
+
+    // Channel
+    parseExpr(comp, type, NULL);
+    if (!typeChannel(*type))
+        comp->error.handler(comp->error.context, "Incompatible type in %s()", (builtin == BUILTIN_SEND) ? "send" : (builtin == BUILTIN_RECV) ? "recv" : "close");
+
+    Type *itemType = (*type)->base->base;
+
+    if (builtin == BUILTIN_SEND)
+    {
+        lexEat(&comp->lex, TOK_COMMA);
+
+        // Item (must always be a pointer, even for value types)
+        Type *srcType;
+        parseExpr(comp, &srcType, NULL);
+        doImplicitTypeConv(comp, itemType, &srcType, NULL, false);
+        typeAssertCompatible(&comp->types, itemType, srcType, false);
+
+        if (!typeStructured(itemType))
+        {
+            // Assignment to an anonymous stack area does not require updating reference counts
+            int itemOffset = identAllocStack(&comp->idents, &comp->blocks, typeSize(&comp->types, itemType));
+            genPushLocalPtr(&comp->gen, itemOffset);
+            genSwapAssign(&comp->gen, itemType->kind, 0);
+
+            genPushLocalPtr(&comp->gen, itemOffset);
+        }
+
+        *type = comp->voidType;
+    }
+    else if (builtin == BUILTIN_RECV)
+    {
+        // Pointer to result (hidden parameter)
+        int resultOffset = identAllocStack(&comp->idents, &comp->blocks, typeSize(&comp->types, itemType));
+        genPushLocalPtr(&comp->gen, resultOffset);
+
+        *type = itemType;
+    }
+    else    // BUILTIN_CLOSE
+        *type = comp->voidType;
+
+    genCallBuiltin(&comp->gen, itemType->kind, builtin);
+}
+
+
 // fn repr(val: type, type): str
 static void parseBuiltinReprCall(Compiler *comp, Type **type, Const *constant)
 {
@@ -748,6 +1208,14 @@ static void parseBuiltinCall(Compiler *comp, Type **type, Const *constant, Built
         case BUILTIN_MAKE:          parseBuiltinMakeCall(comp, type, constant);             break;
         case BUILTIN_APPEND:        parseBuiltinAppendCall(comp, type, constant);           break;
         case BUILTIN_DELETE:        parseBuiltinDeleteCall(comp, type, constant);           break;
+        case BUILTIN_INSERT:
+        case BUILTIN_APPENDALL:     parseBuiltinInsertCall(comp, type, constant, builtin);  break;
+        case BUILTIN_COPY:          parseBuiltinCopyCall(comp, type, constant);             break;
+        case BUILTIN_FILL:          parseBuiltinFillCall(comp, type, constant);             break;
+        case BUILTIN_RESIZE:
+        case BUILTIN_RESERVE:       parseBuiltinResizeCall(comp, type, constant, builtin);  break;
+        case BUILTIN_SORT:
+        case BUILTIN_BSEARCH:       parseBuiltinSortCall(comp, type, constant, builtin);    break;
         case BUILTIN_LEN:           parseBuiltinLenCall(comp, type, constant);              break;
         case BUILTIN_SIZEOF:        parseBuiltinSizeofCall(comp, type, constant);           break;
         case BUILTIN_SIZEOFSELF:    parseBuiltinSizeofselfCall(comp, type, constant);       break;
@@ -755,7 +1223,16 @@ static void parseBuiltinCall(Compiler *comp, Type **type, Const *constant, Built
         // Fibers
         case BUILTIN_FIBERSPAWN:
         case BUILTIN_FIBERCALL:
-        case BUILTIN_FIBERALIVE:    parseBuiltinFiberCall(comp, type, constant, builtin);   break;
+        case BUILTIN_FIBERALIVE:
+        case BUILTIN_FIBERSTART:
+        case BUILTIN_FIBERWAIT:     parseBuiltinFiberCall(comp, type, constant, builtin);   break;
+        case BUILTIN_PARFOR:        parseBuiltinParforCall(comp, type, constant);           break;
+
+        // Channels
+        case BUILTIN_SEND:
+        case BUILTIN_RECV:
+        case BUILTIN_SELECT:
+        case BUILTIN_CLOSE:         parseBuiltinChanCall(comp, type, constant, builtin);    break;
 
         // Misc
         case BUILTIN_REPR:          parseBuiltinReprCall(comp, type, constant);             break;
@@ -938,6 +1415,12 @@ static void parseArrayOrStructLiteral(Compiler *comp, Type **type, Const *consta
     int bufOffset = 0;
     if (constant)
     {
+        if (typeGarbageCollected(*type))
+        {
+            comp->storageConsts = realloc(comp->storageConsts, (comp->numStorageConsts + 1) * sizeof(StorageConst));
+            comp->storageConsts[comp->numStorageConsts++] = (StorageConst){.offset = comp->storage.len, .type = *type};
+        }
+
         constant->ptrVal = (int64_t)&comp->storage.data[comp->storage.len];
         comp->storage.len += typeSize(&comp->types, *type);
     }
@@ -1084,7 +1567,20 @@ static void parseDerefSelector(Compiler *comp, Type **type, Const *constant, boo
 }
 
 
-// indexSelector = "[" expr "]".
+static void parseSliceSelector(Compiler *comp, Type **type)
+{
+    // End index
+    lexEat(&comp->lex, TOK_COLON);
+    Type *indexType;
+    parseExpr(comp, &indexType, NULL);
+    typeAssertCompatible(&comp->types, comp->intType, indexType, false);
+    lexEat(&comp->lex, TOK_RBRACKET);
+
+    doGetSlice(comp, type);
+}
+
+
+// indexSelector = "[" expr [":" expr] "]".
 static void parseIndexSelector(Compiler *comp, Type **type, Const *constant, bool *isVar, bool *isCall)
 {
     // Implicit dereferencing: a^[i] == a[i]
@@ -1110,6 +1606,15 @@ static void parseIndexSelector(Compiler *comp, Type **type, Const *constant, boo
     Type *indexType;
     parseExpr(comp, &indexType, NULL);
     typeAssertCompatible(&comp->types, comp->intType, indexType, false);
+
+    if (comp->lex.tok.kind == TOK_COLON)
+    {
+        parseSliceSelector(comp, type);
+        *isVar = typeStructured(*type);
+        *isCall = false;
+        return;
+    }
+
     lexEat(&comp->lex, TOK_RBRACKET);
 
     if ((*type)->kind == TYPE_DYNARRAY)
@@ -109,6 +109,7 @@ static bool optimizeDeref(CodeGen *gen, TypeKind typeKind)
     // Optimization: (PUSH | ...) + DEREF -> (PUSH | ...); DEREF
     if (((prev->opcode == OP_PUSH && prev->typeKind == TYPE_PTR) ||
           prev->opcode == OP_PUSH_LOCAL_PTR                      ||
+          prev->opcode == OP_PUSH_GLOBAL_PTR                     ||
           prev->opcode == OP_GET_ARRAY_PTR                       ||
           prev->opcode == OP_GET_DYNARRAY_PTR                    ||
           prev->opcode == OP_GET_FIELD_PTR)                      &&
@@ -193,6 +194,13 @@ void genPushLocalPtr(CodeGen *gen, int offset)
 }
 
 
+void genPushGlobalVarPtr(CodeGen *gen, int offset)
+{
+    const Instruction instr = {.opcode = OP_PUSH_GLOBAL_PTR, .tokKind = TOK_NONE, .typeKind = TYPE_NONE, .operand.intVal = offset};
+    genAddInstr(gen, &instr);
+}
+
+
 void genPushReg(CodeGen *gen, int regIndex)
 {
     const Instruction instr = {.opcode = OP_PUSH_REG, .tokKind = TOK_NONE, .typeKind = TYPE_NONE, .operand.intVal = regIndex};
@@ -375,6 +383,13 @@ void genCallExtern(CodeGen *gen, void *entry)
 }
 
 
+void genCallExternTyped(CodeGen *gen, External *external)
+{
+    const Instruction instr = {.opcode = OP_CALL_EXTERN_TYPED, .tokKind = TOK_NONE, .typeKind = TYPE_NONE, .operand.ptrVal = (int64_t)external};
+    genAddInstr(gen, &instr);
+}
+
+
 void genCallBuiltin(CodeGen *gen, TypeKind typeKind, BuiltinFunc builtin)
 {
     const Instruction instr = {.opcode = OP_CALL_BUILTIN, .tokKind = TOK_NONE, .typeKind = typeKind, .operand.builtinVal = builtin};
@@ -382,6 +397,28 @@ void genCallBuiltin(CodeGen *gen, TypeKind typeKind, BuiltinFunc builtin)
 }
 
 
+void genCallBuiltinChecked(CodeGen *gen, TypeKind typeKind, BuiltinFunc builtin)
+{
+    // I/O call whose format string segment has been checked at compile time
+    const Instruction instr = {.opcode = OP_CALL_BUILTIN, .tokKind = TOK_STRLITERAL, .typeKind = typeKind, .operand.builtinVal = builtin};
+    genAddInstr(gen, &instr);
+}
+
+
+void genResume(CodeGen *gen)
+{
+    const Instruction instr = {.opcode = OP_RESUME, .tokKind = TOK_NONE, .typeKind = TYPE_NONE, .operand.intVal = 0};
+    genAddInstr(gen, &instr);
+}
+
+
+void genYield(CodeGen *gen)
+{
+    const Instruction instr = {.opcode = OP_YIELD, .tokKind = TOK_NONE, .typeKind = TYPE_NONE, .operand.intVal = 0};
+    genAddInstr(gen, &instr);
+}
+
+
 void genReturn(CodeGen *gen, int paramSlots)
 {
     const Instruction instr = {.opcode = OP_RETURN, .tokKind = TOK_NONE, .typeKind = TYPE_NONE, .operand.intVal = paramSlots};
@@ -389,9 +426,9 @@ void genReturn(CodeGen *gen, int paramSlots)
 }
 
 
-void genEnterFrame(CodeGen *gen, int localVarSize)
+void genEnterFrame(CodeGen *gen, int localVarSize, int frameSlots)
 {
-    const Instruction instr = {.opcode = OP_ENTER_FRAME, .tokKind = TOK_NONE, .typeKind = TYPE_NONE, .operand.intVal = localVarSize};
+    const Instruction instr = {.opcode = OP_ENTER_FRAME, .tokKind = TOK_NONE, .typeKind = TYPE_NONE, .operand.intVal = localVarSize | ((int64_t)frameSlots << 32)};
     genAddInstr(gen, &instr);
 }
 
@@ -598,7 +635,14 @@ void genLeaveFrameFixup(CodeGen *gen, int localVarSize)
     // Fixup enter stub
     int next = gen->ip;
     gen->ip = genRestorePos(gen);
-    genEnterFrame(gen, localVarSize);
+
+    // The stack needed by the function includes the structured parameters passed by value to the functions it calls
+    int frameSlots = align(localVarSize, sizeof(Slot)) / sizeof(Slot);
+    for (int ip = gen->ip + 1; ip < next; ip++)
+        if (gen->code[ip].opcode == OP_PUSH_STRUCT)
+            frameSlots += align(gen->code[ip].operand.intVal, sizeof(Slot)) / sizeof(Slot);
+
+    genEnterFrame(gen, localVarSize, frameSlots);
     gen->ip = next;
 
     genLeaveFrame(gen);
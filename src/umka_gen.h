@@ -39,6 +39,7 @@ void genPushUIntConst(CodeGen *gen, uint64_t uintVal);
 void genPushRealConst(CodeGen *gen, double realVal);
 void genPushGlobalPtr(CodeGen *gen, void *ptrVal);
 void genPushLocalPtr (CodeGen *gen, int offset);
+void genPushGlobalVarPtr(CodeGen *gen, int offset);
 void genPushReg      (CodeGen *gen, int regIndex);
 void genPushStruct   (CodeGen *gen, int size);
 
@@ -69,10 +70,14 @@ void genGotoIf(CodeGen *gen, int dest);
 
 void genCall       (CodeGen *gen, int paramSlots);
 void genCallExtern (CodeGen *gen, void *entry);
+void genCallExternTyped(CodeGen *gen, External *external);
 void genCallBuiltin(CodeGen *gen, TypeKind typeKind, BuiltinFunc builtin);
+void genCallBuiltinChecked(CodeGen *gen, TypeKind typeKind, BuiltinFunc builtin);
+void genResume     (CodeGen *gen);
+void genYield      (CodeGen *gen);
 void genReturn     (CodeGen *gen, int numParams);
 
-void genEnterFrame(CodeGen *gen, int localVarSize);
+void genEnterFrame(CodeGen *gen, int localVarSize, int frameSlots);
 void genLeaveFrame(CodeGen *gen);
 
 void genHalt(CodeGen *gen);
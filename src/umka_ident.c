@@ -9,6 +9,7 @@ void identInit(Idents *idents, Error *error)
 {
     idents->first = idents->last = NULL;
     idents->tempVarNameSuffix = 0;
+    idents->globalsSize = 0;
     idents->error = error;
 }
 
@@ -57,6 +58,8 @@ Ident *identFind(Idents *idents, Modules *modules, Blocks *blocks, int module, c
         if (i > 0 && i < curFnBlockPos)
             continue;
 
+        Ident *universeIdent = NULL;
+
         for (Ident *ident = idents->first; ident; ident = ident->next)
             if (ident->hash == nameHash && strcmp(ident->name, name) == 0 && ident->block == blocks->item[i].block &&
 
@@ -68,14 +71,23 @@ Ident *identFind(Idents *idents, Modules *modules, Blocks *blocks, int module, c
                     bool method = ident->type->kind == TYPE_FN && ident->type->sig.method;
 
                     // We don't need a method and what we found is not a method
+                    // Universe identifiers, e.g., built-in functions, can be shadowed by module identifiers
                     if (!rcvType && !method)
-                        return ident;
+                    {
+                        if (ident->module != 0 || module == 0)
+                            return ident;
+                        if (!universeIdent)
+                            universeIdent = ident;
+                    }
 
                     // We need a method and what we found is a method
                     if (rcvType && method && (typeCompatible(ident->type->sig.param[0]->type, rcvType, false) ||
                                               typeCompatible(rcvType, ident->type->sig.param[0]->type, false)))
                         return ident;
             }
+
+        if (universeIdent)
+            return universeIdent;
     }
 
     return NULL;
@@ -99,7 +111,7 @@ static Ident *identAdd(Idents *idents, Modules *modules, Blocks *blocks, IdentKi
 
     Ident *ident = identFind(idents, modules, blocks, blocks->module, name, rcvType);
 
-    if (ident && ident->block == blocks->item[blocks->top].block)
+    if (ident && ident->block == blocks->item[blocks->top].block && !(ident->module == 0 && blocks->module != 0))
     {
         // Forward type declaration resolution
         if (ident->kind == IDENT_TYPE && ident->type->kind == TYPE_FORWARD &&
@@ -150,6 +162,7 @@ static Ident *identAdd(Idents *idents, Modules *modules, Blocks *blocks, IdentKi
     ident->exported         = exported;
     ident->inHeap           = false;
     ident->prototypeOffset  = -1;
+    ident->globalOffset     = -1;
     ident->next             = NULL;
 
     // Add to list
@@ -225,9 +238,12 @@ Ident *identAllocVar(Idents *idents, Types *types, Modules *modules, Blocks *blo
     Ident *ident;
     if (blocks->top == 0)       // Global
     {
+        // Initial values are stored separately at compile time, run-time values are stored in the global variable storage of each VM
         void *ptr = malloc(typeSize(types, type));
         ident = identAddGlobalVar(idents, modules, blocks, name, type, exported, ptr);
         ident->inHeap = true;
+        ident->globalOffset = idents->globalsSize;
+        idents->globalsSize += align(typeSize(types, type), sizeof(Slot));
     }
     else                        // Local
     {
@@ -248,6 +264,15 @@ Ident *identAllocParam(Idents *idents, Types *types, Modules *modules, Blocks *b
 }
 
 
+void identCopyGlobals(Idents *idents, void *globals)
+{
+    // Gather the initial values of all global variables into a single block of globalsSize bytes
+    for (Ident *ident = idents->first; ident; ident = ident->next)
+        if (ident->kind == IDENT_VAR && ident->inHeap)
+            memcpy(globals + ident->globalOffset, ident->ptr, typeSizeNoCheck(ident->type));
+}
+
+
 char *identTempVarName(Idents *idents, char *buf)
 {
     sprintf(buf, "__temp%d", idents->tempVarNameSuffix++);
@@ -24,6 +24,7 @@ typedef struct tagIdent
     int module, block;                  // Global identifiers are in block 0
     bool exported, inHeap;
     int prototypeOffset;                // For function prototypes
+    int globalOffset;                   // For global variables (offset in the global variable storage of each VM)
     union
     {
         BuiltinFunc builtin;            // For built-in functions
@@ -39,6 +40,7 @@ typedef struct
 {
     Ident *first, *last;
     int tempVarNameSuffix;
+    int globalsSize;
     Error *error;
 } Idents;
 
@@ -58,6 +60,7 @@ Ident *identAddBuiltinFunc(Idents *idents, Modules *modules, Blocks *blocks, cha
 int    identAllocStack    (Idents *idents, Blocks *blocks, int size);
 Ident *identAllocVar      (Idents *idents, Types *types, Modules *modules, Blocks *blocks, char *name, Type *type, bool exported);
 Ident *identAllocParam    (Idents *idents, Types *types, Modules *modules, Blocks *blocks, Signature *sig, int index);
+void   identCopyGlobals   (Idents *idents, void *globals);
 
 char *identTempVarName(Idents *idents, char *buf);
 
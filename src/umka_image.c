@@ -0,0 +1,1339 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdarg.h>
+
+#include "umka_compiler.h"
+
+
+// A program image holds everything the VM needs to run a compiled program: the code, the types, the storage of constants,
+// the initial values of global variables and the global identifiers of the modules. Instruction operands and data that point
+// to the storage or to the types are saved as storage offsets and type indices, which are found from the known types of the
+// operands, constants and global variables. External functions are saved by name and resolved when the image is loaded.
+// The image is not portable between platforms with different data layouts
+
+enum
+{
+    IMAGE_VERSION = 4
+};
+
+
+static const char imageMagic[8] = "UMKAIMG";
+
+
+typedef enum
+{
+    RELOC_NONE,
+    RELOC_STORAGE,              // Offset in the storage
+    RELOC_TYPE,                 // Index in the type table
+    RELOC_EXTERN                // Index in the external function table
+} RelocKind;
+
+
+typedef struct
+{
+    int64_t val;
+    RelocKind reloc;
+} ImageSlot;
+
+
+typedef struct
+{
+    char magic[8];
+    int version;
+    int slotSize, instrSize;
+    int numModules, numTypes, numIdents, numFields, numExterns;
+    int codeLen, storageLen, numStorageRelocs, numStorageConsts, globalsSize, numGlobalsRelocs;
+} ImageHeader;
+
+
+typedef struct
+{
+    TypeKind kind;
+    int block;
+    int base;                   // Type index, -1 if none
+    int numItems;
+    bool weak;
+    int typeIdent;              // Identifier index, -1 if none
+    int numParams, numDefaultParams, numResults;
+    bool method;
+    int offsetFromSelf;
+    int resultType[MAX_RESULTS];
+} ImageType;
+
+
+typedef struct
+{
+    IdentName name;
+    unsigned int hash;
+    int type;
+    int offset;                 // For fields
+    ImageSlot defaultVal;       // For parameters
+} ImageField;
+
+
+typedef struct
+{
+    IdentKind kind;
+    IdentName name;
+    unsigned int hash;
+    int type;
+    int module, block;
+    bool exported;
+    int prototypeOffset, globalOffset;
+    ImageSlot val;              // For functions and constants
+} ImageIdent;
+
+
+typedef struct
+{
+    char name[DEFAULT_STR_LEN + 1];
+    bool typed;
+    unsigned int signatureHash;
+    int numParams;
+    int paramOffset[MAX_PARAMS];
+    bool paramStructured[MAX_PARAMS];
+    int resultOffset;
+    bool frame;
+} ImageExtern;
+
+
+typedef struct
+{
+    Opcode opcode, inlineOpcode;
+    TokenKind tokKind;
+    TypeKind typeKind;
+    ImageSlot operand;
+    int fileName;               // Storage offset, -1 if none
+    int fnName;                 // Storage offset, -1 if none
+    int line;
+} ImageInstr;
+
+
+typedef struct
+{
+    int offset;
+    int type;
+} ImageStorageConst;
+
+
+typedef struct
+{
+    void *ptr;
+    int index;
+} PtrIndex;
+
+
+typedef struct
+{
+    Compiler *comp;
+    char *buf;
+    int len, capacity;
+    PtrIndex *types, *idents;
+    int numTypes, numIdents;
+    External **externs;
+    int numExterns;
+    ImageInstr *code;
+    int *relocs;
+    int numRelocs;
+} ImageWriter;
+
+
+typedef struct
+{
+    Compiler *comp;
+    const char *image;
+    int len, pos;
+    char *storage;
+    int storageLen;
+    char *globals;
+    ImageType *imageTypes;
+    Type **types;
+    Ident **idents;
+    External **externs;
+    int numTypes, numBuiltinTypes, numIdents, numExterns;
+} ImageReader;
+
+
+static int ptrIndexCompare(const void *a, const void *b)
+{
+    const char *ptrA = ((const PtrIndex *)a)->ptr, *ptrB = ((const PtrIndex *)b)->ptr;
+    return (ptrA > ptrB) - (ptrA < ptrB);
+}
+
+
+static int ptrIndexFind(PtrIndex *table, int len, void *ptr)
+{
+    PtrIndex key = {.ptr = ptr};
+    PtrIndex *item = bsearch(&key, table, len, sizeof(PtrIndex), ptrIndexCompare);
+    return item ? item->index : -1;
+}
+
+
+// Writer
+
+static void writerFree(ImageWriter *writer)
+{
+    free(writer->buf);
+    free(writer->types);
+    free(writer->idents);
+    free(writer->externs);
+    free(writer->code);
+    free(writer->relocs);
+    memset(writer, 0, sizeof(ImageWriter));
+}
+
+
+static void writerError(ImageWriter *writer, const char *format, ...)
+{
+    char msg[DEFAULT_STR_LEN];
+
+    va_list args;
+    va_start(args, format);
+    vsnprintf(msg, DEFAULT_STR_LEN, format, args);
+    va_end(args);
+
+    Error *error = &writer->comp->error;
+    writerFree(writer);
+    error->handler(error->context, "%s", msg);
+}
+
+
+static void writerPut(ImageWriter *writer, const void *data, int size)
+{
+    // Empty data may come with a null pointer, which memcpy() does not accept
+    if (size == 0)
+        return;
+
+    if (writer->len + size > writer->capacity)
+    {
+        while (writer->len + size > writer->capacity)
+            writer->capacity = 2 * writer->capacity + 1024;
+        writer->buf = realloc(writer->buf, writer->capacity);
+    }
+
+    memcpy(writer->buf + writer->len, data, size);
+    writer->len += size;
+}
+
+
+static bool writerInStorage(ImageWriter *writer, int64_t ptr)
+{
+    Storage *storage = &writer->comp->storage;
+    return ptr >= (int64_t)storage->data && ptr < (int64_t)(storage->data + storage->len);
+}
+
+
+static ImageSlot writerEncodePtr(ImageWriter *writer, int64_t ptr, bool type)
+{
+    if (writerInStorage(writer, ptr))
+        return (ImageSlot){.val = ptr - (int64_t)writer->comp->storage.data, .reloc = RELOC_STORAGE};
+
+    if (type)
+    {
+        int index = ptrIndexFind(writer->types, writer->numTypes, (void *)ptr);
+        if (index >= 0)
+            return (ImageSlot){.val = index, .reloc = RELOC_TYPE};
+    }
+
+    return (ImageSlot){.val = ptr, .reloc = RELOC_NONE};
+}
+
+
+static ImageSlot writerEncodeConst(ImageWriter *writer, Type *type, Const *constant)
+{
+    // String and composite constants point to the storage, other constants are values
+    if (type->kind != TYPE_STR && !typeStructured(type))
+        return (ImageSlot){.val = constant->intVal, .reloc = RELOC_NONE};
+
+    ImageSlot slot = writerEncodePtr(writer, constant->ptrVal, false);
+    if (slot.reloc == RELOC_NONE && slot.val != 0)
+        writerError(writer, "Constant cannot be saved");
+    return slot;
+}
+
+
+static int writerTypeIndex(ImageWriter *writer, Type *type)
+{
+    if (!type)
+        return -1;
+
+    int index = ptrIndexFind(writer->types, writer->numTypes, type);
+    if (index < 0)
+        writerError(writer, "Unknown type cannot be saved");
+    return index;
+}
+
+
+static int writerExternIndex(ImageWriter *writer, External *external)
+{
+    for (int i = 0; i < writer->numExterns; i++)
+        if (writer->externs[i] == external)
+            return i;
+
+    writer->externs = realloc(writer->externs, (writer->numExterns + 1) * sizeof(External *));
+    writer->externs[writer->numExterns] = external;
+    return writer->numExterns++;
+}
+
+
+static void writerCollect(ImageWriter *writer)
+{
+    Compiler *comp = writer->comp;
+
+    // Types are indexed in the order of the type list, which starts with the built-in types
+    for (Type *type = comp->types.first; type; type = type->next)
+        writer->numTypes++;
+
+    writer->types = malloc((writer->numTypes + 1) * sizeof(PtrIndex));
+
+    int index = 0;
+    for (Type *type = comp->types.first; type; type = type->next, index++)
+        writer->types[index] = (PtrIndex){.ptr = type, .index = index};
+
+    qsort(writer->types, writer->numTypes, sizeof(PtrIndex), ptrIndexCompare);
+
+    // Universe identifiers are declared anew when the image is loaded, so only the module identifiers are saved
+    for (Ident *ident = comp->idents.first; ident; ident = ident->next)
+        if (ident->module != 0)
+            writer->numIdents++;
+
+    writer->idents = malloc((writer->numIdents + 1) * sizeof(PtrIndex));
+
+    index = 0;
+    for (Ident *ident = comp->idents.first; ident; ident = ident->next)
+        if (ident->module != 0)
+        {
+            writer->idents[index] = (PtrIndex){.ptr = ident, .index = index};
+            index++;
+        }
+
+    qsort(writer->idents, writer->numIdents, sizeof(PtrIndex), ptrIndexCompare);
+}
+
+
+static void writerEncodeCode(ImageWriter *writer)
+{
+    Compiler *comp = writer->comp;
+    writer->code = malloc((comp->gen.ip + 1) * sizeof(ImageInstr));
+
+    for (int i = 0; i < comp->gen.ip; i++)
+    {
+        Instruction *instr = &comp->gen.code[i];
+        ImageInstr *imageInstr = &writer->code[i];
+
+        imageInstr->opcode       = instr->opcode;
+        imageInstr->inlineOpcode = instr->inlineOpcode;
+        imageInstr->tokKind      = instr->tokKind;
+        imageInstr->typeKind     = instr->typeKind;
+        imageInstr->operand      = (ImageSlot){.val = instr->operand.intVal, .reloc = RELOC_NONE};
+
+        switch (instr->opcode)
+        {
+            case OP_PUSH:
+            {
+                // Pointers pushed by genPushGlobalPtr() refer to types or to the storage. A pointer push merged with
+                // the subsequent dereference takes the type of the dereferenced value
+                if (instr->typeKind == TYPE_PTR || instr->inlineOpcode == OP_DEREF)
+                {
+                    imageInstr->operand = writerEncodePtr(writer, instr->operand.ptrVal, true);
+                    if (imageInstr->operand.reloc == RELOC_NONE && imageInstr->operand.val != 0)
+                        writerError(writer, "Pointer at instruction %d cannot be saved", i);
+                }
+                break;
+            }
+
+            case OP_CHANGE_REF_CNT:
+            case OP_CHANGE_REF_CNT_ASSIGN:
+            case OP_ASSERT_TYPE:
+            {
+                imageInstr->operand = (ImageSlot){.val = writerTypeIndex(writer, (Type *)instr->operand.ptrVal), .reloc = RELOC_TYPE};
+                break;
+            }
+
+            case OP_CALL_EXTERN:
+            {
+                External *external = comp->externals.first;
+                while (external && external->entry != (void *)instr->operand.ptrVal)
+                    external = external->next;
+
+                if (!external)
+                    writerError(writer, "External function at instruction %d cannot be saved", i);
+
+                imageInstr->operand = (ImageSlot){.val = writerExternIndex(writer, external), .reloc = RELOC_EXTERN};
+                break;
+            }
+
+            case OP_CALL_EXTERN_TYPED:
+            {
+                imageInstr->operand = (ImageSlot){.val = writerExternIndex(writer, (External *)instr->operand.ptrVal), .reloc = RELOC_EXTERN};
+                break;
+            }
+
+            default: break;
+        }
+
+        imageInstr->fileName = writerInStorage(writer, (int64_t)instr->debug.fileName) ? instr->debug.fileName - comp->storage.data : -1;
+        imageInstr->fnName = writerInStorage(writer, (int64_t)instr->debug.fnName) ? instr->debug.fnName - comp->storage.data : -1;
+        imageInstr->line = instr->debug.line;
+    }
+}
+
+
+static void writerAddRelocs(ImageWriter *writer, const char *block, int offset, Type *type)
+{
+    // Composite constants in the storage and initialized global variables may hold pointers to strings in the storage
+    if (!typeGarbageCollected(type))
+        return;
+
+    switch (type->kind)
+    {
+        case TYPE_PTR:
+        case TYPE_STR:
+        {
+            int64_t ptr;
+            memcpy(&ptr, block + offset, sizeof(ptr));
+
+            if (writerInStorage(writer, ptr))
+            {
+                writer->relocs = realloc(writer->relocs, (writer->numRelocs + 1) * sizeof(int));
+                writer->relocs[writer->numRelocs++] = offset;
+            }
+            else if (ptr != 0)
+                writerError(writer, "Pointer at offset %d cannot be saved", offset);
+            break;
+        }
+
+        case TYPE_ARRAY:
+        {
+            const int itemSize = typeSizeNoCheck(type->base);
+            for (int i = 0; i < type->numItems; i++)
+                writerAddRelocs(writer, block, offset + i * itemSize, type->base);
+            break;
+        }
+
+        case TYPE_STRUCT:
+        {
+            for (int i = 0; i < type->numItems; i++)
+                writerAddRelocs(writer, block, offset + type->field[i]->offset, type->field[i]->type);
+            break;
+        }
+
+        default: break;
+    }
+}
+
+
+static void writerPutBlock(ImageWriter *writer, const char *block, int size)
+{
+    // The relocations have been found by writerAddRelocs()
+    char *copy = malloc(size + 1);
+    memcpy(copy, block, size);
+
+    for (int i = 0; i < writer->numRelocs; i++)
+    {
+        int64_t ptr;
+        memcpy(&ptr, copy + writer->relocs[i], sizeof(ptr));
+
+        int64_t offset = ptr - (int64_t)writer->comp->storage.data;
+        memcpy(copy + writer->relocs[i], &offset, sizeof(offset));
+    }
+
+    writerPut(writer, copy, size);
+    writerPut(writer, writer->relocs, writer->numRelocs * sizeof(int));
+    free(copy);
+}
+
+
+static void writerPutStorage(ImageWriter *writer)
+{
+    Compiler *comp = writer->comp;
+
+    writer->numRelocs = 0;
+    for (int i = 0; i < comp->numStorageConsts; i++)
+        writerAddRelocs(writer, comp->storage.data, comp->storageConsts[i].offset, comp->storageConsts[i].type);
+
+    writerPutBlock(writer, comp->storage.data, comp->storage.len);
+
+    // The composite constants are saved, so that the program can be saved again after loading
+    for (int i = 0; i < comp->numStorageConsts; i++)
+    {
+        ImageStorageConst imageConst = {.offset = comp->storageConsts[i].offset, .type = writerTypeIndex(writer, comp->storageConsts[i].type)};
+        writerPut(writer, &imageConst, sizeof(imageConst));
+    }
+}
+
+
+static void writerPutGlobals(ImageWriter *writer)
+{
+    Compiler *comp = writer->comp;
+
+    writer->numRelocs = 0;
+    for (Ident *ident = comp->idents.first; ident; ident = ident->next)
+        if (ident->kind == IDENT_VAR && ident->block == 0 && ident->globalOffset >= 0 &&
+            ident->globalOffset + typeSizeNoCheck(ident->type) <= comp->idents.globalsSize)
+            writerAddRelocs(writer, comp->globals, ident->globalOffset, ident->type);
+
+    writerPutBlock(writer, comp->globals, comp->idents.globalsSize);
+}
+
+
+static void writerPutTypes(ImageWriter *writer)
+{
+    Compiler *comp = writer->comp;
+
+    for (Type *type = comp->types.first; type; type = type->next)
+    {
+        ImageType imageType = {0};
+
+        imageType.kind      = type->kind;
+        imageType.block     = type->block;
+        imageType.base      = writerTypeIndex(writer, type->base);
+        imageType.numItems  = type->numItems;
+        imageType.weak      = type->weak;
+
+        // Local type identifiers are no longer in the list, so their types are spelled without names
+        imageType.typeIdent = type->typeIdent ? ptrIndexFind(writer->idents, writer->numIdents, type->typeIdent) : -1;
+
+        if (type->kind == TYPE_FN)
+        {
+            imageType.numParams         = type->sig.numParams;
+            imageType.numDefaultParams  = type->sig.numDefaultParams;
+            imageType.numResults        = type->sig.numResults;
+            imageType.method            = type->sig.method;
+            imageType.offsetFromSelf    = type->sig.offsetFromSelf;
+
+            for (int i = 0; i < type->sig.numResults; i++)
+                imageType.resultType[i] = writerTypeIndex(writer, type->sig.resultType[i]);
+        }
+
+        writerPut(writer, &imageType, sizeof(imageType));
+    }
+}
+
+
+static int writerPutFields(ImageWriter *writer)
+{
+    Compiler *comp = writer->comp;
+    int numFields = 0;
+
+    for (Type *type = comp->types.first; type; type = type->next)
+    {
+        if (type->kind == TYPE_STRUCT || type->kind == TYPE_INTERFACE)
+            for (int i = 0; i < type->numItems; i++)
+            {
+                ImageField field = {0};
+                strcpy(field.name, type->field[i]->name);
+                field.hash   = type->field[i]->hash;
+                field.type   = writerTypeIndex(writer, type->field[i]->type);
+                field.offset = type->field[i]->offset;
+
+                writerPut(writer, &field, sizeof(field));
+                numFields++;
+            }
+
+        else if (type->kind == TYPE_FN)
+            for (int i = 0; i < type->sig.numParams; i++)
+            {
+                ImageField param = {0};
+                strcpy(param.name, type->sig.param[i]->name);
+                param.hash       = type->sig.param[i]->hash;
+                param.type       = writerTypeIndex(writer, type->sig.param[i]->type);
+                param.defaultVal = writerEncodeConst(writer, type->sig.param[i]->type, &type->sig.param[i]->defaultVal);
+
+                writerPut(writer, &param, sizeof(param));
+                numFields++;
+            }
+    }
+
+    return numFields;
+}
+
+
+static void writerPutIdents(ImageWriter *writer)
+{
+    Compiler *comp = writer->comp;
+
+    for (Ident *ident = comp->idents.first; ident; ident = ident->next)
+    {
+        if (ident->module == 0)
+            continue;
+
+        ImageIdent imageIdent = {0};
+
+        imageIdent.kind             = ident->kind;
+        strcpy(imageIdent.name, ident->name);
+        imageIdent.hash             = ident->hash;
+        imageIdent.type             = writerTypeIndex(writer, ident->type);
+        imageIdent.module           = ident->module;
+        imageIdent.block            = ident->block;
+        imageIdent.exported         = ident->exported;
+        imageIdent.prototypeOffset  = ident->prototypeOffset;
+        imageIdent.globalOffset     = ident->globalOffset;
+
+        // Global variables are saved with the global variable storage, function offsets are not pointers
+        if (ident->kind == IDENT_CONST)
+        {
+            if (ident->type->kind == TYPE_FN)
+                imageIdent.val = (ImageSlot){.val = ident->offset, .reloc = RELOC_NONE};
+            else
+                imageIdent.val = writerEncodeConst(writer, ident->type, &ident->constant);
+        }
+
+        writerPut(writer, &imageIdent, sizeof(imageIdent));
+    }
+}
+
+
+static void writerPutExterns(ImageWriter *writer)
+{
+    for (int i = 0; i < writer->numExterns; i++)
+    {
+        External *external = writer->externs[i];
+        ImageExtern imageExtern = {0};
+
+        strcpy(imageExtern.name, external->name);
+        imageExtern.typed = external->signature != NULL;
+
+        if (imageExtern.typed)
+        {
+            imageExtern.signatureHash   = hash(external->signature);
+            imageExtern.numParams       = external->numParams;
+            imageExtern.resultOffset    = external->resultOffset;
+            imageExtern.frame           = external->frame;
+
+            for (int j = 0; j < external->numParams; j++)
+            {
+                imageExtern.paramOffset[j]     = external->paramOffset[j];
+                imageExtern.paramStructured[j] = external->paramStructured[j];
+            }
+        }
+
+        writerPut(writer, &imageExtern, sizeof(imageExtern));
+    }
+}
+
+
+static void writerBuild(ImageWriter *writer)
+{
+    Compiler *comp = writer->comp;
+
+    writerCollect(writer);
+    writerEncodeCode(writer);
+
+    // The header is rewritten with the section sizes when all the sections are ready
+    ImageHeader header = {0};
+    memcpy(header.magic, imageMagic, sizeof(header.magic));
+    header.version      = IMAGE_VERSION;
+    header.slotSize     = sizeof(Slot);
+    header.instrSize    = sizeof(Instruction);
+    header.numModules   = comp->modules.numModules;
+    header.numTypes     = writer->numTypes;
+    header.numIdents    = writer->numIdents;
+    header.numExterns   = writer->numExterns;
+    header.codeLen      = comp->gen.ip;
+    header.storageLen   = comp->storage.len;
+    header.globalsSize  = comp->idents.globalsSize;
+
+    writerPut(writer, &header, sizeof(header));
+
+    for (int i = 0; i < comp->modules.numModules; i++)
+        writerPut(writer, comp->modules.module[i], sizeof(Module));
+
+    writerPutTypes(writer);
+    writerPutIdents(writer);
+    header.numFields = writerPutFields(writer);
+    writerPutExterns(writer);
+
+    writerPut(writer, writer->code, comp->gen.ip * sizeof(ImageInstr));
+
+    writerPutStorage(writer);
+    header.numStorageRelocs = writer->numRelocs;
+    header.numStorageConsts = comp->numStorageConsts;
+
+    writerPutGlobals(writer);
+    header.numGlobalsRelocs = writer->numRelocs;
+
+    memcpy(writer->buf, &header, sizeof(header));
+}
+
+
+void compilerSave(Compiler *comp, char *fileName)
+{
+    if (!comp->globals)
+        comp->error.handler(comp->error.context, "Program is not compiled");
+
+    ImageWriter writer = {.comp = comp};
+    writerBuild(&writer);
+
+    FILE *file = fopen(fileName, "wb");
+    if (!file)
+        writerError(&writer, "Cannot open file %s", fileName);
+
+    bool written = fwrite(writer.buf, writer.len, 1, file) == 1;
+    fclose(file);
+
+    if (!written)
+        writerError(&writer, "Cannot write file %s", fileName);
+
+    writerFree(&writer);
+}
+
+
+// Reader
+
+static void readerFree(ImageReader *reader)
+{
+    free(reader->globals);
+    free(reader->imageTypes);
+    free(reader->types);
+    free(reader->idents);
+    free(reader->externs);
+    memset(reader, 0, sizeof(ImageReader));
+}
+
+
+static void readerError(ImageReader *reader, const char *format, ...)
+{
+    char msg[DEFAULT_STR_LEN];
+
+    va_list args;
+    va_start(args, format);
+    vsnprintf(msg, DEFAULT_STR_LEN, format, args);
+    va_end(args);
+
+    Error *error = &reader->comp->error;
+    readerFree(reader);
+    error->handler(error->context, "%s", msg);
+}
+
+
+static void readerGet(ImageReader *reader, void *data, int64_t size)
+{
+    if (size < 0 || reader->pos + size > reader->len)
+        readerError(reader, "Corrupted image");
+
+    memcpy(data, reader->image + reader->pos, size);
+    reader->pos += size;
+}
+
+
+static int64_t readerDecodePtr(ImageReader *reader, ImageSlot slot)
+{
+    switch (slot.reloc)
+    {
+        case RELOC_NONE:
+            return slot.val;
+
+        case RELOC_STORAGE:
+        {
+            if (slot.val < 0 || slot.val >= reader->storageLen)
+                readerError(reader, "Corrupted image");
+            return (int64_t)(reader->storage + slot.val);
+        }
+
+        case RELOC_TYPE:
+        {
+            if (slot.val < 0 || slot.val >= reader->numTypes)
+                readerError(reader, "Corrupted image");
+            return (int64_t)reader->types[slot.val];
+        }
+
+        default:
+            readerError(reader, "Corrupted image");
+            return 0;
+    }
+}
+
+
+static Type *readerType(ImageReader *reader, int index)
+{
+    if (index < -1 || index >= reader->numTypes)
+        readerError(reader, "Corrupted image");
+    return index >= 0 ? reader->types[index] : NULL;
+}
+
+
+static void readerGetBlock(ImageReader *reader, char *block, int size, int numRelocs)
+{
+    readerGet(reader, block, size);
+
+    for (int i = 0; i < numRelocs; i++)
+    {
+        int offset;
+        readerGet(reader, &offset, sizeof(offset));
+
+        if (offset < 0 || offset + (int)sizeof(int64_t) > size)
+            readerError(reader, "Corrupted image");
+
+        int64_t ptr;
+        memcpy(&ptr, block + offset, sizeof(ptr));
+
+        ptr = readerDecodePtr(reader, (ImageSlot){.val = ptr, .reloc = RELOC_STORAGE});
+        memcpy(block + offset, &ptr, sizeof(ptr));
+    }
+}
+
+
+static void readerGetStorageConsts(ImageReader *reader, int numStorageConsts)
+{
+    Compiler *comp = reader->comp;
+    comp->storageConsts = malloc((numStorageConsts + 1) * sizeof(StorageConst));
+
+    for (int i = 0; i < numStorageConsts; i++)
+    {
+        ImageStorageConst imageConst;
+        readerGet(reader, &imageConst, sizeof(imageConst));
+
+        Type *type = readerType(reader, imageConst.type);
+        if (!type || imageConst.offset < 0 || imageConst.offset + typeSizeNoCheck(type) > reader->storageLen)
+            readerError(reader, "Corrupted image");
+
+        // The storage of the image follows the storage used by the lexer
+        comp->storageConsts[comp->numStorageConsts++] = (StorageConst){.offset = reader->storage - comp->storage.data + imageConst.offset, .type = type};
+    }
+}
+
+
+static void readerGetTypes(ImageReader *reader, int numTypes)
+{
+    Compiler *comp = reader->comp;
+
+    // The built-in types have already been declared by compilerInit() and are reused
+    int numBuiltinTypes = 0;
+    for (Type *type = comp->types.first; type; type = type->next)
+        numBuiltinTypes++;
+
+    reader->numBuiltinTypes = numBuiltinTypes;
+
+    if (numTypes < numBuiltinTypes)
+        readerError(reader, "Corrupted image");
+
+    reader->types = malloc((numTypes + 1) * sizeof(Type *));
+    reader->numTypes = numTypes;
+
+    int index = 0;
+    for (Type *type = comp->types.first; type; type = type->next)
+        reader->types[index++] = type;
+
+    ImageType *imageTypes = reader->imageTypes = malloc((numTypes + 1) * sizeof(ImageType));
+    readerGet(reader, imageTypes, (int64_t)numTypes * sizeof(ImageType));
+
+    for (int i = 0; i < numTypes; i++)
+    {
+        if (i < numBuiltinTypes)
+        {
+            if (imageTypes[i].kind != reader->types[i]->kind)
+                readerError(reader, "Corrupted image");
+            continue;
+        }
+
+        bool structured = imageTypes[i].kind == TYPE_STRUCT || imageTypes[i].kind == TYPE_INTERFACE;
+
+        if (imageTypes[i].numItems < 0 || (structured && imageTypes[i].numItems > MAX_FIELDS) ||
+            imageTypes[i].numParams < 0 || imageTypes[i].numParams > MAX_PARAMS ||
+            imageTypes[i].numResults < 0 || imageTypes[i].numResults > MAX_RESULTS)
+            readerError(reader, "Corrupted image");
+
+        Type *type = typeAdd(&comp->types, &comp->blocks, imageTypes[i].kind);
+        type->block = imageTypes[i].block;
+
+        // Fields and parameters are read later, the counts are kept consistent with them
+        if (type->kind == TYPE_FN)
+        {
+            type->sig.numParams         = 0;
+            type->sig.numDefaultParams  = imageTypes[i].numDefaultParams;
+            type->sig.numResults        = imageTypes[i].numResults;
+            type->sig.method            = imageTypes[i].method;
+            type->sig.offsetFromSelf    = imageTypes[i].offsetFromSelf;
+        }
+
+        reader->types[i] = type;
+    }
+
+    for (int i = numBuiltinTypes; i < numTypes; i++)
+    {
+        Type *type = reader->types[i];
+        type->base = readerType(reader, imageTypes[i].base);
+        type->weak = imageTypes[i].weak;
+
+        if (type->kind != TYPE_STRUCT && type->kind != TYPE_INTERFACE)
+            type->numItems = imageTypes[i].numItems;
+
+        if (type->kind == TYPE_FN)
+            for (int j = 0; j < type->sig.numResults; j++)
+                type->sig.resultType[j] = readerType(reader, imageTypes[i].resultType[j]);
+    }
+}
+
+
+static void readerGetIdents(ImageReader *reader, int numIdents)
+{
+    Compiler *comp = reader->comp;
+
+    reader->idents = malloc((numIdents + 1) * sizeof(Ident *));
+    reader->numIdents = numIdents;
+
+    for (int i = 0; i < numIdents; i++)
+    {
+        ImageIdent imageIdent;
+        readerGet(reader, &imageIdent, sizeof(imageIdent));
+
+        if (imageIdent.module <= 0 || imageIdent.module >= comp->modules.numModules)
+            readerError(reader, "Corrupted image");
+
+        Type *type = readerType(reader, imageIdent.type);
+        if (!type)
+            readerError(reader, "Corrupted image");
+
+        Ident *ident = malloc(sizeof(Ident));
+        ident->kind = imageIdent.kind;
+
+        memcpy(ident->name, imageIdent.name, sizeof(IdentName));
+        ident->name[sizeof(IdentName) - 1] = 0;
+        ident->hash = imageIdent.hash;
+
+        ident->type             = type;
+        ident->module           = imageIdent.module;
+        ident->block            = imageIdent.block;
+        ident->exported         = imageIdent.exported;
+        ident->inHeap           = false;
+        ident->prototypeOffset  = imageIdent.prototypeOffset;
+        ident->globalOffset     = imageIdent.globalOffset;
+        ident->ptr              = NULL;
+        ident->next             = NULL;
+
+        if (ident->kind == IDENT_CONST)
+            ident->constant.ptrVal = readerDecodePtr(reader, imageIdent.val);
+
+        comp->idents.last->next = ident;
+        comp->idents.last = ident;
+
+        reader->idents[i] = ident;
+    }
+}
+
+
+static void readerGetFields(ImageReader *reader, int numFields)
+{
+    ImageType *imageTypes = reader->imageTypes;
+
+    for (int i = reader->numBuiltinTypes; i < reader->numTypes; i++)
+    {
+        Type *type = reader->types[i];
+
+        if (imageTypes[i].typeIdent < -1 || imageTypes[i].typeIdent >= reader->numIdents)
+            readerError(reader, "Corrupted image");
+
+        type->typeIdent = imageTypes[i].typeIdent >= 0 ? reader->idents[imageTypes[i].typeIdent] : NULL;
+
+        int num = 0;
+        if (type->kind == TYPE_STRUCT || type->kind == TYPE_INTERFACE)
+            num = imageTypes[i].numItems;
+        else if (type->kind == TYPE_FN)
+            num = imageTypes[i].numParams;
+
+        for (int j = 0; j < num; j++)
+        {
+            ImageField imageField;
+            readerGet(reader, &imageField, sizeof(imageField));
+            imageField.name[sizeof(IdentName) - 1] = 0;
+
+            if (--numFields < 0)
+                readerError(reader, "Corrupted image");
+
+            if (type->kind == TYPE_FN)
+            {
+                Param *param = malloc(sizeof(Param));
+                strcpy(param->name, imageField.name);
+                param->hash = imageField.hash;
+                param->type = readerType(reader, imageField.type);
+                param->defaultVal.ptrVal = readerDecodePtr(reader, imageField.defaultVal);
+
+                type->sig.param[type->sig.numParams++] = param;
+            }
+            else
+            {
+                Field *field = malloc(sizeof(Field));
+                strcpy(field->name, imageField.name);
+                field->hash = imageField.hash;
+                field->type = readerType(reader, imageField.type);
+                field->offset = imageField.offset;
+
+                type->field[type->numItems++] = field;
+            }
+        }
+    }
+
+    if (numFields != 0)
+        readerError(reader, "Corrupted image");
+
+    // The sizes of global variables are known when all the types are complete
+    for (int i = 0; i < reader->numIdents; i++)
+    {
+        Ident *ident = reader->idents[i];
+        if (ident->kind == IDENT_VAR && (ident->globalOffset < 0 || ident->globalOffset + typeSizeNoCheck(ident->type) > reader->comp->idents.globalsSize))
+            readerError(reader, "Corrupted image");
+    }
+}
+
+
+static void readerGetExterns(ImageReader *reader, int numExterns)
+{
+    Compiler *comp = reader->comp;
+
+    reader->externs = malloc((numExterns + 1) * sizeof(External *));
+    reader->numExterns = numExterns;
+
+    for (int i = 0; i < numExterns; i++)
+    {
+        ImageExtern imageExtern;
+        readerGet(reader, &imageExtern, sizeof(imageExtern));
+        imageExtern.name[DEFAULT_STR_LEN] = 0;
+
+        // External functions should be added by the host before the image is loaded, as before compilation
+        External *external = externalFind(&comp->externals, imageExtern.name);
+        if (!external)
+            readerError(reader, "Unresolved external function %s", imageExtern.name);
+
+        if (imageExtern.typed != (external->signature != NULL) ||
+           (imageExtern.typed && hash(external->signature) != imageExtern.signatureHash))
+            readerError(reader, "Signature of %s does not match the image", imageExtern.name);
+
+        if (imageExtern.typed)
+        {
+
+            if (imageExtern.numParams < 0 || imageExtern.numParams > MAX_PARAMS)
+                readerError(reader, "Corrupted image");
+
+            external->numParams     = imageExtern.numParams;
+            external->resultOffset  = imageExtern.resultOffset;
+            external->frame         = imageExtern.frame;
+
+            for (int j = 0; j < imageExtern.numParams; j++)
+            {
+                external->paramOffset[j]     = imageExtern.paramOffset[j];
+                external->paramStructured[j] = imageExtern.paramStructured[j];
+            }
+        }
+
+        reader->externs[i] = external;
+    }
+}
+
+
+static void readerGetCode(ImageReader *reader, int codeLen)
+{
+    Compiler *comp = reader->comp;
+    CodeGen *gen = &comp->gen;
+
+    if (codeLen > gen->capacity)
+    {
+        gen->capacity = codeLen;
+        gen->code = realloc(gen->code, gen->capacity * sizeof(Instruction));
+    }
+
+    for (int i = 0; i < codeLen; i++)
+    {
+        ImageInstr imageInstr;
+        readerGet(reader, &imageInstr, sizeof(imageInstr));
+
+        Instruction *instr = &gen->code[i];
+
+        instr->opcode       = imageInstr.opcode;
+        instr->inlineOpcode = imageInstr.inlineOpcode;
+        instr->tokKind      = imageInstr.tokKind;
+        instr->typeKind     = imageInstr.typeKind;
+
+        if (imageInstr.operand.reloc == RELOC_EXTERN)
+        {
+            if (imageInstr.operand.val < 0 || imageInstr.operand.val >= reader->numExterns)
+                readerError(reader, "Corrupted image");
+
+            External *external = reader->externs[imageInstr.operand.val];
+
+            if (instr->opcode == OP_CALL_EXTERN_TYPED)
+                instr->operand.ptrVal = (int64_t)external;
+            else
+                instr->operand.ptrVal = (int64_t)external->entry;
+        }
+        else
+            instr->operand.intVal = readerDecodePtr(reader, imageInstr.operand);
+
+        if (imageInstr.fileName >= 0)
+            instr->debug.fileName = (char *)readerDecodePtr(reader, (ImageSlot){.val = imageInstr.fileName, .reloc = RELOC_STORAGE});
+        else
+            instr->debug.fileName = comp->lex.fileName;
+
+        if (imageInstr.fnName >= 0)
+            instr->debug.fnName = (char *)readerDecodePtr(reader, (ImageSlot){.val = imageInstr.fnName, .reloc = RELOC_STORAGE});
+        else
+            instr->debug.fnName = NULL;
+
+        instr->debug.line = imageInstr.line;
+    }
+
+    gen->ip = codeLen;
+    gen->mainDefined = true;
+}
+
+
+void compilerLoad(Compiler *comp, const char *image, int imageLen)
+{
+    if (comp->globals || comp->modules.numModules != 1)
+        comp->error.handler(comp->error.context, "Program is already compiled");
+
+    ImageReader reader = {.comp = comp, .image = image, .len = imageLen};
+
+    ImageHeader header;
+    readerGet(&reader, &header, sizeof(header));
+
+    if (memcmp(header.magic, imageMagic, sizeof(header.magic)) != 0 || header.version != IMAGE_VERSION ||
+        header.slotSize != sizeof(Slot) || header.instrSize != sizeof(Instruction))
+        readerError(&reader, "Incompatible image");
+
+    if (header.numModules < 2 || header.numModules > MAX_MODULES || header.numTypes < 0 || header.numIdents < 0 ||
+        header.numFields < 0 || header.numExterns < 0 || header.codeLen <= 0 || header.storageLen < 0 ||
+        header.globalsSize < comp->idents.globalsSize || header.numStorageRelocs < 0 || header.numStorageConsts < 0 || header.numGlobalsRelocs < 0)
+        readerError(&reader, "Corrupted image");
+
+    // The storage of the image is appended to the storage used by the lexer
+    if (comp->storage.len + header.storageLen > comp->storage.capacity)
+        readerError(&reader, "Storage overflow");
+
+    reader.storage = comp->storage.data + comp->storage.len;
+    reader.storageLen = header.storageLen;
+
+    // Modules, except the universe module declared by compilerInit()
+    Module universe;
+    readerGet(&reader, &universe, sizeof(Module));
+
+    for (int i = 1; i < header.numModules; i++)
+    {
+        Module *module = malloc(sizeof(Module));
+        comp->modules.module[comp->modules.numModules++] = module;
+        readerGet(&reader, module, sizeof(Module));
+
+        module->path[DEFAULT_STR_LEN] = module->folder[DEFAULT_STR_LEN] = module->name[DEFAULT_STR_LEN] = 0;
+    }
+
+    // Types and identifiers refer to each other, so the types are created first and completed when the identifiers are ready
+    comp->idents.globalsSize = header.globalsSize;
+
+    readerGetTypes (&reader, header.numTypes);
+    readerGetIdents(&reader, header.numIdents);
+    readerGetFields(&reader, header.numFields);
+
+    readerGetExterns(&reader, header.numExterns);
+    readerGetCode(&reader, header.codeLen);
+
+    // Storage
+    readerGetBlock(&reader, reader.storage, header.storageLen, header.numStorageRelocs);
+    readerGetStorageConsts(&reader, header.numStorageConsts);
+    comp->storage.len += header.storageLen;
+
+    // Global variables. The command-line arguments are those of the current process
+    reader.globals = malloc(header.globalsSize + 1);
+    readerGetBlock(&reader, reader.globals, header.globalsSize, header.numGlobalsRelocs);
+
+    comp->globals = reader.globals;
+    reader.globals = NULL;
+
+    identCopyGlobals(&comp->idents, comp->globals);
+    vmSetGlobals(&comp->vm, comp->globals, comp->idents.globalsSize);
+
+    comp->blocks.module = 1;
+    readerFree(&reader);
+}
+
+
+// Compile cache
+
+static void cacheFileName(Compiler *comp, char *fileName, int size)
+{
+    // A single image per main module path, replaced whenever the main module or any of its imports changes
+    snprintf(fileName, size, "%s/%08x.umi", comp->cacheDir, hash(comp->lex.fileName));
+}
+
+
+static bool cacheModuleSourceHash(Compiler *comp, char *path, uint64_t *sourceHash)
+{
+    // The source is found as in parseImportItem()
+    const char *source = NULL;
+    int sourceLen = 0;
+
+    if (comp->modules.loader && comp->modules.loader(path, &source, &sourceLen, comp->modules.loaderContext))
+    {
+        *sourceHash = hashSource(source, sourceLen);
+        return true;
+    }
+
+    FILE *file = fopen(path, "rb");
+    if (!file)
+        return false;
+
+    fseek(file, 0, SEEK_END);
+    const int bufLen = ftell(file);
+    rewind(file);
+
+    char *buf = malloc(bufLen + 1);
+    bool ok = bufLen >= 0 && (bufLen == 0 || fread(buf, bufLen, 1, file) == 1);
+    fclose(file);
+
+    if (ok)
+        *sourceHash = hashSource(buf, bufLen);
+
+    free(buf);
+    return ok;
+}
+
+
+static bool cacheUpToDate(Compiler *comp, const char *image, int imageLen)
+{
+    ImageHeader header;
+    if (imageLen < (int)sizeof(header))
+        return false;
+
+    memcpy(&header, image, sizeof(header));
+
+    if (memcmp(header.magic, imageMagic, sizeof(header.magic)) != 0 || header.version != IMAGE_VERSION ||
+        header.slotSize != sizeof(Slot) || header.instrSize != sizeof(Instruction))
+        return false;
+
+    if (header.numModules < 2 || header.numModules > MAX_MODULES || header.numTypes < 0 || header.numIdents < 0 ||
+        header.numFields < 0 || header.numExterns < 0 || header.codeLen <= 0 || header.storageLen < 0 ||
+        header.globalsSize < 0 || header.numStorageRelocs < 0 || header.numStorageConsts < 0 || header.numGlobalsRelocs < 0)
+        return false;
+
+    // A partially written or truncated image is never loaded
+    const int64_t externsPos = sizeof(ImageHeader) + (int64_t)header.numModules * sizeof(Module) + (int64_t)header.numTypes * sizeof(ImageType) +
+                               (int64_t)header.numIdents * sizeof(ImageIdent) + (int64_t)header.numFields * sizeof(ImageField);
+
+    const int64_t len = externsPos + (int64_t)header.numExterns * sizeof(ImageExtern) + (int64_t)header.codeLen * sizeof(ImageInstr) +
+                        header.storageLen + (int64_t)header.numStorageRelocs * sizeof(int) + (int64_t)header.numStorageConsts * sizeof(ImageStorageConst) +
+                        header.globalsSize + (int64_t)header.numGlobalsRelocs * sizeof(int);
+
+    if (len != imageLen || comp->storage.len + header.storageLen > comp->storage.capacity)
+        return false;
+
+    // The main module and all the imported modules should have the same source as when the image was saved
+    for (int i = 1; i < header.numModules; i++)
+    {
+        Module module;
+        memcpy(&module, image + sizeof(ImageHeader) + i * sizeof(Module), sizeof(Module));
+        module.path[DEFAULT_STR_LEN] = 0;
+
+        uint64_t sourceHash;
+        if (i == 1)
+        {
+            if (strcmp(module.path, comp->lex.fileName) != 0)
+                return false;
+            sourceHash = hashSource(comp->lex.buf, comp->lex.bufLen);
+        }
+        else if (!cacheModuleSourceHash(comp, module.path, &sourceHash))
+            return false;
+
+        if (sourceHash != module.sourceHash)
+            return false;
+    }
+
+    // The external functions should be the same as when the image was saved
+    for (int i = 0; i < header.numExterns; i++)
+    {
+        ImageExtern imageExtern;
+        memcpy(&imageExtern, image + externsPos + i * sizeof(ImageExtern), sizeof(ImageExtern));
+        imageExtern.name[DEFAULT_STR_LEN] = 0;
+
+        External *external = externalFind(&comp->externals, imageExtern.name);
+        if (!external || imageExtern.typed != (external->signature != NULL) ||
+           (imageExtern.typed && hash(external->signature) != imageExtern.signatureHash))
+            return false;
+    }
+
+    return true;
+}
+
+
+bool compilerLoadCache(Compiler *comp)
+{
+    char fileName[2 * DEFAULT_STR_LEN + 1];
+    cacheFileName(comp, fileName, sizeof(fileName));
+
+    FILE *file = fopen(fileName, "rb");
+    if (!file)
+        return false;
+
+    fseek(file, 0, SEEK_END);
+    const int imageLen = ftell(file);
+    rewind(file);
+
+    char *image = malloc(imageLen + 1);
+    bool ok = imageLen > 0 && fread(image, imageLen, 1, file) == 1;
+    fclose(file);
+
+    ok = ok && cacheUpToDate(comp, image, imageLen);
+
+    if (ok)
+    {
+        jmp_buf jumper;
+        memcpy(jumper, comp->error.jumper, sizeof(jmp_buf));
+
+        bool failed = false;
+        if (setjmp(comp->error.jumper) == 0)
+            compilerLoad(comp, image, imageLen);
+        else
+            failed = true;
+
+        memcpy(comp->error.jumper, jumper, sizeof(jmp_buf));
+
+        if (failed)
+        {
+            free(image);
+            longjmp(comp->error.jumper, 1);
+        }
+    }
+
+    free(image);
+    return ok;
+}
+
+
+void compilerSaveCache(Compiler *comp)
+{
+    char fileName[2 * DEFAULT_STR_LEN + 1], tempFileName[3 * DEFAULT_STR_LEN + 1];
+    cacheFileName(comp, fileName, sizeof(fileName));
+
+    // Instances that compile the same program concurrently write their own temporary files
+    snprintf(tempFileName, sizeof(tempFileName), "%s.%p.tmp", fileName, (void *)comp);
+
+    // A program that cannot be saved is not cached, which is not a compilation error
+    jmp_buf jumper;
+    memcpy(jumper, comp->error.jumper, sizeof(jmp_buf));
+
+    if (setjmp(comp->error.jumper) == 0)
+    {
+        ImageWriter writer = {.comp = comp};
+        writerBuild(&writer);
+
+        FILE *file = fopen(tempFileName, "wb");
+        if (file)
+        {
+            bool written = fwrite(writer.buf, writer.len, 1, file) == 1;
+            written = fclose(file) == 0 && written;
+
+            // The image appears in the cache only when it is complete
+            if (written && rename(tempFileName, fileName) != 0)
+            {
+                remove(fileName);
+                written = rename(tempFileName, fileName) == 0;
+            }
+
+            if (!written)
+                remove(tempFileName);
+        }
+
+        writerFree(&writer);
+    }
+
+    memcpy(comp->error.jumper, jumper, sizeof(jmp_buf));
+}
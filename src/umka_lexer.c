@@ -32,6 +32,7 @@ static const char *spelling [] =
     "type",
     "var",
     "weak",
+    "yield",
 
     // Operators
     "+",
@@ -91,31 +92,19 @@ static const char *spelling [] =
 };
 
 
-enum
-{
-    NUM_KEYWORDS = TOK_WEAK - TOK_BREAK + 1
-};
-
-
-static unsigned int keywordHash[NUM_KEYWORDS];
-
-
-int lexInit(Lexer *lex, Storage *storage, DebugInfo *debug, const char *fileName, Error *error)
+int lexInit(Lexer *lex, Storage *storage, DebugInfo *debug, const char *fileName, const char *source, int sourceLen, Error *error)
 {
     // Fill keyword hashes
     for (int i = 0; i < NUM_KEYWORDS; i++)
-        keywordHash[i] = hash(spelling[TOK_BREAK + i]);
+        lex->keywordHash[i] = hash(spelling[TOK_BREAK + i]);
 
     // Initialize lexer
-    if (storage->len + strlen(fileName) + 1 > storage->capacity)
-        error->handler(error->context, "Storage overflow");
-
-    strcpy(&storage->data[storage->len], fileName);
-    lex->fileName = &storage->data[storage->len];
-    storage->len += strlen(fileName) + 1;
+    lex->fileName = storageAddStr(storage, fileName, error);
 
     lex->buf = NULL;
+    lex->bufLen = 0;
     lex->bufPos = 0;
+    lex->ownBuf = false;
     lex->line = 1;
     lex->pos = 1;
     lex->tok.kind = TOK_NONE;
@@ -124,9 +113,18 @@ int lexInit(Lexer *lex, Storage *storage, DebugInfo *debug, const char *fileName
     lex->storage = storage;
     lex->debug = debug;
     lex->debug->fileName = lex->fileName;
+    lex->debug->fnName = NULL;
     lex->debug->line = lex->line;
     lex->error = error;
 
+    // The source supplied by the host is lexed in place, not copied, so it should not be modified or freed during compilation
+    if (source)
+    {
+        lex->buf = source;
+        lex->bufLen = sourceLen;
+        return sourceLen;
+    }
+
     FILE *file = fopen(lex->fileName, "rb");
 
     if (!file)
@@ -139,16 +137,21 @@ int lexInit(Lexer *lex, Storage *storage, DebugInfo *debug, const char *fileName
     const int bufLen = ftell(file);
     rewind(file);
 
-    lex->buf = malloc(bufLen + 1);
+    char *buf = malloc(bufLen + 1);
 
-    if (fread(lex->buf, bufLen, 1, file) != 1)
+    if (fread(buf, bufLen, 1, file) != 1)
     {
+        free(buf);
         lex->error->handler(lex->error->context, "Cannot read file %s", lex->fileName);
         return 0;
     }
 
-    lex->buf[bufLen] = 0;
+    buf[bufLen] = 0;
     fclose(file);
+
+    lex->buf = buf;
+    lex->bufLen = bufLen;
+    lex->ownBuf = true;
     return bufLen;
 }
 
@@ -157,16 +160,39 @@ void lexFree(Lexer *lex)
 {
     if (lex->buf)
     {
-        free(lex->buf);
+        if (lex->ownBuf)
+            free((char *)lex->buf);
+
         lex->fileName = NULL;
         lex->buf = NULL;
     }
 }
 
 
+static char lexCurChar(Lexer *lex)
+{
+    // The source supplied by the host is not necessarily null-terminated
+    return (lex->bufPos < lex->bufLen) ? lex->buf[lex->bufPos] : 0;
+}
+
+
+static int lexCopyNumber(Lexer *lex, char *numBuf)
+{
+    // Numbers are converted from a null-terminated copy, since the library functions could read beyond the end of the source
+    int len = 0;
+    while (len < DEFAULT_STR_LEN && lex->bufPos + len < lex->bufLen && lex->buf[lex->bufPos + len] != '\n')
+    {
+        numBuf[len] = lex->buf[lex->bufPos + len];
+        len++;
+    }
+    numBuf[len] = 0;
+    return len;
+}
+
+
 static char lexChar(Lexer *lex)
 {
-    char ch = lex->buf[lex->bufPos];
+    char ch = lexCurChar(lex);
     if (ch)
     {
         lex->bufPos++;
@@ -178,7 +204,7 @@ static char lexChar(Lexer *lex)
             lex->pos = 1;
         }
     }
-    return lex->buf[lex->bufPos];
+    return lexCurChar(lex);
 }
 
 
@@ -207,9 +233,12 @@ static char lexEscChar(Lexer *lex, bool *escaped)
             {
                 lexChar(lex);
 
+                char numBuf[DEFAULT_STR_LEN + 1];
+                lexCopyNumber(lex, numBuf);
+
                 unsigned int hex = 0;
                 int len = 0;
-                const int items = sscanf(lex->buf + lex->bufPos, "%x%n", &hex, &len);
+                const int items = sscanf(numBuf, "%x%n", &hex, &len);
 
                 if (items < 1 || hex > 0xFF)
                 {
@@ -259,7 +288,7 @@ static void lexMultiLineComment(Lexer *lex)
 
 static void lexSpacesAndComments(Lexer *lex)
 {
-    char ch = lex->buf[lex->bufPos];
+    char ch = lexCurChar(lex);
 
     while (ch && (ch == ' ' || ch == '\t' || ch == '\r' || ch == '/'))
     {
@@ -278,7 +307,7 @@ static void lexSpacesAndComments(Lexer *lex)
                 break;
             }
 
-            ch = lex->buf[lex->bufPos];
+            ch = lexCurChar(lex);
         }
         else
             ch = lexChar(lex);
@@ -289,7 +318,7 @@ static void lexSpacesAndComments(Lexer *lex)
 static void lexKeywordOrIdent(Lexer *lex)
 {
     lex->tok.kind = TOK_NONE;
-    char ch = lex->buf[lex->bufPos];
+    char ch = lexCurChar(lex);
     int len = 0;
 
     do
@@ -311,7 +340,7 @@ static void lexKeywordOrIdent(Lexer *lex)
 
     // Search for a keyword
     for (int i = 0; i < NUM_KEYWORDS; i++)
-        if (lex->tok.hash == keywordHash[i] && strcmp(lex->tok.name, spelling[TOK_BREAK + i]) == 0)
+        if (lex->tok.hash == lex->keywordHash[i] && strcmp(lex->tok.name, spelling[TOK_BREAK + i]) == 0)
         {
             lex->tok.kind = TOK_BREAK + i;
             break;
@@ -325,7 +354,7 @@ static void lexKeywordOrIdent(Lexer *lex)
 static void lexOperator(Lexer *lex)
 {
     lex->tok.kind = TOK_NONE;
-    char ch = lex->buf[lex->bufPos];
+    char ch = lexCurChar(lex);
 
     switch (ch)
     {
@@ -623,17 +652,20 @@ static void lexOperator(Lexer *lex)
 static void lexNumber(Lexer *lex)
 {
     lex->tok.kind = TOK_NONE;
-    char ch = lex->buf[lex->bufPos];
+    char ch = lexCurChar(lex);
     char *tail;
 
+    char numBuf[DEFAULT_STR_LEN + 1];
+    lexCopyNumber(lex, numBuf);
+
     // Integer number
     lex->tok.kind = TOK_INTNUMBER;
-    lex->tok.uintVal = strtoull(lex->buf + lex->bufPos, &tail, 0);
+    lex->tok.uintVal = strtoull(numBuf, &tail, 0);
 
     if (errno == ERANGE)
         lex->error->handler(lex->error->context, "Number is too large");
 
-    if (tail == lex->buf + lex->bufPos && ch != '.')
+    if (tail == numBuf && ch != '.')
     {
         lex->tok.kind = TOK_NONE;
         return;
@@ -643,19 +675,19 @@ static void lexNumber(Lexer *lex)
     if (tail[0] == '.' || tail[0] == 'E' || tail[0] == 'e')
     {
         lex->tok.kind = TOK_REALNUMBER;
-        lex->tok.realVal = strtod(lex->buf + lex->bufPos, &tail);
+        lex->tok.realVal = strtod(numBuf, &tail);
 
         if (lex->tok.realVal == HUGE_VAL)
             lex->error->handler(lex->error->context, "Number is too large");
 
-        if (tail == lex->buf + lex->bufPos)
+        if (tail == numBuf)
         {
             lex->tok.kind = TOK_NONE;
             return;
         }
     }
 
-    int len = tail - (lex->buf + lex->bufPos);
+    int len = tail - numBuf;
     lex->bufPos += len;
     lex->pos += len;
 }
@@ -685,7 +717,7 @@ static void lexStrLiteral(Lexer *lex)
     char ch = lexEscChar(lex, &escaped);
     while (ch != '\"' || escaped)
     {
-        if (ch == '\n' && !escaped)
+        if ((ch == '\n' || ch == 0) && !escaped)
         {
             lex->error->handler(lex->error->context, "Unterminated string");
             lex->tok.kind = TOK_NONE;
@@ -712,7 +744,7 @@ static void lexNextWithEOLN(Lexer *lex)
     lex->tok.kind = TOK_NONE;
     lexSpacesAndComments(lex);
 
-    char ch = lex->buf[lex->bufPos];
+    char ch = lexCurChar(lex);
     if ((ch >= 'A' && ch <= 'Z') || (ch >= 'a' && ch <= 'z') || ch == '_')
         lexKeywordOrIdent(lex);
     else if ((ch >= '0' && ch <= '9') || ch == '.')
@@ -727,7 +759,7 @@ static void lexNextWithEOLN(Lexer *lex)
 
     if (lex->tok.kind == TOK_NONE)
     {
-        if (!lex->buf[lex->bufPos])
+        if (!lexCurChar(lex))
             lex->tok.kind = TOK_EOF;
         else
             lex->error->handler(lex->error->context, "Unexpected character or end of file");
@@ -746,6 +778,7 @@ void lexNext(Lexer *lex)
             if (lex->prevTok.kind == TOK_BREAK       ||
                 lex->prevTok.kind == TOK_CONTINUE    ||
                 lex->prevTok.kind == TOK_RETURN      ||
+                lex->prevTok.kind == TOK_YIELD       ||
                 lex->prevTok.kind == TOK_STR         ||
                 lex->prevTok.kind == TOK_PLUSPLUS    ||
                 lex->prevTok.kind == TOK_MINUSMINUS  ||
@@ -28,6 +28,7 @@ typedef enum
     TOK_TYPE,
     TOK_VAR,
     TOK_WEAK,
+    TOK_YIELD,
 
     // Operators
     TOK_PLUS,
@@ -87,6 +88,12 @@ typedef enum
 } TokenKind;
 
 
+enum
+{
+    NUM_KEYWORDS = TOK_YIELD - TOK_BREAK + 1
+};
+
+
 typedef char IdentName[MAX_IDENT_LEN + 1];
 
 
@@ -111,16 +118,18 @@ typedef struct
 typedef struct
 {
     char *fileName;
-    char *buf;
-    int bufPos, line, pos;
+    const char *buf;
+    int bufLen, bufPos, line, pos;
+    bool ownBuf;                                // The source buffer is read from the file rather than supplied by the host
     Token tok, prevTok;
+    unsigned int keywordHash[NUM_KEYWORDS];     // Per lexer, so that several compilers can run concurrently
     Storage *storage;
     DebugInfo *debug;
     Error *error;
 } Lexer;
 
 
-int lexInit(Lexer *lex, Storage *storage, DebugInfo *debug, const char *fileName, Error *error);
+int lexInit(Lexer *lex, Storage *storage, DebugInfo *debug, const char *fileName, const char *source, int sourceLen, Error *error);
 void lexFree(Lexer *lex);
 void lexNext(Lexer *lex);
 bool lexCheck(Lexer *lex, TokenKind kind);
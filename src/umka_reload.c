@@ -0,0 +1,369 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "umka_compiler.h"
+#include "umka_decl.h"
+
+
+// A hot reload compiles the new version of a module after the whole program and patches the program in place. The old version
+// is retired: its identifiers, code and global variables stay in the program, but its identifiers are moved to the module slot
+// of retired identifiers, so that they cannot be found by name, and the new version takes the module slot of the old one. The entry point
+// of each old function jumps to the new function with the same name and signature, so that the calls compiled before the reload,
+// the function values and the interface methods all reach the new code. The new global variables are added to the global
+// variables of the program, and those that have the same name and type as the old ones start as copies of the old ones
+
+
+typedef struct
+{
+    Lexer lex;
+    DebugInfo debug;
+    Module oldModule;
+    Ident **oldIdents;              // Identifiers of the old version, moved to the module of retired identifiers
+    int numOldIdents, retiredModule;
+    int numModules, numBlocks, module;
+    Ident *lastIdent;
+    Type *lastType;
+    int globalsSize, storageLen, numStorageConsts, ip;
+    Instruction entry;
+} ReloadState;
+
+
+typedef struct tagTypePair
+{
+    Type *left, *right;
+    struct tagTypePair *outer;
+} TypePair;
+
+
+static bool reloadSameType(Type *left, Type *right, TypePair *outer);
+
+
+static bool reloadSameSignature(Signature *left, Signature *right, TypePair *outer)
+{
+    // Parameter names and default values do not matter to the callers compiled before the reload
+    if (left->method != right->method || left->numParams != right->numParams || left->numResults != right->numResults)
+        return false;
+
+    for (int i = 0; i < left->numParams; i++)
+        if (!reloadSameType(left->param[i]->type, right->param[i]->type, outer))
+            return false;
+
+    for (int i = 0; i < left->numResults; i++)
+        if (!reloadSameType(left->resultType[i], right->resultType[i], outer))
+            return false;
+
+    return true;
+}
+
+
+static bool reloadSameType(Type *left, Type *right, TypePair *outer)
+{
+    // Unlike typeEquivalent(), the types of the old and new versions are distinct even if they are the same,
+    // so the recursive types are compared assuming that the pairs being compared are the same
+    if (left == right)
+        return true;
+
+    for (TypePair *pair = outer; pair; pair = pair->outer)
+        if (pair->left == left && pair->right == right)
+            return true;
+
+    if (left->kind != right->kind || left->weak != right->weak)
+        return false;
+
+    TypePair pair = {left, right, outer};
+
+    switch (left->kind)
+    {
+        case TYPE_PTR:
+        case TYPE_DYNARRAY:
+        case TYPE_CHAN:         return reloadSameType(left->base, right->base, &pair);
+
+        case TYPE_ARRAY:        return left->numItems == right->numItems && reloadSameType(left->base, right->base, &pair);
+
+        case TYPE_STRUCT:
+        case TYPE_INTERFACE:
+        {
+            if (left->numItems != right->numItems)
+                return false;
+
+            for (int i = 0; i < left->numItems; i++)
+                if (strcmp(left->field[i]->name, right->field[i]->name) != 0 ||
+                    !reloadSameType(left->field[i]->type, right->field[i]->type, &pair))
+                    return false;
+
+            return true;
+        }
+
+        case TYPE_FN:           return reloadSameSignature(&left->sig, &right->sig, &pair);
+
+        default:                return true;
+    }
+}
+
+
+static bool reloadSameFunc(Ident *oldFn, Ident *newFn)
+{
+    if (strcmp(oldFn->name, newFn->name) != 0 || oldFn->type->sig.method != newFn->type->sig.method)
+        return false;
+
+    // Methods are also matched by the name of the receiver base type
+    if (oldFn->type->sig.method)
+    {
+        Type *oldRcv = oldFn->type->sig.param[0]->type;
+        Type *newRcv = newFn->type->sig.param[0]->type;
+
+        if (oldRcv->kind == TYPE_PTR)
+            oldRcv = oldRcv->base;
+
+        if (newRcv->kind == TYPE_PTR)
+            newRcv = newRcv->base;
+
+        if (!oldRcv->typeIdent || !newRcv->typeIdent || strcmp(oldRcv->typeIdent->name, newRcv->typeIdent->name) != 0)
+            return false;
+    }
+
+    return true;
+}
+
+
+static bool reloadGlobalFunc(Ident *ident, int module)
+{
+    return ident->module == module && ident->block == 0 && ident->kind == IDENT_CONST && ident->type->kind == TYPE_FN;
+}
+
+
+static bool reloadGlobalVar(Ident *ident, int module)
+{
+    return ident->module == module && ident->block == 0 && ident->kind == IDENT_VAR && ident->globalOffset >= 0;
+}
+
+
+static int reloadRetiredModule(Modules *modules)
+{
+    // All the retired identifiers share a single module that has an empty name, so that it cannot be imported or found by name
+    int res = moduleFindByPath(modules, "");
+    if (res >= 0)
+        return res;
+
+    if (modules->numModules >= MAX_MODULES)
+        modules->error->handler(modules->error->context, "Too many modules");
+
+    Module *module = malloc(sizeof(Module));
+
+    module->path[0] = module->folder[0] = module->name[0] = 0;
+    module->hash = module->pathHash = hash("");
+    module->sourceHash = 0;
+
+    for (int i = 0; i < MAX_MODULES; i++)
+        module->imports[i] = false;
+
+    modules->module[modules->numModules] = module;
+    return modules->numModules++;
+}
+
+
+static void reloadRetireIdents(Compiler *comp, ReloadState *state, int oldModule)
+{
+    // Called before the rollback is set up, so that nothing may be changed before the module of retired identifiers is found or added
+    state->retiredModule = reloadRetiredModule(&comp->modules);
+
+    for (Ident *ident = comp->idents.first; ident; ident = ident->next)
+        if (ident->module == oldModule)
+        {
+            state->oldIdents = realloc(state->oldIdents, (state->numOldIdents + 1) * sizeof(Ident *));
+            state->oldIdents[state->numOldIdents++] = ident;
+            ident->module = state->retiredModule;
+        }
+
+    // The new version starts with no imports
+    Module *module = comp->modules.module[oldModule];
+    for (int i = 0; i < MAX_MODULES; i++)
+        module->imports[i] = false;
+}
+
+
+static void reloadRollback(Compiler *comp, ReloadState *state, int oldModule)
+{
+    lexFree(&comp->lex);
+    comp->lex   = state->lex;
+    comp->debug = state->debug;
+
+    // Identifiers and types added by the failed reload
+    Ident *ident = state->lastIdent->next;
+    state->lastIdent->next = NULL;
+    comp->idents.last = state->lastIdent;
+
+    while (ident)
+    {
+        Ident *next = ident->next;
+        if (ident->inHeap)
+            free(ident->ptr);
+        free(ident);
+        ident = next;
+    }
+
+    Type *type = state->lastType->next;
+    state->lastType->next = NULL;
+    comp->types.last = state->lastType;
+
+    while (type)
+    {
+        Type *next = type->next;
+        typeFreeFieldsAndParams(type);
+        free(type);
+        type = next;
+    }
+
+    // Modules
+    for (int i = 0; i < state->numOldIdents; i++)
+        state->oldIdents[i]->module = oldModule;
+
+    for (int i = state->numModules; i < comp->modules.numModules; i++)
+        free(comp->modules.module[i]);
+
+    comp->modules.numModules = state->numModules;
+    *comp->modules.module[oldModule] = state->oldModule;
+
+    comp->blocks.top = 0;
+    comp->blocks.numBlocks = state->numBlocks;
+    comp->blocks.module = state->module;
+
+    // Code and data
+    comp->gen.ip = state->ip;
+    comp->gen.top = -1;
+    comp->gen.breaks = comp->gen.continues = comp->gen.returns = NULL;
+    comp->gen.code[0] = state->entry;
+
+    comp->idents.globalsSize = state->globalsSize;
+    comp->storage.len = state->storageLen;
+    comp->numStorageConsts = state->numStorageConsts;
+}
+
+
+static void reloadPatchFuncs(Compiler *comp, ReloadState *state, int module)
+{
+    // The old functions whose signature has changed are not patched, and the code compiled against them keeps calling them
+    for (Ident *newFn = state->lastIdent->next; newFn; newFn = newFn->next)
+        if (reloadGlobalFunc(newFn, module))
+            for (int i = 0; i < state->numOldIdents; i++)
+            {
+                Ident *oldFn = state->oldIdents[i];
+                if (reloadGlobalFunc(oldFn, state->retiredModule) && reloadSameFunc(oldFn, newFn) && reloadSameType(oldFn->type, newFn->type, NULL))
+                {
+                    genGoFromTo(&comp->gen, oldFn->offset, newFn->offset);
+                    break;
+                }
+            }
+}
+
+
+static void reloadKeepGlobals(Compiler *comp, ReloadState *state, int module)
+{
+    for (Ident *newVar = state->lastIdent->next; newVar; newVar = newVar->next)
+        if (reloadGlobalVar(newVar, module))
+            for (int i = 0; i < state->numOldIdents; i++)
+            {
+                Ident *oldVar = state->oldIdents[i];
+                if (reloadGlobalVar(oldVar, state->retiredModule) && strcmp(oldVar->name, newVar->name) == 0)
+                {
+                    if (reloadSameType(oldVar->type, newVar->type, NULL))
+                    {
+                        comp->keptGlobals = realloc(comp->keptGlobals, (comp->numKeptGlobals + 1) * sizeof(KeptGlobal));
+                        comp->keptGlobals[comp->numKeptGlobals++] = (KeptGlobal){.offset = newVar->globalOffset, .oldOffset = oldVar->globalOffset, .type = newVar->type};
+                    }
+                    break;
+                }
+            }
+
+    // Initial values of the new global variables
+    comp->globals = realloc(comp->globals, comp->idents.globalsSize);
+
+    for (Ident *ident = state->lastIdent->next; ident; ident = ident->next)
+        if (ident->kind == IDENT_VAR && ident->inHeap)
+            memcpy((char *)comp->globals + ident->globalOffset, ident->ptr, typeSizeNoCheck(ident->type));
+}
+
+
+void compilerReload(Compiler *comp, char *path, const char *source, int sourceLen)
+{
+    if (!comp->globals)
+        comp->error.handler(comp->error.context, "Program is not compiled");
+
+    int oldModule = moduleFindByPath(&comp->modules, path);
+    if (oldModule < 1)
+        comp->error.handler(comp->error.context, "Unknown module %s", path);
+
+    ReloadState state =
+    {
+        .lex              = comp->lex,
+        .debug            = comp->debug,
+        .oldModule        = *comp->modules.module[oldModule],
+        .numModules       = comp->modules.numModules,
+        .numBlocks        = comp->blocks.numBlocks,
+        .module           = comp->blocks.module,
+        .lastIdent        = comp->idents.last,
+        .lastType         = comp->types.last,
+        .globalsSize      = comp->idents.globalsSize,
+        .storageLen       = comp->storage.len,
+        .numStorageConsts = comp->numStorageConsts,
+        .ip               = comp->gen.ip,
+        .entry            = comp->gen.code[0]
+    };
+
+    // The new version is compiled into the module slot of the old one, so that the old identifiers should be retired first
+    reloadRetireIdents(comp, &state, oldModule);
+
+    // A failed reload leaves the program as it was
+    jmp_buf jumper;
+    memcpy(jumper, comp->error.jumper, sizeof(jmp_buf));
+
+    if (setjmp(comp->error.jumper) == 0)
+    {
+
+        // The host loader may supply the module source, otherwise the module is read from the file
+        const char *moduleSource = source;
+        int moduleSourceLen = sourceLen;
+
+        if (!moduleSource && comp->modules.loader && !comp->modules.loader(path, &moduleSource, &moduleSourceLen, comp->modules.loaderContext))
+            moduleSource = NULL;
+
+        lexInit(&comp->lex, &comp->storage, &comp->debug, path, moduleSource, moduleSourceLen, &comp->error);
+        parseReloadedModule(comp, oldModule);
+    }
+    else
+    {
+        reloadRollback(comp, &state, oldModule);
+        free(state.oldIdents);
+        memcpy(comp->error.jumper, jumper, sizeof(jmp_buf));
+        longjmp(comp->error.jumper, 1);
+    }
+
+    memcpy(comp->error.jumper, jumper, sizeof(jmp_buf));
+
+    lexFree(&comp->lex);
+    comp->lex           = state.lex;
+    comp->debug         = state.debug;
+    comp->blocks.module = state.module;
+
+    reloadPatchFuncs(comp, &state, oldModule);
+    reloadKeepGlobals(comp, &state, oldModule);
+    free(state.oldIdents);
+
+    compilerUpdateGlobals(comp, &comp->vm);
+}
+
+
+void compilerUpdateGlobals(Compiler *comp, VM *vm)
+{
+    // A VM that was running the program before a reload gets the new global variables, including the copies of the kept ones
+    int size = vm->globalsSize;
+    if (size >= comp->idents.globalsSize)
+        return;
+
+    vmGrowGlobals(vm, comp->globals, comp->idents.globalsSize);
+
+    for (int i = 0; i < comp->numKeptGlobals; i++)
+        if (comp->keptGlobals[i].offset >= size)
+            vmCopyGlobal(vm, comp->keptGlobals[i].offset, comp->keptGlobals[i].oldOffset, comp->keptGlobals[i].type);
+}
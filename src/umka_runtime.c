@@ -44,6 +44,45 @@ void rtlfwrite(Slot *params, Slot *result)
 }
 
 
+void rtlfgetline(Slot *params, Slot *result)
+{
+    char *buf  = (char *)params[2].ptrVal;
+    int   size = params[1].intVal;
+    FILE *file = (FILE *)params[0].ptrVal;
+
+    // Read up to size bytes, stopping after a newline character. Unlike fgets(), null characters are allowed
+    int len = 0;
+    while (len < size)
+    {
+        int ch = getc(file);
+        if (ch == EOF)
+            break;
+
+        buf[len++] = ch;
+        if (ch == '\n')
+            break;
+    }
+
+    result->intVal = len;
+}
+
+
+void rtlsetvbuf(Slot *params, Slot *result)
+{
+    FILE *file = (FILE *)params[1].ptrVal;
+    int   size = params[0].intVal;
+
+    result->intVal = setvbuf(file, NULL, (size > 0) ? _IOFBF : _IONBF, (size > 0) ? size : 0);
+}
+
+
+void rtlftell(Slot *params, Slot *result)
+{
+    FILE *file = (FILE *)params[0].ptrVal;
+    result->intVal = ftell(file);
+}
+
+
 void rtlfseek(Slot *params, Slot *result)
 {
     FILE *file   = (FILE *)params[2].ptrVal;
@@ -8,6 +8,9 @@ void rtlfopen  (Slot *params, Slot *result);
 void rtlfclose (Slot *params, Slot *result);
 void rtlfread  (Slot *params, Slot *result);
 void rtlfwrite (Slot *params, Slot *result);
+void rtlfgetline(Slot *params, Slot *result);
+void rtlsetvbuf(Slot *params, Slot *result);
+void rtlftell  (Slot *params, Slot *result);
 void rtlfseek  (Slot *params, Slot *result);
 void rtlremove (Slot *params, Slot *result);
 void rtltime   (Slot *params, Slot *result);
@@ -1,3 +1,4 @@
+#include <stdio.h>
 #include <string.h>
 
 #include "umka_stmt.h"
@@ -34,15 +35,97 @@ static void doGarbageCollectionDownToBlock(Compiler *comp, int block)
 }
 
 
-void doResolveExtern(Compiler *comp)
+static Type *doParseExternSignature(Compiler *comp, Ident *ident, External *external)
 {
-    for (Ident *ident = comp->idents.first; ident; ident = ident->next)
+    // Save context
+    int currentModule       = comp->blocks.module;
+    DebugInfo currentDebug  = comp->debug;
+    Lexer currentLex        = comp->lex;
+
+    // The signature is parsed in the module of the prototype, so that it can refer to the types declared there
+    lexInit(&comp->lex, &comp->storage, &comp->debug, external->name, external->signature, strlen(external->signature), &comp->error);
+    comp->blocks.module = ident->module;
+
+    lexNext(&comp->lex);
+    Type *type = parseType(comp, NULL);
+    lexCheck(&comp->lex, TOK_EOF);
+
+    // Restore context
+    lexFree(&comp->lex);
+    comp->lex               = currentLex;
+    comp->debug             = currentDebug;
+    comp->blocks.module     = currentModule;
+
+    return type;
+}
+
+
+static void doResolveExternTyped(Compiler *comp, Ident *ident, External *external)
+{
+    Signature *sig = &ident->type->sig;
+    Type *type = doParseExternSignature(comp, ident, external);
+
+    // Parameter names and default values may differ, types may not
+    bool match = type->kind == TYPE_FN && type->sig.numParams == sig->numParams && type->sig.numResults == sig->numResults;
+
+    for (int i = 0; match && i < sig->numParams; i++)
+        match = typeEquivalent(type->sig.param[i]->type, sig->param[i]->type);
+
+    for (int i = 0; match && i < sig->numResults; i++)
+        match = typeEquivalent(type->sig.resultType[i], sig->resultType[i]);
+
+    if (!match)
+        comp->error.handler(comp->error.context, "Prototype of %s does not match its signature %s", ident->name, external->signature);
+
+    // Parameter layout: the first parameter is pushed first, so it has the highest address
+    int paramSizeTotal = typeParamSizeTotal(&comp->types, sig);
+
+    external->numParams = sig->numParams;
+    external->resultOffset = -1;
+    external->frame = false;
+
+    if (typeStructured(sig->resultType[0]))
+    {
+        external->numParams--;
+        external->resultOffset = paramSizeTotal - typeParamSizeUpTo(&comp->types, sig, sig->numParams - 1);
+    }
+
+    for (int i = 0; i < external->numParams; i++)
+    {
+        external->paramOffset[i] = paramSizeTotal - typeParamSizeUpTo(&comp->types, sig, i);
+        external->paramStructured[i] = typeStructured(sig->param[i]->type);
+
+        // The __result pointer is not among them, as it refers to the caller's stack and needs no garbage collection
+        if (typeGarbageCollected(sig->param[i]->type))
+            external->frame = true;
+    }
+}
+
+
+void doResolveExtern(Compiler *comp, Ident *first)
+{
+    // The prototypes before the first identifier have already been resolved
+    for (Ident *ident = first; ident; ident = ident->next)
         if (ident->prototypeOffset >= 0)
         {
             External *external = externalFind(&comp->externals, ident->name);
             if (!external)
                 comp->error.handler(comp->error.context, "Unresolved prototype of %s", ident->name);
 
+            if (external->signature)
+                doResolveExternTyped(comp, ident, external);
+
+            int paramSlots = typeParamSizeTotal(&comp->types, &ident->type->sig) / sizeof(Slot);
+
+            // A typed external function whose parameters need no garbage collection is called without a stack frame
+            if (external->signature && !external->frame)
+            {
+                genEntryPoint(&comp->gen, ident->prototypeOffset);
+                genCallExternTyped(&comp->gen, external);
+                genReturn(&comp->gen, paramSlots);
+                continue;
+            }
+
             // All parameters must be declared since they may require garbage collection
             blocksEnter(&comp->blocks, ident);
             genEntryPoint(&comp->gen, ident->prototypeOffset);
@@ -51,13 +134,14 @@ void doResolveExtern(Compiler *comp)
             for (int i = 0; i < ident->type->sig.numParams; i++)
                 identAllocParam(&comp->idents, &comp->types, &comp->modules, &comp->blocks, &ident->type->sig, i);
 
-            genCallExtern(&comp->gen, external->entry);
+            if (external->signature)
+                genCallExternTyped(&comp->gen, external);
+            else
+                genCallExtern(&comp->gen, external->entry);
 
             doGarbageCollection(comp, blocksCurrent(&comp->blocks));
             identFree(&comp->idents, blocksCurrent(&comp->blocks));
             genLeaveFrameFixup(&comp->gen, 0);
-
-            int paramSlots = typeParamSizeTotal(&comp->types, &ident->type->sig) / sizeof(Slot);
             genReturn(&comp->gen, paramSlots);
 
             blocksLeave(&comp->blocks);
@@ -387,6 +471,123 @@ static void parseForHeader(Compiler *comp, TokenKind lookaheadTokKind)
 
 
 // forInHeader = [ident ","] ident "in" expr.
+static Ident *doFindGenerator(Compiler *comp)
+{
+    // Look ahead for a fiber function call: [ident "."] ident "("
+    if (comp->lex.tok.kind != TOK_IDENT)
+        return NULL;
+
+    Lexer lookaheadLex = comp->lex;
+
+    int module = moduleFind(&comp->modules, lookaheadLex.tok.name);
+    if (module >= 0)
+    {
+        lexNext(&lookaheadLex);
+        if (lookaheadLex.tok.kind != TOK_PERIOD)
+            return NULL;
+
+        lexNext(&lookaheadLex);
+        if (lookaheadLex.tok.kind != TOK_IDENT)
+            return NULL;
+    }
+    else
+        module = comp->blocks.module;
+
+    Ident *ident = identFind(&comp->idents, &comp->modules, &comp->blocks, module, lookaheadLex.tok.name, NULL);
+    if (!ident || ident->kind != IDENT_CONST || !typeFiberFunc(ident->type))
+        return NULL;
+
+    lexNext(&lookaheadLex);
+    if (lookaheadLex.tok.kind != TOK_LPAR)
+        return NULL;
+
+    return ident;
+}
+
+
+static void parseForInGeneratorHeader(Compiler *comp, Ident *indexIdent, char *itemName)
+{
+    // Generator: fn (parent: ^fiber, item: ^type). The item is initialized with the optional expr and updated by each "yield"
+    Ident *generator = parseQualIdent(comp);
+    lexNext(&comp->lex);
+
+    Type *itemPtrType = generator->type->sig.param[1]->type;
+    Type *itemType = itemPtrType->base;
+
+    // Allocate the item on the heap, so that the generator does not pin the current fiber's stack
+    IdentName tempName;
+    identTempVarName(&comp->idents, tempName);
+    Ident *itemPtrIdent = identAllocVar(&comp->idents, &comp->types, &comp->modules, &comp->blocks, tempName, itemPtrType, false);
+
+    genPushIntConst(&comp->gen, typeSize(&comp->types, itemType));
+    genCallBuiltin(&comp->gen, TYPE_PTR, BUILTIN_NEW);
+    doPushVarPtr(comp, itemPtrIdent);
+    genSwapAssign(&comp->gen, TYPE_PTR, 0);
+
+    // "(" [expr] ")"
+    lexEat(&comp->lex, TOK_LPAR);
+
+    if (comp->lex.tok.kind != TOK_RPAR)
+    {
+        doPushVarPtr(comp, itemPtrIdent);
+        genDeref(&comp->gen, TYPE_PTR);
+
+        Type *type;
+        parseExpr(comp, &type, NULL);
+        doImplicitTypeConv(comp, itemType, &type, NULL, false);
+        typeAssertCompatible(&comp->types, itemType, type, false);
+
+        genChangeRefCntAssign(&comp->gen, itemType);
+    }
+
+    lexEat(&comp->lex, TOK_RPAR);
+
+    // Spawn the generator fiber once before the loop
+    identTempVarName(&comp->idents, tempName);
+    Ident *fiberIdent = identAllocVar(&comp->idents, &comp->types, &comp->modules, &comp->blocks, tempName, comp->ptrFiberType, false);
+
+    doPushConst(comp, generator->type, &generator->constant);
+    doPushVarPtr(comp, itemPtrIdent);
+    genDeref(&comp->gen, TYPE_PTR);
+    genChangeRefCnt(&comp->gen, TOK_PLUSPLUS, itemPtrType);
+    genCallBuiltin(&comp->gen, TYPE_NONE, BUILTIN_FIBERSPAWN);
+    doPushVarPtr(comp, fiberIdent);
+    genSwapAssign(&comp->gen, TYPE_PTR, 0);
+
+    genForCondProlog(&comp->gen);
+
+    // Implicit conditional expr: resume the generator until it yields or returns, then check that it has yielded
+    doPushVarPtr(comp, fiberIdent);
+    genDeref(&comp->gen, TYPE_PTR);
+    genResume(&comp->gen);
+    genCallBuiltin(&comp->gen, TYPE_NONE, BUILTIN_FIBERALIVE);
+
+    genForCondEpilog(&comp->gen);
+
+    // Declare variable for generated item
+    Ident *itemIdent = identAllocVar(&comp->idents, &comp->types, &comp->modules, &comp->blocks, itemName, itemType, false);
+
+    // Implicit simpleStmt: index++, if the index is used
+    if (indexIdent)
+    {
+        doPushVarPtr(comp, indexIdent);
+        genUnary(&comp->gen, TOK_PLUSPLUS, TYPE_INT);
+    }
+
+    genForPostStmtEpilog(&comp->gen);
+
+    // Assign generated item to iteration variable
+    doPushVarPtr(comp, itemPtrIdent);
+    genDeref(&comp->gen, TYPE_PTR);
+
+    if (!typeStructured(itemType))
+        genDeref(&comp->gen, itemType->kind);
+
+    doPushVarPtr(comp, itemIdent);
+    genSwapChangeRefCntAssign(&comp->gen, itemType);
+}
+
+
 static void parseForInHeader(Compiler *comp, TokenKind lookaheadTokKind)
 {
     Ident *indexIdent = NULL, *itemIdent = NULL;
@@ -417,6 +618,12 @@ static void parseForInHeader(Compiler *comp, TokenKind lookaheadTokKind)
     lexNext(&comp->lex);
     lexEat(&comp->lex, TOK_IN);
 
+    if (doFindGenerator(comp))
+    {
+        parseForInGeneratorHeader(comp, (lookaheadTokKind == TOK_COMMA) ? indexIdent : NULL, itemName);
+        return;
+    }
+
     genForCondProlog(&comp->gen);
 
     // Additional scope embracing expr (needed for timely garbage collection in expr, since it is computed at each iteration)
@@ -631,7 +838,45 @@ static void parseReturnStmt(Compiler *comp)
 }
 
 
-// stmt = decl | block | simpleStmt | ifStmt | switchStmt | forStmt | breakStmt | continueStmt | returnStmt.
+// yieldStmt = "yield" [expr].
+static void parseYieldStmt(Compiler *comp)
+{
+    lexEat(&comp->lex, TOK_YIELD);
+
+    if (comp->lex.tok.kind != TOK_SEMICOLON && comp->lex.tok.kind != TOK_RBRACE)
+    {
+        // Get function type
+        Type *fnType = NULL;
+        for (int i = comp->blocks.top; i >= 1; i--)
+            if (comp->blocks.item[i].fn)
+            {
+                fnType = comp->blocks.item[i].fn->type;
+                break;
+            }
+
+        if (!fnType || !typeFiberFunc(fnType))
+            comp->error.handler(comp->error.context, "Value can only be yielded from a fiber function");
+
+        // Assign expr to the item pointed to by the second parameter
+        Type *itemType = fnType->sig.param[1]->type->base;
+        int itemPtrOffset = typeParamSizeTotal(&comp->types, &fnType->sig) - typeParamSizeUpTo(&comp->types, &fnType->sig, 1) + 2 * sizeof(Slot);
+
+        genPushLocalPtr(&comp->gen, itemPtrOffset);
+        genDeref(&comp->gen, TYPE_PTR);
+
+        Type *type;
+        parseExpr(comp, &type, NULL);
+        doImplicitTypeConv(comp, itemType, &type, NULL, false);
+        typeAssertCompatible(&comp->types, itemType, type, false);
+
+        genChangeRefCntAssign(&comp->gen, itemType);
+    }
+
+    genYield(&comp->gen);
+}
+
+
+// stmt = decl | block | simpleStmt | ifStmt | switchStmt | forStmt | breakStmt | continueStmt | returnStmt | yieldStmt.
 static void parseStmt(Compiler *comp)
 {
     switch (comp->lex.tok.kind)
@@ -654,6 +899,7 @@ static void parseStmt(Compiler *comp)
         case TOK_BREAK:     parseBreakStmt(comp);       break;
         case TOK_CONTINUE:  parseContinueStmt(comp);    break;
         case TOK_RETURN:    parseReturnStmt(comp);      break;
+        case TOK_YIELD:     parseYieldStmt(comp);       break;
 
         default: break;
     }
@@ -689,12 +935,38 @@ static void parseBlock(Compiler *comp)
 }
 
 
+static char *doFnName(Compiler *comp, Ident *fn)
+{
+    // Function name for stack traces: methods are prefixed with the receiver base type name, function literals get the name
+    // of the enclosing function, if any
+    char name[2 * DEFAULT_STR_LEN + 16];
+
+    if (fn->type->sig.method)
+    {
+        Type *rcvType = fn->type->sig.param[0]->type;
+        if (rcvType->kind == TYPE_PTR)
+            rcvType = rcvType->base;
+
+        snprintf(name, sizeof(name), "%s.%s", rcvType->typeIdent ? rcvType->typeIdent->name : "", fn->name);
+    }
+    else if (strncmp(fn->name, "__temp", 6) == 0)
+        snprintf(name, sizeof(name), "%s fn literal", comp->debug.fnName ? comp->debug.fnName : "<module>");
+    else
+        snprintf(name, sizeof(name), "%s", fn->name);
+
+    return storageAddStr(&comp->storage, name, &comp->error);
+}
+
+
 // fnBlock = block.
 void parseFnBlock(Compiler *comp, Ident *fn)
 {
     lexEat(&comp->lex, TOK_LBRACE);
     blocksEnter(&comp->blocks, fn);
 
+    char *outerFnName = comp->debug.fnName;
+    comp->debug.fnName = doFnName(comp, fn);
+
     bool mainFn = false;
     if (strcmp(fn->name, "main") == 0)
     {
@@ -735,16 +1007,15 @@ void parseFnBlock(Compiler *comp, Ident *fn)
     genLeaveFrameFixup(&comp->gen, comp->blocks.item[comp->blocks.top].localVarSize);
 
     if (mainFn)
-    {
-        doGarbageCollection(comp, 0);
         genHalt(&comp->gen);
-    }
     else
     {
         int paramSlots = typeParamSizeTotal(&comp->types, &fn->type->sig) / sizeof(Slot);
         genReturn(&comp->gen, paramSlots);
     }
 
+    comp->debug.fnName = outerFnName;
+
     blocksLeave(&comp->blocks);
     lexEat(&comp->lex, TOK_RBRACE);
 }
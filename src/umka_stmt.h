@@ -4,7 +4,7 @@
 #include "umka_compiler.h"
 
 
-void doResolveExtern(Compiler *comp);
+void doResolveExtern(Compiler *comp, Ident *first);
 
 void parseAssignmentStmt(Compiler *comp, Type *type, void *initializedVarPtr);
 void parseDeclAssignmentStmt(Compiler *comp, IdentName name, bool constExpr, bool exported);
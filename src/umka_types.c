@@ -32,6 +32,7 @@ static char *spelling [] =
     "struct",
     "interface",
     "fiber",
+    "chan",
     "fn"
 };
 
@@ -176,6 +177,7 @@ int typeSizeNoCheck(Type *type)
             return size;
         }
         case TYPE_FIBER:    return sizeof(Fiber);
+        case TYPE_CHAN:     return sizeof(Channel);
         case TYPE_FN:       return sizeof(int64_t);
         default:            return -1;
     }
@@ -232,8 +234,8 @@ bool typeEquivalent(Type *left, Type *right)
             return typeEquivalent(left->base, right->base);
         }
 
-        // Dynamic arrays
-        else if (left->kind == TYPE_DYNARRAY)
+        // Dynamic arrays or channels
+        else if (left->kind == TYPE_DYNARRAY || left->kind == TYPE_CHAN)
             return typeEquivalent(left->base, right->base);
 
         // Strings
@@ -547,10 +549,14 @@ static char *typeSpellingRecursive(Type *type, char *buf, int depth)
     {
         if (type->kind == TYPE_ARRAY)
             sprintf(buf, "[%d]", type->numItems);
+        else if (type->kind == TYPE_CHAN)
+            sprintf(buf, "%s ", spelling[type->kind]);
+        else if (type->kind == TYPE_PTR && type->base->kind == TYPE_CHAN)
+            buf[0] = 0;     // Channels are always represented by pointers
         else
             sprintf(buf, "%s", spelling[type->kind]);
 
-        if (type->kind == TYPE_PTR || type->kind == TYPE_ARRAY || type->kind == TYPE_DYNARRAY)
+        if (type->kind == TYPE_PTR || type->kind == TYPE_ARRAY || type->kind == TYPE_DYNARRAY || type->kind == TYPE_CHAN)
         {
             char baseBuf[DEFAULT_STR_LEN + 1];
             if (depth > 0)
@@ -33,6 +33,7 @@ typedef enum
     TYPE_STRUCT,
     TYPE_INTERFACE,
     TYPE_FIBER,
+    TYPE_CHAN,          // Base type for channel pointers only
     TYPE_FN
 } TypeKind;
 
@@ -100,6 +101,7 @@ typedef struct
 
 void typeInit(Types *types, Error *error);
 void typeFree(Types *types, int startBlock /* < 0 to free in all blocks*/);
+void typeFreeFieldsAndParams(Type *type);
 
 Type *typeAdd       (Types *types, Blocks *blocks, TypeKind kind);
 void typeDeepCopy   (Type *dest, Type *src);
@@ -156,7 +158,7 @@ static inline bool typeStructured(Type *type)
 static inline bool typeKindGarbageCollected(TypeKind typeKind)
 {
     return typeKind == TYPE_PTR    || typeKind == TYPE_STR       || typeKind == TYPE_ARRAY  || typeKind == TYPE_DYNARRAY ||
-           typeKind == TYPE_STRUCT || typeKind == TYPE_INTERFACE || typeKind == TYPE_FIBER;
+           typeKind == TYPE_STRUCT || typeKind == TYPE_INTERFACE || typeKind == TYPE_FIBER    || typeKind == TYPE_CHAN;
 }
 
 
@@ -169,6 +171,12 @@ static inline bool typeCharArrayPtr(Type *type)
 }
 
 
+static inline bool typeChannel(Type *type)
+{
+    return type->kind == TYPE_PTR && type->base->kind == TYPE_CHAN;
+}
+
+
 static inline bool typeFiberFunc(Type *type)
 {
     return type->kind                            == TYPE_FN    &&
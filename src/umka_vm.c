@@ -4,20 +4,28 @@
 #include <stdlib.h>
 #include <string.h>
 #include <stdint.h>
+#include <stddef.h>
 #include <stdarg.h>
 #include <math.h>
 #include <limits.h>
 
+#ifndef _WIN32
+    #include <unistd.h>
+#endif
+
 #include "umka_vm.h"
 
 //#define DEBUG_REF_CNT
 
 
+
+
 static char *opcodeSpelling [] =
 {
     "NOP",
     "PUSH",
     "PUSH_LOCAL_PTR",
+    "PUSH_GLOBAL_PTR",
     "PUSH_REG",
     "PUSH_STRUCT",
     "POP",
@@ -38,7 +46,10 @@ static char *opcodeSpelling [] =
     "GOTO_IF",
     "CALL",
     "CALL_EXTERN",
+    "CALL_EXTERN_TYPED",
     "CALL_BUILTIN",
+    "RESUME",
+    "YIELD",
     "RETURN",
     "ENTER_FRAME",
     "LEAVE_FRAME",
@@ -71,12 +82,29 @@ static char *builtinSpelling [] =
     "makefrom",
     "append",
     "delete",
+    "insert",
+    "appendall",
+    "copy",
+    "fill",
+    "resize",
+    "reserve",
+    "sort",
+    "bsearch",
+    "slice",
     "len",
     "sizeof",
     "sizeofself",
     "fiberspawn",
     "fibercall",
     "fiberalive",
+    "fiberstart",
+    "fiberwait",
+    "parfor",
+    "makechan",
+    "send",
+    "recv",
+    "select",
+    "close",
     "repr",
     "error"
 };
@@ -84,26 +112,43 @@ static char *builtinSpelling [] =
 
 // Memory management
 
+static int atomicAdd(int *val, int delta, bool shared)
+{
+    if (shared)
+        return __atomic_add_fetch(val, delta, __ATOMIC_ACQ_REL);
+    return *val += delta;
+}
+
+
 static void pageInit(HeapPages *pages)
 {
     pages->first = pages->last = NULL;
+    pages->shared = false;
+    pthread_mutex_init(&pages->lock, NULL);
 }
 
 
-static void pageFree(HeapPages *pages)
+static void pageFreeChunkMemory(HeapPage *page);
+
+
+static void pageFree(HeapPages *pages, bool warnLeak)
 {
     HeapPage *page = pages->first;
     while (page)
     {
         HeapPage *next = page->next;
-        if (page->ptr)
-        {
+        if (warnLeak && page->refCnt > 0)
             printf("Memory leak at %p (%d refs)\n", page->ptr, page->refCnt);
-            free(page->ptr);
-        }
+
+        if (page->refCnt > 0)
+            pageFreeChunkMemory(page);
+
+        free(page->ptr);
+        free(page->chunkIndex);
         free(page);
         page = next;
     }
+    pthread_mutex_destroy(&pages->lock);
 }
 
 
@@ -112,6 +157,16 @@ static HeapPage *pageAdd(HeapPages *pages, int size)
     HeapPage *page = malloc(sizeof(HeapPage));
 
     page->ptr = malloc(size);
+    page->chunkIndex = malloc((size / VM_HEAP_GRANULE + 1) * sizeof(int));
+
+    if (!page->ptr || !page->chunkIndex)
+    {
+        free(page->ptr);
+        free(page->chunkIndex);
+        free(page);
+        return NULL;
+    }
+
     memset(page->ptr, 0, size);
     page->size = size;
     page->occupied = 0;
@@ -119,12 +174,12 @@ static HeapPage *pageAdd(HeapPages *pages, int size)
     page->prev = pages->last;
     page->next = NULL;
 
-    // Add to list
+    // Add to list. Other threads may be traversing the list at the same time
     if (!pages->first)
         pages->first = pages->last = page;
     else
     {
-        pages->last->next = page;
+        __atomic_store_n(&pages->last->next, page, __ATOMIC_RELEASE);
         pages->last = page;
     }
 
@@ -155,25 +210,64 @@ static void pageRemove(HeapPages *pages, HeapPage *page)
         page->next->prev = page->prev;
 
     free(page->ptr);
+    free(page->chunkIndex);
     free(page);
 }
 
 
-static HeapPage *pageFind(HeapPages *pages, void *ptr)
+static void pageCollect(HeapPages *pages)
+{
+    // Remove the empty pages that have been kept while the heap was shared
+    HeapPage *page = pages->first;
+    while (page)
+    {
+        HeapPage *next = page->next;
+        if (page->refCnt == 0 && !(page == pages->last && page->size == VM_MIN_HEAP_PAGE))
+            pageRemove(pages, page);
+        page = next;
+    }
+}
+
+
+static HeapChunkHeader *pageFindChunk(HeapPage *page, void *ptr)
+{
+    // The index gives the chunk that covers the start of the granule of ptr. Since no chunk is shorter than its header,
+    // the chunk that covers ptr is at most a few chunks further. Page layout: header, data, footer (char), header, data, footer (char)...
+    void *chunkPtr = page->ptr + page->chunkIndex[(ptr - page->ptr) / VM_HEAP_GRANULE];
+    while (1)
+    {
+        HeapChunkHeader *chunk = chunkPtr;
+        void *next = chunkPtr + sizeof(HeapChunkHeader) + align(chunk->size + 1, sizeof(int64_t));
+        if (ptr < next)
+            return chunk;
+        chunkPtr = next;
+    }
+}
+
+
+static HeapPage *pageFindForInterior(HeapPages *pages, void *ptr, HeapChunkHeader **chunk)
 {
-    for (HeapPage *page = pages->first; page; page = page->next)
-        if (ptr >= page->ptr && ptr < page->ptr + page->occupied)
+    // Also accepts pointers into the middle of a chunk, e.g., slice data pointers, but not into its header
+    for (HeapPage *page = pages->first; page; page = __atomic_load_n(&page->next, __ATOMIC_ACQUIRE))
+        if (ptr >= page->ptr && ptr < page->ptr + __atomic_load_n(&page->occupied, __ATOMIC_ACQUIRE))
         {
-            HeapChunkHeader *chunk = ptr - sizeof(HeapChunkHeader);
-            if (chunk->magic == VM_HEAP_CHUNK_MAGIC)
-                return page;
-            return NULL;
+            *chunk = pageFindChunk(page, ptr);
+            return (ptr >= (void *)(*chunk) + sizeof(HeapChunkHeader)) ? page : NULL;
         }
 
     return NULL;
 }
 
 
+static HeapPage *pageFind(HeapPages *pages, void *ptr)
+{
+    // Only accepts pointers to the start of a chunk. The chunk is never guessed from the bytes before ptr, which may be script data
+    HeapChunkHeader *chunk;
+    HeapPage *page = pageFindForInterior(pages, ptr, &chunk);
+    return (page && ptr == (void *)chunk + sizeof(HeapChunkHeader)) ? page : NULL;
+}
+
+
 static void *chunkAlloc(HeapPages *pages, int size, Error *error)
 {
     if (size < 0)
@@ -183,16 +277,35 @@ static void *chunkAlloc(HeapPages *pages, int size, Error *error)
     int chunkSize = sizeof(HeapChunkHeader) + align(size + 1, sizeof(int64_t));
     int pageSize = chunkSize > VM_MIN_HEAP_PAGE ? chunkSize : VM_MIN_HEAP_PAGE;
 
+    if (pages->shared)
+        pthread_mutex_lock(&pages->lock);
+
     if (!pages->last || pages->last->occupied + chunkSize > pages->last->size)
-        pageAdd(pages, pageSize);
+    {
+        if (!pageAdd(pages, pageSize))
+        {
+            if (pages->shared)
+                pthread_mutex_unlock(&pages->lock);
+            error->handlerRuntime(error->context, "Out of memory");
+        }
+    }
+
+    HeapPage *page = pages->last;
+    for (int granule = (page->occupied + VM_HEAP_GRANULE - 1) / VM_HEAP_GRANULE; granule * VM_HEAP_GRANULE < page->occupied + chunkSize; granule++)
+        page->chunkIndex[granule] = page->occupied;
 
     HeapChunkHeader *chunk = pages->last->ptr + pages->last->occupied;
     chunk->magic = VM_HEAP_CHUNK_MAGIC;
     chunk->refCnt = 1;
     chunk->size = size;
+    chunk->dynArray = false;
+    chunk->kind = CHUNK_DATA;
+
+    __atomic_store_n(&pages->last->occupied, pages->last->occupied + chunkSize, __ATOMIC_RELEASE);
+    atomicAdd(&pages->last->refCnt, 1, pages->shared);
 
-    pages->last->occupied += chunkSize;
-    pages->last->refCnt++;
+    if (pages->shared)
+        pthread_mutex_unlock(&pages->lock);
 
 #ifdef DEBUG_REF_CNT
     printf("Add chunk at %p\n", (void *)chunk + sizeof(HeapChunkHeader));
@@ -202,23 +315,165 @@ static void *chunkAlloc(HeapPages *pages, int size, Error *error)
 }
 
 
-static void chunkChangeRefCnt(HeapPages *pages, HeapPage *page, void *ptr, int delta)
+static void pageChangeRefCnt(HeapPages *pages, HeapPage *page, int delta)
+{
+    if (atomicAdd(&page->refCnt, delta, pages->shared) > 0)
+        return;
+
+    if (pages->shared)
+        pthread_mutex_lock(&pages->lock);
+
+    // The last page is kept and lazily cleared, since short-lived chunks, e.g., fibers spawned in a loop, would otherwise
+    // allocate and clear a whole new page every time. If the heap is shared, other threads may be traversing the page list,
+    // so the other empty pages are removed later by pageCollect()
+    if (page->refCnt == 0)
+    {
+        if (page == pages->last && page->size == VM_MIN_HEAP_PAGE)
+        {
+            memset(page->ptr, 0, page->occupied);
+            __atomic_store_n(&page->occupied, 0, __ATOMIC_RELEASE);
+        }
+        else if (!pages->shared)
+            pageRemove(pages, page);
+    }
+
+    if (pages->shared)
+        pthread_mutex_unlock(&pages->lock);
+}
+
+
+static int chunkChangeRefCntOnly(HeapPages *pages, void *ptr, int delta)
 {
+    // Return the new chunk ref count or -1 if the chunk has already been released.
+    // If the heap is shared, only one thread gets the zero ref count and thus traverses the chunk children
     HeapChunkHeader *chunk = ptr - sizeof(HeapChunkHeader);
+    int refCnt = __atomic_load_n(&chunk->refCnt, __ATOMIC_ACQUIRE);
 
     // TODO: double-check the suspicious condition
-    if (chunk->refCnt > 0)
+    if (pages->shared)
+    {
+        do
+        {
+            if (refCnt <= 0)
+                return -1;
+        } while (!__atomic_compare_exchange_n(&chunk->refCnt, &refCnt, refCnt + delta, false, __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE));
+    }
+    else
     {
-        chunk->refCnt += delta;
-        page->refCnt += delta;
+        if (refCnt <= 0)
+            return -1;
+        chunk->refCnt = refCnt + delta;
+    }
 
 #ifdef DEBUG_REF_CNT
-        printf("%p: delta: %d  chunk: %d  page: %d\n", ptr, delta, chunk->refCnt, page->refCnt);
+    printf("%p: delta: %d  chunk: %d\n", ptr, delta, refCnt + delta);
 #endif
+
+    return refCnt + delta;
+}
+
+
+static void chunkChangeRefCnt(HeapPages *pages, HeapPage *page, void *ptr, int delta)
+{
+    if (chunkChangeRefCntOnly(pages, ptr, delta) >= 0)
+        pageChangeRefCnt(pages, page, delta);
+}
+
+
+static void stackPoolInit(FiberStackPool *pool)
+{
+    pool->numStacks = 0;
+    pthread_mutex_init(&pool->lock, NULL);
+}
+
+
+static void stackPoolFree(FiberStackPool *pool)
+{
+    for (int i = 0; i < pool->numStacks; i++)
+        free(pool->stack[i]);
+    pool->numStacks = 0;
+    pthread_mutex_destroy(&pool->lock);
+}
+
+
+static Slot *stackAlloc(FiberStackPool *pool, int size)
+{
+    // Only the stacks of the initial size are reused. They are not cleared, since all local variables are zeroed when a stack frame is entered
+    Slot *stack = NULL;
+
+    if (size == VM_FIBER_STACK)
+    {
+        pthread_mutex_lock(&pool->lock);
+        if (pool->numStacks > 0)
+            stack = pool->stack[--pool->numStacks];
+        pthread_mutex_unlock(&pool->lock);
     }
 
-    if (page->refCnt == 0)
-        pageRemove(pages, page);
+    return stack ? stack : malloc(size * sizeof(Slot));
+}
+
+
+static void stackFree(FiberStackPool *pool, Slot *stack, int size)
+{
+    if (size == VM_FIBER_STACK)
+    {
+        pthread_mutex_lock(&pool->lock);
+        if (pool->numStacks < VM_FIBER_STACK_POOL)
+        {
+            pool->stack[pool->numStacks++] = stack;
+            stack = NULL;
+        }
+        pthread_mutex_unlock(&pool->lock);
+    }
+
+    free(stack);
+}
+
+
+static void fiberFreeStack(Fiber *fiber)
+{
+    // Each stack segment ends with a header that refers to the previous segment
+    Slot *stack = fiber->stack;
+    int stackSize = fiber->stackSize;
+
+    for (int i = 0; i < fiber->numSegments; i++)
+    {
+        Slot *header = stack + stackSize - VM_SEGMENT_HEADER;
+        Slot *prevStack = (Slot *)header[2].ptrVal;
+        int prevStackSize = header[1].intVal;
+
+        stackFree(fiber->stackPool, stack, stackSize);
+        stack = prevStack;
+        stackSize = prevStackSize;
+    }
+
+    stackFree(fiber->stackPool, stack, stackSize);
+
+    if (fiber->spareSegment)
+        stackFree(fiber->stackPool, fiber->spareSegment, fiber->spareSegmentSize);
+}
+
+
+static void pageFreeChunkMemory(HeapPage *page)
+{
+    // The live fibers and channels of a discarded heap still own their stacks and waiter arrays
+    // Page layout: header, data, footer (char), header, data, footer (char)...
+    void *chunkPtr = page->ptr;
+    while (chunkPtr < page->ptr + page->occupied)
+    {
+        HeapChunkHeader *chunk = chunkPtr;
+        void *data = chunkPtr + sizeof(HeapChunkHeader);
+
+        if (chunk->magic == VM_HEAP_CHUNK_MAGIC && chunk->refCnt > 0)
+        {
+            if (chunk->kind == CHUNK_FIBER)
+                fiberFreeStack((Fiber *)data);
+            else if (chunk->kind == CHUNK_CHAN)
+                free(((Channel *)data)->waiter);
+        }
+
+        chunkPtr = data + align(chunk->size + 1, sizeof(int64_t));
+    }
 }
 
 
@@ -250,688 +505,2378 @@ static int fsscanf(bool string, void *stream, const char *format, ...)
 
 // Virtual machine
 
-void vmInit(VM *vm, int stackSize, Error *error)
+static void vmLoop(VM *vm);
+static void doParfor(VM *vm, ParforJob *job);
+
+
+// Fiber scheduler
+
+static void queueInit(FiberQueue *queue)
 {
-    vm->fiber = malloc(sizeof(Fiber));
-    vm->fiber->stack = malloc(stackSize * sizeof(Slot));
-    vm->fiber->stackSize = stackSize;
-    vm->fiber->alive = true;
-    pageInit(&vm->pages);
-    vm->error = error;
+    queue->fiber = NULL;
+    queue->capacity = queue->head = queue->len = 0;
+    pthread_mutex_init(&queue->lock, NULL);
 }
 
 
-void vmFree(VM *vm)
+static void queueFree(FiberQueue *queue)
 {
-    pageFree(&vm->pages);
-    free(vm->fiber->stack);
-    free(vm->fiber);
+    free(queue->fiber);
+    pthread_mutex_destroy(&queue->lock);
 }
 
 
-void vmReset(VM *vm, Instruction *code)
+static void queuePush(FiberQueue *queue, Fiber *fiber)
 {
-    vm->fiber->code = code;
-    vm->fiber->ip = 0;
-    vm->fiber->top = vm->fiber->base = vm->fiber->stack + vm->fiber->stackSize - 1;
+    pthread_mutex_lock(&queue->lock);
+
+    if (queue->len == queue->capacity)
+    {
+        int capacity = queue->capacity > 0 ? 2 * queue->capacity : 64;
+        Fiber **items = malloc(capacity * sizeof(Fiber *));
+
+        for (int i = 0; i < queue->len; i++)
+            items[i] = queue->fiber[(queue->head + i) % queue->capacity];
+
+        free(queue->fiber);
+        queue->fiber = items;
+        queue->capacity = capacity;
+        queue->head = 0;
+    }
+
+    queue->fiber[(queue->head + queue->len) % queue->capacity] = fiber;
+    queue->len++;
+
+    pthread_mutex_unlock(&queue->lock);
 }
 
 
-static void doBasicSwap(Slot *slot)
+static Fiber *queuePop(FiberQueue *queue, bool steal)
 {
-    Slot val = slot[0];
-    slot[0] = slot[1];
-    slot[1] = val;
+    // The owner takes fibers from the head, so that the yielding fibers run in turn, while other workers steal from the tail
+    Fiber *fiber = NULL;
+    pthread_mutex_lock(&queue->lock);
+
+    if (queue->len > 0)
+    {
+        if (steal)
+            fiber = queue->fiber[(queue->head + queue->len - 1) % queue->capacity];
+        else
+        {
+            fiber = queue->fiber[queue->head];
+            queue->head = (queue->head + 1) % queue->capacity;
+        }
+        queue->len--;
+    }
+
+    pthread_mutex_unlock(&queue->lock);
+    return fiber;
 }
 
 
-static void doBasicDeref(Slot *slot, TypeKind typeKind, Error *error)
+static int schedGetNumCores(void)
 {
-    if (!slot->ptrVal)
-        error->handlerRuntime(error->context, "Pointer is null");
+#ifdef _WIN32
+    char *numCoresStr = getenv("NUMBER_OF_PROCESSORS");
+    int numCores = numCoresStr ? atoi(numCoresStr) : 1;
+#else
+    int numCores = sysconf(_SC_NPROCESSORS_ONLN);
+#endif
 
-    switch (typeKind)
-    {
-        case TYPE_INT8:         slot->intVal  = *(int8_t   *)slot->ptrVal; break;
-        case TYPE_INT16:        slot->intVal  = *(int16_t  *)slot->ptrVal; break;
-        case TYPE_INT32:        slot->intVal  = *(int32_t  *)slot->ptrVal; break;
-        case TYPE_INT:          slot->intVal  = *(int64_t  *)slot->ptrVal; break;
-        case TYPE_UINT8:        slot->intVal  = *(uint8_t  *)slot->ptrVal; break;
-        case TYPE_UINT16:       slot->intVal  = *(uint16_t *)slot->ptrVal; break;
-        case TYPE_UINT32:       slot->intVal  = *(uint32_t *)slot->ptrVal; break;
-        case TYPE_UINT:         slot->uintVal = *(uint64_t *)slot->ptrVal; break;
-        case TYPE_BOOL:         slot->intVal  = *(bool     *)slot->ptrVal; break;
-        case TYPE_CHAR:         slot->intVal  = *(char     *)slot->ptrVal; break;
-        case TYPE_REAL32:       slot->realVal = *(float    *)slot->ptrVal; break;
-        case TYPE_REAL:         slot->realVal = *(double   *)slot->ptrVal; break;
-        case TYPE_PTR:
-        case TYPE_STR:          slot->ptrVal  = (int64_t)(*(void *   *)slot->ptrVal); break;
-        case TYPE_ARRAY:
-        case TYPE_DYNARRAY:
-        case TYPE_STRUCT:
-        case TYPE_INTERFACE:
-        case TYPE_FIBER:        break;  // Always represented by pointer, not dereferenced
-        case TYPE_FN:           slot->intVal  = *(int64_t  *)slot->ptrVal; break;
+    if (numCores < 1)
+        numCores = 1;
+    if (numCores > VM_MAX_WORKERS)
+        numCores = VM_MAX_WORKERS;
+    return numCores;
+}
 
-        default:                error->handlerRuntime(error->context, "Illegal type"); return;
+
+static void schedPut(Scheduler *sched, int workerIndex, Fiber *fiber)
+{
+    queuePush(&sched->worker[workerIndex].queue, fiber);
+    __atomic_add_fetch(&sched->numQueued, 1, __ATOMIC_SEQ_CST);
+
+    if (__atomic_load_n(&sched->numSleeping, __ATOMIC_SEQ_CST) > 0)
+    {
+        pthread_mutex_lock(&sched->lock);
+        pthread_cond_signal(&sched->wake);
+        pthread_mutex_unlock(&sched->lock);
     }
 }
 
 
-static void doBasicAssign(void *lhs, Slot rhs, TypeKind typeKind, int structSize, Error *error)
+static Fiber *schedTake(Scheduler *sched, int workerIndex)
 {
-    if (!lhs)
-        error->handlerRuntime(error->context, "Pointer is null");
+    while (!__atomic_load_n(&sched->terminate, __ATOMIC_ACQUIRE))
+    {
+        // Take a fiber from the own queue of the worker or steal it from another worker
+        for (int i = 0; i < sched->numWorkers; i++)
+        {
+            Fiber *fiber = queuePop(&sched->worker[(workerIndex + i) % sched->numWorkers].queue, i > 0);
+            if (fiber)
+            {
+                __atomic_sub_fetch(&sched->numQueued, 1, __ATOMIC_SEQ_CST);
+                return fiber;
+            }
+        }
 
-    Const rhsConstant = {.intVal = rhs.intVal};
-    if (typeOverflow(typeKind, rhsConstant))
-        error->handlerRuntime(error->context, "Overflow in assignment to %s", typeKindSpelling(typeKind));
+        // Sleep until any fiber is queued
+        pthread_mutex_lock(&sched->lock);
+        __atomic_add_fetch(&sched->numSleeping, 1, __ATOMIC_SEQ_CST);
 
-    switch (typeKind)
-    {
-        case TYPE_INT8:         *(int8_t   *)lhs = rhs.intVal;  break;
-        case TYPE_INT16:        *(int16_t  *)lhs = rhs.intVal;  break;
-        case TYPE_INT32:        *(int32_t  *)lhs = rhs.intVal;  break;
-        case TYPE_INT:          *(int64_t  *)lhs = rhs.intVal;  break;
-        case TYPE_UINT8:        *(uint8_t  *)lhs = rhs.intVal;  break;
-        case TYPE_UINT16:       *(uint16_t *)lhs = rhs.intVal;  break;
-        case TYPE_UINT32:       *(uint32_t *)lhs = rhs.intVal;  break;
-        case TYPE_UINT:         *(uint64_t *)lhs = rhs.uintVal; break;
-        case TYPE_BOOL:         *(bool     *)lhs = rhs.intVal;  break;
-        case TYPE_CHAR:         *(char     *)lhs = rhs.intVal;  break;
-        case TYPE_REAL32:       *(float    *)lhs = rhs.realVal; break;
-        case TYPE_REAL:         *(double   *)lhs = rhs.realVal; break;
-        case TYPE_PTR:
-        case TYPE_STR:          *(void *   *)lhs = (void *)rhs.ptrVal; break;
-        case TYPE_ARRAY:
-        case TYPE_DYNARRAY:
-        case TYPE_STRUCT:
-        case TYPE_INTERFACE:
-        case TYPE_FIBER:        memcpy(lhs, (void *)rhs.ptrVal, structSize); break;
-        case TYPE_FN:           *(int64_t  *)lhs = rhs.intVal; break;
+        while (__atomic_load_n(&sched->numQueued, __ATOMIC_SEQ_CST) == 0 && !sched->terminate)
+            pthread_cond_wait(&sched->wake, &sched->lock);
 
-        default:                error->handlerRuntime(error->context, "Illegal type"); return;
+        __atomic_sub_fetch(&sched->numSleeping, 1, __ATOMIC_SEQ_CST);
+        pthread_mutex_unlock(&sched->lock);
     }
+    return NULL;
 }
 
 
-static void doBasicChangeRefCnt(Fiber *fiber, HeapPages *pages, void *ptr, Type *type, TokenKind tokKind, Error *error)
+static void fiberRelease(HeapPages *pages, Fiber *fiber)
 {
-    // Update ref counts for pointers (including static/dynamic array items and structure/interface fields) if allocated dynamically
-    // Among garbage collected types, all types except the pointer and string types are represented by pointers by default
-    // RTTI is required for lists, trees, etc., since the propagation depth for the root ref count is unknown at compile time
+    HeapPage *page = pageFind(pages, fiber);
+    int refCnt = chunkChangeRefCntOnly(pages, fiber, -1);
+    if (refCnt == 0)
+        fiberFreeStack(fiber);
+    if (refCnt >= 0)
+        pageChangeRefCnt(pages, page, -1);
+}
 
-    switch (type->kind)
+
+static void workerRuntimeError(void *context, const char *format, ...)
+{
+    va_list args;
+    va_start(args, format);
+
+    Worker *worker = context;
+    Instruction *instr = &worker->vm.fiber->code[worker->vm.fiber->ip];
+
+    snprintf(worker->error.fileName, sizeof(worker->error.fileName), "%s", instr->debug.fileName);
+    worker->error.line = instr->debug.line;
+    worker->error.pos = 1;
+    vsnprintf(worker->error.msg, sizeof(worker->error.msg), format, args);
+    worker->error.traceLen = vmGetStackTrace(&worker->vm, worker->error.trace, MAX_STACK_TRACE);
+
+    va_end(args);
+    longjmp(worker->error.jumper, 1);
+}
+
+
+static void *workerRun(void *data)
+{
+    Worker *worker = data;
+    Scheduler *sched = worker->scheduler;
+    Fiber *fiber;
+
+    while ((fiber = schedTake(sched, worker->vm.workerIndex)))
     {
-        case TYPE_PTR:
+        // Run the fiber until it yields or returns
+        worker->vm.fiber = fiber;
+        worker->vm.callbackDepth = 0;
+        worker->vm.externDepth = 0;
+
+        if (setjmp(worker->error.jumper) != 0)
         {
-            HeapPage *page = pageFind(pages, ptr);
-            if (page && !type->weak)
+            // Errors in a parallel loop are reported by the thread that runs the loop
+            pthread_mutex_lock(&sched->lock);
+            if (fiber->job)
             {
-                if (tokKind == TOK_PLUSPLUS)
-                    chunkChangeRefCnt(pages, page, ptr, 1);
-                else
+                if (!fiber->job->failed)
                 {
-                    // Traverse children only before removing the last remaining ref
-                    HeapChunkHeader *chunk = ptr - sizeof(HeapChunkHeader);
-                    if (chunk->refCnt == 1 && typeKindGarbageCollected(type->base->kind))
-                    {
-                        void *data = ptr;
-                        if (type->base->kind == TYPE_PTR || type->base->kind == TYPE_STR)
-                            data = *(void **)data;
-
-                        doBasicChangeRefCnt(fiber, pages, data, type->base, tokKind, error);
-                    }
-                    chunkChangeRefCnt(pages, page, ptr, -1);
+                    fiber->job->failure = worker->error;
+                    __atomic_store_n(&fiber->job->failed, true, __ATOMIC_RELEASE);
                 }
             }
-            break;
-        }
+            else if (!sched->failed)
+            {
+                sched->failure = worker->error;
+                sched->failed = true;
+            }
+            pthread_mutex_unlock(&sched->lock);
 
-        case TYPE_STR:
+            __atomic_store_n(&fiber->alive, false, __ATOMIC_RELEASE);
+        }
+        else if (fiber->job)
         {
-            HeapPage *page = pageFind(pages, ptr);
-            if (page)
-                chunkChangeRefCnt(pages, page, ptr, (tokKind == TOK_PLUSPLUS) ? 1 : -1);
-            break;
+            doParfor(&worker->vm, fiber->job);
+            __atomic_store_n(&fiber->alive, false, __ATOMIC_RELEASE);
         }
+        else
+            vmLoop(&worker->vm);
 
-        case TYPE_ARRAY:
+        if (fiber->alive)
         {
-            if (typeKindGarbageCollected(type->base->kind))
-            {
-                void *itemPtr = ptr;
-                int itemSize = typeSizeNoCheck(type->base);
+            // A fiber blocked on a channel is not queued again until the channel wakes it up, unless it has already done so
+            FiberParkState parkState = FIBER_PARKING;
+            if (!__atomic_compare_exchange_n(&fiber->parkState, &parkState, FIBER_PARKED, false, __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE))
+                schedPut(sched, worker->vm.workerIndex, fiber);
+        }
+        else
+        {
+            // Release the ref held by the scheduler while the heap is still shared
+            ParforJob *job = fiber->job;
+            fiberRelease(worker->vm.pages, fiber);
+
+            pthread_mutex_lock(&sched->lock);
+            __atomic_sub_fetch(&sched->numActive, 1, __ATOMIC_SEQ_CST);
+            if (job)
+                job->numHelpers--;
+            pthread_cond_broadcast(&sched->finish);
+            pthread_mutex_unlock(&sched->lock);
+
+            // Fibers that are not scheduled and are blocked on a channel check whether the deadlock has occurred
+            pthread_mutex_lock(&sched->chanLock);
+            pthread_cond_broadcast(&sched->chanChange);
+            pthread_mutex_unlock(&sched->chanLock);
+        }
+    }
+    return NULL;
+}
 
-                for (int i = 0; i < type->numItems; i++)
-                {
-                    void *item = itemPtr;
-                    if (type->base->kind == TYPE_PTR || type->base->kind == TYPE_STR)
-                        item = *(void **)item;
 
-                    doBasicChangeRefCnt(fiber, pages, item, type->base, tokKind, error);
-                    itemPtr += itemSize;
-                }
-            }
-            break;
-        }
+static void schedInit(VM *vm)
+{
+    // Worker threads are started when the first fiber is scheduled
+    Scheduler *sched = malloc(sizeof(Scheduler));
+    vm->scheduler = sched;
+
+    sched->numWorkers = schedGetNumCores();
+    sched->nextWorker = 0;
+    sched->numQueued = sched->numSleeping = sched->numActive = 0;
+    sched->terminate = sched->failed = false;
+
+    pthread_mutex_init(&sched->lock, NULL);
+    pthread_cond_init(&sched->wake, NULL);
+    pthread_cond_init(&sched->finish, NULL);
+    pthread_mutex_init(&sched->chanLock, NULL);
+    pthread_cond_init(&sched->chanChange, NULL);
+
+    for (int i = 0; i < sched->numWorkers; i++)
+    {
+        Worker *worker = &sched->worker[i];
 
-        case TYPE_DYNARRAY:
-        {
-            DynArray *array = (DynArray *)ptr;
-            HeapPage *page = pageFind(pages, array->data);
-            if (page)
-            {
-                if (tokKind == TOK_PLUSPLUS)
-                    chunkChangeRefCnt(pages, page, array->data, 1);
-                else
-                {
-                    // Traverse children only before removing the last remaining ref
-                    HeapChunkHeader *chunk = array->data - sizeof(HeapChunkHeader);
-                    if (chunk->refCnt == 1 && typeKindGarbageCollected(type->base->kind))
-                    {
-                        void *itemPtr = array->data;
+        worker->vm = *vm;
+        worker->vm.fiber = NULL;
+        worker->vm.workerIndex = i;
+        worker->vm.error = &worker->error;
 
-                        for (int i = 0; i < array->len; i++)
-                        {
-                            void *item = itemPtr;
-                            if (type->base->kind == TYPE_PTR || type->base->kind == TYPE_STR)
-                                item = *(void **)item;
+        worker->error.handler = workerRuntimeError;
+        worker->error.handlerRuntime = workerRuntimeError;
+        worker->error.context = worker;
 
-                            doBasicChangeRefCnt(fiber, pages, item, type->base, tokKind, error);
-                            itemPtr += array->itemSize;
-                        }
-                    }
-                    chunkChangeRefCnt(pages, page, array->data, -1);
-                }
-            }
-            break;
-        }
+        worker->scheduler = sched;
+        queueInit(&worker->queue);
+    }
 
-        case TYPE_STRUCT:
-        {
-            for (int i = 0; i < type->numItems; i++)
-            {
-                if (typeKindGarbageCollected(type->field[i]->type->kind))
-                {
-                    void *field = ptr + type->field[i]->offset;
-                    if (type->field[i]->type->kind == TYPE_PTR || type->field[i]->type->kind == TYPE_STR)
-                        field = *(void **)field;
+    for (int i = 0; i < sched->numWorkers; i++)
+        pthread_create(&sched->worker[i].thread, NULL, workerRun, &sched->worker[i]);
+}
 
-                    doBasicChangeRefCnt(fiber, pages, field, type->field[i]->type, tokKind, error);
-                }
-            }
-            break;
-        }
 
-        case TYPE_INTERFACE:
-        {
-            // Interface layout: __self, __selftype, methods
-            void *__self = *(void **)ptr;
-            Type *__selftype = *(Type **)(ptr + type->field[1]->offset);
+static void schedFree(VM *vm)
+{
+    // Fibers that are still queued are not resumed, while the running ones are waited for until they yield or return
+    Scheduler *sched = vm->scheduler;
+    if (!sched)
+        return;
+
+    pthread_mutex_lock(&sched->lock);
+    __atomic_store_n(&sched->terminate, true, __ATOMIC_RELEASE);
+    pthread_cond_broadcast(&sched->wake);
+    pthread_mutex_unlock(&sched->lock);
+
+    for (int i = 0; i < sched->numWorkers; i++)
+        pthread_join(sched->worker[i].thread, NULL);
+
+    for (int i = 0; i < sched->numWorkers; i++)
+        queueFree(&sched->worker[i].queue);
+
+    pthread_mutex_destroy(&sched->lock);
+    pthread_cond_destroy(&sched->wake);
+    pthread_cond_destroy(&sched->finish);
+    pthread_mutex_destroy(&sched->chanLock);
+    pthread_cond_destroy(&sched->chanChange);
+
+    free(sched);
+    vm->scheduler = NULL;
+}
 
-            if (__self)
-                doBasicChangeRefCnt(fiber, pages, __self, __selftype, tokKind, error);
-            break;
-        }
 
-        case TYPE_FIBER:
-        {
-            HeapPage *page = pageFind(pages, ptr);
-            if (page)
-            {
-                // Don't use ref counting for the fiber stack, otherwise every local variable will also be ref-counted
-                HeapChunkHeader *chunk = ptr - sizeof(HeapChunkHeader);
-                if (chunk->refCnt == 1 && tokKind == TOK_MINUSMINUS)
-                    free(((Fiber *)ptr)->stack);
-            }
-            break;
-        }
+static int schedGetWorker(VM *vm)
+{
+    // Fibers are queued to the current worker thread, or distributed among all worker threads if queued by another thread
+    Scheduler *sched = vm->scheduler;
+    if (vm->workerIndex >= 0)
+        return vm->workerIndex;
+    return __atomic_fetch_add(&sched->nextWorker, 1, __ATOMIC_RELAXED) % sched->numWorkers;
+}
 
-        default: break;
-    }
+
+static void schedStart(VM *vm, Fiber *fiber)
+{
+    if (!vm->scheduler)
+        schedInit(vm);
+
+    Scheduler *sched = vm->scheduler;
+
+    // From now on, the heap is accessed by the worker threads
+    if (!vm->pages->shared)
+        vm->pages->shared = true;
+
+    // Parallel loop helpers run the loop body to completion, like the loop owner, rather than yield to the worker thread
+    fiber->scheduled = !fiber->job;
+    fiber->scheduler = sched;
+
+    // The scheduler holds a ref to the fiber until it returns, even if no other refs remain
+    chunkChangeRefCnt(vm->pages, pageFind(vm->pages, fiber), fiber, 1);
+
+    pthread_mutex_lock(&sched->lock);
+    __atomic_add_fetch(&sched->numActive, 1, __ATOMIC_SEQ_CST);
+    pthread_mutex_unlock(&sched->lock);
+
+    schedPut(sched, schedGetWorker(vm), fiber);
 }
 
 
-static int doFillReprBuf(Slot *slot, Type *type, char *buf, int maxLen, Error *error)
+static void schedUnshareHeap(VM *vm)
 {
-    int len = 0;
-    switch (type->kind)
+    // Called with the scheduler locked. If no scheduled fibers are running, the heap is no longer shared
+    if (vm->scheduler->numActive == 0)
     {
-        case TYPE_VOID:     len = snprintf(buf, maxLen, "void ");                                           break;
-        case TYPE_INT8:
-        case TYPE_INT16:
-        case TYPE_INT32:
-        case TYPE_INT:
-        case TYPE_UINT8:
-        case TYPE_UINT16:
-        case TYPE_UINT32:   len = snprintf(buf, maxLen, "%lld ",  (long long int)slot->intVal);             break;
-        case TYPE_UINT:     len = snprintf(buf, maxLen, "%llu ", (unsigned long long int)slot->uintVal);    break;
-        case TYPE_BOOL:     len = snprintf(buf, maxLen, slot->intVal ? "true " : "false ");                 break;
-        case TYPE_CHAR:     len = snprintf(buf, maxLen, "%c ", (char)slot->intVal);                         break;
-        case TYPE_REAL32:
-        case TYPE_REAL:     len = snprintf(buf, maxLen, "%lf ", slot->realVal);                             break;
-        case TYPE_PTR:      len = snprintf(buf, maxLen, "%p ", (void *)slot->ptrVal);                       break;
-        case TYPE_STR:      len = snprintf(buf, maxLen, "\"%s\" ", (char *)slot->ptrVal);                   break;
+        vm->pages->shared = false;
+        pageCollect(vm->pages);
+    }
+}
 
-        case TYPE_ARRAY:
-        {
-            len += snprintf(buf, maxLen, "{");
 
-            void *itemPtr = (void *)slot->ptrVal;
-            int itemSize = typeSizeNoCheck(type->base);
+static void schedWait(VM *vm, Fiber *fiber, Error *error)
+{
+    Scheduler *sched = vm->scheduler;
+    pthread_mutex_lock(&sched->lock);
 
-            for (int i = 0; i < type->numItems; i++)
-            {
-                Slot itemSlot = {.ptrVal = (int64_t)itemPtr};
-                doBasicDeref(&itemSlot, type->base->kind, error);
-                len += doFillReprBuf(&itemSlot, type->base, buf + len, maxLen, error);
-                itemPtr += itemSize;
-            }
+    while (__atomic_load_n(&fiber->alive, __ATOMIC_ACQUIRE))
+        pthread_cond_wait(&sched->finish, &sched->lock);
 
-            len += snprintf(buf + len, maxLen, "} ");
-            break;
-        }
+    schedUnshareHeap(vm);
 
-        case TYPE_DYNARRAY:
-        {
-            len += snprintf(buf, maxLen, "{");
+    Error failure = sched->failure;
+    bool failed = sched->failed;
+    sched->failed = false;
 
-            DynArray *array = (DynArray *)slot->ptrVal;
-            if (array && array->data)
-            {
-                void *itemPtr = array->data;
-                for (int i = 0; i < array->len; i++)
-                {
-                    Slot itemSlot = {.ptrVal = (int64_t)itemPtr};
-                    doBasicDeref(&itemSlot, type->base->kind, error);
-                    len += doFillReprBuf(&itemSlot, type->base, buf + len, maxLen, error);
-                    itemPtr += array->itemSize;
-                }
-            }
+    pthread_mutex_unlock(&sched->lock);
 
-            len += snprintf(buf + len, maxLen, "} ");
-            break;
-        }
+    if (failed)
+        error->handlerRuntime(error->context, "%s (in scheduled fiber at %s: %d)", failure.msg, failure.fileName, failure.line);
+}
 
-        case TYPE_STRUCT:
-        {
-            len += snprintf(buf, maxLen, "{");
 
-            for (int i = 0; i < type->numItems; i++)
-            {
-                Slot fieldSlot = {.ptrVal = slot->ptrVal + type->field[i]->offset};
-                doBasicDeref(&fieldSlot, type->field[i]->type->kind, error);
-                len += snprintf(buf + len, maxLen, "%s: ", type->field[i]->name);
-                len += doFillReprBuf(&fieldSlot, type->field[i]->type, buf + len, maxLen, error);
-            }
+static void chanLock(VM *vm)
+{
+    // Without the scheduler, channels are only accessed by the thread that owns the VM
+    if (vm->scheduler)
+        pthread_mutex_lock(&vm->scheduler->chanLock);
+}
 
-            len += snprintf(buf + len, maxLen, "} ");
-            break;
-        }
 
-        case TYPE_INTERFACE:
-        {
-            // Interface layout: __self, __selftype, methods
-            void *__self = *(void **)slot->ptrVal;
-            Type *__selftype = *(Type **)(slot->ptrVal + type->field[1]->offset);
+static void chanUnlock(VM *vm)
+{
+    if (vm->scheduler)
+        pthread_mutex_unlock(&vm->scheduler->chanLock);
+}
 
-            if (__self)
-            {
-                Slot selfSlot = {.ptrVal = (int64_t)__self};
-                doBasicDeref(&selfSlot, __selftype->base->kind, error);
-                len += doFillReprBuf(&selfSlot, __selftype->base, buf + len, maxLen, error);
-            }
-            break;
+
+static void *chanItem(Channel *chan, int index)
+{
+    int numSlots = chan->capacity > 0 ? chan->capacity : 1;
+    return (void *)chan + sizeof(Channel) + ((chan->head + index) % numSlots) * chan->itemSize;
+}
+
+
+static void chanAddWaiter(Channel *chan, Fiber *fiber)
+{
+    for (int i = 0; i < chan->numWaiters; i++)
+        if (chan->waiter[i] == fiber)
+            return;
+
+    if (chan->numWaiters == chan->maxWaiters)
+    {
+        chan->maxWaiters = chan->maxWaiters > 0 ? 2 * chan->maxWaiters : 4;
+        chan->waiter = realloc(chan->waiter, chan->maxWaiters * sizeof(Fiber *));
+    }
+
+    chan->waiter[chan->numWaiters++] = fiber;
+}
+
+
+static void chanRemoveWaiter(Channel *chan, Fiber *fiber)
+{
+    for (int i = 0; i < chan->numWaiters; i++)
+        if (chan->waiter[i] == fiber)
+        {
+            chan->waiter[i] = chan->waiter[--chan->numWaiters];
+            return;
         }
+}
 
-        case TYPE_FIBER:    len = snprintf(buf, maxLen, "fiber ");                                 break;
-        case TYPE_FN:       len = snprintf(buf, maxLen, "fn ");                                    break;
-        default:            break;
+
+static void chanWake(VM *vm, Channel *chan)
+{
+    // Any change of the channel state resumes all fibers blocked on it, so that they try again
+    Scheduler *sched = vm->scheduler;
+    if (!sched)
+        return;
+
+    for (int i = 0; i < chan->numWaiters; i++)
+    {
+        Fiber *waiter = chan->waiter[i];
+        if (__atomic_exchange_n(&waiter->parkState, FIBER_RUNNING, __ATOMIC_ACQ_REL) == FIBER_PARKED)
+            schedPut(sched, schedGetWorker(vm), waiter);
     }
 
-    return len;
+    chan->numWaiters = 0;
+    pthread_cond_broadcast(&sched->chanChange);
 }
 
 
-static void doCheckFormatString(char *format, int *formatLen, TypeKind *typeKind, Error *error)
+static bool chanBlock(VM *vm, Fiber *fiber, Channel **chans, int numChans, Fiber **newFiber, Error *error)
 {
-    enum {SIZE_SHORT_SHORT, SIZE_SHORT, SIZE_NORMAL, SIZE_LONG, SIZE_LONG_LONG} size;
-    *typeKind = TYPE_VOID;
-    int i = 0;
+    // Wait until any of the channels changes. Returns false if the fiber should rather yield to its worker thread
+    Scheduler *sched = vm->scheduler;
 
-    while (format[i])
+    if (fiber->scheduled)
     {
-        size = SIZE_NORMAL;
-        *typeKind = TYPE_VOID;
+        for (int i = 0; i < numChans; i++)
+            chanAddWaiter(chans[i], fiber);
 
-        while (format[i] && format[i] != '%')
-            i++;
+        fiber->parkState = FIBER_PARKING;
+        *newFiber = fiber->parent;
+        return false;
+    }
+
+    // A fiber that is not scheduled blocks its thread, which is a deadlock if no scheduled fibers can wake it up
+    if (!sched || __atomic_load_n(&sched->numActive, __ATOMIC_SEQ_CST) == 0)
+    {
+        chanUnlock(vm);
+        error->handlerRuntime(error->context, "Channel operation blocks forever");
+    }
+
+    pthread_cond_wait(&sched->chanChange, &sched->chanLock);
+    return true;
+}
+
+
+void vmInit(VM *vm, int stackSize, Error *error)
+{
+    vm->pages = malloc(sizeof(HeapPages));
+    vm->stackPool = malloc(sizeof(FiberStackPool));
+    vm->externWait = malloc(sizeof(ExternWait));
+    pageInit(vm->pages);
+    stackPoolInit(vm->stackPool);
+    pthread_mutex_init(&vm->externWait->lock, NULL);
+    pthread_cond_init(&vm->externWait->resume, NULL);
+
+    vm->fiber = malloc(sizeof(Fiber));
+    vm->fiber->stack = malloc(stackSize * sizeof(Slot));
+    vm->fiber->stackSize = vm->fiber->maxStackSize = vm->fiber->usedStackSize = stackSize;
+    vm->fiber->numSegments = 0;
+    vm->fiber->spareSegment = NULL;
+    vm->fiber->spareSegmentSize = 0;
+    vm->fiber->stackPool = vm->stackPool;
+    vm->fiber->externWait = vm->externWait;
+    vm->fiber->globals = vm->globals = NULL;
+    vm->globalsSize = 0;
+    vm->fiber->parent = NULL;
+    vm->fiber->alive = true;
+    vm->fiber->scheduled = false;
+    vm->fiber->parkState = FIBER_RUNNING;
+    vm->fiber->sendTicket = 0;
+    vm->fiber->job = NULL;
+    vm->fiber->scheduler = NULL;
+    vm->fiber->budget = VM_FIBER_BUDGET;
+
+    vm->scheduler = NULL;
+    vm->workerIndex = -1;
+    vm->budget = 0;
+    vm->interrupted = false;
+    vm->callbackDepth = 0;
+    vm->externDepth = 0;
+    vm->result = NULL;
+    vm->error = error;
+}
+
+
+void vmFree(VM *vm)
+{
+    schedFree(vm);
+
+    // The stacks of the child fibers are freed with the heap
+    while (vm->fiber->parent)
+        vm->fiber = vm->fiber->parent;
+
+    pageFree(vm->pages, true);
+    free(vm->fiber->stack);
+    free(vm->fiber);
+    free(vm->globals);
+    stackPoolFree(vm->stackPool);
+    pthread_mutex_destroy(&vm->externWait->lock);
+    pthread_cond_destroy(&vm->externWait->resume);
+    free(vm->pages);
+    free(vm->stackPool);
+    free(vm->externWait);
+}
+
+
+void vmReset(VM *vm, Instruction *code)
+{
+    vm->fiber->code = code;
+    vm->fiber->ip = 0;
+    vm->fiber->top = vm->fiber->base = vm->fiber->stack + vm->fiber->stackSize - 1;
+    vm->fiber->base->intVal = 0;        // Null return address of main(), which ends stack traces
+}
+
+
+void vmSetGlobals(VM *vm, void *globals, int size)
+{
+    // Each VM has its own copy of global variables, so that several VMs can run the same compiled program
+    free(vm->globals);
+    vm->globals = malloc(size);
+    vm->globalsSize = size;
+    memcpy(vm->globals, globals, size);
+    vm->fiber->globals = vm->globals;
+}
+
+
+void vmGrowGlobals(VM *vm, void *globals, int size)
+{
+    // The global variables added to the program by a hot reload get their initial values, the existing ones keep their values
+    if (size <= vm->globalsSize)
+        return;
+
+    vm->globals = realloc(vm->globals, size);
+    memcpy((char *)vm->globals + vm->globalsSize, (char *)globals + vm->globalsSize, size - vm->globalsSize);
+    vm->globalsSize = size;
+    vm->fiber->globals = vm->globals;
+}
+
+
+void vmResetState(VM *vm, void *globals, int size)
+{
+    // The heap is discarded as a whole rather than released chunk by chunk, so that nothing left by a completed, interrupted
+    // or failed run can survive. An interrupted or failed run may have left the VM in a child fiber, which lived in the heap
+    // and whose stack is freed with it
+    schedFree(vm);
+
+    while (vm->fiber->parent)
+        vm->fiber = vm->fiber->parent;
+
+    pageFree(vm->pages, false);
+    pageInit(vm->pages);
+
+    memcpy(vm->globals, globals, size);
+
+    vm->fiber->alive = true;
+    vm->fiber->parkState = FIBER_RUNNING;
+    vm->fiber->sendTicket = 0;
+    vm->fiber->job = NULL;
+    vm->fiber->budget = VM_FIBER_BUDGET;
+
+    vm->interrupted = false;
+    vm->callbackDepth = 0;
+    vm->externDepth = 0;
+    vm->result = NULL;
+}
+
+
+static void doPushSegment(Fiber *fiber, int slots, int movedSlots, Error *error)
+{
+    // Switch to a new stack segment that has room for slots, and move the topmost slots there, i.e., the parameters of the function
+    // being called. Nothing is relocated: the old segment stays where it was, and the pointers to its local variables remain valid
+    int required = slots + VM_SEGMENT_HEADER;
+    int size = 2 * fiber->stackSize;
+    if (size < required)
+        size = required;
+
+    Slot *segment = NULL;
+
+    if (fiber->spareSegment && fiber->spareSegmentSize >= required && fiber->usedStackSize + fiber->spareSegmentSize <= fiber->maxStackSize)
+    {
+        segment = fiber->spareSegment;
+        size = fiber->spareSegmentSize;
+        fiber->spareSegment = NULL;
+    }
+    else
+    {
+        if (fiber->usedStackSize + size > fiber->maxStackSize)
+            size = required;
+
+        if (fiber->usedStackSize + size > fiber->maxStackSize)
+            error->handlerRuntime(error->context, "Stack overflow");
+
+        segment = stackAlloc(fiber->stackPool, size);
+    }
+
+    Slot *header = segment + size - VM_SEGMENT_HEADER;
+    header[2].ptrVal = (int64_t)fiber->stack;
+    header[1].intVal = fiber->stackSize;
+    header[0].ptrVal = (int64_t)(fiber->top + movedSlots);
+
+    memcpy(header - movedSlots, fiber->top, movedSlots * sizeof(Slot));
+
+    fiber->stack = segment;
+    fiber->stackSize = size;
+    fiber->top = header - movedSlots;
+    fiber->usedStackSize += size;
+    fiber->numSegments++;
+}
+
+
+static void doPopSegment(Fiber *fiber)
+{
+    // Return to the previous stack segment. The larger of the segment left and the spare segment is kept for reuse
+    Slot *segment = fiber->stack;
+    int size = fiber->stackSize;
+    Slot *header = segment + size - VM_SEGMENT_HEADER;
+
+    fiber->stack = (Slot *)header[2].ptrVal;
+    fiber->stackSize = header[1].intVal;
+    fiber->top = (Slot *)header[0].ptrVal;
+    fiber->usedStackSize -= size;
+    fiber->numSegments--;
+
+    if (fiber->spareSegment && fiber->spareSegmentSize >= size)
+        stackFree(fiber->stackPool, segment, size);
+    else
+    {
+        if (fiber->spareSegment)
+            stackFree(fiber->stackPool, fiber->spareSegment, fiber->spareSegmentSize);
+
+        fiber->spareSegment = segment;
+        fiber->spareSegmentSize = size;
+    }
+}
+
+
+static void doReserveStack(Fiber *fiber, int entryOffset, int pushedSlots, int movedSlots, Error *error)
+{
+    // Ensure that the function to be called fits into the current stack segment, together with the slots to be pushed before the call,
+    // its local variables, its structured parameters passed by value to other functions and any other operands. Otherwise, switch
+    // to a new segment and move there the parameters already pushed onto the stack
+    int slots = pushedSlots + 2 * VM_MIN_FREE_STACK + 5;    // + 5 for return address, old base pointer and I/O registers
+
+    if (entryOffset > 0 && fiber->code[entryOffset].opcode == OP_ENTER_FRAME)
+        slots += fiber->code[entryOffset].operand.intVal >> 32;
+
+    if (fiber->top - fiber->stack < slots)
+        doPushSegment(fiber, slots + movedSlots, movedSlots, error);
+}
+
+
+static void doUnwindStack(Fiber *fiber, Slot *top)
+{
+    // Restore the stack top saved before calling a script function from a built-in function or from the host, and leave
+    // the stack segments that the call has added, if it has not returned normally
+    while (fiber->numSegments > 0 && (top < fiber->stack || top >= fiber->stack + fiber->stackSize))
+        doPopSegment(fiber);
+
+    fiber->top = top;
+}
+
+
+static void doBasicSwap(Slot *slot)
+{
+    Slot val = slot[0];
+    slot[0] = slot[1];
+    slot[1] = val;
+}
+
+
+static void doBasicDeref(Slot *slot, TypeKind typeKind, Error *error)
+{
+    if (!slot->ptrVal)
+        error->handlerRuntime(error->context, "Pointer is null");
+
+    switch (typeKind)
+    {
+        case TYPE_INT8:         slot->intVal  = *(int8_t   *)slot->ptrVal; break;
+        case TYPE_INT16:        slot->intVal  = *(int16_t  *)slot->ptrVal; break;
+        case TYPE_INT32:        slot->intVal  = *(int32_t  *)slot->ptrVal; break;
+        case TYPE_INT:          slot->intVal  = *(int64_t  *)slot->ptrVal; break;
+        case TYPE_UINT8:        slot->intVal  = *(uint8_t  *)slot->ptrVal; break;
+        case TYPE_UINT16:       slot->intVal  = *(uint16_t *)slot->ptrVal; break;
+        case TYPE_UINT32:       slot->intVal  = *(uint32_t *)slot->ptrVal; break;
+        case TYPE_UINT:         slot->uintVal = *(uint64_t *)slot->ptrVal; break;
+        case TYPE_BOOL:         slot->intVal  = *(bool     *)slot->ptrVal; break;
+        case TYPE_CHAR:         slot->intVal  = *(char     *)slot->ptrVal; break;
+        case TYPE_REAL32:       slot->realVal = *(float    *)slot->ptrVal; break;
+        case TYPE_REAL:         slot->realVal = *(double   *)slot->ptrVal; break;
+        case TYPE_PTR:
+        case TYPE_STR:          slot->ptrVal  = (int64_t)(*(void *   *)slot->ptrVal); break;
+        case TYPE_ARRAY:
+        case TYPE_DYNARRAY:
+        case TYPE_STRUCT:
+        case TYPE_INTERFACE:
+        case TYPE_FIBER:
+        case TYPE_CHAN:         break;  // Always represented by pointer, not dereferenced
+        case TYPE_FN:           slot->intVal  = *(int64_t  *)slot->ptrVal; break;
+
+        default:                error->handlerRuntime(error->context, "Illegal type"); return;
+    }
+}
+
+
+static void doBasicAssign(void *lhs, Slot rhs, TypeKind typeKind, int structSize, Error *error)
+{
+    if (!lhs)
+        error->handlerRuntime(error->context, "Pointer is null");
+
+    Const rhsConstant = {.intVal = rhs.intVal};
+    if (typeOverflow(typeKind, rhsConstant))
+        error->handlerRuntime(error->context, "Overflow in assignment to %s", typeKindSpelling(typeKind));
+
+    switch (typeKind)
+    {
+        case TYPE_INT8:         *(int8_t   *)lhs = rhs.intVal;  break;
+        case TYPE_INT16:        *(int16_t  *)lhs = rhs.intVal;  break;
+        case TYPE_INT32:        *(int32_t  *)lhs = rhs.intVal;  break;
+        case TYPE_INT:          *(int64_t  *)lhs = rhs.intVal;  break;
+        case TYPE_UINT8:        *(uint8_t  *)lhs = rhs.intVal;  break;
+        case TYPE_UINT16:       *(uint16_t *)lhs = rhs.intVal;  break;
+        case TYPE_UINT32:       *(uint32_t *)lhs = rhs.intVal;  break;
+        case TYPE_UINT:         *(uint64_t *)lhs = rhs.uintVal; break;
+        case TYPE_BOOL:         *(bool     *)lhs = rhs.intVal;  break;
+        case TYPE_CHAR:         *(char     *)lhs = rhs.intVal;  break;
+        case TYPE_REAL32:       *(float    *)lhs = rhs.realVal; break;
+        case TYPE_REAL:         *(double   *)lhs = rhs.realVal; break;
+        case TYPE_PTR:
+        case TYPE_STR:          *(void *   *)lhs = (void *)rhs.ptrVal; break;
+        case TYPE_ARRAY:
+        case TYPE_DYNARRAY:
+        case TYPE_STRUCT:
+        case TYPE_INTERFACE:
+        case TYPE_FIBER:        memcpy(lhs, (void *)rhs.ptrVal, structSize); break;
+        case TYPE_FN:           *(int64_t  *)lhs = rhs.intVal; break;
+
+        default:                error->handlerRuntime(error->context, "Illegal type"); return;
+    }
+}
+
+
+static void doBasicChangeRefCnt(Fiber *fiber, HeapPages *pages, void *ptr, Type *type, TokenKind tokKind, Error *error)
+{
+    // Update ref counts for pointers (including static/dynamic array items and structure/interface fields) if allocated dynamically
+    // Among garbage collected types, all types except the pointer and string types are represented by pointers by default
+    // RTTI is required for lists, trees, etc., since the propagation depth for the root ref count is unknown at compile time
+
+    switch (type->kind)
+    {
+        case TYPE_PTR:
+        {
+            HeapPage *page = pageFind(pages, ptr);
+            if (page && !type->weak)
+            {
+                if (tokKind == TOK_PLUSPLUS)
+                    chunkChangeRefCnt(pages, page, ptr, 1);
+                else
+                {
+                    // Traverse children only after removing the last remaining ref, but before the page can be cleared
+                    int refCnt = chunkChangeRefCntOnly(pages, ptr, -1);
+                    if (refCnt == 0 && typeKindGarbageCollected(type->base->kind))
+                    {
+                        void *data = ptr;
+                        if (type->base->kind == TYPE_PTR || type->base->kind == TYPE_STR)
+                            data = *(void **)data;
+
+                        doBasicChangeRefCnt(fiber, pages, data, type->base, tokKind, error);
+                    }
+                    if (refCnt >= 0)
+                        pageChangeRefCnt(pages, page, -1);
+                }
+            }
+            break;
+        }
+
+        case TYPE_STR:
+        {
+            HeapPage *page = pageFind(pages, ptr);
+            if (page)
+                chunkChangeRefCnt(pages, page, ptr, (tokKind == TOK_PLUSPLUS) ? 1 : -1);
+            break;
+        }
+
+        case TYPE_ARRAY:
+        {
+            if (typeKindGarbageCollected(type->base->kind))
+            {
+                void *itemPtr = ptr;
+                int itemSize = typeSizeNoCheck(type->base);
+
+                for (int i = 0; i < type->numItems; i++)
+                {
+                    void *item = itemPtr;
+                    if (type->base->kind == TYPE_PTR || type->base->kind == TYPE_STR)
+                        item = *(void **)item;
+
+                    doBasicChangeRefCnt(fiber, pages, item, type->base, tokKind, error);
+                    itemPtr += itemSize;
+                }
+            }
+            break;
+        }
+
+        case TYPE_DYNARRAY:
+        {
+            // Slices share the chunk of the original array, so their data may point into the middle of the chunk
+            DynArray *array = (DynArray *)ptr;
+            HeapChunkHeader *chunk;
+            HeapPage *page = pageFindForInterior(pages, array->data, &chunk);
+            if (page)
+            {
+                void *chunkData = (void *)chunk + sizeof(HeapChunkHeader);
+
+                if (tokKind == TOK_PLUSPLUS)
+                    chunkChangeRefCnt(pages, page, chunkData, 1);
+                else
+                {
+                    // Traverse children only after removing the last remaining ref, but before the page can be cleared
+                    // The last ref may be held by a slice, so traverse all the items of the chunk rather than of the array
+                    int refCnt = chunkChangeRefCntOnly(pages, chunkData, -1);
+                    if (refCnt == 0 && typeKindGarbageCollected(type->base->kind) && array->itemSize > 0)
+                    {
+                        void *itemPtr = chunkData;
+                        int numItems = chunk->size / array->itemSize;
+
+                        for (int i = 0; i < numItems; i++)
+                        {
+                            void *item = itemPtr;
+                            if (type->base->kind == TYPE_PTR || type->base->kind == TYPE_STR)
+                                item = *(void **)item;
+
+                            doBasicChangeRefCnt(fiber, pages, item, type->base, tokKind, error);
+                            itemPtr += array->itemSize;
+                        }
+                    }
+                    if (refCnt >= 0)
+                        pageChangeRefCnt(pages, page, -1);
+                }
+            }
+            break;
+        }
+
+        case TYPE_STRUCT:
+        {
+            for (int i = 0; i < type->numItems; i++)
+            {
+                if (typeKindGarbageCollected(type->field[i]->type->kind))
+                {
+                    void *field = ptr + type->field[i]->offset;
+                    if (type->field[i]->type->kind == TYPE_PTR || type->field[i]->type->kind == TYPE_STR)
+                        field = *(void **)field;
+
+                    doBasicChangeRefCnt(fiber, pages, field, type->field[i]->type, tokKind, error);
+                }
+            }
+            break;
+        }
+
+        case TYPE_INTERFACE:
+        {
+            // Interface layout: __self, __selftype, methods
+            void *__self = *(void **)ptr;
+            Type *__selftype = *(Type **)(ptr + type->field[1]->offset);
+
+            if (__self)
+                doBasicChangeRefCnt(fiber, pages, __self, __selftype, tokKind, error);
+            break;
+        }
+
+        case TYPE_FIBER:
+        {
+            HeapPage *page = pageFind(pages, ptr);
+            if (page)
+            {
+                // Don't use ref counting for the fiber stack, otherwise every local variable will also be ref-counted
+                // The fiber is traversed as a pointer base type, i.e., after its last ref has been removed
+                HeapChunkHeader *chunk = ptr - sizeof(HeapChunkHeader);
+                if (chunk->refCnt == 0 && tokKind == TOK_MINUSMINUS)
+                {
+                    // A fiber that has not returned still holds the ref to its parent fiber passed as a parameter
+                    Fiber *child = ptr, *parent = child->parent;
+                    HeapPage *parentPage = pageFind(pages, parent);
+
+                    if (parentPage && __atomic_load_n(&child->alive, __ATOMIC_ACQUIRE))
+                    {
+                        int refCnt = chunkChangeRefCntOnly(pages, parent, -1);
+                        if (refCnt == 0)
+                            doBasicChangeRefCnt(fiber, pages, parent, type, tokKind, error);
+                        if (refCnt >= 0)
+                            pageChangeRefCnt(pages, parentPage, -1);
+                    }
+
+                    fiberFreeStack(child);
+                }
+            }
+            break;
+        }
+
+        case TYPE_CHAN:
+        {
+            // The channel is traversed as a pointer base type, i.e., after its last ref has been removed
+            Channel *chan = ptr;
+            HeapChunkHeader *chunk = ptr - sizeof(HeapChunkHeader);
+            if (chunk->refCnt == 0 && tokKind == TOK_MINUSMINUS)
+            {
+                if (typeKindGarbageCollected(type->base->kind))
+                    for (int i = 0; i < chan->len; i++)
+                    {
+                        void *item = chanItem(chan, i);
+                        if (type->base->kind == TYPE_PTR || type->base->kind == TYPE_STR)
+                            item = *(void **)item;
+
+                        doBasicChangeRefCnt(fiber, pages, item, type->base, tokKind, error);
+                    }
+
+                free(chan->waiter);
+                chan->waiter = NULL;
+                chan->numWaiters = chan->maxWaiters = 0;
+            }
+            break;
+        }
+
+        default: break;
+    }
+}
+
+
+static int doFillReprBuf(Slot *slot, Type *type, char *buf, int maxLen, Error *error)
+{
+    int len = 0;
+    switch (type->kind)
+    {
+        case TYPE_VOID:     len = snprintf(buf, maxLen, "void ");                                           break;
+        case TYPE_INT8:
+        case TYPE_INT16:
+        case TYPE_INT32:
+        case TYPE_INT:
+        case TYPE_UINT8:
+        case TYPE_UINT16:
+        case TYPE_UINT32:   len = snprintf(buf, maxLen, "%lld ",  (long long int)slot->intVal);             break;
+        case TYPE_UINT:     len = snprintf(buf, maxLen, "%llu ", (unsigned long long int)slot->uintVal);    break;
+        case TYPE_BOOL:     len = snprintf(buf, maxLen, slot->intVal ? "true " : "false ");                 break;
+        case TYPE_CHAR:     len = snprintf(buf, maxLen, "%c ", (char)slot->intVal);                         break;
+        case TYPE_REAL32:
+        case TYPE_REAL:     len = snprintf(buf, maxLen, "%lf ", slot->realVal);                             break;
+        case TYPE_PTR:      len = snprintf(buf, maxLen, "%p ", (void *)slot->ptrVal);                       break;
+        case TYPE_STR:      len = snprintf(buf, maxLen, "\"%s\" ", (char *)slot->ptrVal);                   break;
+
+        case TYPE_ARRAY:
+        {
+            len += snprintf(buf, maxLen, "{");
+
+            void *itemPtr = (void *)slot->ptrVal;
+            int itemSize = typeSizeNoCheck(type->base);
+
+            for (int i = 0; i < type->numItems; i++)
+            {
+                Slot itemSlot = {.ptrVal = (int64_t)itemPtr};
+                doBasicDeref(&itemSlot, type->base->kind, error);
+                len += doFillReprBuf(&itemSlot, type->base, buf + len, maxLen, error);
+                itemPtr += itemSize;
+            }
+
+            len += snprintf(buf + len, maxLen, "} ");
+            break;
+        }
+
+        case TYPE_DYNARRAY:
+        {
+            len += snprintf(buf, maxLen, "{");
+
+            DynArray *array = (DynArray *)slot->ptrVal;
+            if (array && array->data)
+            {
+                void *itemPtr = array->data;
+                for (int i = 0; i < array->len; i++)
+                {
+                    Slot itemSlot = {.ptrVal = (int64_t)itemPtr};
+                    doBasicDeref(&itemSlot, type->base->kind, error);
+                    len += doFillReprBuf(&itemSlot, type->base, buf + len, maxLen, error);
+                    itemPtr += array->itemSize;
+                }
+            }
+
+            len += snprintf(buf + len, maxLen, "} ");
+            break;
+        }
+
+        case TYPE_STRUCT:
+        {
+            len += snprintf(buf, maxLen, "{");
+
+            for (int i = 0; i < type->numItems; i++)
+            {
+                Slot fieldSlot = {.ptrVal = slot->ptrVal + type->field[i]->offset};
+                doBasicDeref(&fieldSlot, type->field[i]->type->kind, error);
+                len += snprintf(buf + len, maxLen, "%s: ", type->field[i]->name);
+                len += doFillReprBuf(&fieldSlot, type->field[i]->type, buf + len, maxLen, error);
+            }
+
+            len += snprintf(buf + len, maxLen, "} ");
+            break;
+        }
+
+        case TYPE_INTERFACE:
+        {
+            // Interface layout: __self, __selftype, methods
+            void *__self = *(void **)slot->ptrVal;
+            Type *__selftype = *(Type **)(slot->ptrVal + type->field[1]->offset);
+
+            if (__self)
+            {
+                Slot selfSlot = {.ptrVal = (int64_t)__self};
+                doBasicDeref(&selfSlot, __selftype->base->kind, error);
+                len += doFillReprBuf(&selfSlot, __selftype->base, buf + len, maxLen, error);
+            }
+            break;
+        }
+
+        case TYPE_FIBER:    len = snprintf(buf, maxLen, "fiber ");                                 break;
+        case TYPE_FN:       len = snprintf(buf, maxLen, "fn ");                                    break;
+        default:            break;
+    }
+
+    return len;
+}
+
+
+bool vmCheckFormatString(const char *format, int *formatLen, TypeKind *typeKind)
+{
+    // Find the first conversion specifier and the expected argument type
+    // On failure, formatLen points to the illegal type character
+    enum {SIZE_SHORT_SHORT, SIZE_SHORT, SIZE_NORMAL, SIZE_LONG, SIZE_LONG_LONG} size;
+    *typeKind = TYPE_VOID;
+    int i = 0;
+
+    while (format[i])
+    {
+        size = SIZE_NORMAL;
+        *typeKind = TYPE_VOID;
+
+        while (format[i] && format[i] != '%')
+            i++;
+
+        // "%" [flags] [width] ["." precision] [length] type
+        // "%"
+        if (format[i] == '%')
+        {
+            i++;
+
+            // [flags]
+            while (format[i] == '+' || format[i] == '-'  || format[i] == ' ' ||
+                   format[i] == '0' || format[i] == '\'' || format[i] == '#')
+                i++;
+
+            // [width]
+            while (format[i] >= '0' && format[i] <= '9')
+                i++;
+
+            // [.precision]
+            if (format[i] == '.')
+            {
+                i++;
+                while (format[i] >= '0' && format[i] <= '9')
+                    i++;
+            }
+
+            // [length]
+            if (format[i] == 'h')
+            {
+                size = SIZE_SHORT;
+                i++;
+
+                if (format[i] == 'h')
+                {
+                    size = SIZE_SHORT_SHORT;
+                    i++;
+                }
+            }
+            else if (format[i] == 'l')
+            {
+                size = SIZE_LONG;
+                i++;
+
+                if (format[i] == 'l')
+                {
+                    size = SIZE_LONG_LONG;
+                    i++;
+                }
+            }
+
+            // type
+            switch (format[i])
+            {
+                case '%': i++; continue;
+                case 'd':
+                case 'i':
+                {
+                    switch (size)
+                    {
+                        case SIZE_SHORT_SHORT:  *typeKind = TYPE_INT8;      break;
+                        case SIZE_SHORT:        *typeKind = TYPE_INT16;     break;
+                        case SIZE_NORMAL:
+                        case SIZE_LONG:         *typeKind = TYPE_INT32;     break;
+                        case SIZE_LONG_LONG:    *typeKind = TYPE_INT;       break;
+                    }
+                    break;
+                }
+                case 'u':
+                case 'x':
+                case 'X':
+                {
+                    switch (size)
+                    {
+                        case SIZE_SHORT_SHORT:  *typeKind = TYPE_UINT8;      break;
+                        case SIZE_SHORT:        *typeKind = TYPE_UINT16;     break;
+                        case SIZE_NORMAL:
+                        case SIZE_LONG:         *typeKind = TYPE_UINT32;     break;
+                        case SIZE_LONG_LONG:    *typeKind = TYPE_UINT;       break;
+                    }
+                    break;
+                }
+                case 'f':
+                case 'F':
+                case 'e':
+                case 'E':
+                case 'g':
+                case 'G': *typeKind = (size == SIZE_NORMAL) ? TYPE_REAL32 : TYPE_REAL;      break;
+                case 's': *typeKind = TYPE_STR;                                             break;
+                case 'c': *typeKind = TYPE_CHAR;                                            break;
+
+                default : *formatLen = i; return false;
+            }
+            i++;
+        }
+        break;
+    }
+    *formatLen = i;
+    return true;
+}
+
+
+static void doBuiltinPrintf(Fiber *fiber, bool console, bool string, Error *error)
+{
+    void *stream      = console ? stdout : (void *)fiber->reg[VM_REG_IO_STREAM].ptrVal;
+    char *format      = (char *)fiber->reg[VM_REG_IO_FORMAT].ptrVal;
+    TypeKind typeKind = fiber->code[fiber->ip].typeKind;
+
+    if (!stream)
+        error->handlerRuntime(error->context, "printf() destination is null");
+
+    if (!format)
+        error->handlerRuntime(error->context, "printf() format string is null");
+
+    // Format strings known at compile time are split into null-terminated segments that have already been checked,
+    // other strings have to be checked and copied
+    int formatLen;
+    char formatBuf[DEFAULT_STR_LEN + 1];
+    char *curFormat = format;
+
+    if (fiber->code[fiber->ip].tokKind == TOK_STRLITERAL)
+        formatLen = strlen(format);
+    else
+    {
+        TypeKind expectedTypeKind;
+        if (!vmCheckFormatString(format, &formatLen, &expectedTypeKind))
+            error->handlerRuntime(error->context, "Illegal type character %c in format string", format[formatLen]);
+
+        if (typeKind != expectedTypeKind && !(typeKindInteger(typeKind) && typeKindInteger(expectedTypeKind)) &&
+                                            !(typeKindReal(typeKind)    && typeKindReal(expectedTypeKind)))
+            error->handlerRuntime(error->context, "Incompatible types %s and %s in printf()", typeKindSpelling(expectedTypeKind), typeKindSpelling(typeKind));
+
+        if (format[formatLen])
+        {
+            curFormat = (formatLen + 1 > sizeof(formatBuf)) ? malloc(formatLen + 1) : formatBuf;
+            strncpy(curFormat, format, formatLen);
+            curFormat[formatLen] = 0;
+        }
+    }
+
+    int len = 0;
+
+    if (typeKind == TYPE_VOID)
+        len = fsprintf(string, stream, curFormat);
+    else if (typeKind == TYPE_REAL || typeKind == TYPE_REAL32)
+        len = fsprintf(string, stream, curFormat, fiber->top->realVal);
+    else
+        len = fsprintf(string, stream, curFormat, fiber->top->intVal);
+
+    if (curFormat != format && curFormat != formatBuf)
+        free(curFormat);
+
+    fiber->reg[VM_REG_IO_FORMAT].ptrVal += formatLen;
+    fiber->reg[VM_REG_IO_COUNT].intVal += len;
+    if (string)
+        fiber->reg[VM_REG_IO_STREAM].ptrVal += len;
+}
+
+
+static void doBuiltinScanf(Fiber *fiber, bool console, bool string, Error *error)
+{
+    void *stream      = console ? stdin : (void *)fiber->reg[VM_REG_IO_STREAM].ptrVal;
+    char *format      = (char *)fiber->reg[VM_REG_IO_FORMAT].ptrVal;
+    TypeKind typeKind = fiber->code[fiber->ip].typeKind;
+
+    if (!stream)
+        error->handlerRuntime(error->context, "scanf() source is null");
+
+    if (!format)
+        error->handlerRuntime(error->context, "scanf() format string is null");
+
+    if (typeKind != TYPE_VOID && !fiber->top->ptrVal)
+        error->handlerRuntime(error->context, "scanf() destination is null");
+
+    // Format strings known at compile time are split into null-terminated segments that have already been checked
+    int formatLen;
+    if (fiber->code[fiber->ip].tokKind == TOK_STRLITERAL)
+        formatLen = strlen(format);
+    else
+    {
+        TypeKind expectedTypeKind;
+        if (!vmCheckFormatString(format, &formatLen, &expectedTypeKind))
+            error->handlerRuntime(error->context, "Illegal type character %c in format string", format[formatLen]);
+
+        if (typeKind != expectedTypeKind)
+            error->handlerRuntime(error->context, "Incompatible types %s and %s in scanf()", typeKindSpelling(expectedTypeKind), typeKindSpelling(typeKind));
+    }
+
+    char formatBuf[DEFAULT_STR_LEN + 1];
+    char *curFormat = (formatLen + 2 + 1 > sizeof(formatBuf)) ? malloc(formatLen + 2 + 1) : formatBuf;     // + 2 for "%n"
+    strncpy(curFormat, format, formatLen);
+    curFormat[formatLen] = 0;
+    strcat(curFormat, "%n");
+
+    int len = 0, cnt = 0;
+
+    if (typeKind == TYPE_VOID)
+        cnt = fsscanf(string, stream, curFormat, &len);
+    else
+        cnt = fsscanf(string, stream, curFormat, (void *)fiber->top->ptrVal, &len);
+
+    if (curFormat != formatBuf)
+        free(curFormat);
+
+    fiber->reg[VM_REG_IO_FORMAT].ptrVal += formatLen;
+    fiber->reg[VM_REG_IO_COUNT].intVal += cnt;
+    if (string)
+        fiber->reg[VM_REG_IO_STREAM].ptrVal += len;
+}
+
+
+static void *doAllocDynArrayData(HeapPages *pages, int len, int itemSize, Error *error)
+{
+    void *data = chunkAlloc(pages, len * itemSize, error);
+    ((HeapChunkHeader *)(data - sizeof(HeapChunkHeader)))->dynArray = true;
+    return data;
+}
+
+
+static void doChangeRefCntItems(Fiber *fiber, HeapPages *pages, void *data, int len, Type *type, TokenKind tokKind, Error *error)
+{
+    // Update ref counts for len items of the dynamic array type, starting from data
+    if (!typeKindGarbageCollected(type->base->kind))
+        return;
+
+    int itemSize = typeSizeNoCheck(type->base);
+
+    for (int i = 0; i < len; i++)
+    {
+        void *item = data + i * itemSize;
+        if (type->base->kind == TYPE_PTR || type->base->kind == TYPE_STR)
+            item = *(void **)item;
+
+        doBasicChangeRefCnt(fiber, pages, item, type->base, tokKind, error);
+    }
+}
+
+
+static int doGetDynArrayCapacity(HeapPages *pages, DynArray *array)
+{
+    // Capacity is the number of items that fit between the beginning of the array and the end of its chunk
+    HeapChunkHeader *chunk;
+    if (array->itemSize == 0 || !pageFindForInterior(pages, array->data, &chunk) || !chunk->dynArray)
+        return array->len;
+
+    void *chunkEnd = (void *)chunk + sizeof(HeapChunkHeader) + chunk->size;
+    return (chunkEnd - array->data) / array->itemSize;
+}
+
+
+static void doReallocDynArray(Fiber *fiber, HeapPages *pages, DynArray *result, DynArray *array, Type *type, int len, int capacity, Error *error)
+{
+    // Get a dynamic array of len items that can grow up to capacity items without reallocation
+    // The original chunk is shared if it is large enough, otherwise the items are copied to a new chunk
+    // In both cases, the items beyond the original array length are zero
+    if (len < 0)
+        error->handlerRuntime(error->context, "Dynamic array length cannot be negative");
+
+    if (capacity < len)
+        capacity = len;
+
+    if (capacity <= doGetDynArrayCapacity(pages, array))
+    {
+        if (len > array->len)
+        {
+            // The free space may still contain the items of other slices, so release them
+            void *newItems = array->data + array->len * array->itemSize;
+            doChangeRefCntItems(fiber, pages, newItems, len - array->len, type, TOK_MINUSMINUS, error);
+            memset(newItems, 0, (len - array->len) * array->itemSize);
+        }
+
+        HeapChunkHeader *chunk;
+        HeapPage *page = pageFindForInterior(pages, array->data, &chunk);
+        if (page)
+            chunkChangeRefCnt(pages, page, (void *)chunk + sizeof(HeapChunkHeader), 1);
+
+        result->data = array->data;
+    }
+    else
+    {
+        int numCopiedItems = (len < array->len) ? len : array->len;
+
+        result->data = doAllocDynArrayData(pages, capacity, array->itemSize, error);
+        memcpy(result->data, array->data, numCopiedItems * array->itemSize);
+        doChangeRefCntItems(fiber, pages, result->data, numCopiedItems, type, TOK_PLUSPLUS, error);
+    }
+
+    result->len      = len;
+    result->itemSize = array->itemSize;
+}
+
+
+// fn make([...] type (actually itemSize: int), len: int): [] type
+static void doBuiltinMake(Fiber *fiber, HeapPages *pages, Error *error)
+{
+    DynArray *result = (DynArray *)(fiber->top++)->ptrVal;
+    result->len      = (fiber->top++)->intVal;
+    result->itemSize = (fiber->top++)->intVal;
+    result->data     = doAllocDynArrayData(pages, result->len, result->itemSize, error);
+
+    (--fiber->top)->ptrVal = (int64_t)result;
+}
+
+
+// fn makefrom(array: [...] type, itemSize: int, len: int): [] type
+static void doBuiltinMakefrom(Fiber *fiber, HeapPages *pages, Error *error)
+{
+    doBuiltinMake(fiber, pages, error);
+
+    DynArray *dest = (DynArray *)(fiber->top++)->ptrVal;
+    void *src      = (void     *)(fiber->top++)->ptrVal;
+
+    memcpy(dest->data, src, dest->len * dest->itemSize);
+    (--fiber->top)->ptrVal = (int64_t)dest;
+}
+
+
+// fn append(array: [] type, item: ^type, type): [] type
+static void doBuiltinAppend(Fiber *fiber, HeapPages *pages, Error *error)
+{
+    DynArray *result = (DynArray *)(fiber->top++)->ptrVal;
+    Type *type       = (Type     *)(fiber->top++)->ptrVal;
+    void *item       = (void     *)(fiber->top++)->ptrVal;
+    DynArray *array  = (DynArray *)(fiber->top++)->ptrVal;
+
+    if (!array || !array->data)
+        error->handlerRuntime(error->context, "Dynamic array is null");
+
+    doReallocDynArray(fiber, pages, result, array, type, array->len + 1, 0, error);
+
+    void *resultItem = result->data + (result->len - 1) * result->itemSize;
+    memcpy(resultItem, item, result->itemSize);
+    doChangeRefCntItems(fiber, pages, resultItem, 1, type, TOK_PLUSPLUS, error);
+
+    (--fiber->top)->ptrVal = (int64_t)result;
+}
+
+
+// fn delete(array: [] type, index: int, type): [] type
+static void doBuiltinDelete(Fiber *fiber, HeapPages *pages, Error *error)
+{
+    DynArray *result = (DynArray *)(fiber->top++)->ptrVal;
+    Type *type       = (Type     *)(fiber->top++)->ptrVal;
+    int index        =             (fiber->top++)->intVal;
+    DynArray *array  = (DynArray *)(fiber->top++)->ptrVal;
+
+    if (!array || !array->data)
+        error->handlerRuntime(error->context, "Dynamic array is null");
+
+    if (index < 0 || index > array->len - 1)
+        error->handlerRuntime(error->context, "Index %d is out of range 0...%d", index, array->len - 1);
+
+    result->len      = array->len - 1;
+    result->itemSize = array->itemSize;
+    result->data     = doAllocDynArrayData(pages, result->len, result->itemSize, error);
+
+    memcpy(result->data, array->data, index * array->itemSize);
+    memcpy(result->data + index * result->itemSize, array->data + (index + 1) * result->itemSize, (result->len - index) * result->itemSize);
+
+    doChangeRefCntItems(fiber, pages, result->data, result->len, type, TOK_PLUSPLUS, error);
+
+    (--fiber->top)->ptrVal = (int64_t)result;
+}
+
+
+// fn insert(array: [] type, index: int, items: [] type, type): [] type
+// fn appendall(array: [] type, items: [] type, type): [] type
+static void doBuiltinInsert(Fiber *fiber, HeapPages *pages, bool toEnd, Error *error)
+{
+    DynArray *result = (DynArray *)(fiber->top++)->ptrVal;
+    Type *type       = (Type     *)(fiber->top++)->ptrVal;
+    DynArray *items  = (DynArray *)(fiber->top++)->ptrVal;
+    int index        = toEnd ? -1 : (fiber->top++)->intVal;
+    DynArray *array  = (DynArray *)(fiber->top++)->ptrVal;
+
+    if (!array || !array->data || !items || !items->data)
+        error->handlerRuntime(error->context, "Dynamic array is null");
+
+    if (toEnd)
+        index = array->len;
+
+    if (index < 0 || index > array->len)
+        error->handlerRuntime(error->context, "Index %d is out of range 0...%d", index, array->len);
+
+    int len = array->len + items->len;
+    int itemSize = array->itemSize;
+
+    // Items to be inserted may be a slice of the same chunk, so move the tail in place only if they don't overlap
+    bool overlap = items->data < array->data + len * itemSize && items->data + items->len * itemSize > array->data;
+
+    if (!overlap && len <= doGetDynArrayCapacity(pages, array))
+    {
+        doReallocDynArray(fiber, pages, result, array, type, len, 0, error);
+        memmove(result->data + (index + items->len) * itemSize, result->data + index * itemSize, (array->len - index) * itemSize);
+    }
+    else
+    {
+        result->len      = len;
+        result->itemSize = itemSize;
+        result->data     = doAllocDynArrayData(pages, len, itemSize, error);
+
+        memcpy(result->data, array->data, index * itemSize);
+        memcpy(result->data + (index + items->len) * itemSize, array->data + index * itemSize, (array->len - index) * itemSize);
+
+        doChangeRefCntItems(fiber, pages, result->data, index, type, TOK_PLUSPLUS, error);
+        doChangeRefCntItems(fiber, pages, result->data + (index + items->len) * itemSize, array->len - index, type, TOK_PLUSPLUS, error);
+    }
+
+    void *resultItems = result->data + index * itemSize;
+    memcpy(resultItems, items->data, items->len * itemSize);
+    doChangeRefCntItems(fiber, pages, resultItems, items->len, type, TOK_PLUSPLUS, error);
+
+    (--fiber->top)->ptrVal = (int64_t)result;
+}
+
+
+// fn copy(dest, src: [] type, type): int
+static void doBuiltinCopy(Fiber *fiber, HeapPages *pages, Error *error)
+{
+    Type *type     = (Type     *)(fiber->top++)->ptrVal;
+    DynArray *src  = (DynArray *)(fiber->top++)->ptrVal;
+    DynArray *dest = (DynArray *)fiber->top->ptrVal;
+
+    if (!dest || !dest->data || !src || !src->data)
+        error->handlerRuntime(error->context, "Dynamic array is null");
+
+    int len = (dest->len < src->len) ? dest->len : src->len;
+
+    // Increase the new items' ref counts before decreasing the old ones', since the arrays may overlap
+    doChangeRefCntItems(fiber, pages, src->data, len, type, TOK_PLUSPLUS, error);
+    doChangeRefCntItems(fiber, pages, dest->data, len, type, TOK_MINUSMINUS, error);
+    memmove(dest->data, src->data, len * dest->itemSize);
+
+    fiber->top->intVal = len;
+}
+
+
+// fn fill(array: [] type, item: ^type, type)
+static void doBuiltinFill(Fiber *fiber, HeapPages *pages, Error *error)
+{
+    Type *type      = (Type     *)(fiber->top++)->ptrVal;
+    void *item      = (void     *)(fiber->top++)->ptrVal;
+    DynArray *array = (DynArray *)(fiber->top++)->ptrVal;
+
+    if (!array || !array->data)
+        error->handlerRuntime(error->context, "Dynamic array is null");
+
+    if (array->len == 0)
+        return;
+
+    // The item may be one of the array items, so increase its ref counts before releasing them
+    for (int i = 0; i < array->len; i++)
+        doChangeRefCntItems(fiber, pages, item, 1, type, TOK_PLUSPLUS, error);
+    doChangeRefCntItems(fiber, pages, array->data, array->len, type, TOK_MINUSMINUS, error);
+
+    memmove(array->data, item, array->itemSize);
+
+    // Fill the rest by doubling the already filled part
+    int filled = 1;
+    while (filled < array->len)
+    {
+        int len = (filled < array->len - filled) ? filled : array->len - filled;
+        memcpy(array->data + filled * array->itemSize, array->data, len * array->itemSize);
+        filled += len;
+    }
+}
+
+
+// fn resize(array: [] type, len: int, type): [] type
+// fn reserve(array: [] type, capacity: int, type): [] type
+static void doBuiltinResize(Fiber *fiber, HeapPages *pages, bool reserve, Error *error)
+{
+    DynArray *result = (DynArray *)(fiber->top++)->ptrVal;
+    Type *type       = (Type     *)(fiber->top++)->ptrVal;
+    int len          =             (fiber->top++)->intVal;
+    DynArray *array  = (DynArray *)(fiber->top++)->ptrVal;
+
+    if (!array || !array->data)
+        error->handlerRuntime(error->context, "Dynamic array is null");
+
+    if (reserve)
+        doReallocDynArray(fiber, pages, result, array, type, array->len, len, error);
+    else
+        doReallocDynArray(fiber, pages, result, array, type, len, 0, error);
+
+    (--fiber->top)->ptrVal = (int64_t)result;
+}
+
+
+static bool doCallLess(VM *vm, int lessEntryOffset, Type *itemPtrType, void *a, void *b)
+{
+    // Call the script comparison function: fn (a, b: ^type): bool
+    Fiber *fiber = vm->fiber;
+    Slot *top = fiber->top;
+    int ip = fiber->ip;
+
+    doReserveStack(fiber, lessEntryOffset, 3, 0, vm->error);
+
+    // Push parameters and increase their ref counts, as any caller does
+    (--fiber->top)->ptrVal = (int64_t)a;
+    doBasicChangeRefCnt(fiber, vm->pages, a, itemPtrType, TOK_PLUSPLUS, vm->error);
+
+    (--fiber->top)->ptrVal = (int64_t)b;
+    doBasicChangeRefCnt(fiber, vm->pages, b, itemPtrType, TOK_PLUSPLUS, vm->error);
+
+    // Push null return address and go to the entry point, as vmRun() does
+    (--fiber->top)->intVal = 0;
+    fiber->ip = lessEntryOffset;
+
+    vm->callbackDepth++;
+    vmLoop(vm);
+    vm->callbackDepth--;
+
+    doUnwindStack(fiber, top);
+    fiber->ip = ip;
+
+    return fiber->reg[VM_REG_RESULT].intVal;
+}
+
+
+static bool doLess(VM *vm, int lessEntryOffset, Type *itemPtrType, void *a, void *b)
+{
+    if (lessEntryOffset > 0)
+        return doCallLess(vm, lessEntryOffset, itemPtrType, a, b);
+
+    TypeKind typeKind = itemPtrType->base->kind;
+    if (typeKind == TYPE_STR)
+    {
+        char *aStr = *(char **)a, *bStr = *(char **)b;
+        return strcmp(aStr ? aStr : "", bStr ? bStr : "") < 0;
+    }
+
+    Slot aVal = {.ptrVal = (int64_t)a}, bVal = {.ptrVal = (int64_t)b};
+    doBasicDeref(&aVal, typeKind, vm->error);
+    doBasicDeref(&bVal, typeKind, vm->error);
+
+    if (typeKind == TYPE_UINT)
+        return aVal.uintVal < bVal.uintVal;
+    if (typeKindReal(typeKind))
+        return aVal.realVal < bVal.realVal;
+    return aVal.intVal < bVal.intVal;
+}
+
+
+static void doMergeSort(VM *vm, int lessEntryOffset, Type *itemPtrType, void *data, void *buf, int len, int itemSize)
+{
+    // Stable merge sort for arbitrary items and comparison functions, buf should hold len / 2 items
+    if (len < 2)
+        return;
+
+    int half = len / 2;
+    void *middle = data + half * itemSize;
+
+    doMergeSort(vm, lessEntryOffset, itemPtrType, data, buf, half, itemSize);
+    doMergeSort(vm, lessEntryOffset, itemPtrType, middle, buf, len - half, itemSize);
+
+    // Already ordered
+    if (!doLess(vm, lessEntryOffset, itemPtrType, middle, middle - itemSize))
+        return;
+
+    memcpy(buf, data, half * itemSize);
+
+    void *left = buf, *leftEnd = buf + half * itemSize;
+    void *right = middle, *rightEnd = data + len * itemSize;
+    void *dest = data;
+
+    while (left < leftEnd && right < rightEnd)
+    {
+        if (doLess(vm, lessEntryOffset, itemPtrType, right, left))
+        {
+            memcpy(dest, right, itemSize);
+            right += itemSize;
+        }
+        else
+        {
+            memcpy(dest, left, itemSize);
+            left += itemSize;
+        }
+        dest += itemSize;
+    }
+
+    // The rest of the right half is already in place
+    memcpy(dest, left, leftEnd - left);
+}
+
+
+static uint64_t doGetRadixKey(Slot val, TypeKind typeKind)
+{
+    // Map items to unsigned keys preserving their order
+    if (typeKind == TYPE_UINT)
+        return val.uintVal;
+
+    if (typeKindReal(typeKind))
+    {
+        uint64_t bits;
+        memcpy(&bits, &val.realVal, sizeof(bits));
+        return (bits & 0x8000000000000000ULL) ? ~bits : bits ^ 0x8000000000000000ULL;
+    }
+
+    return (uint64_t)val.intVal ^ 0x8000000000000000ULL;
+}
+
+
+static Slot doGetRadixKeyValue(uint64_t key, TypeKind typeKind)
+{
+    Slot val;
+
+    if (typeKind == TYPE_UINT)
+        val.uintVal = key;
+    else if (typeKindReal(typeKind))
+    {
+        uint64_t bits = (key & 0x8000000000000000ULL) ? key ^ 0x8000000000000000ULL : ~key;
+        memcpy(&val.realVal, &bits, sizeof(bits));
+    }
+    else
+        val.intVal = (int64_t)(key ^ 0x8000000000000000ULL);
+
+    return val;
+}
+
+
+static void doRadixSort(HeapPages *pages, void *data, int len, int itemSize, TypeKind typeKind, Error *error)
+{
+    // LSD radix sort for ordinal and real items: the items are fully determined by their keys,
+    // so the keys are sorted and then converted back to items
+    uint64_t *keysChunk = chunkAlloc(pages, 2 * len * sizeof(uint64_t), error);
+    uint64_t *keys = keysChunk, *buf = keys + len;
+
+    int count[8][256];
+    memset(count, 0, sizeof(count));
+
+    for (int i = 0; i < len; i++)
+    {
+        Slot val = {.ptrVal = (int64_t)(data + i * itemSize)};
+        doBasicDeref(&val, typeKind, error);
+
+        keys[i] = doGetRadixKey(val, typeKind);
+        for (int digit = 0; digit < 8; digit++)
+            count[digit][(keys[i] >> (8 * digit)) & 0xFF]++;
+    }
+
+    for (int digit = 0; digit < 8; digit++)
+    {
+        // Skip the digit if it is the same for all the items
+        if (count[digit][(keys[0] >> (8 * digit)) & 0xFF] == len)
+            continue;
+
+        int offset = 0;
+        for (int i = 0; i < 256; i++)
+        {
+            int num = count[digit][i];
+            count[digit][i] = offset;
+            offset += num;
+        }
+
+        for (int i = 0; i < len; i++)
+            buf[count[digit][(keys[i] >> (8 * digit)) & 0xFF]++] = keys[i];
+
+        uint64_t *temp = keys;
+        keys = buf;
+        buf = temp;
+    }
+
+    for (int i = 0; i < len; i++)
+        doBasicAssign(data + i * itemSize, doGetRadixKeyValue(keys[i], typeKind), typeKind, 0, error);
+
+    chunkChangeRefCnt(pages, pageFind(pages, keysChunk), keysChunk, -1);
+}
+
+
+static void doGetSortedArray(Fiber *fiber, void **data, int *len, int *itemSize, Error *error)
+{
+    // Static arrays are passed with their length and item size, dynamic arrays hold them. A nil dynamic array is empty.
+    // The array stays on the top of the stack
+    if (fiber->code[fiber->ip].typeKind == TYPE_ARRAY)
+    {
+        *itemSize = (fiber->top++)->intVal;
+        *len      = (fiber->top++)->intVal;
+        *data     = (void *)fiber->top->ptrVal;
+    }
+    else    // TYPE_DYNARRAY
+    {
+        DynArray *array = (DynArray *)fiber->top->ptrVal;
+        if (!array)
+            error->handlerRuntime(error->context, "Dynamic array is null");
+
+        *data     = array->data;
+        *len      = array->data ? array->len : 0;
+        *itemSize = array->itemSize;
+    }
+}
+
+
+// fn sort(array: [] type | [...] type [, len, itemSize: int], less: fn (a, b: ^type): bool | null, ^type)
+static void doBuiltinSort(VM *vm, Fiber *fiber, Error *error)
+{
+    Type *itemPtrType   = (Type *)(fiber->top++)->ptrVal;
+    int lessEntryOffset =         (fiber->top++)->intVal;
+
+    void *data;
+    int len, itemSize;
+    doGetSortedArray(fiber, &data, &len, &itemSize, error);
+    fiber->top++;
+
+    if (len < 2)
+        return;
+
+    TypeKind typeKind = itemPtrType->base->kind;
+
+    if (lessEntryOffset == 0 && typeKind != TYPE_STR)
+        doRadixSort(vm->pages, data, len, itemSize, typeKind, error);
+    else
+    {
+        // The buffer is allocated on the heap, so that it is not lost if the comparison function fails
+        void *buf = chunkAlloc(vm->pages, (len / 2) * itemSize, error);
+        doMergeSort(vm, lessEntryOffset, itemPtrType, data, buf, len, itemSize);
+        chunkChangeRefCnt(vm->pages, pageFind(vm->pages, buf), buf, -1);
+    }
+}
+
+
+// fn bsearch(array: [] type | [...] type [, len, itemSize: int], item: ^type, less: fn (a, b: ^type): bool | null, ^type): int
+static void doBuiltinBsearch(VM *vm, Fiber *fiber, Error *error)
+{
+    Type *itemPtrType   = (Type *)(fiber->top++)->ptrVal;
+    int lessEntryOffset =         (fiber->top++)->intVal;
+    void *item          = (void *)(fiber->top++)->ptrVal;
+
+    void *data;
+    int len, itemSize;
+    doGetSortedArray(fiber, &data, &len, &itemSize, error);
+
+    // Find the first item that is not less than the given one
+    int left = 0, right = len;
+    while (left < right)
+    {
+        int middle = left + (right - left) / 2;
+        if (doLess(vm, lessEntryOffset, itemPtrType, data + middle * itemSize, item))
+            left = middle + 1;
+        else
+            right = middle;
+    }
+
+    if (left < len && !doLess(vm, lessEntryOffset, itemPtrType, item, data + left * itemSize))
+        fiber->top->intVal = left;
+    else
+        fiber->top->intVal = -1;
+}
+
+
+// fn slice(array: [] type | [...] type | str, startIndex, endIndex: int [, len, itemSize: int, type]): [] type | str
+static void doBuiltinSlice(Fiber *fiber, HeapPages *pages, Error *error)
+{
+    TypeKind typeKind = fiber->code[fiber->ip].typeKind;
+
+    if (typeKind == TYPE_STR)
+    {
+        int endIndex   = (fiber->top++)->intVal;
+        int startIndex = (fiber->top++)->intVal;
+        char *str      = (char *)fiber->top->ptrVal;
+
+        if (!str)
+            error->handlerRuntime(error->context, "String is null");
+
+        int len = strlen(str);
+        if (startIndex < 0 || startIndex > endIndex || endIndex > len)
+            error->handlerRuntime(error->context, "Slice %d...%d is out of range 0...%d", startIndex, endIndex, len);
+
+        // Strings are null-terminated, so a slice cannot share the original chunk and has to be copied
+        char *result = chunkAlloc(pages, endIndex - startIndex + 1, error);
+        memcpy(result, str + startIndex, endIndex - startIndex);
+        result[endIndex - startIndex] = 0;
+
+        fiber->top->ptrVal = (int64_t)result;
+        return;
+    }
+
+    DynArray *result = (DynArray *)(fiber->top++)->ptrVal;
+    Type *type = NULL;
+    void *data;
+    int len, itemSize;
+
+    if (typeKind == TYPE_ARRAY)
+    {
+        type     = (Type *)(fiber->top++)->ptrVal;
+        itemSize = (fiber->top++)->intVal;
+        len      = (fiber->top++)->intVal;
+    }
+
+    int endIndex   = (fiber->top++)->intVal;
+    int startIndex = (fiber->top++)->intVal;
+
+    if (typeKind == TYPE_ARRAY)
+    {
+        data = (void *)fiber->top->ptrVal;
+        if (!data)
+            error->handlerRuntime(error->context, "Array is null");
+    }
+    else    // TYPE_DYNARRAY
+    {
+        DynArray *array = (DynArray *)fiber->top->ptrVal;
+        if (!array)
+            error->handlerRuntime(error->context, "Dynamic array is null");
+
+        // A nil dynamic array is empty
+        data     = array->data;
+        len      = data ? array->len : 0;
+        itemSize = array->itemSize;
+    }
+
+    if (startIndex < 0 || startIndex > endIndex || endIndex > len)
+        error->handlerRuntime(error->context, "Slice %d...%d is out of range 0...%d", startIndex, endIndex, len);
+
+    result->len      = endIndex - startIndex;
+    result->itemSize = itemSize;
+
+    if (typeKind == TYPE_ARRAY)
+    {
+        // A static array may live on the stack or inside another chunk, so its slice is a copy that owns its items
+        result->data = doAllocDynArrayData(pages, result->len, itemSize, error);
+        memcpy(result->data, data + startIndex * itemSize, result->len * itemSize);
+        doChangeRefCntItems(fiber, pages, result->data, result->len, type, TOK_PLUSPLUS, error);
+    }
+    else
+    {
+        // A slice of a dynamic array shares the original chunk, if any
+        result->data = data ? data + startIndex * itemSize : NULL;
+
+        HeapChunkHeader *chunk;
+        HeapPage *page = pageFindForInterior(pages, data, &chunk);
+        if (page)
+            chunkChangeRefCnt(pages, page, (void *)chunk + sizeof(HeapChunkHeader), 1);
+    }
+
+    fiber->top->ptrVal = (int64_t)result;
+}
+
+
+static void doBuiltinLen(Fiber *fiber, Error *error)
+{
+    if (!fiber->top->ptrVal)
+        error->handlerRuntime(error->context, "Dynamic array or string is null");
+
+    switch (fiber->code[fiber->ip].typeKind)
+    {
+        // Done at compile time for arrays
+        case TYPE_DYNARRAY: fiber->top->intVal = ((DynArray *)(fiber->top->ptrVal))->len; break;
+        case TYPE_STR:      fiber->top->intVal = strlen((char *)fiber->top->ptrVal); break;
+        default:            error->handlerRuntime(error->context, "Illegal type"); return;
+    }
+}
+
+
+static void doBuiltinSizeofself(Fiber *fiber, Error *error)
+{
+    int size = 0;
+
+    // Interface layout: __self, __selftype, methods
+    Type *__selftype = *(Type **)(fiber->top->ptrVal + sizeof(void *));
+    if (__selftype)
+        size = typeSizeNoCheck(__selftype->base);
+
+    fiber->top->intVal = size;
+}
+
+
+// type FiberFunc = fn(parent: ^fiber, anyParam: ^type)
+static Fiber *doAllocChildFiber(Fiber *fiber, HeapPages *pages, Error *error)
+{
+    // Copy whole fiber context except the stack. The child fiber starts with a small stack, and new stack segments are added when needed
+    Fiber *child = chunkAlloc(pages, sizeof(Fiber), error);
+    ((HeapChunkHeader *)((void *)child - sizeof(HeapChunkHeader)))->kind = CHUNK_FIBER;
+    *child = *fiber;
+
+    child->stackSize = child->usedStackSize = (VM_FIBER_STACK < fiber->maxStackSize) ? VM_FIBER_STACK : fiber->maxStackSize;
+    child->stack = stackAlloc(child->stackPool, child->stackSize);
+    child->top = child->base = child->stack + child->stackSize - 1;
+    child->numSegments = 0;
+    child->spareSegment = NULL;
+    child->spareSegmentSize = 0;
+    child->parent = fiber;
+    child->scheduled = false;
+    child->parkState = FIBER_RUNNING;
+    child->sendTicket = 0;
+    child->job = NULL;
+    child->scheduler = NULL;
+    child->budget = VM_FIBER_BUDGET;
+    return child;
+}
+
+
+// fn fiberspawn(childFunc: FiberFunc, anyParam: ^type): ^fiber
+static void doBuiltinFiberspawn(Fiber *fiber, HeapPages *pages, Error *error)
+{
+    void *anyParam = (void *)(fiber->top++)->ptrVal;
+    int childEntryOffset = (fiber->top++)->intVal;
+
+    Fiber *child = doAllocChildFiber(fiber, pages, error);
+    doReserveStack(child, childEntryOffset, 3, 0, error);
+
+    // The parent fiber pointer is a parameter released by the child fiber function, so its ref count is increased, as any caller does
+    HeapPage *page = pageFind(pages, fiber);
+    if (page)
+        chunkChangeRefCnt(pages, page, fiber, 1);
+
+    // Call child fiber function
+    (--child->top)->ptrVal = (int64_t)fiber;                  // Push parent fiber pointer
+    (--child->top)->ptrVal = (int64_t)anyParam;               // Push arbitrary pointer parameter
+    (--child->top)->intVal = VM_FIBER_KILL_SIGNAL;   // Push fiber kill signal instead of return address
+    child->ip = childEntryOffset;                    // Call
+
+    // Return child fiber pointer to parent fiber as result
+    (--fiber->top)->ptrVal = (int64_t)child;
+}
+
+
+// fn fibercall(child: ^fiber)
+static void doBuiltinFibercall(Fiber *fiber, Fiber **newFiber, HeapPages *pages, Error *error)
+{
+    *newFiber = (Fiber *)(fiber->top++)->ptrVal;
+    if (!(*newFiber) || !(*newFiber)->alive)
+        error->handlerRuntime(error->context, "Fiber is null");
+
+    // Any fiber can yield to its parent, but only the fiber's own thread can switch to it
+    if ((*newFiber)->scheduled && *newFiber != fiber->parent)
+        error->handlerRuntime(error->context, "Fiber is run by the scheduler");
+}
+
+
+// fn fiberalive(child: ^fiber)
+static void doBuiltinFiberalive(Fiber *fiber, HeapPages *pages, Error *error)
+{
+    Fiber *child = (Fiber *)fiber->top->ptrVal;
+    if (!child)
+        error->handlerRuntime(error->context, "Fiber is null");
 
-        // "%" [flags] [width] ["." precision] [length] type
-        // "%"
-        if (format[i] == '%')
-        {
-            i++;
+    fiber->top->intVal = __atomic_load_n(&child->alive, __ATOMIC_ACQUIRE);
+}
 
-            // [flags]
-            while (format[i] == '+' || format[i] == '-'  || format[i] == ' ' ||
-                   format[i] == '0' || format[i] == '\'' || format[i] == '#')
-                i++;
 
-            // [width]
-            while (format[i] >= '0' && format[i] <= '9')
-                i++;
+// fn fiberstart(child: ^fiber)
+static void doBuiltinFiberstart(VM *vm, Fiber *fiber, Error *error)
+{
+    Fiber *child = (Fiber *)(fiber->top++)->ptrVal;
+    if (!child || !child->alive)
+        error->handlerRuntime(error->context, "Fiber is null");
 
-            // [.precision]
-            if (format[i] == '.')
-            {
-                i++;
-                while (format[i] >= '0' && format[i] <= '9')
-                    i++;
-            }
+    if (child->scheduled || child == fiber)
+        error->handlerRuntime(error->context, "Fiber is already running");
 
-            // [length]
-            if (format[i] == 'h')
-            {
-                size = SIZE_SHORT;
-                i++;
+    schedStart(vm, child);
+}
 
-                if (format[i] == 'h')
-                {
-                    size = SIZE_SHORT_SHORT;
-                    i++;
-                }
-            }
-            else if (format[i] == 'l')
-            {
-                size = SIZE_LONG;
-                i++;
 
-                if (format[i] == 'l')
-                {
-                    size = SIZE_LONG_LONG;
-                    i++;
-                }
-            }
+// fn fiberwait(child: ^fiber)
+static bool doBuiltinFiberwait(VM *vm, Fiber *fiber, Fiber **newFiber, Error *error)
+{
+    Fiber *child = (Fiber *)fiber->top->ptrVal;
+    if (!child)
+        error->handlerRuntime(error->context, "Fiber is null");
 
-            // type
-            switch (format[i])
-            {
-                case '%': i++; continue;
-                case 'd':
-                case 'i':
-                {
-                    switch (size)
-                    {
-                        case SIZE_SHORT_SHORT:  *typeKind = TYPE_INT8;      break;
-                        case SIZE_SHORT:        *typeKind = TYPE_INT16;     break;
-                        case SIZE_NORMAL:
-                        case SIZE_LONG:         *typeKind = TYPE_INT32;     break;
-                        case SIZE_LONG_LONG:    *typeKind = TYPE_INT;       break;
-                    }
-                    break;
-                }
-                case 'u':
-                case 'x':
-                case 'X':
-                {
-                    switch (size)
-                    {
-                        case SIZE_SHORT_SHORT:  *typeKind = TYPE_UINT8;      break;
-                        case SIZE_SHORT:        *typeKind = TYPE_UINT16;     break;
-                        case SIZE_NORMAL:
-                        case SIZE_LONG:         *typeKind = TYPE_UINT32;     break;
-                        case SIZE_LONG_LONG:    *typeKind = TYPE_UINT;       break;
-                    }
-                    break;
-                }
-                case 'f':
-                case 'F':
-                case 'e':
-                case 'E':
-                case 'g':
-                case 'G': *typeKind = (size == SIZE_NORMAL) ? TYPE_REAL32 : TYPE_REAL;      break;
-                case 's': *typeKind = TYPE_STR;                                             break;
-                case 'c': *typeKind = TYPE_CHAR;                                            break;
+    if (__atomic_load_n(&child->alive, __ATOMIC_ACQUIRE))
+    {
+        if (!child->scheduled)
+            error->handlerRuntime(error->context, "Fiber is not started");
 
-                default : error->handlerRuntime(error->context, "Illegal type character %c in format string", format[i]);
-            }
-            i++;
+        // A scheduled fiber does not block its worker thread, but yields and waits again when resumed
+        if (fiber->scheduled)
+        {
+            *newFiber = fiber->parent;
+            return false;
         }
-        break;
+
+        schedWait(vm, child, error);
     }
-    *formatLen = i;
+
+    fiber->top++;
+    return true;
 }
 
 
-static void doBuiltinPrintf(Fiber *fiber, bool console, bool string, Error *error)
+static void doCallParforBody(VM *vm, ParforJob *job, int64_t index)
 {
-    void *stream      = console ? stdout : (void *)fiber->reg[VM_REG_IO_STREAM].ptrVal;
-    char *format      = (char *)fiber->reg[VM_REG_IO_FORMAT].ptrVal;
-    TypeKind typeKind = fiber->code[fiber->ip].typeKind;
+    // Call the script loop body: fn (index: int [, data: ^type])
+    Fiber *fiber = vm->fiber;
+    Slot *top = fiber->top;
+    int ip = fiber->ip;
 
-    if (!stream)
-        error->handlerRuntime(error->context, "printf() destination is null");
+    doReserveStack(fiber, job->entryOffset, 3, 0, vm->error);
 
-    if (!format)
-        error->handlerRuntime(error->context, "printf() format string is null");
+    // Push parameters and increase their ref counts, as any caller does
+    (--fiber->top)->intVal = index;
 
-    int formatLen;
-    TypeKind expectedTypeKind;
-    doCheckFormatString(format, &formatLen, &expectedTypeKind, error);
+    if (job->dataType)
+    {
+        (--fiber->top)->ptrVal = (int64_t)job->data;
+        doBasicChangeRefCnt(fiber, vm->pages, job->data, job->dataType, TOK_PLUSPLUS, vm->error);
+    }
 
-    if (typeKind != expectedTypeKind && !(typeKindInteger(typeKind) && typeKindInteger(expectedTypeKind)) &&
-                                        !(typeKindReal(typeKind)    && typeKindReal(expectedTypeKind)))
-        error->handlerRuntime(error->context, "Incompatible types %s and %s in printf()", typeKindSpelling(expectedTypeKind), typeKindSpelling(typeKind));
+    // Push null return address and go to the entry point, as vmRun() does
+    (--fiber->top)->intVal = 0;
+    fiber->ip = job->entryOffset;
 
-    char *curFormat = malloc(formatLen + 1);
-    strncpy(curFormat, format, formatLen);
-    curFormat[formatLen] = 0;
+    vm->callbackDepth++;
+    vmLoop(vm);
+    vm->callbackDepth--;
 
-    int len = 0;
+    doUnwindStack(fiber, top);
+    fiber->ip = ip;
+}
 
-    if (typeKind == TYPE_VOID)
-        len = fsprintf(string, stream, curFormat);
-    else if (typeKind == TYPE_REAL || typeKind == TYPE_REAL32)
-        len = fsprintf(string, stream, curFormat, fiber->top->realVal);
-    else
-        len = fsprintf(string, stream, curFormat, fiber->top->intVal);
 
-    fiber->reg[VM_REG_IO_FORMAT].ptrVal += formatLen;
-    fiber->reg[VM_REG_IO_COUNT].intVal += len;
-    if (string)
-        fiber->reg[VM_REG_IO_STREAM].ptrVal += len;
+static void doParfor(VM *vm, ParforJob *job)
+{
+    // Take index ranges until all of them are taken by this or other threads
+    while (!__atomic_load_n(&job->failed, __ATOMIC_ACQUIRE))
+    {
+        int64_t first = __atomic_fetch_add(&job->next, job->grain, __ATOMIC_RELAXED);
+        if (first >= job->count)
+            break;
 
-    free(curFormat);
+        int64_t last = (first + job->grain < job->count) ? first + job->grain : job->count;
+        for (int64_t i = first; i < last; i++)
+            doCallParforBody(vm, job, i);
+    }
 }
 
 
-static void doBuiltinScanf(Fiber *fiber, bool console, bool string, Error *error)
+// fn parfor(count: int, body: fn (index: int [, data: ^type]), data: ^type, type)
+static void doBuiltinParfor(VM *vm, Fiber *fiber, HeapPages *pages, Error *error)
 {
-    void *stream      = console ? stdin : (void *)fiber->reg[VM_REG_IO_STREAM].ptrVal;
-    char *format      = (char *)fiber->reg[VM_REG_IO_FORMAT].ptrVal;
-    TypeKind typeKind = fiber->code[fiber->ip].typeKind;
-
-    if (!stream)
-        error->handlerRuntime(error->context, "scanf() source is null");
-
-    if (!format)
-        error->handlerRuntime(error->context, "scanf() format string is null");
+    ParforJob job;
+    job.dataType    = (Type *)(fiber->top++)->ptrVal;
+    job.data        = (void *)(fiber->top++)->ptrVal;
+    job.entryOffset =         (fiber->top++)->intVal;
+    job.count       =         (fiber->top++)->intVal;
+    job.next        = 0;
+    job.failed      = false;
+
+    if (job.count <= 0)
+        return;
+
+    // Even if the loop owner is a scheduled fiber, it cannot yield to its worker thread until the loop body returns
+    bool scheduled = fiber->scheduled;
+    fiber->scheduled = false;
+
+    // The loop is split into more index ranges than threads, so that the threads that are done early take the remaining ranges
+    int numThreads = vm->scheduler ? vm->scheduler->numWorkers : schedGetNumCores();
+
+    job.grain = job.count / (8 * numThreads);
+    if (job.grain < 1)
+        job.grain = 1;
+
+    int numHelpers = (job.count + job.grain - 1) / job.grain - 1;
+    if (numHelpers > numThreads - 1)
+        numHelpers = numThreads - 1;
+
+    // Run the loop on the current thread if there are no other threads to help
+    if (numHelpers == 0)
+    {
+        job.numHelpers = 0;
+        doParfor(vm, &job);
+        fiber->scheduled = scheduled;
+        return;
+    }
 
-    int formatLen;
-    TypeKind expectedTypeKind;
-    doCheckFormatString(format, &formatLen, &expectedTypeKind, error);
+    if (!vm->scheduler)
+        schedInit(vm);
 
-    if (typeKind != expectedTypeKind)
-        error->handlerRuntime(error->context, "Incompatible types %s and %s in scanf()", typeKindSpelling(expectedTypeKind), typeKindSpelling(typeKind));
+    Fiber *helper[VM_MAX_WORKERS];
+    job.numHelpers = numHelpers;
 
-    char *curFormat = malloc(formatLen + 2 + 1);     // + 2 for "%n"
-    strncpy(curFormat, format, formatLen);
-    curFormat[formatLen] = 0;
-    strcat(curFormat, "%n");
+    for (int i = 0; i < numHelpers; i++)
+    {
+        helper[i] = doAllocChildFiber(fiber, pages, error);
+        helper[i]->job = &job;
+        schedStart(vm, helper[i]);
+    }
 
-    int len = 0, cnt = 0;
+    // The helpers refer to the job, so an error in the loop body cannot leave this function until they return
+    jmp_buf jumper;
+    memcpy(jumper, error->jumper, sizeof(jmp_buf));
 
-    if (typeKind == TYPE_VOID)
-        cnt = fsscanf(string, stream, curFormat, &len);
+    bool failed = false;
+    if (setjmp(error->jumper) == 0)
+        doParfor(vm, &job);
     else
     {
-        if (!fiber->top->ptrVal)
-            error->handlerRuntime(error->context, "scanf() destination is null");
-
-        cnt = fsscanf(string, stream, curFormat, (void *)fiber->top->ptrVal, &len);
+        __atomic_store_n(&job.failed, true, __ATOMIC_RELEASE);
+        failed = true;
     }
 
-    fiber->reg[VM_REG_IO_FORMAT].ptrVal += formatLen;
-    fiber->reg[VM_REG_IO_COUNT].intVal += cnt;
-    if (string)
-        fiber->reg[VM_REG_IO_STREAM].ptrVal += len;
-
-    free(curFormat);
-}
+    memcpy(error->jumper, jumper, sizeof(jmp_buf));
 
+    Scheduler *sched = vm->scheduler;
+    pthread_mutex_lock(&sched->lock);
 
-// fn make([...] type (actually itemSize: int), len: int): [] type
-static void doBuiltinMake(Fiber *fiber, HeapPages *pages, Error *error)
-{
-    DynArray *result = (DynArray *)(fiber->top++)->ptrVal;
-    result->len      = (fiber->top++)->intVal;
-    result->itemSize = (fiber->top++)->intVal;
-    result->data     = chunkAlloc(pages, result->len * result->itemSize, error);
+    while (job.numHelpers > 0)
+        pthread_cond_wait(&sched->finish, &sched->lock);
 
-    (--fiber->top)->ptrVal = (int64_t)result;
-}
+    for (int i = 0; i < numHelpers; i++)
+        fiberRelease(pages, helper[i]);
 
+    schedUnshareHeap(vm);
+    pthread_mutex_unlock(&sched->lock);
 
-// fn makefrom(array: [...] type, itemSize: int, len: int): [] type
-static void doBuiltinMakefrom(Fiber *fiber, HeapPages *pages, Error *error)
-{
-    doBuiltinMake(fiber, pages, error);
+    fiber->scheduled = scheduled;
 
-    DynArray *dest = (DynArray *)(fiber->top++)->ptrVal;
-    void *src      = (void     *)(fiber->top++)->ptrVal;
+    if (failed)
+        longjmp(error->jumper, 1);
 
-    memcpy(dest->data, src, dest->len * dest->itemSize);
-    (--fiber->top)->ptrVal = (int64_t)dest;
+    if (job.failed)
+        error->handlerRuntime(error->context, "%s (in parallel loop at %s: %d)", job.failure.msg, job.failure.fileName, job.failure.line);
 }
 
 
-// fn append(array: [] type, item: ^type): [] type
-static void doBuiltinAppend(Fiber *fiber, HeapPages *pages, Error *error)
+// fn makechan(type: ^chan type, capacity: int): chan type
+static void doBuiltinMakechan(Fiber *fiber, HeapPages *pages, Error *error)
 {
-    DynArray *result = (DynArray *)(fiber->top++)->ptrVal;
-    void *item       = (void     *)(fiber->top++)->ptrVal;
-    DynArray *array  = (DynArray *)(fiber->top++)->ptrVal;
+    int capacity = (fiber->top++)->intVal;
+    Type *type   = (Type *)fiber->top->ptrVal;
 
-    if (!array || !array->data)
-        error->handlerRuntime(error->context, "Dynamic array is null");
+    if (capacity < 0)
+        error->handlerRuntime(error->context, "Channel capacity is negative");
 
-    result->len      = array->len + 1;
-    result->itemSize = array->itemSize;
-    result->data     = chunkAlloc(pages, result->len * result->itemSize, error);
+    int itemSize = typeSizeNoCheck(type->base);
+    int numSlots = capacity > 0 ? capacity : 1;
 
-    memcpy(result->data, array->data, array->len * array->itemSize);
-    memcpy(result->data + (result->len - 1) * result->itemSize, item, result->itemSize);
+    Channel *chan = chunkAlloc(pages, sizeof(Channel) + numSlots * itemSize, error);
+    ((HeapChunkHeader *)((void *)chan - sizeof(HeapChunkHeader)))->kind = CHUNK_CHAN;
 
-    (--fiber->top)->ptrVal = (int64_t)result;
+    chan->type = type;
+    chan->itemSize = itemSize;
+    chan->capacity = capacity;
+    chan->head = chan->len = 0;
+    chan->numSent = chan->numReceived = 0;
+    chan->closed = false;
+    chan->waiter = NULL;
+    chan->numWaiters = chan->maxWaiters = 0;
+
+    fiber->top->ptrVal = (int64_t)chan;
 }
 
 
-// fn delete(array: [] type, index: int): [] type
-static void doBuiltinDelete(Fiber *fiber, HeapPages *pages, Error *error)
+// fn send(c: chan type, item: ^type)
+static bool doBuiltinSend(VM *vm, Fiber *fiber, Fiber **newFiber, HeapPages *pages, Error *error)
 {
-    DynArray *result = (DynArray *)(fiber->top++)->ptrVal;
-    int index        =             (fiber->top++)->intVal;
-    DynArray *array  = (DynArray *)(fiber->top++)->ptrVal;
+    void *item    = (void    *)fiber->top[0].ptrVal;
+    Channel *chan = (Channel *)fiber->top[1].ptrVal;
 
-    if (!array || !array->data)
-        error->handlerRuntime(error->context, "Dynamic array is null");
+    if (!chan)
+        error->handlerRuntime(error->context, "Channel is null");
 
-    result->len      = array->len - 1;
-    result->itemSize = array->itemSize;
-    result->data     = chunkAlloc(pages, result->len * result->itemSize, error);
+    chanLock(vm);
 
-    memcpy(result->data, array->data, index * array->itemSize);
-    memcpy(result->data + index * result->itemSize, array->data + (index + 1) * result->itemSize, (result->len - index) * result->itemSize);
+    while (1)
+    {
+        // Put the item into the channel, unless it has already been put before the fiber was blocked
+        if (fiber->sendTicket == 0)
+        {
+            if (chan->closed)
+            {
+                chanUnlock(vm);
+                error->handlerRuntime(error->context, "Channel is closed");
+            }
 
-    (--fiber->top)->ptrVal = (int64_t)result;
+            if (chan->len < (chan->capacity > 0 ? chan->capacity : 1))
+            {
+                void *chanItemPtr = chanItem(chan, chan->len);
+                memcpy(chanItemPtr, item, chan->itemSize);
+                doChangeRefCntItems(fiber, pages, chanItemPtr, 1, chan->type, TOK_PLUSPLUS, error);
+
+                chan->len++;
+                fiber->sendTicket = ++chan->numSent;
+                chanWake(vm, chan);
+            }
+        }
+
+        // An unbuffered channel also waits until the item is received
+        if (fiber->sendTicket > 0 && (chan->capacity > 0 || chan->numReceived >= fiber->sendTicket))
+        {
+            fiber->sendTicket = 0;
+            break;
+        }
+
+        if (!chanBlock(vm, fiber, &chan, 1, newFiber, error))
+        {
+            chanUnlock(vm);
+            return false;
+        }
+    }
+
+    chanUnlock(vm);
+    fiber->top += 2;
+    return true;
 }
 
 
-static void doBuiltinLen(Fiber *fiber, Error *error)
+// fn recv(c: chan type, result: ^type): type
+static bool doBuiltinRecv(VM *vm, Fiber *fiber, Fiber **newFiber, TypeKind typeKind, Error *error)
 {
-    if (!fiber->top->ptrVal)
-        error->handlerRuntime(error->context, "Dynamic array or string is null");
+    void *result  = (void    *)fiber->top[0].ptrVal;
+    Channel *chan = (Channel *)fiber->top[1].ptrVal;
 
-    switch (fiber->code[fiber->ip].typeKind)
+    if (!chan)
+        error->handlerRuntime(error->context, "Channel is null");
+
+    chanLock(vm);
+
+    while (chan->len == 0 && !chan->closed)
+        if (!chanBlock(vm, fiber, &chan, 1, newFiber, error))
+        {
+            chanUnlock(vm);
+            return false;
+        }
+
+    // The item refs are moved from the channel to the result. A closed channel gives zero values when empty
+    if (chan->len > 0)
     {
-        // Done at compile time for arrays
-        case TYPE_DYNARRAY: fiber->top->intVal = ((DynArray *)(fiber->top->ptrVal))->len; break;
-        case TYPE_STR:      fiber->top->intVal = strlen((char *)fiber->top->ptrVal); break;
-        default:            error->handlerRuntime(error->context, "Illegal type"); return;
+        memcpy(result, chanItem(chan, 0), chan->itemSize);
+
+        chan->head = (chan->head + 1) % (chan->capacity > 0 ? chan->capacity : 1);
+        chan->len--;
+        chan->numReceived++;
+        chanWake(vm, chan);
     }
+    else
+        memset(result, 0, chan->itemSize);
+
+    chanUnlock(vm);
+
+    fiber->top++;
+    fiber->top->ptrVal = (int64_t)result;
+    doBasicDeref(fiber->top, typeKind, error);
+    return true;
 }
 
 
-static void doBuiltinSizeofself(Fiber *fiber, Error *error)
+// fn select(c1, c2, ...: chan type, count: int): int
+static bool doBuiltinSelect(VM *vm, Fiber *fiber, Fiber **newFiber, Error *error)
 {
-    int size = 0;
+    int numChans = fiber->top[0].intVal;
+    if (numChans < 1 || numChans > VM_MAX_SELECT_CHANS)
+        error->handlerRuntime(error->context, "Illegal number of channels in select()");
 
-    // Interface layout: __self, __selftype, methods
-    Type *__selftype = *(Type **)(fiber->top->ptrVal + sizeof(void *));
-    if (__selftype)
-        size = typeSizeNoCheck(__selftype->base);
+    Channel *chans[VM_MAX_SELECT_CHANS];
+    for (int i = 0; i < numChans; i++)
+    {
+        chans[i] = (Channel *)fiber->top[numChans - i].ptrVal;
+        if (!chans[i])
+            error->handlerRuntime(error->context, "Channel is null");
+    }
 
-    fiber->top->intVal = size;
-}
+    chanLock(vm);
 
+    // Find the first channel that has an item. Closed empty channels are skipped, unless all channels are such
+    int index;
+    while (1)
+    {
+        bool open = false;
+        for (index = 0; index < numChans; index++)
+        {
+            if (chans[index]->len > 0)
+                break;
+            if (!chans[index]->closed)
+                open = true;
+        }
 
-// type FiberFunc = fn(parent: ^fiber, anyParam: ^type)
-// fn fiberspawn(childFunc: FiberFunc, anyParam: ^type): ^fiber
-static void doBuiltinFiberspawn(Fiber *fiber, HeapPages *pages, Error *error)
-{
-    void *anyParam = (void *)(fiber->top++)->ptrVal;
-    int childEntryOffset = (fiber->top++)->intVal;
+        if (index < numChans)
+            break;
 
-    // Copy whole fiber context
-    Fiber *child = chunkAlloc(pages, sizeof(Fiber), error);
-    *child = *fiber;
+        if (!open)
+        {
+            index = -1;
+            break;
+        }
 
-    child->stack = malloc(fiber->stackSize * sizeof(Slot));
-    *(child->stack) = *(fiber->stack);
+        if (!chanBlock(vm, fiber, chans, numChans, newFiber, error))
+        {
+            chanUnlock(vm);
+            return false;
+        }
+    }
 
-    child->top  = child->stack + (fiber->top  - fiber->stack);
-    child->base = child->stack + (fiber->base - fiber->stack);
+    // The fiber may still be blocked on the channels that have not changed
+    for (int i = 0; i < numChans; i++)
+        chanRemoveWaiter(chans[i], fiber);
 
-    // Call child fiber function
-    (--child->top)->ptrVal = (int64_t)fiber;                  // Push parent fiber pointer
-    (--child->top)->ptrVal = (int64_t)anyParam;               // Push arbitrary pointer parameter
-    (--child->top)->intVal = VM_FIBER_KILL_SIGNAL;   // Push fiber kill signal instead of return address
-    child->ip = childEntryOffset;                    // Call
+    chanUnlock(vm);
 
-    // Return child fiber pointer to parent fiber as result
-    (--fiber->top)->ptrVal = (int64_t)child;
+    fiber->top += numChans;
+    fiber->top->intVal = index;
+    return true;
 }
 
 
-// fn fibercall(child: ^fiber)
-static void doBuiltinFibercall(Fiber *fiber, Fiber **newFiber, HeapPages *pages, Error *error)
+// fn close(c: chan type)
+static void doBuiltinClose(VM *vm, Fiber *fiber, Error *error)
 {
-    *newFiber = (Fiber *)(fiber->top++)->ptrVal;
-    if (!(*newFiber) || !(*newFiber)->alive)
-        error->handlerRuntime(error->context, "Fiber is null");
-}
+    Channel *chan = (Channel *)(fiber->top++)->ptrVal;
+    if (!chan)
+        error->handlerRuntime(error->context, "Channel is null");
 
+    chanLock(vm);
 
-// fn fiberalive(child: ^fiber)
-static void doBuiltinFiberalive(Fiber *fiber, HeapPages *pages, Error *error)
-{
-    Fiber *child = (Fiber *)fiber->top->ptrVal;
-    if (!child)
-        error->handlerRuntime(error->context, "Fiber is null");
+    if (chan->closed)
+    {
+        chanUnlock(vm);
+        error->handlerRuntime(error->context, "Channel is closed");
+    }
 
-    fiber->top->intVal = child->alive;
+    chan->closed = true;
+    chanWake(vm, chan);
+
+    chanUnlock(vm);
 }
 
 
@@ -972,6 +2917,18 @@ static void doPushLocalPtr(Fiber *fiber, Error *error)
 }
 
 
+static void doPushGlobalPtr(Fiber *fiber, Error *error)
+{
+    // Global variable addresses are offsets (in bytes) from the global variable storage start
+    (--fiber->top)->ptrVal = (int64_t)((int8_t *)fiber->globals + fiber->code[fiber->ip].operand.intVal);
+
+    if (fiber->code[fiber->ip].inlineOpcode == OP_DEREF)
+        doBasicDeref(fiber->top, fiber->code[fiber->ip].typeKind, error);
+
+    fiber->ip++;
+}
+
+
 static void doPushReg(Fiber *fiber)
 {
     (--fiber->top)->intVal = fiber->reg[fiber->code[fiber->ip].operand.intVal].intVal;
@@ -1376,21 +3333,80 @@ static void doCall(Fiber *fiber, Error *error)
     if (entryOffset == 0)
         error->handlerRuntime(error->context, "Called function is not defined");
 
+    // The parameters and the entry point address are moved to a new stack segment if needed
+    doReserveStack(fiber, entryOffset, 0, paramSlots + 1, error);
+
     // Push return address and go to the entry point
     (--fiber->top)->intVal = fiber->ip + 1;
     fiber->ip = entryOffset;
 }
 
 
-static void doCallExtern(Fiber *fiber)
+static bool doWaitExtern(VM *vm, Fiber *fiber)
+{
+    // The external function may have suspended the fiber. A scheduled fiber yields to its worker thread, any other fiber run by the host
+    // thread returns to the host, as if interrupted by the budget. A fiber that cannot return to the host, i.e., an unscheduled fiber
+    // on a worker thread or a script function called back by a built-in function or by an external one, blocks its thread
+    if (__atomic_load_n(&fiber->parkState, __ATOMIC_ACQUIRE) == FIBER_RUNNING)
+        return true;
+
+    if (fiber->scheduled)
+        return false;
+
+    if (vm->callbackDepth == 0 && vm->workerIndex < 0)
+    {
+        vm->interrupted = true;
+        return false;
+    }
+
+    pthread_mutex_lock(&fiber->externWait->lock);
+    while (__atomic_load_n(&fiber->parkState, __ATOMIC_ACQUIRE) != FIBER_RUNNING)
+        pthread_cond_wait(&fiber->externWait->resume, &fiber->externWait->lock);
+    pthread_mutex_unlock(&fiber->externWait->lock);
+
+    return true;
+}
+
+
+static bool doCallExtern(VM *vm, Fiber *fiber)
 {
     ExternFunc fn = (ExternFunc)fiber->code[fiber->ip].operand.ptrVal;
     fn(fiber->top + 5, &fiber->reg[VM_REG_RESULT]);       // + 5 for saved I/O registers, old base pointer and return address
     fiber->ip++;
+
+    return doWaitExtern(vm, fiber);
+}
+
+
+static bool doCallExternTyped(VM *vm, Fiber *fiber)
+{
+    External *external = (External *)fiber->code[fiber->ip].operand.ptrVal;
+
+    // Without a stack frame, the parameters immediately follow the return address
+    char *paramPtr = (char *)(fiber->top + (external->frame ? 5 : 1));
+
+    // Pass the parameters in declaration order, structured ones by pointer to the caller's copy
+    Slot params[MAX_PARAMS];
+    for (int i = 0; i < external->numParams; i++)
+    {
+        if (external->paramStructured[i])
+            params[i].ptrVal = (int64_t)(paramPtr + external->paramOffset[i]);
+        else
+            params[i] = *(Slot *)(paramPtr + external->paramOffset[i]);
+    }
+
+    // A structured result is written to the __result area
+    if (external->resultOffset >= 0)
+        fiber->reg[VM_REG_RESULT] = *(Slot *)(paramPtr + external->resultOffset);
+
+    ((ExternFunc)external->entry)(params, &fiber->reg[VM_REG_RESULT]);
+    fiber->ip++;
+
+    return doWaitExtern(vm, fiber);
 }
 
 
-static void doCallBuiltin(Fiber *fiber, Fiber **newFiber, HeapPages *pages, Error *error)
+static void doCallBuiltin(VM *vm, Fiber *fiber, Fiber **newFiber, HeapPages *pages, Error *error)
 {
     BuiltinFunc builtin = fiber->code[fiber->ip].operand.builtinVal;
     TypeKind typeKind   = fiber->code[fiber->ip].typeKind;
@@ -1453,6 +3469,15 @@ static void doCallBuiltin(Fiber *fiber, Fiber **newFiber, HeapPages *pages, Erro
         case BUILTIN_MAKEFROM:      doBuiltinMakefrom(fiber, pages, error); break;
         case BUILTIN_APPEND:        doBuiltinAppend(fiber, pages, error); break;
         case BUILTIN_DELETE:        doBuiltinDelete(fiber, pages, error); break;
+        case BUILTIN_INSERT:        doBuiltinInsert(fiber, pages, false, error); break;
+        case BUILTIN_APPENDALL:     doBuiltinInsert(fiber, pages, true, error); break;
+        case BUILTIN_COPY:          doBuiltinCopy(fiber, pages, error); break;
+        case BUILTIN_FILL:          doBuiltinFill(fiber, pages, error); break;
+        case BUILTIN_RESIZE:        doBuiltinResize(fiber, pages, false, error); break;
+        case BUILTIN_RESERVE:       doBuiltinResize(fiber, pages, true, error); break;
+        case BUILTIN_SORT:          doBuiltinSort(vm, fiber, error); break;
+        case BUILTIN_BSEARCH:       doBuiltinBsearch(vm, fiber, error); break;
+        case BUILTIN_SLICE:         doBuiltinSlice(fiber, pages, error); break;
         case BUILTIN_LEN:           doBuiltinLen(fiber, error); break;
         case BUILTIN_SIZEOF:        error->handlerRuntime(error->context, "Illegal instruction"); return;       // Done at compile time
         case BUILTIN_SIZEOFSELF:    doBuiltinSizeofself(fiber, error); break;
@@ -1461,6 +3486,37 @@ static void doCallBuiltin(Fiber *fiber, Fiber **newFiber, HeapPages *pages, Erro
         case BUILTIN_FIBERSPAWN:    doBuiltinFiberspawn(fiber, pages, error); break;
         case BUILTIN_FIBERCALL:     doBuiltinFibercall(fiber, newFiber, pages, error); break;
         case BUILTIN_FIBERALIVE:    doBuiltinFiberalive(fiber, pages, error); break;
+        case BUILTIN_FIBERSTART:    doBuiltinFiberstart(vm, fiber, error); break;
+        case BUILTIN_FIBERWAIT:
+        {
+            if (!doBuiltinFiberwait(vm, fiber, newFiber, error))
+                return;     // Execute the same instruction when resumed
+            break;
+        }
+
+        case BUILTIN_PARFOR:        doBuiltinParfor(vm, fiber, pages, error); break;
+
+        // Channels
+        case BUILTIN_MAKECHAN:      doBuiltinMakechan(fiber, pages, error); break;
+        case BUILTIN_SEND:
+        {
+            if (!doBuiltinSend(vm, fiber, newFiber, pages, error))
+                return;     // Execute the same instruction when resumed
+            break;
+        }
+        case BUILTIN_RECV:
+        {
+            if (!doBuiltinRecv(vm, fiber, newFiber, typeKind, error))
+                return;
+            break;
+        }
+        case BUILTIN_SELECT:
+        {
+            if (!doBuiltinSelect(vm, fiber, newFiber, error))
+                return;
+            break;
+        }
+        case BUILTIN_CLOSE:         doBuiltinClose(vm, fiber, error); break;
 
         // Misc
         case BUILTIN_REPR:          doBuiltinRepr(fiber, pages, error); break;
@@ -1470,6 +3526,32 @@ static void doCallBuiltin(Fiber *fiber, Fiber **newFiber, HeapPages *pages, Erro
 }
 
 
+static void doResume(Fiber *fiber, Fiber **newFiber, Error *error)
+{
+    // Switch to the generator fiber at the top of the stack, unless it has already returned
+    Fiber *child = (Fiber *)fiber->top->ptrVal;
+    if (!child)
+        error->handlerRuntime(error->context, "Fiber is null");
+
+    if (child->scheduled)
+        error->handlerRuntime(error->context, "Fiber is run by the scheduler");
+
+    fiber->ip++;
+    if (child->alive)
+        *newFiber = child;
+}
+
+
+static void doYield(Fiber *fiber, Fiber **newFiber, Error *error)
+{
+    if (!fiber->parent)
+        error->handlerRuntime(error->context, "No fiber to yield to");
+
+    fiber->ip++;
+    *newFiber = fiber->parent;
+}
+
+
 static void doReturn(Fiber *fiber, Fiber **newFiber)
 {
     // Pop return address
@@ -1478,7 +3560,7 @@ static void doReturn(Fiber *fiber, Fiber **newFiber)
     if (returnOffset == VM_FIBER_KILL_SIGNAL)
     {
         // For fiber function, kill the fiber, extract the parent fiber pointer and switch to it
-        fiber->alive = false;
+        __atomic_store_n(&fiber->alive, false, __ATOMIC_RELEASE);
         *newFiber = (Fiber *)(fiber->top + 1)->ptrVal;
     }
     else
@@ -1486,14 +3568,43 @@ static void doReturn(Fiber *fiber, Fiber **newFiber)
         // For conventional function, remove parameters and entry point address from stack and go back
         fiber->top += fiber->code[fiber->ip].operand.intVal + 1;
         fiber->ip = returnOffset;
+
+        // Leave the stack segment added for the function
+        if (fiber->numSegments > 0 && fiber->top == fiber->stack + fiber->stackSize - VM_SEGMENT_HEADER)
+            doPopSegment(fiber);
+    }
+}
+
+
+static bool doPreempt(VM *vm, Fiber *fiber)
+{
+    // The time slice of the fiber is over. A scheduled fiber yields to its worker thread, while any other fiber run by the host thread
+    // returns to the host if the host has set a budget. Script functions called back by built-in functions are never interrupted
+    if (vm->callbackDepth == 0)
+    {
+        if (fiber->scheduled)
+        {
+            fiber->budget = VM_FIBER_BUDGET;
+            return true;
+        }
+
+        if (vm->budget > 0 && vm->workerIndex < 0)
+        {
+            fiber->budget = vm->budget;
+            vm->interrupted = true;
+            return true;
+        }
     }
+
+    fiber->budget = (vm->budget > 0) ? vm->budget : VM_FIBER_BUDGET;
+    return false;
 }
 
 
 static void doEnterFrame(Fiber *fiber, Error *error)
 {
     // Push old stack frame base pointer, move new one to stack top, shift stack top by local variables' size
-    int size = fiber->code[fiber->ip].operand.intVal;
+    int size = fiber->code[fiber->ip].operand.intVal & 0xFFFFFFFF;
     int slots = align(size, sizeof(Slot)) / sizeof(Slot);
 
     if (fiber->top - slots - fiber->stack < VM_MIN_FREE_STACK)
@@ -1536,7 +3647,7 @@ static void doLeaveFrame(Fiber *fiber)
 static void vmLoop(VM *vm)
 {
     Fiber *fiber = vm->fiber;
-    HeapPages *pages = &vm->pages;
+    HeapPages *pages = vm->pages;
     Error *error = vm->error;
 
     while (1)
@@ -1548,6 +3659,7 @@ static void vmLoop(VM *vm)
         {
             case OP_PUSH:                           doPush(fiber, error);                         break;
             case OP_PUSH_LOCAL_PTR:                 doPushLocalPtr(fiber, error);                 break;
+            case OP_PUSH_GLOBAL_PTR:                doPushGlobalPtr(fiber, error);                break;
             case OP_PUSH_REG:                       doPushReg(fiber);                             break;
             case OP_PUSH_STRUCT:                    doPushStruct(fiber, error);                   break;
             case OP_POP:                            doPop(fiber);                                 break;
@@ -1564,18 +3676,85 @@ static void vmLoop(VM *vm)
             case OP_GET_DYNARRAY_PTR:               doGetDynArrayPtr(fiber, error);               break;
             case OP_GET_FIELD_PTR:                  doGetFieldPtr(fiber, error);                  break;
             case OP_ASSERT_TYPE:                    doAssertType(fiber);                          break;
-            case OP_GOTO:                           doGoto(fiber);                                break;
-            case OP_GOTO_IF:                        doGotoIf(fiber);                              break;
-            case OP_CALL:                           doCall(fiber, error);                         break;
-            case OP_CALL_EXTERN:                    doCallExtern(fiber);                          break;
+            case OP_GOTO:
+            case OP_GOTO_IF:
+            {
+                int ip = fiber->ip;
+
+                if (fiber->code[ip].opcode == OP_GOTO)
+                    doGoto(fiber);
+                else
+                    doGotoIf(fiber);
+
+                // Loop back-edges and function calls consume the time slice
+                if (fiber->ip < ip && --fiber->budget <= 0 && doPreempt(vm, fiber))
+                    return;
+                break;
+            }
+            case OP_CALL:
+            {
+                doCall(fiber, error);
+
+                if (--fiber->budget <= 0 && doPreempt(vm, fiber))
+                    return;
+                break;
+            }
+            case OP_CALL_EXTERN:
+            {
+                // A fiber suspended by the external function yields to its worker thread or returns to the host
+                vm->externDepth++;
+                bool running = doCallExtern(vm, fiber);
+                vm->externDepth--;
+
+                if (!running)
+                    return;
+                break;
+            }
+            case OP_CALL_EXTERN_TYPED:
+            {
+                vm->externDepth++;
+                bool running = doCallExternTyped(vm, fiber);
+                vm->externDepth--;
+
+                if (!running)
+                    return;
+                break;
+            }
             case OP_CALL_BUILTIN:
             {
                 Fiber *newFiber = NULL;
-                doCallBuiltin(fiber, &newFiber, pages, error);
+                doCallBuiltin(vm, fiber, &newFiber, pages, error);
+
+                if (newFiber)
+                {
+                    // A scheduled fiber yields to its worker thread rather than to its parent
+                    if (fiber->scheduled && newFiber == fiber->parent)
+                        return;
+
+                    fiber = vm->fiber = newFiber;
+                }
+
+                break;
+            }
+            case OP_RESUME:
+            {
+                Fiber *newFiber = NULL;
+                doResume(fiber, &newFiber, error);
 
                 if (newFiber)
                     fiber = vm->fiber = newFiber;
+                break;
+            }
+            case OP_YIELD:
+            {
+                Fiber *newFiber = NULL;
+                doYield(fiber, &newFiber, error);
 
+                // A scheduled fiber yields to its worker thread rather than to its parent
+                if (fiber->scheduled)
+                    return;
+
+                fiber = vm->fiber = newFiber;
                 break;
             }
             case OP_RETURN:
@@ -1587,7 +3766,13 @@ static void vmLoop(VM *vm)
                 doReturn(fiber, &newFiber);
 
                 if (newFiber)
+                {
+                    // A scheduled fiber returns to its worker thread rather than to its parent
+                    if (fiber->scheduled)
+                        return;
+
                     fiber = vm->fiber = newFiber;
+                }
 
                 if (!fiber->alive)
                     return;
@@ -1622,12 +3807,228 @@ void vmRun(VM *vm, int entryOffset, int numParamSlots, Slot *params, Slot *resul
         vm->fiber->ip = entryOffset;
     }
 
-    // Main loop
+    vm->result = (entryOffset > 0) ? result : NULL;
+    vm->callbackDepth = 0;
+    vm->fiber->budget = (vm->budget > 0) ? vm->budget : VM_FIBER_BUDGET;
+
+    vmContinue(vm);
+}
+
+
+void vmRunPrepared(VM *vm, Instruction *code, int entryOffset, int numParamSlots, Slot *params, Slot *result)
+{
+    // The entry point and the number of parameters of a prepared call are checked once by compilerPrepareCall(). The fiber is only reset
+    // if the previous call has not returned, i.e., has failed or has been interrupted, otherwise its stack is empty and can be reused
+    Fiber *fiber = vm->fiber;
+    Slot *bottom = fiber->stack + fiber->stackSize - 1;
+
+    if (fiber->code != code || fiber->numSegments > 0 || fiber->base != bottom)
+        vmReset(vm, code);
+
+    // Push parameters, null return address and go to the entry point
+    fiber->top = bottom - numParamSlots;
+    for (int i = 0; i < numParamSlots; i++)
+        fiber->top[i] = params[i];
+
+    (--fiber->top)->intVal = 0;
+    fiber->ip = entryOffset;
+
+    vm->result = result;
+    vm->callbackDepth = 0;
+    fiber->budget = (vm->budget > 0) ? vm->budget : VM_FIBER_BUDGET;
+
+    vmContinue(vm);
+}
+
+
+void vmContinue(VM *vm)
+{
+    // A fiber suspended by an external function stays interrupted until resumed by the host
+    if (__atomic_load_n(&vm->fiber->parkState, __ATOMIC_ACQUIRE) != FIBER_RUNNING)
+    {
+        vm->interrupted = true;
+        return;
+    }
+
+    // Main loop, until the script returns or is interrupted when its budget is exhausted
+    vm->interrupted = false;
     vmLoop(vm);
 
     // Save result
-    if (entryOffset > 0 && result)
-        *result = vm->fiber->reg[VM_REG_RESULT];
+    if (!vm->interrupted && vm->result)
+        *vm->result = vm->fiber->reg[VM_REG_RESULT];
+}
+
+
+void vmRunBatch(VM *vm, int entryOffset, int numCalls, int numParamSlots, Slot *params, Slot *results)
+{
+    if (entryOffset <= 0)
+        vm->error->handlerRuntime(vm->error->context, "Called function is not defined");
+
+    // Batch calls are never interrupted, as well as the script functions called back by built-in functions
+    vm->result = NULL;
+    vm->interrupted = false;
+    vm->callbackDepth = 1;
+    vm->fiber->budget = VM_FIBER_BUDGET;
+
+    Fiber *fiber = vm->fiber;
+    Slot *top = fiber->top;
+
+    for (int i = 0; i < numCalls; i++)
+    {
+        doReserveStack(fiber, entryOffset, numParamSlots + 1, 0, vm->error);
+
+        // Push parameters, null return address and go to the entry point
+        fiber->top -= numParamSlots;
+        for (int j = 0; j < numParamSlots; j++)
+            fiber->top[j] = params[i * numParamSlots + j];
+
+        (--fiber->top)->intVal = 0;
+        fiber->ip = entryOffset;
+
+        vmLoop(vm);
+
+        if (results)
+            results[i] = fiber->reg[VM_REG_RESULT];
+
+        doUnwindStack(fiber, top);
+    }
+}
+
+
+void vmRunNested(VM *vm, int entryOffset, int numParamSlots, Slot *params, Slot *result)
+{
+    // A script function called by an external function runs on top of the stack of the script that called the external function,
+    // as the script functions called back by built-in functions do. An error is caught by the API function that made the call,
+    // which then restores the interrupted script with vmRestoreCallState(), so that the external function can return to it
+    if (entryOffset <= 0)
+        vm->error->handlerRuntime(vm->error->context, "Called function is not defined");
+
+    CallState state;
+    vmSaveCallState(vm, &state);
+
+    Fiber *fiber = vm->fiber;
+    doReserveStack(fiber, entryOffset, numParamSlots + 1, 0, vm->error);
+
+    // Push parameters, null return address and go to the entry point
+    fiber->top -= numParamSlots;
+    for (int i = 0; i < numParamSlots; i++)
+        fiber->top[i] = params[i];
+
+    (--fiber->top)->intVal = 0;
+    fiber->ip = entryOffset;
+
+    vm->callbackDepth++;
+    vmLoop(vm);
+
+    // The result is stored after the registers are restored, since it may be the result register of the external function
+    Slot res = fiber->reg[VM_REG_RESULT];
+    vmRestoreCallState(vm, &state);
+
+    if (result)
+        *result = res;
+}
+
+
+void vmSaveCallState(VM *vm, CallState *state)
+{
+    Fiber *fiber = vm->fiber;
+
+    state->fiber = fiber;
+    state->top = fiber->top;
+    state->base = fiber->base;
+    state->ip = fiber->ip;
+    state->callbackDepth = vm->callbackDepth;
+    memcpy(state->reg, fiber->reg, sizeof(state->reg));
+}
+
+
+void vmRestoreCallState(VM *vm, CallState *state)
+{
+    Fiber *fiber = state->fiber;
+
+    vm->fiber = fiber;
+    doUnwindStack(fiber, state->top);
+    fiber->base = state->base;
+    fiber->ip = state->ip;
+    vm->callbackDepth = state->callbackDepth;
+    memcpy(fiber->reg, state->reg, sizeof(fiber->reg));
+}
+
+
+int vmGetStackTrace(VM *vm, DebugInfo *trace, int maxFrames)
+{
+    // The innermost frame is the current instruction. Each stack frame holds the old base pointer and the return address,
+    // which follows the call instruction. The trace ends at the null return address pushed by the host or by a built-in function
+    Fiber *fiber = vm->fiber;
+    Slot *base = fiber->base, *stack = fiber->stack;
+    int stackSize = fiber->stackSize, numSegments = fiber->numSegments;
+    int ip = fiber->ip, numFrames = 0;
+
+    while (numFrames < maxFrames)
+    {
+        trace[numFrames++] = fiber->code[ip].debug;
+
+        // The caller's frame may be in a previous stack segment
+        while ((base < stack || base >= stack + stackSize - 1) && numSegments > 0)
+        {
+            Slot *header = stack + stackSize - VM_SEGMENT_HEADER;
+            stack = (Slot *)header[2].ptrVal;
+            stackSize = header[1].intVal;
+            numSegments--;
+        }
+
+        if (base < stack || base >= stack + stackSize - 1)
+            break;
+
+        int returnOffset = base[1].intVal;
+        if (returnOffset <= 0)
+            break;
+
+        ip = returnOffset - 1;
+        base = (Slot *)base[0].ptrVal;
+    }
+
+    return numFrames;
+}
+
+
+void vmShareDynArray(VM *vm, DynArray *array, Type *type, void *data, int len)
+{
+    // Release the old items. The host memory lies outside the heap pages, so the VM never changes its ref count or frees it,
+    // and any operation that needs more room than len items copies the items to the heap
+    doBasicChangeRefCnt(vm->fiber, vm->pages, array, type, TOK_MINUSMINUS, vm->error);
+
+    array->len      = len;
+    array->itemSize = typeSizeNoCheck(type->base);
+    array->data     = data;
+}
+
+
+void vmCopyGlobal(VM *vm, int destOffset, int srcOffset, Type *type)
+{
+    // The copy is a new reference to the heap data of the original
+    void *dest = (char *)vm->globals + destOffset;
+    memcpy(dest, (char *)vm->globals + srcOffset, typeSizeNoCheck(type));
+
+    if (typeGarbageCollected(type))
+    {
+        void *ptr = dest;
+        if (type->kind == TYPE_PTR || type->kind == TYPE_STR)
+            ptr = *(void **)ptr;
+
+        doBasicChangeRefCnt(vm->fiber, vm->pages, ptr, type, TOK_PLUSPLUS, vm->error);
+    }
+}
+
+
+void vmReleaseGlobal(VM *vm, int offset, Type *type)
+{
+    void *ptr = (char *)vm->globals + offset;
+    if (type->kind == TYPE_PTR || type->kind == TYPE_STR)
+        ptr = *(void **)ptr;
+
+    doBasicChangeRefCnt(vm->fiber, vm->pages, ptr, type, TOK_MINUSMINUS, vm->error);
 }
 
 
@@ -1656,6 +4057,7 @@ int vmAsm(int ip, Instruction *instr, char *buf)
             break;
         }
         case OP_PUSH_LOCAL_PTR:
+        case OP_PUSH_GLOBAL_PTR:
         case OP_PUSH_REG:
         case OP_PUSH_STRUCT:
         case OP_POP_REG:
@@ -1666,9 +4068,10 @@ int vmAsm(int ip, Instruction *instr, char *buf)
         case OP_GOTO:
         case OP_GOTO_IF:
         case OP_CALL:
-        case OP_RETURN:
-        case OP_ENTER_FRAME:            chars += sprintf(buf + chars, " %lld", (long long int)instr->operand.intVal); break;
+        case OP_RETURN:                 chars += sprintf(buf + chars, " %lld", (long long int)instr->operand.intVal); break;
+        case OP_ENTER_FRAME:            chars += sprintf(buf + chars, " %lld %lld", (long long int)(instr->operand.intVal & 0xFFFFFFFF), (long long int)(instr->operand.intVal >> 32)); break;
         case OP_CALL_EXTERN:            chars += sprintf(buf + chars, " %p",   (void *)instr->operand.ptrVal); break;
+        case OP_CALL_EXTERN_TYPED:      chars += sprintf(buf + chars, " %s",   ((External *)instr->operand.ptrVal)->name); break;
         case OP_CALL_BUILTIN:           chars += sprintf(buf + chars, " %s",   builtinSpelling[instr->operand.builtinVal]); break;
         case OP_CHANGE_REF_CNT:
         case OP_CHANGE_REF_CNT_ASSIGN:
@@ -1689,3 +4092,37 @@ int vmAsm(int ip, Instruction *instr, char *buf)
 
     return chars;
 }
+
+
+void *vmSuspendExtern(Slot *result)
+{
+    // The result pointer passed to an external function is always the result register of the calling fiber
+    Fiber *fiber = (Fiber *)((void *)result - offsetof(Fiber, reg) - VM_REG_RESULT * sizeof(Slot));
+    __atomic_store_n(&fiber->parkState, FIBER_PARKING, __ATOMIC_RELEASE);
+    return fiber;
+}
+
+
+void vmResumeExtern(void *handle, Slot *result)
+{
+    Fiber *fiber = handle;
+    fiber->reg[VM_REG_RESULT] = *result;
+
+    pthread_mutex_lock(&fiber->externWait->lock);
+    FiberParkState parkState = __atomic_exchange_n(&fiber->parkState, FIBER_RUNNING, __ATOMIC_ACQ_REL);
+    pthread_cond_broadcast(&fiber->externWait->resume);
+    pthread_mutex_unlock(&fiber->externWait->lock);
+
+    // A scheduled fiber that has already returned to its worker thread is queued again to any worker thread
+    if (parkState == FIBER_PARKED)
+    {
+        Scheduler *sched = fiber->scheduler;
+        schedPut(sched, __atomic_fetch_add(&sched->nextWorker, 1, __ATOMIC_RELAXED) % sched->numWorkers, fiber);
+    }
+}
+
+
+char *vmBuiltinSpelling(BuiltinFunc builtin)
+{
+    return builtinSpelling[builtin];
+}
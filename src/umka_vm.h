@@ -1,6 +1,8 @@
 #ifndef UMKA_VM_H_INCLUDED
 #define UMKA_VM_H_INCLUDED
 
+#include <pthread.h>
+
 #include "umka_common.h"
 #include "umka_lexer.h"
 #include "umka_types.h"
@@ -22,8 +24,15 @@ enum
     VM_REG_IO_FORMAT     = VM_NUM_REGS - 2,
     VM_REG_IO_COUNT      = VM_NUM_REGS - 1,
 
-    VM_MIN_FREE_STACK    = 1024,                    // Slots
+    VM_MIN_FREE_STACK    = 256,                     // Slots
+    VM_FIBER_STACK       = 1024,                    // Slots, initial stack size for child fibers
+    VM_SEGMENT_HEADER    = 3,                       // Slots at the end of a stack segment: previous segment, its size and the stack top to return to
+    VM_FIBER_STACK_POOL  = 1024,                    // Max number of free child fiber stacks kept for reuse
     VM_MIN_HEAP_PAGE     = 1024 * 1024,             // Bytes
+    VM_HEAP_GRANULE      = 256,                     // Bytes of a heap page per entry of its chunk index
+    VM_MAX_WORKERS       = 64,                      // Max number of scheduler worker threads
+    VM_MAX_SELECT_CHANS  = 64,                      // Max number of channels in a select() call
+    VM_FIBER_BUDGET      = 10000,                   // Loop iterations and function calls in a time slice of a scheduled fiber
 
     VM_HEAP_CHUNK_MAGIC  = 0x1234567887654321LL,
 
@@ -36,6 +45,7 @@ typedef enum
     OP_NOP,
     OP_PUSH,
     OP_PUSH_LOCAL_PTR,
+    OP_PUSH_GLOBAL_PTR,
     OP_PUSH_REG,
     OP_PUSH_STRUCT,
     OP_POP,
@@ -56,7 +66,10 @@ typedef enum
     OP_GOTO_IF,
     OP_CALL,
     OP_CALL_EXTERN,
+    OP_CALL_EXTERN_TYPED,
     OP_CALL_BUILTIN,
+    OP_RESUME,
+    OP_YIELD,
     OP_RETURN,
     OP_ENTER_FRAME,
     OP_LEAVE_FRAME,
@@ -94,6 +107,15 @@ typedef enum
     BUILTIN_MAKEFROM,       // Array to dynamic array - implicit calls only
     BUILTIN_APPEND,
     BUILTIN_DELETE,
+    BUILTIN_INSERT,
+    BUILTIN_APPENDALL,
+    BUILTIN_COPY,
+    BUILTIN_FILL,
+    BUILTIN_RESIZE,
+    BUILTIN_RESERVE,
+    BUILTIN_SORT,
+    BUILTIN_BSEARCH,
+    BUILTIN_SLICE,          // Slicing expression a[i:j] - implicit calls only
     BUILTIN_LEN,
     BUILTIN_SIZEOF,
     BUILTIN_SIZEOFSELF,
@@ -102,6 +124,16 @@ typedef enum
     BUILTIN_FIBERSPAWN,
     BUILTIN_FIBERCALL,
     BUILTIN_FIBERALIVE,
+    BUILTIN_FIBERSTART,
+    BUILTIN_FIBERWAIT,
+    BUILTIN_PARFOR,
+
+    // Channels
+    BUILTIN_MAKECHAN,       // make() for channels - implicit calls only
+    BUILTIN_SEND,
+    BUILTIN_RECV,
+    BUILTIN_SELECT,
+    BUILTIN_CLOSE,
 
     // Misc
     BUILTIN_REPR,
@@ -123,21 +155,58 @@ typedef struct
 {
     Opcode opcode;
     Opcode inlineOpcode;            // Inlined instruction (DEREF, POP, SWAP): PUSH + DEREF, CHANGE_REF_CNT + POP, SWAP + ASSIGN etc.
-    TokenKind tokKind;              // Unary/binary operation token
+    TokenKind tokKind;              // Unary/binary operation token, or TOK_STRLITERAL for I/O calls with format segments checked at compile time
     TypeKind typeKind;              // Slot type kind
-    Slot operand;
+    Slot operand;                   // For ENTER_FRAME: local variable size in bytes, and stack slots needed by the function in the upper 32 bits
     DebugInfo debug;
 } Instruction;
 
 
 typedef struct
+{
+    Slot *stack[VM_FIBER_STACK_POOL];
+    int numStacks;
+    pthread_mutex_t lock;
+} FiberStackPool;
+
+
+typedef struct
+{
+    pthread_mutex_t lock;
+    pthread_cond_t resume;
+} ExternWait;                       // Fibers suspended by external functions that block their threads until resumed by the host
+
+
+typedef enum
+{
+    FIBER_RUNNING,
+    FIBER_PARKING,                  // Blocked on a channel or suspended by an external function, but not yet returned to its worker thread
+    FIBER_PARKED                    // Blocked or suspended and not queued, until the channel or the host wakes it up
+} FiberParkState;
+
+
+typedef struct tagFiber
 {
     Instruction *code;
+    void *globals;
     int ip;
     Slot *stack, *top, *base;
-    int stackSize;
+    int stackSize, maxStackSize;    // Current stack segment size, max total size of all segments
+    int usedStackSize;              // Total size of all segments
+    int numSegments;                // Segments added to the initial stack when a called function did not fit into it
+    Slot *spareSegment;             // Last segment left, kept for the next call that needs a segment
+    int spareSegmentSize;
+    FiberStackPool *stackPool;      // Shared by all fibers of the VM
+    ExternWait *externWait;         // Shared by all fibers of the VM
     Slot reg[VM_NUM_REGS];
+    struct tagFiber *parent;
     bool alive;
+    bool scheduled;                 // Run by the scheduler on worker threads
+    FiberParkState parkState;
+    int64_t sendTicket;             // Number of the item sent to an unbuffered channel, but not yet received
+    struct tagParforJob *job;       // Parallel loop that the fiber helps to run, if any
+    struct tagScheduler *scheduler; // Scheduler that runs the fiber, if scheduled
+    int budget;                     // Loop iterations and function calls left in the time slice
 } Fiber;
 
 
@@ -146,6 +215,7 @@ typedef struct tagHeapPage
     void *ptr;
     int size, occupied;
     int refCnt;
+    int *chunkIndex;                // Offset of the chunk that covers the start of each granule, for finding the chunk of any pointer
     struct tagHeapPage *prev, *next;
 } HeapPage;
 
@@ -153,33 +223,138 @@ typedef struct tagHeapPage
 typedef struct
 {
     HeapPage *first, *last;
+    bool shared;                    // Accessed by several threads: ref counts are atomic, empty pages are not removed
+    pthread_mutex_t lock;
 } HeapPages;
 
 
+typedef enum
+{
+    CHUNK_DATA,
+    CHUNK_FIBER,            // Owns its stack segments
+    CHUNK_CHAN              // Owns its waiter array
+} HeapChunkKind;
+
+
 typedef struct
 {
     int64_t magic;
     int refCnt;
     int size;
+    bool dynArray;          // Dynamic array items, so that dynamic arrays and slices can grow up to the chunk end
+    HeapChunkKind kind;     // Chunks that own memory outside the heap pages, which has to be freed with the heap
 } HeapChunkHeader;
 
 
 typedef void (*ExternFunc)(Slot *params, Slot *result);
 
 
+typedef struct
+{
+    Fiber **fiber;
+    int capacity, head, len;
+    pthread_mutex_t lock;
+} FiberQueue;
+
+
+typedef struct
+{
+    Type *type;                     // Channel base type, i.e., the type of the items is type->base
+    int itemSize, capacity;         // Unbuffered channels have zero capacity, but still hold one item while it is being received
+    int head, len;
+    int64_t numSent, numReceived;
+    bool closed;
+    Fiber **waiter;                 // Scheduled fibers blocked on the channel
+    int numWaiters, maxWaiters;
+} Channel;                          // Followed by the items
+
+
+typedef struct tagParforJob
+{
+    int entryOffset;                // Loop body: fn (index: int [, data: ^type])
+    void *data;
+    Type *dataType;                 // Null if the loop body has no data parameter
+    int64_t count, next, grain;     // Indices are taken by the threads in ranges of grain indices
+    int numHelpers;                 // Helper fibers that have not yet returned
+    bool failed;
+    Error failure;
+} ParforJob;
+
+
 typedef struct
 {
     Fiber *fiber;
-    HeapPages pages;
+    void *globals;                  // Global variables, initialized from the compiled program
+    int globalsSize;
+    HeapPages *pages;               // Shared with the scheduler worker threads
+    FiberStackPool *stackPool;
+    ExternWait *externWait;
+    struct tagScheduler *scheduler;
+    int workerIndex;                // Scheduler worker thread that runs the VM loop, -1 for the thread that owns the VM
+    int budget;                     // Loop iterations and function calls before returning to the host, 0 for unlimited
+    bool interrupted;               // Returned to the host when the budget was exhausted or an external function suspended the fiber
+    int callbackDepth;              // Script functions called back by built-in functions, which cannot be interrupted
+    int externDepth;                // External functions being run, which may call script functions through the API
+    Slot *result;                   // Result of the interrupted function call
     Error *error;
 } VM;
 
 
+typedef struct
+{
+    Fiber *fiber;
+    Slot *top, *base;
+    int ip;
+    int callbackDepth;
+    Slot reg[VM_NUM_REGS];
+} CallState;                        // State of the script that called an external function, restored after a nested call
+
+
+typedef struct
+{
+    VM vm;                          // Shares the heap and the global variables with the VM that owns the scheduler
+    Error error;
+    FiberQueue queue;
+    pthread_t thread;
+    struct tagScheduler *scheduler;
+} Worker;
+
+
+typedef struct tagScheduler
+{
+    Worker worker[VM_MAX_WORKERS];
+    int numWorkers, nextWorker;
+    int numQueued, numSleeping, numActive;
+    bool terminate, failed;
+    Error failure;                  // The first run-time error in a scheduled fiber
+    pthread_mutex_t lock;
+    pthread_cond_t wake, finish;
+    pthread_mutex_t chanLock;       // Protects all the channels of the VM
+    pthread_cond_t chanChange;      // Any channel or the number of active fibers has changed
+} Scheduler;
+
+
 void vmInit(VM *vm, int stackSize /* slots */, Error *error);
 void vmFree(VM *vm);
 void vmReset(VM *vm, Instruction *code);
+void vmSetGlobals(VM *vm, void *globals, int size);
+void vmResetState(VM *vm, void *globals, int size);
+void vmGrowGlobals(VM *vm, void *globals, int size);
 void vmRun(VM *vm, int entryOffset, int numParamSlots, Slot *params, Slot *result);
+void vmContinue(VM *vm);
+void vmRunPrepared(VM *vm, Instruction *code, int entryOffset, int numParamSlots, Slot *params, Slot *result);
+void vmRunBatch(VM *vm, int entryOffset, int numCalls, int numParamSlots, Slot *params, Slot *results);
+void vmRunNested(VM *vm, int entryOffset, int numParamSlots, Slot *params, Slot *result);
+void vmSaveCallState(VM *vm, CallState *state);
+void vmRestoreCallState(VM *vm, CallState *state);
+int  vmGetStackTrace(VM *vm, DebugInfo *trace, int maxFrames);
+void vmShareDynArray(VM *vm, DynArray *array, Type *type, void *data, int len);
+void vmCopyGlobal(VM *vm, int destOffset, int srcOffset, Type *type);
+void vmReleaseGlobal(VM *vm, int offset, Type *type);
 int vmAsm(int ip, Instruction *instr, char *buf);
 char *vmBuiltinSpelling(BuiltinFunc builtin);
+void *vmSuspendExtern(Slot *result);
+void vmResumeExtern(void *handle, Slot *result);
+bool vmCheckFormatString(const char *format, int *formatLen, TypeKind *typeKind);
 
 #endif // UMKA_VM_H_INCLUDED
@@ -0,0 +1,147 @@
+// Asynchronous external function test: script fibers issue requests that are completed later by a host event loop,
+// so that many requests are outstanding at a time. The suspended main fiber returns to the host, which continues it
+// Build with "make tests/async" and run from the tests directory
+
+#define _POSIX_C_SOURCE 200809L
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <time.h>
+#include <pthread.h>
+
+#include "../src/umka_api.h"
+
+
+enum
+{
+    NUM_REQUESTS = 100,
+    MAX_PENDING  = NUM_REQUESTS + 1
+};
+
+
+typedef struct
+{
+    void *handle;
+    int64_t value;
+} Request;
+
+
+// Local stand-in for an event loop that completes network requests
+static Request pending[MAX_PENDING];
+static int numPending, maxNumPending;
+static bool terminate;
+static pthread_mutex_t lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t change = PTHREAD_COND_INITIALIZER;
+
+
+static void fetch(UmkaStackSlot *params, UmkaStackSlot *result)
+{
+    int64_t id = params[0].intVal;
+
+    pthread_mutex_lock(&lock);
+
+    pending[numPending].handle = umkaSuspend(result);
+    pending[numPending].value = id * 10;
+    numPending++;
+
+    if (numPending > maxNumPending)
+        maxNumPending = numPending;
+
+    pthread_cond_signal(&change);
+    pthread_mutex_unlock(&lock);
+}
+
+
+static void *eventLoop(void *arg)
+{
+    while (1)
+    {
+        pthread_mutex_lock(&lock);
+
+        while (numPending == 0 && !terminate)
+            pthread_cond_wait(&change, &lock);
+
+        if (terminate)
+        {
+            pthread_mutex_unlock(&lock);
+            break;
+        }
+
+        // Let more requests arrive, as if waiting for the network
+        struct timespec delay = {0, 1000000};
+        pthread_mutex_unlock(&lock);
+        nanosleep(&delay, NULL);
+        pthread_mutex_lock(&lock);
+
+        Request request = pending[--numPending];
+        pthread_mutex_unlock(&lock);
+
+        UmkaStackSlot result;
+        result.intVal = request.value;
+        umkaResume(request.handle, &result);
+    }
+
+    return NULL;
+}
+
+
+int main(void)
+{
+    pthread_t thread;
+    pthread_create(&thread, NULL, eventLoop, NULL);
+
+    void *umka = umkaAlloc();
+    bool ok = umkaInit(umka, "async.um", 1024 * 1024, 1024 * 1024, 0, NULL);
+
+    if (ok)
+    {
+        umkaAddFunc(umka, "fetch", &fetch);
+        ok = umkaCompile(umka);
+    }
+
+    if (ok)
+        ok = umkaRun(umka);
+
+    int64_t result = 0;
+    bool suspended = false;
+    if (ok)
+    {
+        UmkaStackSlot param, res;
+        param.intVal = NUM_REQUESTS;
+        ok = umkaCall(umka, umkaGetFunc(umka, NULL, "work"), 1, &param, &res);
+
+        // The last request suspends the main fiber, which returns to the host until the request is completed
+        suspended = ok && umkaInterrupted(umka);
+
+        struct timespec delay = {0, 100000};
+        while (ok && umkaInterrupted(umka))
+        {
+            nanosleep(&delay, NULL);
+            ok = umkaContinue(umka);
+        }
+
+        result = res.intVal;
+    }
+
+    if (!ok)
+    {
+        UmkaError error;
+        umkaGetError(umka, &error);
+        printf("Error %s (%d, %d): %s\n", error.fileName, error.line, error.pos, error.msg);
+    }
+
+    umkaFree(umka);
+
+    pthread_mutex_lock(&lock);
+    terminate = true;
+    pthread_cond_signal(&change);
+    pthread_mutex_unlock(&lock);
+    pthread_join(thread, NULL);
+
+    int64_t expected = 10 * (NUM_REQUESTS * (NUM_REQUESTS - 1) / 2) + 10 * 1000;
+    bool passed = ok && suspended && result == expected;
+    printf("Async calls: %d requests, up to %d pending: %s\n", NUM_REQUESTS, maxNumPending, passed ? "ok" : "failed");
+
+    return !passed;
+}
@@ -0,0 +1,63 @@
+// Instruction budget test: the host runs a long script function in small time slices, regaining control
+// whenever the budget is exhausted
+// Build with "make tests/budget" and run from the tests directory
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "../src/umka_api.h"
+
+
+enum
+{
+    BUDGET = 1000,
+    COUNT  = 100000
+};
+
+
+int main(void)
+{
+    void *umka = umkaAlloc();
+    bool ok = umkaInit(umka, "budget.um", 1024 * 1024, 1024 * 1024, 0, NULL);
+
+    if (ok)
+        ok = umkaCompile(umka);
+
+    if (ok)
+        ok = umkaRun(umka);
+
+    int64_t result = 0;
+    int numSlices = 1;
+
+    if (ok)
+    {
+        UmkaStackSlot param, res;
+        param.intVal = COUNT;
+
+        umkaSetBudget(umka, BUDGET);
+        ok = umkaCall(umka, umkaGetFunc(umka, NULL, "work"), 1, &param, &res);
+
+        // The host could do other work between the slices
+        while (ok && umkaInterrupted(umka))
+        {
+            numSlices++;
+            ok = umkaContinue(umka);
+        }
+
+        result = res.intVal;
+    }
+
+    if (!ok)
+    {
+        UmkaError error;
+        umkaGetError(umka, &error);
+        printf("Error %s (%d, %d): %s\n", error.fileName, error.line, error.pos, error.msg);
+    }
+
+    umkaFree(umka);
+
+    int64_t expected = (int64_t)COUNT * (COUNT - 1) / 2 + (int64_t)2 * COUNT * (2 * COUNT - 1) / 2 + 1008 + 6765;
+    printf("Instruction budget: %d slices: %s\n", numSlices, (ok && numSlices > 1 && result == expected) ? "ok" : "failed");
+
+    return !ok || numSlices <= 1 || result != expected;
+}
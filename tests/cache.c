@@ -0,0 +1,183 @@
+// Compile cache test: a program is loaded from the cache unless its main module or an imported module has changed
+// Build with "make tests/cache" and run from the tests directory
+
+#define _XOPEN_SOURCE 700
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <dirent.h>
+#include <sys/stat.h>
+
+#include "../src/umka_api.h"
+
+
+static const char *cacheDir = "cache.tmp";
+
+
+typedef struct
+{
+    const char *mainSource, *modSource;
+} Sources;
+
+
+static bool loadModule(const char *path, const char **source, int *sourceLen, void *context)
+{
+    Sources *sources = context;
+    if (strcmp(path, "mod.um") != 0)
+        return false;
+
+    *source = sources->modSource;
+    *sourceLen = strlen(sources->modSource);
+    return true;
+}
+
+
+// A cache hit leaves the cached image in place, a cache miss replaces it with a new file
+static ino_t cacheFile(void)
+{
+    ino_t ino = 0;
+    DIR *dir = opendir(cacheDir);
+
+    for (struct dirent *entry = dir ? readdir(dir) : NULL; entry; entry = readdir(dir))
+        if (strstr(entry->d_name, ".umi") && !strstr(entry->d_name, ".tmp"))
+        {
+            char path[512];
+            struct stat st;
+            snprintf(path, sizeof(path), "%s/%s", cacheDir, entry->d_name);
+            if (stat(path, &st) == 0)
+                ino = st.st_ino;
+        }
+
+    if (dir)
+        closedir(dir);
+    return ino;
+}
+
+
+static bool compileAndCall(Sources *sources, int64_t *result)
+{
+    void *umka = umkaAlloc();
+    bool ok = umkaInitSource(umka, "main.um", sources->mainSource, strlen(sources->mainSource), 1024 * 1024, 1024 * 1024, 0, NULL);
+
+    if (ok)
+    {
+        umkaSetLoader(umka, loadModule, sources);
+        umkaSetCacheDir(umka, (char *)cacheDir);
+
+        UmkaStackSlot res;
+        ok = umkaCompile(umka) && umkaCall(umka, umkaGetFunc(umka, NULL, "f"), 0, NULL, &res) && umkaRun(umka);
+        *result = res.intVal;
+    }
+
+    if (!ok)
+    {
+        UmkaError error;
+        umkaGetError(umka, &error);
+        printf("Error %s (%d, %d): %s\n", error.fileName, error.line, error.pos, error.msg);
+    }
+
+    umkaFree(umka);
+    return ok;
+}
+
+
+static void removeCache(void)
+{
+    DIR *dir = opendir(cacheDir);
+
+    for (struct dirent *entry = dir ? readdir(dir) : NULL; entry; entry = readdir(dir))
+        if (entry->d_name[0] != '.')
+        {
+            char path[512];
+            snprintf(path, sizeof(path), "%s/%s", cacheDir, entry->d_name);
+            remove(path);
+        }
+
+    if (dir)
+        closedir(dir);
+    remove(cacheDir);
+}
+
+
+int main(void)
+{
+    removeCache();
+    mkdir(cacheDir, 0755);
+
+    const char *mainSource1 = "import \"mod.um\"\nconst greeting = \"hello\"\nfn f*(): int {return mod.g() + len(greeting)}\nfn main() {}";
+    const char *mainSource2 = "import \"mod.um\"\nconst greeting = \"hello, world\"\nfn f*(): int {return mod.g() + len(greeting)}\nfn main() {}";
+    const char *modSource1  = "fn g*(): int {return 100}";
+    const char *modSource2  = "fn g*(): int {return 200}";
+
+    struct
+    {
+        const char *mainSource, *modSource;
+        int64_t expected;
+        bool hit;
+    } steps[] =
+    {
+        {mainSource1, modSource1, 105, false},      // Cold start
+        {mainSource1, modSource1, 105, true},
+        {mainSource1, modSource2, 205, false},      // Imported module changed
+        {mainSource1, modSource2, 205, true},
+        {mainSource2, modSource2, 212, false},      // Main module changed
+        {mainSource2, modSource2, 212, true},
+        {mainSource1, modSource1, 105, false}       // Back to the original sources
+    };
+
+    int numSteps = sizeof(steps) / sizeof(steps[0]);
+    int failures = 0;
+    bool ok = true;
+
+    for (int i = 0; ok && i < numSteps; i++)
+    {
+        ino_t before = cacheFile();
+
+        Sources sources = {steps[i].mainSource, steps[i].modSource};
+        int64_t result = 0;
+        ok = compileAndCall(&sources, &result);
+
+        ino_t after = cacheFile();
+
+        if (result != steps[i].expected || after == 0 || (after == before) != steps[i].hit)
+        {
+            printf("Step %d: result %lld, cache %s\n", i, (long long)result, after == before ? "hit" : "miss");
+            failures++;
+        }
+    }
+
+    // A truncated image is ignored and replaced
+    if (ok)
+    {
+        char path[512];
+        DIR *dir = opendir(cacheDir);
+        for (struct dirent *entry = dir ? readdir(dir) : NULL; entry; entry = readdir(dir))
+            if (strstr(entry->d_name, ".umi"))
+                snprintf(path, sizeof(path), "%s/%s", cacheDir, entry->d_name);
+        if (dir)
+            closedir(dir);
+
+        FILE *file = fopen(path, "wb");
+        if (file)
+        {
+            fwrite("UMKAIMG", 8, 1, file);
+            fclose(file);
+        }
+
+        ino_t before = cacheFile();
+
+        Sources sources = {mainSource1, modSource1};
+        int64_t result = 0;
+        ok = compileAndCall(&sources, &result);
+
+        if (result != 105 || cacheFile() == before)
+            failures++;
+    }
+
+    removeCache();
+
+    printf("Compile cache: %d compilations, %d failures: %s\n", numSteps + 1, failures, (ok && failures == 0) ? "ok" : "failed");
+
+    return !ok || failures != 0;
+}
@@ -0,0 +1,162 @@
+// Prepared call test: script functions are checked once and then called many times, one by one and in batches
+// Build with "make tests/calls" and run from the tests directory
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "../src/umka_api.h"
+
+
+enum
+{
+    NUM_CALLS = 10000
+};
+
+
+typedef struct
+{
+    double x, y;
+} Vec;
+
+
+int main(void)
+{
+    void *umka = umkaAlloc();
+    bool ok = umkaInit(umka, "calls.um", 1024 * 1024, 1024 * 1024, 0, NULL);
+
+    if (ok)
+        ok = umkaCompile(umka);
+
+    if (ok)
+        ok = umkaRun(umka);
+
+    UmkaPreparedCall add, scale, accumulate, getTotal, check;
+    if (ok)
+        ok = umkaPrepareCall(umka, NULL, "add",        2, &add)   &&
+             umkaPrepareCall(umka, NULL, "scale",      4, &scale) &&      // v.x, v.y, k, __result
+             umkaPrepareCall(umka, NULL, "accumulate", 1, &accumulate) &&
+             umkaPrepareCall(umka, NULL, "getTotal",   0, &getTotal) &&
+             umkaPrepareCall(umka, NULL, "check",      1, &check);
+
+    int failures = 0;
+
+    // Single calls. Parameters are pushed in reverse order
+    for (int i = 0; ok && i < NUM_CALLS; i++)
+    {
+        UmkaStackSlot params[2], result;
+        params[1].intVal = i;
+        params[0].intVal = 2 * i;
+
+        ok = umkaCallPrepared(umka, &add, params, &result);
+        if (result.intVal != 3 * i)
+            failures++;
+    }
+
+    // Structured result
+    if (ok)
+    {
+        Vec v;
+        UmkaStackSlot params[4], result;
+        params[2].realVal = 3.0;                    // Structure fields are in the natural order
+        params[3].realVal = 4.0;
+        params[1].realVal = 0.5;
+        params[0].ptrVal = (int64_t)&v;
+
+        ok = umkaCallPrepared(umka, &scale, params, &result);
+        if (v.x != 1.5 || v.y != 2.0 || (Vec *)result.ptrVal != &v)
+            failures++;
+    }
+
+    // Batch calls
+    if (ok)
+    {
+        UmkaStackSlot *params = malloc(NUM_CALLS * 2 * sizeof(UmkaStackSlot));
+        UmkaStackSlot *results = malloc(NUM_CALLS * sizeof(UmkaStackSlot));
+
+        for (int i = 0; i < NUM_CALLS; i++)
+        {
+            params[2 * i + 1].intVal = i;
+            params[2 * i + 0].intVal = -5 * i;
+        }
+
+        ok = umkaCallBatch(umka, &add, NUM_CALLS, params, results);
+        for (int i = 0; ok && i < NUM_CALLS; i++)
+            if (results[i].intVal != -4 * i)
+                failures++;
+
+        for (int i = 0; i < NUM_CALLS; i++)
+            params[i].realVal = 0.25;
+
+        if (ok)
+            ok = umkaCallBatch(umka, &accumulate, NUM_CALLS, params, NULL);
+
+        free(params);
+        free(results);
+    }
+
+    if (ok)
+    {
+        UmkaStackSlot result;
+        ok = umkaCallPrepared(umka, &getTotal, NULL, &result);
+        if (result.realVal != 0.25 * NUM_CALLS)
+            failures++;
+    }
+
+    // A failed call does not leave the stack idle, so the next call has to reset it
+    if (ok)
+    {
+        UmkaStackSlot param, result;
+        param.intVal = -1;
+        if (umkaCallPrepared(umka, &check, &param, &result))
+            failures++;
+
+        param.intVal = 7;
+        ok = umkaCallPrepared(umka, &check, &param, &result);
+        if (result.intVal != 7)
+            failures++;
+    }
+
+    // Execution context: the same prepared calls on its own stack
+    if (ok)
+    {
+        void *context = umkaAllocContext();
+        ok = umkaInitContext(context, umka, 1024 * 1024);
+
+        for (int i = 0; ok && i < NUM_CALLS; i++)
+        {
+            UmkaStackSlot params[2], result;
+            params[1].intVal = i;
+            params[0].intVal = 7;
+
+            ok = umkaCallPreparedContext(context, &add, params, &result);
+            if (result.intVal != i + 7)
+                failures++;
+        }
+
+        if (!ok)
+        {
+            UmkaError error;
+            umkaGetContextError(context, &error);
+            printf("Error %s (%d, %d): %s\n", error.fileName, error.line, error.pos, error.msg);
+        }
+
+        umkaFreeContext(context);
+    }
+
+    // Signature mismatch
+    UmkaPreparedCall wrong;
+    if (ok && umkaPrepareCall(umka, NULL, "add", 3, &wrong))
+        failures++;
+
+    if (!ok)
+    {
+        UmkaError error;
+        umkaGetError(umka, &error);
+        printf("Error %s (%d, %d): %s\n", error.fileName, error.line, error.pos, error.msg);
+    }
+
+    umkaFree(umka);
+
+    printf("Prepared calls: %d calls, %d failures: %s\n", 4 * NUM_CALLS + 4, failures, (ok && failures == 0) ? "ok" : "failed");
+    return !ok || failures != 0;
+}
@@ -0,0 +1,221 @@
+// Error reporting test: runtime errors carry a stack trace, and external functions can call script functions
+// whose errors do not affect the calling script
+// Build with "make tests/errors" and run from the tests directory
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "../src/umka_api.h"
+
+
+static const char *source =
+    "fn host(n: int): int\n"
+    "fn square*(n: int): int {return n * n}\n"
+    "fn fail*(n: int): int {\n"
+    "    a := [2]int{1, 2}\n"
+    "    return a[n]}\n"
+    "fn sum*(n: int): int {\n"
+    "    s := 0\n"
+    "    for i := 0; i < n; i++ {s += host(i)}\n"
+    "    return s\n"
+    "}\n"
+    "fn deep*(n: int): int {\n"
+    "    if n == 0 {return fail(5)}\n"
+    "    return deep(n - 1)\n"
+    "}\n"
+    "fn hostTri(n: int): int\n"
+    "fn tri*(n: int): int {\n"
+    "    if n == 0 {return 0}\n"
+    "    return n + tri(n - 1)\n"
+    "}\n"
+    "fn triFromHost*(n: int): int {return hostTri(n)}\n"
+    "fn triFunc(parent: ^fiber, n: ^int) {n^ = hostTri(n^)}\n"
+    "fn triFromFiber*(n: int): int {\n"
+    "    child := fiberspawn(triFunc, &n)\n"
+    "    fibercall(child)\n"
+    "    return n\n"
+    "}\n"
+    "fn main() {}";
+
+
+static void *umka;
+static int failures;
+
+
+static bool checkFrame(UmkaError *error, int frame, const char *fnName, int line)
+{
+    if (frame >= error->traceLen || strcmp(error->trace[frame].fnName, fnName) != 0 ||
+        strcmp(error->trace[frame].fileName, "errors.um") != 0 || error->trace[frame].line != line)
+    {
+        printf("Frame %d is not %s() at line %d\n", frame, fnName, line);
+        return false;
+    }
+    return true;
+}
+
+
+// Calls the script back, including a failing call, which must not affect the script that called this function
+static void host(UmkaStackSlot *params, UmkaStackSlot *result)
+{
+    UmkaStackSlot param = {.intVal = params[0].intVal}, res;
+
+    if (!umkaCall(umka, umkaGetFunc(umka, NULL, "square"), 1, &param, &res))
+    {
+        failures++;
+        return;
+    }
+
+    if (param.intVal == 3)
+    {
+        UmkaStackSlot index = {.intVal = 7}, dummy;
+        UmkaError error;
+
+        if (umkaCall(umka, umkaGetFunc(umka, NULL, "fail"), 1, &index, &dummy))
+            failures++;
+        else
+        {
+            umkaGetError(umka, &error);
+            if (!strstr(error.msg, "Index 7") || error.traceLen != 1 || !checkFrame(&error, 0, "fail", 5))
+                failures++;
+        }
+
+        if (umkaRun(umka))
+            failures++;
+        else
+        {
+            umkaGetError(umka, &error);
+            if (!strstr(error.msg, "umkaRun()"))
+                failures++;
+        }
+    }
+
+    result->intVal = res.intVal;
+}
+
+
+// Calls the script back and lets it store the result directly into the result of this function
+static void hostTri(UmkaStackSlot *params, UmkaStackSlot *result)
+{
+    UmkaStackSlot param = {.intVal = params[0].intVal};
+    if (!umkaCall(umka, umkaGetFunc(umka, NULL, "tri"), 1, &param, result))
+        failures++;
+}
+
+
+int main(void)
+{
+    umka = umkaAlloc();
+    bool ok = umkaInitSource(umka, "errors.um", source, strlen(source), 1024 * 1024, 1024 * 1024, 0, NULL);
+
+    if (ok)
+    {
+        umkaAddFunc(umka, "host", host);
+        umkaAddFunc(umka, "hostTri", hostTri);
+        ok = umkaCompile(umka);
+    }
+
+    // Nested calls
+    UmkaStackSlot param = {.intVal = 5}, result;
+    if (ok)
+    {
+        ok = umkaCall(umka, umkaGetFunc(umka, NULL, "sum"), 1, &param, &result);
+        if (ok && result.intVal != 0 + 1 + 4 + 9 + 16)
+            failures++;
+    }
+
+    // Nested calls that return their results through the result of the external function, including a call from a child fiber
+    // that needs a larger stack than the fiber has initially
+    if (ok)
+    {
+        param.intVal = 100;
+        ok = umkaCall(umka, umkaGetFunc(umka, NULL, "triFromHost"), 1, &param, &result);
+        if (ok && result.intVal != 5050)
+            failures++;
+    }
+
+    if (ok)
+    {
+        param.intVal = 100;
+        ok = umkaCall(umka, umkaGetFunc(umka, NULL, "triFromFiber"), 1, &param, &result);
+        if (ok && result.intVal != 5050)
+            failures++;
+    }
+
+    // Stack trace of a failed call, and the error handler of the instance left as it was by the nested calls
+    if (ok)
+    {
+        param.intVal = 2;
+        if (umkaCall(umka, umkaGetFunc(umka, NULL, "deep"), 1, &param, &result))
+            failures++;
+        else
+        {
+            UmkaError error;
+            umkaGetError(umka, &error);
+
+            if (error.traceLen != 4 || !checkFrame(&error, 0, "fail", 5) || !checkFrame(&error, 1, "deep", 12) ||
+                !checkFrame(&error, 2, "deep", 13) || !checkFrame(&error, 3, "deep", 13))
+                failures++;
+        }
+
+        param.intVal = 9;
+        ok = umkaCall(umka, umkaGetFunc(umka, NULL, "square"), 1, &param, &result) && umkaRun(umka);
+        if (ok && result.intVal != 81)
+            failures++;
+    }
+
+    if (!ok)
+    {
+        UmkaError error;
+        umkaGetError(umka, &error);
+        printf("Error %s (%d, %d): %s\n", error.fileName, error.line, error.pos, error.msg);
+    }
+
+    umkaFree(umka);
+
+    // Error messages longer than the identifiers they contain
+    if (ok)
+    {
+        char longSource[512] = "fn main() {x := ";
+        char *name = longSource + strlen(longSource);
+        memset(name, 'a', 250);
+        strcpy(name + 250, "}");
+
+        umka = umkaAlloc();
+        if (umkaInitSource(umka, "long.um", longSource, strlen(longSource), 1024 * 1024, 1024 * 1024, 0, NULL) && umkaCompile(umka))
+            failures++;
+        else
+        {
+            UmkaError error;
+            umkaGetError(umka, &error);
+            if (strlen(error.msg) != strlen("Unknown identifier ") + 250 || error.traceLen != 0)
+                failures++;
+        }
+        umkaFree(umka);
+    }
+
+    // Too many channels in select()
+    if (ok)
+    {
+        char selectSource[512] = "fn main() {c := make(chan int, 1); select(c";
+        for (int i = 1; i < 65; i++)
+            strcat(selectSource, ", c");
+        strcat(selectSource, ")}");
+
+        umka = umkaAlloc();
+        if (umkaInitSource(umka, "chans.um", selectSource, strlen(selectSource), 1024 * 1024, 1024 * 1024, 0, NULL) && umkaCompile(umka))
+            failures++;
+        else
+        {
+            UmkaError error;
+            umkaGetError(umka, &error);
+            if (strcmp(error.msg, "Too many channels in select()") != 0)
+                failures++;
+        }
+        umkaFree(umka);
+    }
+
+    printf("Error reporting: %d failures: %s\n", failures, (ok && failures == 0) ? "ok" : "failed");
+
+    return !ok || failures != 0;
+}
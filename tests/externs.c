@@ -0,0 +1,133 @@
+// Typed external function test: the host declares the signatures of its functions, which receive their parameters in
+// declaration order, structured ones by pointer
+// Build with "make tests/externs" and run from the tests directory
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "../src/umka_api.h"
+
+
+typedef struct
+{
+    double x, y;
+} Vec;
+
+
+typedef struct
+{
+    int64_t len;
+    int64_t itemSize;
+    void *data;
+} DynArray;
+
+
+enum
+{
+    COUNT = 1000
+};
+
+
+static void hypot2(UmkaStackSlot *params, UmkaStackSlot *result)
+{
+    result->realVal = params[0].realVal * params[0].realVal + params[1].realVal * params[1].realVal;
+}
+
+
+static void vlen2(UmkaStackSlot *params, UmkaStackSlot *result)
+{
+    Vec *v = (Vec *)params[0].ptrVal;
+    result->realVal = v->x * v->x + v->y * v->y;
+}
+
+
+static void vscale(UmkaStackSlot *params, UmkaStackSlot *result)
+{
+    Vec *v = (Vec *)params[0].ptrVal;
+    Vec *res = (Vec *)result->ptrVal;
+
+    res->x = v->x * params[1].realVal;
+    res->y = v->y * params[1].realVal;
+}
+
+
+static void vsum(UmkaStackSlot *params, UmkaStackSlot *result)
+{
+    DynArray *a = (DynArray *)params[0].ptrVal;
+    double *items = (double *)a->data;
+
+    result->realVal = 0;
+    for (int i = 0; i < a->len; i++)
+        result->realVal += items[i];
+}
+
+
+static void count(UmkaStackSlot *params, UmkaStackSlot *result)
+{
+    char *s = (char *)params[0].ptrVal;
+    char c = params[1].intVal;
+
+    result->intVal = 0;
+    for (; *s; s++)
+        if (*s == c)
+            result->intVal++;
+}
+
+
+static void *init(char *vscaleSignature)
+{
+    void *umka = umkaAlloc();
+    umkaInit(umka, "externs.um", 1024 * 1024, 1024 * 1024, 0, NULL);
+
+    umkaAddTypedFunc(umka, "hypot2", "fn (x, y: real): real", &hypot2);
+    umkaAddTypedFunc(umka, "vlen2",  "fn (v: Vec): real", &vlen2);
+    umkaAddTypedFunc(umka, "vscale", vscaleSignature, &vscale);
+    umkaAddTypedFunc(umka, "vsum",   "fn (a: []real): real", &vsum);
+    umkaAddTypedFunc(umka, "count",  "fn (s: str, c: char): int", &count);
+
+    return umka;
+}
+
+
+int main(void)
+{
+    void *umka = init("fn (v: Vec, k: real): Vec");
+    bool ok = umkaCompile(umka) && umkaRun(umka);
+
+    UmkaStackSlot param, result;
+    result.realVal = 0;
+
+    if (ok)
+    {
+        param.intVal = COUNT;
+        ok = umkaCall(umka, umkaGetFunc(umka, NULL, "compute"), 1, &param, &result);
+    }
+
+    if (!ok)
+    {
+        UmkaError error;
+        umkaGetError(umka, &error);
+        printf("Error %s (%d, %d): %s\n", error.fileName, error.line, error.pos, error.msg);
+    }
+
+    umkaFree(umka);
+
+    // A signature that does not match the prototype is rejected
+    umka = init("fn (v: Vec, k: int): Vec");
+    bool mismatch = !umkaCompile(umka);
+
+    if (mismatch)
+    {
+        UmkaError error;
+        umkaGetError(umka, &error);
+        mismatch = strstr(error.msg, "Prototype of vscale does not match") != NULL;
+    }
+
+    umkaFree(umka);
+
+    double expected = (double)(COUNT - 1) * COUNT * (2 * COUNT - 1) / 6 + COUNT + 100 + 6 + 8 + 3;
+    printf("Typed external functions: %.1f: %s\n", result.realVal, (ok && mismatch && result.realVal == expected) ? "ok" : "failed");
+
+    return !ok || !mismatch || result.realVal != expected;
+}
@@ -0,0 +1,216 @@
+// Program image test: a program compiled and saved by one instance is loaded from a memory-mapped file by another instance
+// Build with "make tests/image" and run from the tests directory
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "../src/umka_api.h"
+
+
+static void hypot2(UmkaStackSlot *params, UmkaStackSlot *result)
+{
+    result->realVal = params[0].realVal * params[0].realVal + params[1].realVal * params[1].realVal;
+}
+
+
+static void twice(UmkaStackSlot *params, UmkaStackSlot *result)
+{
+    result->intVal = 2 * params[0].intVal;
+}
+
+
+static void addFuncs(void *umka)
+{
+    umkaAddTypedFunc(umka, "hypot2", "fn (x, y: real): real", &hypot2);
+    umkaAddFunc(umka, "twice", &twice);
+}
+
+
+static bool callReport(void *umka, char *report)
+{
+    UmkaStackSlot result;
+    UmkaVar summary;
+
+    if (!umkaCall(umka, umkaGetFunc(umka, NULL, "report"), 0, NULL, &result) || !umkaGetVar(umka, NULL, "summary", &summary))
+        return false;
+
+    strcpy(report, *(char **)summary.ptr);
+    return result.intVal == strlen(report);
+}
+
+
+static bool loadFile(void *umka, const char *fileName)
+{
+    FILE *file = fopen(fileName, "rb");
+    if (!file)
+        return false;
+
+    fseek(file, 0, SEEK_END);
+    int imageLen = ftell(file);
+    fseek(file, 0, SEEK_SET);
+
+    char *image = malloc(imageLen);
+    bool ok = fread(image, imageLen, 1, file) == 1 && umkaLoad(umka, image, imageLen);
+
+    free(image);
+    fclose(file);
+    return ok;
+}
+
+
+static void printError(void *umka)
+{
+    UmkaError error;
+    umkaGetError(umka, &error);
+    printf("Error %s (%d, %d): %s\n", error.fileName, error.line, error.pos, error.msg);
+}
+
+
+int main(void)
+{
+    int failures = 0;
+    char compiledReport[UMKA_MSG_LEN], loadedReport[UMKA_MSG_LEN], contextReport[UMKA_MSG_LEN];
+
+    // Compile and save
+    void *compiled = umkaAlloc();
+    bool ok = umkaInit(compiled, "image.um", 1024 * 1024, 1024 * 1024, 0, NULL);
+
+    if (ok)
+    {
+        addFuncs(compiled);
+        ok = umkaCompile(compiled) && umkaSave(compiled, "image.tmp") && callReport(compiled, compiledReport) && umkaRun(compiled);
+    }
+
+    if (!ok)
+        printError(compiled);
+
+    umkaFree(compiled);
+
+    // Load from a memory-mapped file
+    int file = ok ? open("image.tmp", O_RDONLY) : -1;
+    struct stat st;
+    char *image = NULL;
+
+    if (file >= 0 && fstat(file, &st) == 0)
+        image = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, file, 0);
+
+    if (!image || image == MAP_FAILED)
+        ok = false;
+
+    // A truncated image is rejected
+    if (ok)
+    {
+        void *truncated = umkaAlloc();
+        if (umkaInitSource(truncated, "image.um", "", 0, 1024 * 1024, 1024 * 1024, 0, NULL))
+        {
+            addFuncs(truncated);
+            if (umkaLoad(truncated, image, st.st_size / 2))
+                failures++;
+        }
+        umkaFree(truncated);
+    }
+
+    void *loaded = umkaAlloc();
+    ok = umkaInitSource(loaded, "image.um", "", 0, 1024 * 1024, 1024 * 1024, 0, NULL) && ok;
+
+    if (ok)
+    {
+        addFuncs(loaded);
+        ok = umkaLoad(loaded, image, st.st_size);
+    }
+
+    if (image && image != MAP_FAILED)
+        munmap(image, st.st_size);
+
+    if (file >= 0)
+        close(file);
+
+    remove("image.tmp");
+
+    // The loaded program behaves as the compiled one
+    UmkaVar title;
+    void *context = NULL;
+
+    if (ok)
+    {
+        ok = callReport(loaded, loadedReport) && umkaGetVar(loaded, NULL, "title", &title);
+
+        if (ok && (strcmp(loadedReport, compiledReport) != 0 || strcmp(title.type, "str") != 0 || strcmp(*(char **)title.ptr, "image") != 0))
+            failures++;
+
+        // The program is loaded only once
+        if (ok && umkaLoad(loaded, NULL, 0))
+            failures++;
+    }
+
+    if (ok)
+    {
+        // The loaded program can be saved again
+        char resavedReport[UMKA_MSG_LEN];
+        void *resaved = umkaAlloc();
+
+        bool resavedOk = umkaSave(loaded, "image2.tmp") &&
+                         umkaInitSource(resaved, "image.um", "", 0, 1024 * 1024, 1024 * 1024, 0, NULL);
+
+        if (resavedOk)
+        {
+            addFuncs(resaved);
+            resavedOk = loadFile(resaved, "image2.tmp") && callReport(resaved, resavedReport) && umkaRun(resaved);
+        }
+
+        if (!resavedOk || strcmp(resavedReport, compiledReport) != 0)
+            failures++;
+
+        umkaFree(resaved);
+        remove("image2.tmp");
+    }
+
+    if (ok)
+    {
+        // An execution context starts from the initial global variables of the image
+        context = umkaAllocContext();
+        UmkaStackSlot result;
+        UmkaVar summary;
+
+        ok = umkaInitContext(context, loaded, 1024 * 1024) &&
+             umkaCallContext(context, umkaGetFunc(loaded, NULL, "report"), 0, NULL, &result) &&
+             umkaGetVarContext(context, NULL, "summary", &summary);
+
+        if (ok)
+            strcpy(contextReport, *(char **)summary.ptr);
+
+        if (ok && strcmp(contextReport, compiledReport) != 0)
+            failures++;
+
+        if (ok)
+            ok = umkaRunContext(context);
+
+        if (!ok)
+        {
+            UmkaError error;
+            umkaGetContextError(context, &error);
+            printf("Error %s (%d, %d): %s\n", error.fileName, error.line, error.pos, error.msg);
+        }
+
+        umkaFreeContext(context);
+    }
+    else
+        printError(loaded);
+
+    if (ok)
+        ok = umkaRun(loaded);
+
+    umkaFree(loaded);
+
+    if (ok)
+        printf("%s\n", compiledReport);
+
+    printf("Program image: %d failures: %s\n", failures, (ok && failures == 0) ? "ok" : "failed");
+
+    return !ok || failures != 0;
+}
@@ -0,0 +1,210 @@
+// Hot reload test: the functions of a reloaded module are patched, while the global variables keep their values
+// Build with "make tests/reload" and run from the tests directory
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "../src/umka_api.h"
+
+
+static const char *mainSource1 =
+    "import \"counter.um\"\n"
+    "var calls: int\n"
+    "fn tick*(): int {calls++; return counter.step()}\n"
+    "fn main() {}";
+
+static const char *mainSource2 =
+    "import \"counter.um\"\n"
+    "var calls: int\n"
+    "var label: str = \"reloaded\"\n"
+    "fn tick*(): int {calls++; return counter.step(1000)}\n"
+    "fn main() {}";
+
+static const char *counterSource1 =
+    "var count*: int\n"
+    "var names: str = \"\"\n"
+    "var log: str = \"\"\n"
+    "fn step*(): int {count++; names = names + \"a\"; return count}\n"
+    "fn total*(): int {return len(names)}";
+
+// Same count and names, changed log, new extra
+static const char *counterSource2 =
+    "var count*: int\n"
+    "var names: str = \"\"\n"
+    "var log: int\n"
+    "var extra: str = \"\"\n"
+    "var box: ^int\n"
+    "fn step*(): int {count += 10; names = names + \"b\"; extra = extra + \"x\"; box = new(int); return count}\n"
+    "fn total*(): int {return len(names) + len(extra)}";
+
+static const char *counterSourceBroken =
+    "var count*: int\n"
+    "fn step*(): int {return count +}";
+
+// Changed signature of step
+static const char *counterSource3 =
+    "var count*: int\n"
+    "var names: str = \"\"\n"
+    "fn step*(n: int): int {count += n; names = names + \"c\"; return count}\n"
+    "fn total*(): int {return len(names)}";
+
+
+static bool loadModule(const char *path, const char **source, int *sourceLen, void *context)
+{
+    if (strcmp(path, "counter.um") != 0)
+        return false;
+
+    *source = counterSource1;
+    *sourceLen = strlen(counterSource1);
+    return true;
+}
+
+
+static bool call(void *umka, char *moduleName, char *funcName, int64_t expected, int *failures)
+{
+    UmkaStackSlot result;
+    if (!umkaCall(umka, umkaGetFunc(umka, moduleName, funcName), 0, NULL, &result))
+        return false;
+
+    if (result.intVal != expected)
+    {
+        printf("%s() returned %lld rather than %lld\n", funcName, (long long)result.intVal, (long long)expected);
+        (*failures)++;
+    }
+    return true;
+}
+
+
+static bool reload(void *umka, char *moduleName, const char *source)
+{
+    return umkaReload(umka, moduleName, source, strlen(source));
+}
+
+
+static void printError(void *umka)
+{
+    UmkaError error;
+    umkaGetError(umka, &error);
+    printf("Error %s (%d, %d): %s\n", error.fileName, error.line, error.pos, error.msg);
+}
+
+
+int main(void)
+{
+    int failures = 0;
+
+    void *umka = umkaAlloc();
+    bool ok = umkaInitSource(umka, "reload.um", mainSource1, strlen(mainSource1), 1024 * 1024, 1024 * 1024, 0, NULL);
+
+    if (ok)
+    {
+        umkaSetLoader(umka, loadModule, NULL);
+        ok = umkaCompile(umka);
+    }
+
+    // A context that runs the program from before the reloads
+    void *context = umkaAllocContext();
+    if (ok)
+        ok = umkaInitContext(context, umka, 1024 * 1024);
+
+    if (ok)
+        ok = call(umka, NULL, "tick", 1, &failures) && call(umka, NULL, "tick", 2, &failures) && call(umka, NULL, "tick", 3, &failures);
+
+    // The old tick() calls the new step(), which continues from the old count
+    if (ok)
+        ok = reload(umka, "counter.um", counterSource2) &&
+             call(umka, NULL, "tick", 13, &failures) && call(umka, "counter.um", "total", 5, &failures);
+
+    // A failed reload leaves the program as it was
+    if (ok)
+    {
+        if (reload(umka, "counter.um", counterSourceBroken))
+            failures++;
+        else
+        {
+            UmkaError error;
+            umkaGetError(umka, &error);
+            if (strcmp(error.fileName, "counter.um") != 0 || error.line != 2)
+                failures++;
+        }
+
+        ok = call(umka, NULL, "tick", 23, &failures);
+    }
+
+    // The old tick() still calls the old step(), since the signature has changed, until the main module is reloaded too
+    if (ok)
+        ok = reload(umka, "counter.um", counterSource3) && call(umka, NULL, "tick", 33, &failures) &&
+             reload(umka, "reload.um", mainSource2) && call(umka, NULL, "tick", 1023, &failures);
+
+    // Variables of the main module
+    if (ok)
+    {
+        UmkaVar calls, label;
+        ok = umkaGetVar(umka, NULL, "calls", &calls) && umkaGetVar(umka, NULL, "label", &label);
+
+        if (ok && (*(int64_t *)calls.ptr != 7 || strcmp(*(char **)label.ptr, "reloaded") != 0))
+            failures++;
+    }
+
+    // The context gets the new global variables and keeps its old ones
+    if (ok)
+    {
+        UmkaStackSlot result;
+        UmkaVar calls;
+
+        ok = umkaCallContext(context, umkaGetFunc(umka, NULL, "tick"), 0, NULL, &result) &&
+             umkaGetVarContext(context, NULL, "calls", &calls) &&
+             umkaRunContext(context);
+
+        if (ok && (result.intVal != 1000 || *(int64_t *)calls.ptr != 1))
+            failures++;
+
+        if (!ok)
+        {
+            UmkaError error;
+            umkaGetContextError(context, &error);
+            printf("Error %s (%d, %d): %s\n", error.fileName, error.line, error.pos, error.msg);
+        }
+    }
+
+    umkaFreeContext(context);
+
+    if (ok)
+        ok = umkaRun(umka);
+
+    if (!ok)
+        printError(umka);
+
+    umkaFree(umka);
+
+    // The global variables of all the versions of an imported module are released when the instance is freed
+    if (ok)
+    {
+        umka = umkaAlloc();
+        ok = umkaInitSource(umka, "reload.um", mainSource1, strlen(mainSource1), 1024 * 1024, 1024 * 1024, 0, NULL);
+
+        if (ok)
+        {
+            umkaSetLoader(umka, loadModule, NULL);
+            ok = umkaCompile(umka) && call(umka, NULL, "tick", 1, &failures) &&
+                 reload(umka, "counter.um", counterSource2) && call(umka, NULL, "tick", 11, &failures);
+        }
+
+        // Repeated reloads reuse the module slot, so that their number is not limited by the number of modules
+        for (int i = 0; ok && i < 2 * UMKA_MAX_MODULES; i++)
+            ok = reload(umka, "counter.um", counterSource2);
+
+        if (ok)
+            ok = call(umka, NULL, "tick", 21, &failures) && umkaRun(umka);
+
+        if (!ok)
+            printError(umka);
+
+        umkaFree(umka);
+    }
+
+    printf("Hot reload: %d failures: %s\n", failures, (ok && failures == 0) ? "ok" : "failed");
+
+    return !ok || failures != 0;
+}
@@ -0,0 +1,103 @@
+// State reset test: a program compiled once handles many requests, each starting from the initial global variables
+// Build with "make tests/reset" and run from the tests directory
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "../src/umka_api.h"
+
+
+enum
+{
+    NUM_REQUESTS = 1000
+};
+
+
+int main(void)
+{
+    void *umka = umkaAlloc();
+    bool ok = umkaInit(umka, "reset.um", 1024 * 1024, 1024 * 1024, 0, NULL);
+
+    if (ok)
+        ok = umkaCompile(umka);
+
+    UmkaPreparedCall handle, spin;
+    if (ok)
+        ok = umkaPrepareCall(umka, NULL, "handle", 1, &handle) && umkaPrepareCall(umka, NULL, "spin", 1, &spin);
+
+    int failures = 0;
+
+    for (int i = 0; ok && i < NUM_REQUESTS; i++)
+    {
+        UmkaStackSlot param, result;
+        ok = umkaResetState(umka);
+
+        switch (i % 4)
+        {
+            // A complete request. The state is the same as after compilation: 5 + i, 8 characters
+            case 0:
+            case 1:
+            {
+                param.intVal = i;
+                if (ok)
+                    ok = umkaCallPrepared(umka, &handle, &param, &result);
+
+                if (result.intVal != 5 + i + 8 + 1)
+                    failures++;
+                break;
+            }
+
+            // A whole program run
+            case 2:
+            {
+                if (ok)
+                    ok = umkaRun(umka);
+                break;
+            }
+
+            // A request interrupted by the budget and never continued
+            case 3:
+            {
+                param.intVal = 1000000;
+                umkaSetBudget(umka, 1000);
+                if (ok)
+                    ok = umkaCallPrepared(umka, &spin, &param, &result);
+
+                if (!umkaInterrupted(umka))
+                    failures++;
+
+                umkaSetBudget(umka, 0);
+                break;
+            }
+        }
+    }
+
+    // A failed request: the index is out of range
+    if (ok)
+    {
+        UmkaStackSlot param = {.intVal = 2000}, result;
+        if (!umkaResetState(umka) || umkaCallPrepared(umka, &handle, &param, &result))
+            failures++;
+
+        param.intVal = 1000;
+        if (!umkaResetState(umka) || !umkaCallPrepared(umka, &handle, &param, &result) || result.intVal != 5 + 1000 + 8 + 2)
+            failures++;
+    }
+
+    if (!ok)
+    {
+        UmkaError error;
+        umkaGetError(umka, &error);
+        printf("Error %s (%d, %d): %s\n", error.fileName, error.line, error.pos, error.msg);
+    }
+
+    // Discard the last request's state
+    if (ok)
+        ok = umkaResetState(umka);
+
+    umkaFree(umka);
+
+    printf("State reset: %d requests, %d failures: %s\n", NUM_REQUESTS, failures, (ok && failures == 0) ? "ok" : "failed");
+
+    return !ok || failures != 0;
+}
@@ -0,0 +1,118 @@
+// Shared host memory test: scripts process host buffers in place as dynamic arrays, with no items copied
+// Build with "make tests/shared" and run from the tests directory
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "../src/umka_api.h"
+
+
+enum
+{
+    NUM_PIXELS  = 1024 * 1024,
+    NUM_SAMPLES = 1000
+};
+
+
+static bool check(void *umka, bool ok, int *failures)
+{
+    if (!ok)
+    {
+        UmkaError error;
+        umkaGetError(umka, &error);
+        printf("Error %s (%d, %d): %s\n", error.fileName, error.line, error.pos, error.msg);
+        (*failures)++;
+    }
+    return ok;
+}
+
+
+int main(void)
+{
+    uint8_t *pixels = malloc(NUM_PIXELS);
+    double samples[NUM_SAMPLES];
+
+    for (int i = 0; i < NUM_PIXELS; i++)
+        pixels[i] = i % 256;
+
+    for (int i = 0; i < NUM_SAMPLES; i++)
+        samples[i] = i;
+
+    void *umka = umkaAlloc();
+    bool ok = umkaInit(umka, "shared.um", 1024 * 1024, 1024 * 1024, 0, NULL) && umkaCompile(umka) &&
+              umkaCall(umka, umkaGetFunc(umka, NULL, "init"), 0, NULL, NULL);
+
+    int failures = 0;
+
+    if (check(umka, ok, &failures))
+    {
+        // The arrays made by init() are released when the host memory is shared
+        check(umka, umkaShareArray(umka, NULL, "pixels", pixels, NUM_PIXELS), &failures);
+        check(umka, umkaShareArray(umka, NULL, "samples", samples, NUM_SAMPLES), &failures);
+
+        // Scripts write the host memory in place
+        UmkaStackSlot param = {.intVal = 10}, result;
+        check(umka, umkaCall(umka, umkaGetFunc(umka, NULL, "brighten"), 1, &param, &result), &failures);
+
+        for (int i = 0; i < NUM_PIXELS; i++)
+            if (pixels[i] != ((i % 256 + 10 > 255) ? 255 : i % 256 + 10))
+            {
+                failures++;
+                break;
+            }
+
+        // Slices share the host memory as well
+        if (check(umka, umkaCall(umka, umkaGetFunc(umka, NULL, "total"), 0, NULL, &result), &failures))
+            if (result.realVal != (double)NUM_SAMPLES * (NUM_SAMPLES - 1) / 2)
+                failures++;
+
+        // Growing the array copies it to the heap
+        check(umka, umkaCall(umka, umkaGetFunc(umka, NULL, "grow"), 0, NULL, &result), &failures);
+
+        UmkaVar grown;
+        if (!umkaGetVar(umka, NULL, "grown", &grown))
+            failures++;
+        else
+        {
+            UmkaDynArray *array = grown.ptr;
+            if (array->data == samples || array->len != NUM_SAMPLES + 1 || ((double *)array->data)[0] != -1 || samples[0] != 0)
+                failures++;
+        }
+
+        // Items that hold references to the heap cannot be shared, and neither can other variables
+        char *names[2] = {"a", "b"};
+        if (umkaShareArray(umka, NULL, "names", names, 2) || umkaShareArray(umka, NULL, "total", samples, NUM_SAMPLES))
+            failures++;
+
+        // An execution context shares its own host memory
+        double ones[NUM_SAMPLES];
+        for (int i = 0; i < NUM_SAMPLES; i++)
+            ones[i] = 1;
+
+        void *context = umkaAllocContext();
+        bool contextOk = umkaInitContext(context, umka, 1024 * 1024) &&
+                         umkaCallContext(context, umkaGetFunc(umka, NULL, "init"), 0, NULL, NULL) &&
+                         umkaShareArrayContext(context, NULL, "samples", ones, NUM_SAMPLES) &&
+                         umkaCallContext(context, umkaGetFunc(umka, NULL, "total"), 0, NULL, &result) &&
+                         umkaRunContext(context);
+
+        if (!contextOk || result.realVal != NUM_SAMPLES)
+            failures++;
+
+        umkaFreeContext(context);
+
+        // Release the global variables. The shared host memory is left intact
+        check(umka, umkaRun(umka), &failures);
+
+        if (pixels[0] != 10 || samples[NUM_SAMPLES - 1] != NUM_SAMPLES - 1)
+            failures++;
+    }
+
+    umkaFree(umka);
+    free(pixels);
+
+    printf("Shared host memory: %d failures: %s\n", failures, failures == 0 ? "ok" : "failed");
+
+    return failures != 0;
+}
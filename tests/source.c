@@ -0,0 +1,119 @@
+// Source buffer test: many generated scripts are compiled from memory, with imported modules supplied by a host loader
+// Build with "make tests/source" and run from the tests directory
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "../src/umka_api.h"
+
+
+enum
+{
+    NUM_SCRIPTS = 1000
+};
+
+
+// Module sources are not null-terminated: each one is followed by text that must not be lexed
+static const char modules[] =
+    "fn scale*(x: int): int {return 3 * x}\n"
+    "const offset* = 1000"
+    "@@@ garbage after the module"
+    "import \"../import/std.um\"\n"
+    "fn show*(x: int): str {return std.itoa(x)}"
+    "@@@";
+
+
+typedef struct
+{
+    const char *path, *source;
+    int sourceLen;
+    int numLoads;
+} Loader;
+
+
+static bool loadModule(const char *path, const char **source, int *sourceLen, void *context)
+{
+    Loader *loader = context;
+    for (int i = 0; i < 2; i++)
+        if (strcmp(path, loader[i].path) == 0)
+        {
+            *source = loader[i].source;
+            *sourceLen = loader[i].sourceLen;
+            loader[i].numLoads++;
+            return true;
+        }
+
+    // Other modules are read from the files
+    return false;
+}
+
+
+static bool runScript(const char *source, int sourceLen, Loader *loader, int64_t *result)
+{
+    void *umka = umkaAlloc();
+    bool ok = umkaInitSource(umka, "generated.um", source, sourceLen, 1024 * 1024, 1024 * 1024, 0, NULL);
+
+    if (ok)
+    {
+        umkaSetLoader(umka, loadModule, loader);
+        ok = umkaCompile(umka);
+    }
+
+    if (ok)
+        ok = umkaRun(umka);
+
+    if (ok)
+    {
+        UmkaStackSlot res;
+        ok = umkaCall(umka, umkaGetFunc(umka, NULL, "work"), 0, NULL, &res);
+        *result = res.intVal;
+    }
+
+    if (!ok)
+    {
+        UmkaError error;
+        umkaGetError(umka, &error);
+        printf("Error %s (%d, %d): %s\n", error.fileName, error.line, error.pos, error.msg);
+    }
+
+    umkaFree(umka);
+    return ok;
+}
+
+
+int main(void)
+{
+    const char *scale = modules;
+    const char *show = strstr(modules, "@@@") + strlen("@@@ garbage after the module");
+
+    Loader loader[2] = {
+        {"scale.um", scale, strstr(scale, "@@@") - scale, 0},
+        {"show.um",  show,  strstr(show,  "@@@") - show,  0}};
+
+    int failures = 0;
+    char source[256];
+
+    for (int i = 0; i < NUM_SCRIPTS; i++)
+    {
+        // The generated source ends with a number, and the rest of the buffer is not cleared
+        memset(source, '9', sizeof(source));
+        int len = sprintf(source, "import \"scale.um\"\nfn work(): int {return scale.scale(%d) + scale.offset}\nfn main() {}\nconst unused = %d", i, i);
+        source[len] = '9';
+
+        int64_t result = 0;
+        if (!runScript(source, len, loader, &result) || result != 3 * i + 1000)
+            failures++;
+    }
+
+    // A module supplied by the loader imports a module from the file
+    const char *showSource = "import \"show.um\"\nfn work(): int {return len(show.show(12345))}\nfn main() {}";
+    int64_t result = 0;
+    if (!runScript(showSource, strlen(showSource), loader, &result) || result != 5)
+        failures++;
+
+    bool ok = failures == 0 && loader[0].numLoads == NUM_SCRIPTS && loader[1].numLoads == 1;
+    printf("Source buffers: %d scripts, %d failures: %s\n", NUM_SCRIPTS + 1, failures, ok ? "ok" : "failed");
+
+    return !ok;
+}
@@ -0,0 +1,155 @@
+// Multi-threaded stress test: several interpreter instances compile and run the same script concurrently,
+// then several execution contexts run the same compiled program concurrently
+// Build with "make tests/threads" and run from the tests directory
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <pthread.h>
+
+#include "../src/umka_api.h"
+
+
+enum
+{
+    NUM_THREADS    = 16,
+    NUM_ITERATIONS = 20
+};
+
+
+typedef struct
+{
+    int index;
+    int64_t expected;
+    int failures;
+    void *umka;         // Shared compiled program, if any
+} ThreadData;
+
+
+static bool runScript(int64_t seed, int64_t *result)
+{
+    void *umka = umkaAlloc();
+    bool ok = umkaInit(umka, "threads.um", 1024 * 1024, 1024 * 1024, 0, NULL);
+
+    if (ok)
+        ok = umkaCompile(umka);
+
+    if (ok)
+        ok = umkaRun(umka);
+
+    if (ok)
+    {
+        UmkaStackSlot param, res;
+        param.intVal = seed;
+        ok = umkaCall(umka, umkaGetFunc(umka, NULL, "work"), 1, &param, &res);
+        *result = res.intVal;
+    }
+
+    if (!ok)
+    {
+        UmkaError error;
+        umkaGetError(umka, &error);
+        printf("Error %s (%d, %d): %s\n", error.fileName, error.line, error.pos, error.msg);
+    }
+
+    umkaFree(umka);
+    return ok;
+}
+
+
+static bool runContext(void *umka, int64_t seed, int64_t *result)
+{
+    void *context = umkaAllocContext();
+    bool ok = umkaInitContext(context, umka, 1024 * 1024);
+
+    if (ok)
+        ok = umkaRunContext(context);
+
+    if (ok)
+    {
+        UmkaStackSlot param, res;
+        param.intVal = seed;
+        ok = umkaCallContext(context, umkaGetFunc(umka, NULL, "work"), 1, &param, &res);
+        *result = res.intVal;
+    }
+
+    if (!ok)
+    {
+        UmkaError error;
+        umkaGetContextError(context, &error);
+        printf("Error %s (%d, %d): %s\n", error.fileName, error.line, error.pos, error.msg);
+    }
+
+    umkaFreeContext(context);
+    return ok;
+}
+
+
+static void *threadFunc(void *arg)
+{
+    ThreadData *data = arg;
+
+    for (int i = 0; i < NUM_ITERATIONS; i++)
+    {
+        int64_t result;
+        bool ok = data->umka ? runContext(data->umka, data->index, &result) : runScript(data->index, &result);
+
+        if (!ok || result != data->expected)
+            data->failures++;
+    }
+
+    return NULL;
+}
+
+
+static int runThreads(ThreadData *data)
+{
+    pthread_t thread[NUM_THREADS];
+
+    for (int i = 0; i < NUM_THREADS; i++)
+        pthread_create(&thread[i], NULL, threadFunc, &data[i]);
+
+    int failures = 0;
+    for (int i = 0; i < NUM_THREADS; i++)
+    {
+        pthread_join(thread[i], NULL);
+        failures += data[i].failures;
+        data[i].failures = 0;
+    }
+
+    return failures;
+}
+
+
+int main(void)
+{
+    ThreadData data[NUM_THREADS];
+
+    // Reference results are obtained sequentially
+    for (int i = 0; i < NUM_THREADS; i++)
+    {
+        data[i].index = i;
+        data[i].failures = 0;
+        data[i].umka = NULL;
+
+        if (!runScript(i, &data[i].expected))
+            return 1;
+    }
+
+    // Independent interpreter instances
+    int failures = runThreads(data);
+    printf("Instances: %d threads, %d runs each: %d failures\n", NUM_THREADS, NUM_ITERATIONS, failures);
+
+    // Execution contexts sharing a single compiled program
+    void *umka = umkaAlloc();
+    if (!umkaInit(umka, "threads.um", 1024 * 1024, 1024 * 1024, 0, NULL) || !umkaCompile(umka))
+        return 1;
+
+    for (int i = 0; i < NUM_THREADS; i++)
+        data[i].umka = umka;
+
+    int contextFailures = runThreads(data);
+    printf("Contexts:  %d threads, %d runs each: %d failures\n", NUM_THREADS, NUM_ITERATIONS, contextFailures);
+
+    umkaFree(umka);
+    return failures + contextFailures > 0;
+}
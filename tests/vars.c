@@ -0,0 +1,116 @@
+// Global variable access test: the host reads and writes script globals in place, with no script functions called
+// Build with "make tests/vars" and run from the tests directory
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stddef.h>
+#include <string.h>
+
+#include "../src/umka_api.h"
+
+
+typedef struct
+{
+    double x, y, vx, vy;
+} Particle;
+
+
+typedef struct
+{
+    int64_t len;
+    int64_t itemSize;
+    void *data;
+} DynArray;
+
+
+enum
+{
+    NUM_STEPS = 10
+};
+
+
+int main(void)
+{
+    void *umka = umkaAlloc();
+    bool ok = umkaInit(umka, "vars.um", 1024 * 1024, 1024 * 1024, 0, NULL);
+
+    // Globals are only available after compilation
+    UmkaVar particles, steps, weights, title, missing;
+    bool early = umkaGetVar(umka, NULL, "steps", &steps);
+
+    if (ok)
+        ok = umkaCompile(umka);
+
+    // The global variables keep their values after main() returns
+    if (ok)
+        ok = umkaRun(umka);
+
+    bool found = ok &&
+                 umkaGetVar(umka, NULL, "particles", &particles) &&
+                 umkaGetVar(umka, NULL, "steps",     &steps)     &&
+                 umkaGetVar(umka, NULL, "weights",   &weights)   &&
+                 umkaGetVar(umka, NULL, "title",     &title)     &&
+                 !umkaGetVar(umka, NULL, "missing",  &missing)   &&
+                 !umkaGetVar(umka, NULL, "step",     &missing);
+
+    int failures = 0;
+
+    if (found)
+    {
+        if (particles.size != 1000 * sizeof(Particle) || particles.numItems != 1000 || particles.itemSize != sizeof(Particle) ||
+            strcmp(particles.type, "[1000]Particle") != 0 || strcmp(steps.type, "int") != 0 || strcmp(weights.type, "[]real") != 0)
+            failures++;
+
+        // Layout of the array items
+        if (particles.numFields != 4 || steps.numFields != 0 ||
+            strcmp(particles.field[2].name, "vx") != 0 || particles.field[2].offset != offsetof(Particle, vx) ||
+            particles.field[2].size != sizeof(double) || particles.field[3].offset != offsetof(Particle, vy))
+            failures++;
+
+        // Write the script's array in place
+        Particle *p = particles.ptr;
+        for (int i = 0; i < particles.numItems; i++)
+        {
+            p[i].vx = i;
+            p[i].vy = -i;
+        }
+
+        // The script sees the host's writes, and the host sees the script's
+        UmkaPreparedCall step;
+        ok = umkaPrepareCall(umka, NULL, "step", 1, &step);
+
+        for (int i = 0; ok && i < NUM_STEPS; i++)
+        {
+            UmkaStackSlot dt = {.realVal = 0.5}, result;
+            ok = umkaCallPrepared(umka, &step, &dt, &result);
+        }
+
+        if (*(int64_t *)steps.ptr != NUM_STEPS || p[999].x != 999 * 0.5 * NUM_STEPS || p[999].y != -999 * 0.5 * NUM_STEPS)
+            failures++;
+
+        // Items of a dynamic array are reached through its data pointer
+        DynArray *w = weights.ptr;
+        for (int i = 0; i < w->len; i++)
+            ((double *)w->data)[i] = i;
+
+        UmkaStackSlot result;
+        if (ok)
+            ok = umkaCall(umka, umkaGetFunc(umka, NULL, "sumWeights"), 0, NULL, &result);
+
+        if (result.realVal != 45 || strcmp(*(char **)title.ptr, "particles") != 0)
+            failures++;
+    }
+
+    if (!ok)
+    {
+        UmkaError error;
+        umkaGetError(umka, &error);
+        printf("Error %s (%d, %d): %s\n", error.fileName, error.line, error.pos, error.msg);
+    }
+
+    umkaFree(umka);
+
+    printf("Global variables: %d failures: %s\n", failures, (ok && found && !early && failures == 0) ? "ok" : "failed");
+
+    return !ok || !found || early || failures != 0;
+}